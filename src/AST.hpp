@@ -3,10 +3,82 @@
 
 #include "Common.hpp"
 
+//The concrete class of a Node, so that code which classifies nodes
+//can switch on it (or use isa/dynCast below) instead of trying a series
+//of dynamic_casts. Subclasses of each abstract class (Expression,
+//Statement, Type, etc.) are contiguous, so the abstract classes can be
+//tested with a range check. Nodes not listed here have kind Other.
+enum struct NodeKind : uint8_t
+{
+  Other,
+  //Expressions
+  UnaryArith,
+  BinaryArith,
+  IntConstant,
+  FloatConstant,
+  BoolConstant,
+  MapConstant,
+  UnionConstant,
+  CompoundLiteral,
+  Indexed,
+  CallExpr,
+  VarExpr,
+  SubrOverloadExpr,
+  SubroutineExpr,
+  StructMem,
+  NewArray,
+  ArrayLength,
+  IsExpr,
+  AsExpr,
+  ThisExpr,
+  Converted,
+  EnumExpr,
+  SimpleConstant,
+  DefaultValueExpr,
+  UnresolvedExpr,
+  //Statements
+  Block,
+  Assign,
+  CallStmt,
+  ForC,
+  ForArray,
+  ForRange,
+  While,
+  If,
+  Match,
+  Switch,
+  Return,
+  Break,
+  Continue,
+  Print,
+  Assertion,
+  //Types
+  StructType,
+  UnionType,
+  ArrayType,
+  TupleType,
+  MapType,
+  AliasType,
+  EnumType,
+  IntegerType,
+  FloatType,
+  CharType,
+  BoolType,
+  SimpleType,
+  CallableType,
+  UnresolvedType,
+  ExprType,
+  ElemExprType,
+  //Subroutines
+  Subroutine,
+  ExternalSubroutine
+};
+
 struct Node
 {
   Node()
   {
+    kind = NodeKind::Other;
     fileID = 0;
     line = 0;
     col = 0;
@@ -25,6 +97,8 @@ struct Node
     line = other->line;
     col = other->col;
   }
+  //set by the constructor of each concrete subclass
+  NodeKind kind;
   //All nodes know their position in code (for error messages)
   int fileID; //index in sourceFiles
   int line;
@@ -51,6 +125,42 @@ struct Node
   virtual void resolveImpl() {};
 };
 
+//Define T::classof, used by isa<T> and dynCast<T>.
+//NODE_KIND is for concrete classes and NODE_KIND_RANGE for abstract ones.
+#define NODE_KIND(T) \
+  static bool classof(const Node* n) {return n->kind == NodeKind::T;}
+#define NODE_KIND_RANGE(first, last) \
+  static bool classof(const Node* n) \
+  {return n->kind >= NodeKind::first && n->kind <= NodeKind::last;}
+
+//Is n (which must not be null) a T?
+template<typename T>
+inline bool isa(const Node* n)
+{
+  return T::classof(n);
+}
+
+//Equivalent to dynamic_cast<T*>(n)
+template<typename T>
+inline T* dynCast(Node* n)
+{
+  return n && T::classof(n) ? static_cast<T*>(n) : nullptr;
+}
+
+template<typename T>
+inline const T* dynCast(const Node* n)
+{
+  return n && T::classof(n) ? static_cast<const T*>(n) : nullptr;
+}
+
+//Cast n to a T, which it is known to be
+template<typename T>
+inline T* cast(Node* n)
+{
+  INTERNAL_ASSERT(T::classof(n));
+  return static_cast<T*>(n);
+}
+
 struct Member : public Node
 {
   vector<string> names;
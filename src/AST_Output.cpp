@@ -70,7 +70,7 @@ int emitType(Type* t)
 int emitStatement(Statement* s)
 {
   int root = 0;
-  if(Block* b = dynamic_cast<Block*>(s))
+  if(Block* b = dynCast<Block>(s))
   {
     root = out.createNode("Block");
     if(b->scope->names.size())
@@ -92,17 +92,17 @@ int emitStatement(Statement* s)
       out.createEdge(root, stmts);
     }
   }
-  else if(Assign* a = dynamic_cast<Assign*>(s))
+  else if(Assign* a = dynCast<Assign>(s))
   {
     root = out.createNode("Assign");
     out.createEdge(root, emitExpression(a->lvalue));
     out.createEdge(root, emitExpression(a->rvalue));
   }
-  else if(CallStmt* cs = dynamic_cast<CallStmt*>(s))
+  else if(CallStmt* cs = dynCast<CallStmt>(s))
   {
     root = emitExpression(cs->eval);
   }
-  else if(ForC* fc = dynamic_cast<ForC*>(s))
+  else if(ForC* fc = dynCast<ForC>(s))
   {
     root = out.createNode("For loop (C-style)");
     int outerBlock = out.createNode("Outer block");
@@ -117,7 +117,7 @@ int emitStatement(Statement* s)
     }
     out.createEdge(root, emitStatement(fc->inner));
   }
-  else if(ForRange* fr = dynamic_cast<ForRange*>(s))
+  else if(ForRange* fr = dynCast<ForRange>(s))
   {
     root = out.createNode("For loop (range)");
     out.createEdge(root, emitStatement(fr->outer));
@@ -125,7 +125,7 @@ int emitStatement(Statement* s)
     out.createEdge(root, emitExpression(fr->end));
     out.createEdge(root, emitStatement(fr->inner));
   }
-  else if(ForArray* fa = dynamic_cast<ForArray*>(s))
+  else if(ForArray* fa = dynCast<ForArray>(s))
   {
     root = out.createNode("For loop (array)");
     int outerBlock = out.createNode("Outer block");
@@ -134,13 +134,13 @@ int emitStatement(Statement* s)
     out.createEdge(root, emitExpression(fa->arr));
     out.createEdge(root, emitStatement(fa->inner));
   }
-  else if(While* w = dynamic_cast<While*>(s))
+  else if(While* w = dynCast<While>(s))
   {
     root = out.createNode("While loop");
     out.createEdge(root, emitExpression(w->condition));
     out.createEdge(root, emitStatement(w->body));
   }
-  else if(If* ifs = dynamic_cast<If*>(s))
+  else if(If* ifs = dynCast<If>(s))
   {
     root = out.createNode("If statement");
     out.createEdge(root, emitExpression(ifs->condition));
@@ -150,21 +150,21 @@ int emitStatement(Statement* s)
     else
       out.createEdge(root, out.createNode("(no else body)"));
   }
-  else if(Return* ret = dynamic_cast<Return*>(s))
+  else if(Return* ret = dynCast<Return>(s))
   {
     root = out.createNode("Return");
     if(ret->value)
       out.createEdge(root, emitExpression(ret->value));
   }
-  else if(dynamic_cast<Break*>(s))
+  else if(dynCast<Break>(s))
   {
     root = out.createNode("Break statement");
   }
-  else if(dynamic_cast<Continue*>(s))
+  else if(dynCast<Continue>(s))
   {
     root = out.createNode("Continue statement");
   }
-  else if(Print* p = dynamic_cast<Print*>(s))
+  else if(Print* p = dynCast<Print>(s))
   {
     root = out.createNode("Print statement");
     for(auto e : p->exprs)
@@ -172,12 +172,12 @@ int emitStatement(Statement* s)
       out.createEdge(root, emitExpression(e));
     }
   }
-  else if(Assertion* as = dynamic_cast<Assertion*>(s))
+  else if(Assertion* as = dynCast<Assertion>(s))
   {
     root = out.createNode("Assertion");
     out.createEdge(root, emitExpression(as->asserted));
   }
-  else if(Switch* sw = dynamic_cast<Switch*>(s))
+  else if(Switch* sw = dynCast<Switch>(s))
   {
     root = out.createNode("Switch");
     out.createEdge(root, emitExpression(sw->switched));
@@ -192,7 +192,7 @@ int emitStatement(Statement* s)
     desc << sw->defaultPosition << ": default\n";
     out.createEdge(root, out.createNode(desc.str()));
   }
-  else if(Match* mat = dynamic_cast<Match*>(s))
+  else if(Match* mat = dynCast<Match>(s))
   {
     root = out.createNode("Match");
     out.createEdge(root, emitExpression(mat->matched));
@@ -214,18 +214,18 @@ int emitStatement(Statement* s)
 int emitExpression(Expression* e)
 {
   int root = 0;
-  if(UnaryArith* ua = dynamic_cast<UnaryArith*>(e))
+  if(UnaryArith* ua = dynCast<UnaryArith>(e))
   {
     root = out.createNode(Oper(ua->op).getStr());
     out.createEdge(root, emitExpression(ua->expr));
   }
-  else if(BinaryArith* ba = dynamic_cast<BinaryArith*>(e))
+  else if(BinaryArith* ba = dynCast<BinaryArith>(e))
   {
     root = out.createNode(Oper(ba->op).getStr());
     out.createEdge(root, emitExpression(ba->lhs));
     out.createEdge(root, emitExpression(ba->rhs));
   }
-  else if(IntConstant* ic = dynamic_cast<IntConstant*>(e))
+  else if(IntConstant* ic = dynCast<IntConstant>(e))
   {
     if(ic->type == getCharType())
       root = out.createNode("'" + generateCharDotfile((char) ic->uval) + "'");
@@ -234,20 +234,20 @@ int emitExpression(Expression* e)
     else
       root = out.createNode(to_string(ic->uval));
   }
-  else if(FloatConstant* fc = dynamic_cast<FloatConstant*>(e))
+  else if(FloatConstant* fc = dynCast<FloatConstant>(e))
   {
     char buf[32];
     sprintf(buf, "%#f", fc->dp);
     root = out.createNode(buf);
   }
-  else if(BoolConstant* bc = dynamic_cast<BoolConstant*>(e))
+  else if(BoolConstant* bc = dynCast<BoolConstant>(e))
   {
     if(bc->value)
       root = out.createNode("true");
     else
       root = out.createNode("false");
   }
-  else if(CompoundLiteral* compLit = dynamic_cast<CompoundLiteral*>(e))
+  else if(CompoundLiteral* compLit = dynCast<CompoundLiteral>(e))
   {
     if(compLit->type == getStringType())
     {
@@ -256,7 +256,7 @@ int emitExpression(Expression* e)
       oss << "\\\"";
       for(auto m : compLit->members)
       {
-        IntConstant* charElem = dynamic_cast<IntConstant*>(m);
+        IntConstant* charElem = dynCast<IntConstant>(m);
         INTERNAL_ASSERT(charElem);
         oss << generateCharDotfile((char) charElem->uval);
       }
@@ -272,13 +272,13 @@ int emitExpression(Expression* e)
       }
     }
   }
-  else if(Indexed* in = dynamic_cast<Indexed*>(e))
+  else if(Indexed* in = dynCast<Indexed>(e))
   {
     root = out.createNode("Index");
     out.createEdge(root, emitExpression(in->group));
     out.createEdge(root, emitExpression(in->index));
   }
-  else if(CallExpr* call = dynamic_cast<CallExpr*>(e))
+  else if(CallExpr* call = dynCast<CallExpr>(e))
   {
     root = out.createNode("Call");
     out.createEdge(root, emitExpression(call->callable));
@@ -297,23 +297,23 @@ int emitExpression(Expression* e)
     }
     out.createEdge(root, args);
   }
-  else if(VarExpr* ve = dynamic_cast<VarExpr*>(e))
+  else if(VarExpr* ve = dynCast<VarExpr>(e))
   {
     root = out.createNode("Variable " + ve->var->name);
   }
-  else if(IsExpr* ie = dynamic_cast<IsExpr*>(e))
+  else if(IsExpr* ie = dynCast<IsExpr>(e))
   {
     root = out.createNode("Is");
     out.createEdge(root, emitExpression(ie->base));
     out.createEdge(root, emitType(ie->destType));
   }
-  else if(AsExpr* ae = dynamic_cast<AsExpr*>(e))
+  else if(AsExpr* ae = dynCast<AsExpr>(e))
   {
     root = out.createNode("As");
     out.createEdge(root, emitExpression(ae->base));
     out.createEdge(root, emitType(ae->destType));
   }
-  else if(NewArray* na = dynamic_cast<NewArray*>(e))
+  else if(NewArray* na = dynCast<NewArray>(e))
   {
     root = out.createNode("Array allocation");
     out.createEdge(root, emitType(na->elem));
@@ -322,31 +322,42 @@ int emitExpression(Expression* e)
       out.createEdge(root, emitExpression(dim));
     }
   }
-  else if(Converted* c = dynamic_cast<Converted*>(e))
+  else if(Converted* c = dynCast<Converted>(e))
   {
     root = out.createNode("Conversion");
     out.createEdge(root, emitExpression(c->value));
     out.createEdge(root, emitType(c->type));
   }
-  else if(ArrayLength* al = dynamic_cast<ArrayLength*>(e))
+  else if(ArrayLength* al = dynCast<ArrayLength>(e))
   {
     root = out.createNode("Array length");
     out.createEdge(root, emitExpression(al->array));
   }
-  else if(dynamic_cast<ThisExpr*>(e))
+  else if(dynCast<ThisExpr>(e))
   {
     root = out.createNode("this");
   }
-  else if(auto sic = dynamic_cast<SimpleConstant*>(e))
+  else if(auto sic = dynCast<SimpleConstant>(e))
   {
     root = out.createNode(sic->st->name);
   }
-  else if(auto uc = dynamic_cast<UnionConstant*>(e))
+  else if(auto mc = dynCast<MapConstant>(e))
+  {
+    root = out.createNode("Map constant of " + e->type->getName());
+    for(auto& kv : mc->values)
+    {
+      int pair = out.createNode("Key/value");
+      out.createEdge(pair, emitExpression(kv.first));
+      out.createEdge(pair, emitExpression(kv.second));
+      out.createEdge(root, pair);
+    }
+  }
+  else if(auto uc = dynCast<UnionConstant>(e))
   {
     root = out.createNode("Union constant of " + e->type->getName());
     out.createEdge(root, emitExpression(uc->value));
   }
-  else if(auto sm = dynamic_cast<StructMem*>(e))
+  else if(auto sm = dynCast<StructMem>(e))
   {
     root = out.createNode("Struct member");
     out.createEdge(root, emitExpression(sm->base));
@@ -356,16 +367,16 @@ int emitExpression(Expression* e)
       out.createEdge(root, out.createNode(
             "Subroutine " + sm->member.get<Subroutine*>()->decl->name));
   }
-  else if(auto se = dynamic_cast<SubroutineExpr*>(e))
+  else if(auto se = dynCast<SubroutineExpr>(e))
   {
-    auto subr = dynamic_cast<Subroutine*>(se->subr);
-    auto exSubr = dynamic_cast<ExternalSubroutine*>(se->subr);
+    auto subr = dynCast<Subroutine>(se->subr);
+    auto exSubr = dynCast<ExternalSubroutine>(se->subr);
     if(subr)
       root = out.createNode("Subroutine " + subr->decl->name);
     else
       root = out.createNode("External subroutine " + exSubr->decl->name);
   }
-  else if(auto ee = dynamic_cast<EnumExpr*>(e))
+  else if(auto ee = dynCast<EnumExpr>(e))
   {
     root = out.createNode("Enum value " + ee->value->name);
   }
@@ -416,8 +427,8 @@ int emitSubroutineDecl(SubroutineDecl* s)
   int root = out.createNode("Subroutine " + s->name);
   for(auto o : s->overloads)
   {
-    auto subr = dynamic_cast<Subroutine*>(o);
-    auto exSubr = dynamic_cast<ExternalSubroutine*>(o);
+    auto subr = dynCast<Subroutine>(o);
+    auto exSubr = dynCast<ExternalSubroutine>(o);
     if(subr)
       out.createEdge(root, emitSubroutine(subr));
     else
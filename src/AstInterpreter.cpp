@@ -1,997 +1,1746 @@
 #include "AstInterpreter.hpp"
 #include "Variable.hpp"
+#include "FFI.hpp"
+#include "Profiler.hpp"
+#include "Memo.hpp"
+#include "Jit.hpp"
 
-Interpreter::Interpreter(Subroutine* subr, vector<Expression*> args)
+//Native stack that code compiled by --jit leaves for the
+//interpreter itself (and for reporting an error from native code)
+const size_t nativeStackMargin = 1 << 20;
+
+//Steps of a counter loop (ForC and ForRange use the steps below this
+//before they start one)
+const int countLoopStep = 10;
+
+//Tuple subscripts are constants (checked during semantic analysis)
+static int tupleIndex(Indexed* ind)
+{
+  IntConstant* ic = dynCast<IntConstant>(ind->index);
+  INTERNAL_ASSERT(ic);
+  return ic->isSigned() ? ic->sval : ic->uval;
+}
+
+//Check an index for an array element which is being modified
+static uint64_t arrayIndex(const Value& index, size_t size, Indexed* ind)
+{
+  if(index.tag == ValueTag::INT && index.i < 0)
+    errMsgLoc(ind, "negative array index");
+  if(index.u >= size)
+    errMsgLoc(ind, "array index " << index.u << " out of bounds [0, " << size << ")");
+  return index.u;
+}
+
+//The n-th value that resolving lvalue e depends on (its array and map
+//indices, outermost first), or nullptr if it depends on only n values
+static Expression* lvalueOperand(Expression* e, size_t n)
+{
+  while(true)
+  {
+    if(auto ind = dynCast<Indexed>(e))
+    {
+      if(!canonicalize(ind->group->type)->isTuple())
+      {
+        if(n == 0)
+          return ind->index;
+        n--;
+      }
+      e = ind->group;
+    }
+    else if(auto sm = dynCast<StructMem>(e))
+      e = sm->base;
+    else
+      return nullptr;
+  }
+}
+
+//Compare a counter against the bound of a counter loop
+static bool counterInBounds(const Value& counter, const Value& bound, int cmp)
+{
+  if(counter.tag == ValueTag::INT)
+  {
+    switch(cmp)
+    {
+      case CMPL: return counter.i < bound.i;
+      case CMPLE: return counter.i <= bound.i;
+      case CMPG: return counter.i > bound.i;
+      case CMPGE: return counter.i >= bound.i;
+      default: return counter.i != bound.i;
+    }
+  }
+  switch(cmp)
+  {
+    case CMPL: return counter.u < bound.u;
+    case CMPLE: return counter.u <= bound.u;
+    case CMPG: return counter.u > bound.u;
+    case CMPGE: return counter.u >= bound.u;
+    default: return counter.u != bound.u;
+  }
+}
+
+Interpreter::Interpreter(Subroutine* subr, vector<Expression*> args, size_t stackSize, Profiler* prof, Memoizer* m, Jit* j)
+{
+  profiler = prof;
+  memo = m;
+  jit = j;
+  out = &stdoutBuffer;
+  init(stackSize);
+  vector<Value> argVals;
+  for(auto a : args)
+    argVals.push_back(constantValue(a));
+  if(profiler)
+    profiler->start();
+  callSubr(subr, argVals);
+  if(profiler)
+    profiler->stop();
+  out->flush();
+  if(memo && verboseEnabled())
+    memo->printStats(cout);
+  if(jit && verboseEnabled())
+    jit->printStats(cout);
+}
+
+Interpreter::Interpreter(size_t stackSize, OutputBuffer& o, Memoizer* m)
+{
+  profiler = nullptr;
+  memo = m;
+  jit = nullptr;
+  out = &o;
+  init(stackSize);
+}
+
+void Interpreter::runBlock(Block* b, int numLocals)
+{
+  //the block is like the body of a subroutine without parameters
+  frames.emplace();
+  frames.top().locals = slots;
+  slotsUsed = numLocals;
+  size_t depth = work.size();
+  exec(b);
+  run(depth);
+  std::fill(slots, slots + numLocals, Value());
+  slotsUsed = 0;
+  frames.pop();
+}
+
+void Interpreter::addGlobals()
+{
+  globals.resize(globalSlots.size());
+}
+
+void Interpreter::recover()
 {
+  std::fill(slots, slots + slotsUsed, Value());
+  slotsUsed = 0;
+  while(frames.size())
+    frames.pop();
+  while(work.size())
+    work.pop();
+  operands.clear();
   returning = false;
   breaking = false;
   continuing = false;
-  callSubr(subr, args);
+  tailCallee = nullptr;
+  tailArgs.clear();
+  rv = Value();
 }
 
-Expression* Interpreter::callSubr(Subroutine* subr, vector<Expression*> args)
+void Interpreter::init(size_t stackSize)
 {
-  frames.emplace();
-  return invoke(subr, args);
+  returning = false;
+  breaking = false;
+  continuing = false;
+  //zeroed Values are empty (ValueTag::NONE), like the VM's stack
+  slots = (Value*) calloc(stackSize / sizeof(Value), sizeof(Value));
+  if(!slots)
+  {
+    errMsg("Couldn't allocate interpreter stack of " << stackSize << " bytes");
+  }
+  slotsUsed = 0;
+  stackBudget = stackSize;
+  tailCallee = nullptr;
+  globals.resize(globalSlots.size());
+  if(jit)
+  {
+    //compiled code recurses on the native stack, which main
+    //gives the same budget when --jit is used
+    char base;
+    size_t limit = stackSize > 2 * nativeStackMargin ? stackSize - nativeStackMargin : nativeStackMargin;
+    jit->setStackLimit((uintptr_t) &base - limit);
+  }
 }
 
-Expression* Interpreter::callSubr(Subroutine* subr, vector<Expression*> args, Expression*& thisExpr)
+Interpreter::~Interpreter()
 {
-  frames.emplace(thisExpr);
-  INTERNAL_ASSERT(typesSame(thisExpr->type, subr->type->ownerStruct));
-  return invoke(subr, args);
+  //Slots above slotsUsed are always empty, and after a run that ended
+  //normally all slots are. A failed test leaves some behind.
+  std::fill(slots, slots + slotsUsed, Value());
+  free(slots);
 }
 
-Expression* Interpreter::callSubr(Subroutine* subr, vector<Expression*> args, Expression*&& thisExpr)
+Value Interpreter::callSubr(Subroutine* subr, vector<Value>& args, Value* thisPtr)
 {
-  frames.emplace(thisExpr);
-  INTERNAL_ASSERT(typesSame(thisExpr->type, subr->type->ownerStruct));
-  return invoke(subr, args);
+  size_t depth = work.size();
+  startCall(subr, args, thisPtr);
+  run(depth);
+  return popOperand();
 }
 
-Expression* Interpreter::callExtern(ExternalSubroutine* exSubr, vector<Expression*> args)
+Value Interpreter::callExtern(ExternalSubroutine* exSubr, vector<Value>& args)
 {
-  //TODO: lazily load correct dynamic library, put arguments in correct binary format, and call
-  errMsgLoc(exSubr, "External calls aren't supported by interpreter (yet)");
-  return nullptr;
+  return callExternal(exSubr, args.data());
 }
 
-void Interpreter::execute(Statement* stmt)
+Value Interpreter::evaluate(Expression* e)
 {
-  if(breaking || continuing || returning)
-    return;
-  if(auto assign = dynamic_cast<Assign*>(stmt))
+  size_t depth = work.size();
+  eval(e);
+  run(depth);
+  return popOperand();
+}
+
+void Interpreter::run(size_t depth)
+{
+  while(work.size() > depth)
   {
-    Expression* rvalue = evaluate(assign->rvalue);
-    if(auto compoundAssign = dynamic_cast<CompoundLiteral*>(assign->lvalue))
-    {
-      //rvalue (fully evaluated to a constant) should also be a CompoundLiteral.
-      //Do the assignment one element at a time
-      auto compoundRHS = dynamic_cast<CompoundLiteral*>(rvalue);
-      INTERNAL_ASSERT(compoundRHS);
-      size_t n = compoundAssign->members.size();
-      INTERNAL_ASSERT(n == compoundRHS->members.size());
-      for(size_t i = 0; i < n; i++)
-      {
-        //evaluate symbolic lvalue, and directly assign rvalue
-        evaluateLValue(compoundAssign->members[i]) = compoundRHS->members[i];
-      }
-    }
-    else if(auto varExpr = dynamic_cast<VarExpr*>(assign->lvalue))
-    {
-      assignVar(varExpr->var, rvalue);
-    }
+    Task& task = work.top();
+    if(!task.node)
+      finishCall();
+    else if(isa<Expression>(task.node))
+      stepExpression(task);
     else
-    {
-      evaluateLValue(assign->lvalue) = rvalue;
-    }
+      stepStatement(task);
   }
-  else if(auto block = dynamic_cast<Block*>(stmt))
+}
+
+bool Interpreter::exec(Statement* s)
+{
+  size_t depth = work.size();
+  if(profiler)
+    profiler->at(s);
+  if(!executeNow(s))
+    work.emplace(s, operands.size());
+  return work.size() == depth;
+}
+
+void Interpreter::execBlock(Block* block, size_t start)
+{
+  size_t depth = work.size();
+  for(size_t i = start; i < block->stmts.size(); i++)
   {
-    for(auto bstmt : block->stmts)
+    if(breaking || continuing || returning)
+      return;
+    //the rest of the block resumes after the statement, if it becomes
+    //a task (nothing is left to do after the last one)
+    bool last = i + 1 == block->stmts.size();
+    if(!last)
     {
-      execute(bstmt);
-      if(breaking || continuing || returning)
-        return;
+      work.emplace(block, operands.size());
+      work.top().index = i + 1;
     }
+    exec(block->stmts[i]);
+    if(last || work.size() != depth + 1)
+      return;
+    work.pop();
   }
-  else if(auto call = dynamic_cast<CallStmt*>(stmt))
-  {
-    evaluate(call->eval);
-  }
-  else if(auto fc = dynamic_cast<ForC*>(stmt))
+}
+
+bool Interpreter::executeNow(Statement* stmt)
+{
+  switch(stmt->kind)
   {
-    //Initialize the loop
-    if(fc->init)
-      execute(fc->init);
-    while(true)
+    case NodeKind::Assign:
     {
-      //condition is optional; if omitted, always true
-      bool loopCond = true;
-      if(fc->condition)
+      Assign* assign = (Assign*) stmt;
+      if(assign->arrayUpdate)
       {
-        //Evaluate the condition
-        BoolConstant* cond = dynamic_cast<BoolConstant*>(evaluate(fc->condition));
-        INTERNAL_ASSERT(cond);
-        loopCond = cond->value;
+        if(assign->arrayUpdate->operand->mayCall)
+          return false;
+        operands.push_back(evaluateNow(assign->arrayUpdate->operand));
+        updateArray(assign->arrayUpdate);
+        return true;
       }
-      if(!loopCond)
-        break;
-      execute(fc->inner);
-      if(breaking)
+      if(assign->rvalue->mayCall || assign->lvalue->mayCall)
+        return false;
+      if(auto varExpr = dynCast<VarExpr>(assign->lvalue))
       {
-        breaking = false;
-        break;
+        assignVar(varExpr->var, evaluateNow(assign->rvalue));
+        return true;
       }
-      else if(continuing)
-        continuing = false;
-      else if(returning)
-        break;
-      //"continue" is implicit: body execution breaks immediately and the loop continues
-      if(fc->increment)
-        execute(fc->increment);
-    }
-  }
-  else if(auto fr = dynamic_cast<ForRange*>(stmt))
-  {
-    //Create a statement to initialize counter, and another to increment
-    VarExpr* ve = new VarExpr(fr->counter);
-    ve->resolve();
-    Statement* init = new Assign(fr->block, ve, ASSIGN, fr->begin);
-    init->resolve();
-    Statement* incr = new Assign(fr->block, ve, INC);
-    incr->resolve();
-    Expression* cond = new BinaryArith(ve, CMPL, fr->end);
-    cond->resolve();
-    assignVar(fr->counter, fr->begin);
-    execute(init);
-    while(true)
-    {
-      BoolConstant* condVal = dynamic_cast<BoolConstant*>(evaluate(cond));
-      INTERNAL_ASSERT(condVal);
-      if(!condVal->value)
-        break;
-      execute(fr->inner);
-      if(breaking)
+      size_t base = operands.size();
+      operands.push_back(evaluateNow(assign->rvalue));
+      auto compoundAssign = dynCast<CompoundLiteral>(assign->lvalue);
+      size_t count = compoundAssign ? compoundAssign->members.size() : 1;
+      for(size_t i = 0; i < count; i++)
       {
-        breaking = false;
-        break;
+        Expression* lvalue = compoundAssign ? compoundAssign->members[i] : assign->lvalue;
+        for(size_t n = 0; Expression* operand = lvalueOperand(lvalue, n); n++)
+          operands.push_back(evaluateNow(operand));
+        assignFrom(assign, lvalue, i, base);
       }
-      else if(continuing)
-        continuing = false;
-      else if(returning)
-        break;
-      execute(incr);
+      operands.pop_back();
+      return true;
     }
-  }
-  else if(auto fa = dynamic_cast<ForArray*>(stmt))
-  {
-    int dims = fa->counters.size();
-    //A ragged array is easily iterated using DFS over a tree.
-    //Use a stack to store the nodes which must still be visited.
-    //Visit tuple is (array, depth, position), where position is the
-    //depth-level index in the array
-    stack<tuple<Expression*, int, long>> toVisit;
-    toVisit.emplace(evaluate(fa->arr), -1, 0);
-    while(!toVisit.empty())
+    case NodeKind::Block:
+    {
+      execBlock((Block*) stmt, 0);
+      return true;
+    }
+    case NodeKind::If:
+    {
+      If* ifStmt = (If*) stmt;
+      if(ifStmt->condition->mayCall)
+        return false;
+      if(evaluateNow(ifStmt->condition).b)
+        exec(ifStmt->body);
+      else if(ifStmt->elseBody)
+        exec(ifStmt->elseBody);
+      return true;
+    }
+    case NodeKind::Return:
     {
-      Expression* visit = std::get<0>(toVisit.top());
-      int depth = std::get<1>(toVisit.top());
-      int64_t pos = std::get<2>(toVisit.top());
-      toVisit.pop();
-      if(depth >= 0)
+      Return* ret = (Return*) stmt;
+      if(ret->value)
       {
-        //update the index for this depth
-        assignVar(fa->counters[depth], new IntConstant(pos));
+        //(a value that can't make calls isn't a tail call)
+        if(ret->value->mayCall)
+          return false;
+        rv = evaluateNow(ret->value);
       }
-      if(depth + 1 == dims)
+      returning = true;
+      return true;
+    }
+    case NodeKind::Break:
+    {
+      breaking = true;
+      return true;
+    }
+    case NodeKind::Continue:
+    {
+      continuing = true;
+      return true;
+    }
+    case NodeKind::Print:
+    {
+      Print* print = (Print*) stmt;
+      for(auto e : print->exprs)
       {
-        //innermost dimension, assign iter's value
-        assignVar(fa->iter, visit);
-        //and execute the body
-        execute(fa->inner);
-        if(breaking)
-        {
-          breaking = false;
-          break;
-        }
-        else if(continuing)
-          continuing = false;
-        else if(returning)
-          break;
+        if(e->mayCall)
+          return false;
       }
-      else
+      for(auto e : print->exprs)
+        printTopLevel(*out, evaluateNow(e), e->type);
+      return true;
+    }
+    case NodeKind::Match:
+    {
+      Match* ma = (Match*) stmt;
+      if(ma->matched->mayCall)
+        return false;
+      Value matched = evaluateNow(ma->matched);
+      UnionObject* u = asUnion(matched);
+      int i = ma->optionCases[u->option];
+      if(i >= 0)
       {
-        //push elements of visit in reverse order
-        CompoundLiteral* cl = dynamic_cast<CompoundLiteral*>(visit);
-        INTERNAL_ASSERT(cl);
-        for(long i = cl->members.size() - 1; i >= 0; i--)
-        {
-          toVisit.emplace(cl->members[i], depth + 1, i);
-        }
+        assignVar(ma->caseVars[i], u->v);
+        exec(ma->cases[i]);
       }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void Interpreter::eval(Expression* e)
+{
+  //Most expressions don't make calls, and evaluating them directly is
+  //faster. That only recurses as deep as the expression is nested.
+  if(!e->mayCall || e->constant() || isa<VarExpr>(e) || isa<ThisExpr>(e))
+    operands.push_back(evaluateNow(e));
+  else
+    work.emplace(e, operands.size());
+}
+
+void Interpreter::done(Value v)
+{
+  work.pop();
+  operands.push_back(std::move(v));
+}
+
+Value Interpreter::popOperand()
+{
+  Value v = std::move(operands.back());
+  operands.pop_back();
+  return v;
+}
+
+void Interpreter::startCall(Subroutine* subr, vector<Value>& args, Value* thisPtr)
+{
+  if(jit && !thisPtr)
+  {
+    Value result;
+    if(jit->call(subr, args, result))
+    {
+      operands.push_back(result);
+      return;
     }
   }
-  else if(auto w = dynamic_cast<While*>(stmt))
+  if(memo && !thisPtr)
   {
-    while(true)
+    if(MemoTable* table = memo->tableFor(subr))
     {
-      BoolConstant* cond = dynamic_cast<BoolConstant*>(evaluate(w->condition));
-      INTERNAL_ASSERT(cond);
-      if(!cond->value)
-        break;
-      execute(w->body);
-      if(breaking)
+      if(Value* cached = table->find(args))
       {
-        breaking = false;
-        break;
+        operands.push_back(*cached);
+        return;
       }
-      else if(continuing)
-        continuing = false;
-      else if(returning)
-        break;
+      //the result is added to the table by finishCall
+      frames.emplace();
+      frames.top().memoTable = table;
+      frames.top().memoArgs = args;
+      invoke(subr, args);
+      return;
     }
   }
-  else if(auto ifStmt = dynamic_cast<If*>(stmt))
+  frames.emplace(thisPtr);
+  invoke(subr, args);
+}
+
+void Interpreter::invoke(Subroutine* subr, vector<Value>& args)
+{
+  if(profiler)
+    profiler->enter(subr);
+  //returning from the call is the task under the body
+  work.emplace(nullptr, operands.size());
+  enterBody(subr, args);
+}
+
+void Interpreter::enterBody(Subroutine* subr, vector<Value>& args)
+{
+  returning = false;
+  rv = Value();
+  if(args.size() != subr->type->paramTypes.size())
+  {
+    errMsg("Call to " << subr->decl->name << " expects " << \
+        subr->type->paramTypes.size() << " args, but got " << args.size() << ".");
+  }
+  //allocate the frame's slots, if the budget allows for them
+  //along with everything the active calls already use
+  size_t used = (slotsUsed + subr->numLocals + operands.size()) * sizeof(Value) +
+    frames.size() * sizeof(StackFrame) + work.size() * sizeof(Task);
+  if(used > stackBudget)
   {
-    BoolConstant* cond = dynamic_cast<BoolConstant*>(evaluate(ifStmt->condition));
-    INTERNAL_ASSERT(cond);
-    if(cond->value)
-      execute(ifStmt->body);
-    else if(ifStmt->elseBody)
-      execute(ifStmt->elseBody);
+    errMsg("Stack overflow: call depth exceeds the interpreter's stack budget (see --stack)");
   }
-  else if(auto ret = dynamic_cast<Return*>(stmt))
+  //(slots above slotsUsed are always empty, see finishCall)
+  StackFrame& frame = frames.top();
+  frame.subr = subr;
+  frame.locals = slots + slotsUsed;
+  slotsUsed += subr->numLocals;
+  //assign args to corresponding local variables
+  for(size_t i = 0; i < args.size(); i++)
   {
-    if(ret->value)
-      rv = evaluate(ret->value);
-    returning = true;
+    assignVar(subr->params[i], args[i]);
   }
-  else if(dynamic_cast<Break*>(stmt))
+  //Execute the body's statements in linear sequence.
+  //A return statement sets returning, which ends the body.
+  execBlock(subr->body, 0);
+}
+
+void Interpreter::finishCall()
+{
+  returning = false;
+  StackFrame& frame = frames.top();
+  Subroutine* subr = frame.subr;
+  //release everything owned by the frame now,
+  //rather than when its slots are next reused
+  std::fill(frame.locals, frame.locals + subr->numLocals, Value());
+  slotsUsed -= subr->numLocals;
+  if(tailCallee)
   {
-    breaking = true;
+    //reuse this frame for the tail call
+    subr = tailCallee;
+    tailCallee = nullptr;
+    vector<Value> args = std::move(tailArgs);
+    tailArgs.clear();
+    frame.thisPtr = nullptr;
+    frame.thisRval = Value();
+    if(profiler)
+    {
+      profiler->leave();
+      profiler->enter(subr);
+    }
+    enterBody(subr, args);
+    return;
   }
-  else if(dynamic_cast<Continue*>(stmt))
+  if(profiler)
+    profiler->leave();
+  if(rv.tag == ValueTag::NONE && !subr->type->returnType->isSimple())
   {
-    continuing = true;
+    errMsgLoc(subr, "interpreter reached end of subroutine without a return value");
   }
-  else if(auto print = dynamic_cast<Print*>(stmt))
+  Value result = std::move(rv);
+  rv = Value();
+  if(frame.memoTable)
+    frame.memoTable->insert(frame.memoArgs, result);
+  frames.pop();
+  done(result);
+}
+
+bool Interpreter::loopDone()
+{
+  if(breaking)
   {
-    for(auto e : print->exprs)
+    breaking = false;
+    return true;
+  }
+  if(continuing)
+    continuing = false;
+  return returning;
+}
+
+void Interpreter::stepCountLoop(Task& task, For* loop, CounterLoop* cl, Statement* increment)
+{
+  //the body can't change the bound, so it's evaluated once (into operands[base])
+  //and the counter is updated in its slot (slots are never reallocated, so
+  //this sees any assignments to the counter in the body)
+  while(true)
+  {
+    switch(task.step - countLoopStep)
     {
-      Expression* toPrint = evaluate(e);
-      //Evaluating any string always returns "char[]", which
-      //would normally print as an array.
-      if(typesSame(toPrint->type, getCharType()))
-      {
-        IntConstant* ic = dynamic_cast<IntConstant*>(toPrint);
-        cout << (char) ic->uval;
-      }
-      else if(typesSame(e->type, getStringType()))
-      {
-        CompoundLiteral* stringArr = dynamic_cast<CompoundLiteral*>(toPrint);
-        INTERNAL_ASSERT(stringArr);
-        for(auto elem : stringArr->members)
+      case 0:
+        task.step++;
+        eval(cl->bound);
+        return;
+      case 1:
+        if(!counterInBounds(readVar(cl->counter), operands[task.base], cl->cmp))
         {
-          IntConstant* ic = dynamic_cast<IntConstant*>(elem);
-          cout << (char) ic->uval;
+          operands.pop_back();
+          work.pop();
+          return;
         }
-      }
-      else
+        task.step++;
+        if(!exec(loop->inner))
+          return;
+        break;
+      case 2:
       {
-        cout << toPrint;
+        if(loopDone())
+        {
+          operands.pop_back();
+          work.pop();
+          return;
+        }
+        Value next = readVar(cl->counter);
+        next.u += (uint64_t) cl->step;
+        IntegerType* counterType = (IntegerType*) canonicalize(cl->counter->type);
+        if(increment && !intFits(next, counterType->size, counterType->isSigned))
+        {
+          //let the increment statement report the overflow
+          operands.push_back(next);
+          task.step++;
+          exec(increment);
+          return;
+        }
+        readVar(cl->counter).u = next.u;
+        task.step--;
+        break;
       }
+      case 3:
+        readVar(cl->counter).u = popOperand().u;
+        task.step -= 2;
+        break;
+      default:
+        INTERNAL_ERROR;
     }
   }
-  else if(auto assertion = dynamic_cast<Assertion*>(stmt))
+}
+
+void Interpreter::updateArray(ArrayUpdate* au)
+{
+  Value operand = popOperand();
+  //the variable usually holds the only reference to its array
+  //(unlike evaluating "a + x", which would make another)
+  Value& arr = readVar(au->array);
+  makeUnique(arr);
+  if(au->concat)
   {
-    BoolConstant* bc = dynamic_cast<BoolConstant*>(evaluate(assertion->asserted));
-    assert(bc);
-    if(!bc->value)
-    {
-      errMsgLoc(assertion, "Assertion failed: " << assertion->asserted);
-    }
+    if(au->prepend)
+      asArray(arr)->prepend(asArray(operand));
+    else
+      asArray(arr)->append(asArray(operand));
   }
-  else if(auto sw = dynamic_cast<Switch*>(stmt))
+  else if(au->prepend)
+    asArray(arr)->push_front(operand);
+  else
+    asArray(arr)->push_back(operand);
+}
+
+void Interpreter::stepStatement(Task& task)
+{
+  Statement* stmt = (Statement*) task.node;
+  switch(stmt->kind)
   {
-    Expression* switched = evaluate(sw->switched);
-    //Run down list of cases, comparing value
-    int label = sw->defaultPosition;
-    for(size_t i = 0; i < sw->caseValues.size(); i++)
+    case NodeKind::Assign:
     {
-      if(*switched == *evaluate(sw->caseValues[i]))
+      Assign* assign = (Assign*) stmt;
+      if(task.step == 0)
       {
-        label = sw->caseLabels[i];
-        break;
+        task.step = 1;
+        if(assign->arrayUpdate)
+          eval(assign->arrayUpdate->operand);
+        else
+          eval(assign->rvalue);
+        return;
+      }
+      if(assign->arrayUpdate)
+      {
+        updateArray(assign->arrayUpdate);
+        work.pop();
+        return;
+      }
+      //the rvalue is at operands[base], and then what the
+      //lvalue (or the member being assigned) depends on
+      auto compoundAssign = dynCast<CompoundLiteral>(assign->lvalue);
+      Expression* lvalue = compoundAssign ? compoundAssign->members[task.index] : assign->lvalue;
+      if(Expression* operand = lvalueOperand(lvalue, operands.size() - task.base - 1))
+      {
+        eval(operand);
+        return;
       }
+      assignFrom(assign, lvalue, task.index, task.base);
+      if(compoundAssign && ++task.index < compoundAssign->members.size())
+        return;
+      operands.pop_back();
+      work.pop();
+      return;
+    }
+    case NodeKind::Block:
+    {
+      //resume after the statement that was a task
+      size_t start = task.index;
+      work.pop();
+      execBlock((Block*) stmt, start);
+      return;
     }
-    //begin executing body at the proper position
-    for(size_t i = label; i < sw->block->stmts.size(); i++)
+    case NodeKind::CallStmt:
     {
-      execute(sw->block->stmts[i]);
-      if(breaking)
+      CallStmt* call = (CallStmt*) stmt;
+      if(task.step == 0)
       {
-        breaking = false;
+        task.step = 1;
+        eval(call->eval);
         return;
       }
-      else if(continuing || returning)
+      operands.pop_back();
+      work.pop();
+      return;
+    }
+    case NodeKind::ForC:
+    {
+      ForC* fc = (ForC*) stmt;
+      if(task.step >= countLoopStep)
+      {
+        stepCountLoop(task, fc, fc->counterLoop, fc->increment);
         return;
+      }
+      while(true)
+      {
+        switch(task.step)
+        {
+          case 0:
+            //Initialize the loop
+            task.step = 1;
+            if(fc->init)
+            {
+              exec(fc->init);
+              return;
+            }
+            break;
+          case 1:
+            if(fc->counterLoop)
+            {
+              task.step = countLoopStep;
+              stepCountLoop(task, fc, fc->counterLoop, fc->increment);
+              return;
+            }
+            task.step = 2;
+            break;
+          case 2:
+            //condition is optional; if omitted, always true
+            if(fc->condition)
+            {
+              task.step = 3;
+              eval(fc->condition);
+              return;
+            }
+            task.step = 4;
+            if(!exec(fc->inner))
+              return;
+            break;
+          case 3:
+            if(!popOperand().b)
+            {
+              work.pop();
+              return;
+            }
+            task.step = 4;
+            if(!exec(fc->inner))
+              return;
+            break;
+          case 4:
+            if(loopDone())
+            {
+              work.pop();
+              return;
+            }
+            //"continue" is implicit: body execution breaks immediately and the loop continues
+            task.step = 2;
+            if(fc->increment && !exec(fc->increment))
+              return;
+            break;
+          default:
+            INTERNAL_ERROR;
+        }
+      }
     }
-  }
-  else if(auto ma = dynamic_cast<Match*>(stmt))
-  {
-    UnionConstant* uc = dynamic_cast<UnionConstant*>(evaluate(ma->matched));
-    INTERNAL_ASSERT(uc);
-    for(size_t i = 0; i < ma->types.size(); i++)
+    case NodeKind::ForRange:
     {
-      if(typesSame(uc->value->type, ma->types[i]))
+      ForRange* fr = (ForRange*) stmt;
+      if(task.step >= countLoopStep)
       {
-        assignVar(ma->caseVars[i], uc->value);
-        execute(ma->cases[i]);
-        if(breaking)
-          breaking = false;
-        break;
+        stepCountLoop(task, fr, fr->counterLoop, nullptr);
+        return;
+      }
+      while(true)
+      {
+        switch(task.step)
+        {
+          case 0:
+            task.step = 1;
+            eval(fr->begin);
+            return;
+          case 1:
+            //counter is a long, and begin/end have been converted to long
+            assignVar(fr->counter, popOperand());
+            if(fr->counterLoop)
+            {
+              task.step = countLoopStep;
+              stepCountLoop(task, fr, fr->counterLoop, nullptr);
+              return;
+            }
+            task.step = 2;
+            break;
+          case 2:
+            //end is evaluated before every iteration
+            task.step = 3;
+            eval(fr->end);
+            return;
+          case 3:
+            if(readVar(fr->counter).i >= popOperand().i)
+            {
+              work.pop();
+              return;
+            }
+            task.step = 4;
+            if(!exec(fr->inner))
+              return;
+            break;
+          case 4:
+            if(loopDone())
+            {
+              work.pop();
+              return;
+            }
+            readVar(fr->counter).i++;
+            task.step = 2;
+            break;
+          default:
+            INTERNAL_ERROR;
+        }
       }
     }
-  }
-  else
-  {
-    cout << "Interpreter doesn't know how to execute stmt at " << stmt->printLocation() << '\n';
-    INTERNAL_ERROR;
-  }
-}
-
-CompoundLiteral* Interpreter::createArray(uint64_t* dims, int ndims, Type* elem)
-{
-  vector<Expression*> elems;
-  for(uint64_t i = 0; i < dims[0]; i++)
-  {
-    if(ndims == 1)
+    case NodeKind::ForArray:
     {
-      elems.push_back(elem->getDefaultValue());
+      ForArray* fa = (ForArray*) stmt;
+      int dims = fa->counters.size();
+      if(task.step == 0)
+      {
+        task.step = 1;
+        eval(fa->arr);
+        return;
+      }
+      if(task.step == 1)
+      {
+        //A ragged array is iterated depth-first: for each depth d being
+        //visited, operands[base + 2d] is the array and operands[base + 2d + 1]
+        //the position of the next element to visit in it
+        operands.push_back(intValue(0));
+        task.step = 2;
+      }
+      else if(loopDone())
+      {
+        operands.resize(task.base);
+        work.pop();
+        return;
+      }
+      while(true)
+      {
+        size_t levels = (operands.size() - task.base) / 2;
+        if(levels == 0)
+        {
+          work.pop();
+          return;
+        }
+        int depth = levels - 1;
+        size_t level = task.base + 2 * depth;
+        ArrayObject* elems = asArray(operands[level]);
+        int64_t pos = operands[level + 1].i;
+        if(pos >= (int64_t) elems->size())
+        {
+          //done with this array, so continue with its parent
+          operands.resize(level);
+          continue;
+        }
+        operands[level + 1].i++;
+        //update the index for this depth
+        assignVar(fa->counters[depth], intValue(pos));
+        Value visit = elems->get(pos);
+        if(depth + 1 == dims)
+        {
+          //innermost dimension, assign the element to iter
+          assignVar(fa->iter, visit);
+          //and execute the body
+          if(!exec(fa->inner))
+            return;
+          if(loopDone())
+          {
+            operands.resize(task.base);
+            work.pop();
+            return;
+          }
+          continue;
+        }
+        operands.push_back(visit);
+        operands.push_back(intValue(0));
+      }
     }
-    else
+    case NodeKind::While:
     {
-      elems.push_back(createArray(&dims[1], ndims - 1, elem));
+      While* w = (While*) stmt;
+      while(true)
+      {
+        if(task.step == 1)
+        {
+          if(!popOperand().b)
+          {
+            work.pop();
+            return;
+          }
+          task.step = 2;
+          if(!exec(w->body))
+            return;
+        }
+        if(task.step == 2 && loopDone())
+        {
+          work.pop();
+          return;
+        }
+        task.step = 1;
+        size_t depth = work.size();
+        eval(w->condition);
+        if(work.size() != depth)
+          return;
+      }
     }
-  }
-  return new CompoundLiteral(elems, getArrayType(elem, ndims));
-}
-
-Expression* Interpreter::convertConstant(Expression* value, Type* type)
-{
-  type = canonicalize(type);
-  if(typesSame(value->type, type))
-    return value;
-  //For converting union constants, use the underlying value
-  if(auto uc = dynamic_cast<UnionConstant*>(value))
-  {
-    value = uc->value;
-  }
-  Node* loc = value;
-  INTERNAL_ASSERT(value->constant());
-  auto structDst = dynamic_cast<StructType*>(type);
-  if(auto unionDst = dynamic_cast<UnionType*>(type))
-  {
-    int option = -1;
-    //first, look for exact type match
-    for(size_t i = 0; i < unionDst->options.size(); i++)
+    case NodeKind::If:
     {
-      if(typesSame(unionDst->options[i], value->type))
+      If* ifStmt = (If*) stmt;
+      if(task.step == 0)
       {
-        option = i;
-        break;
+        task.step = 1;
+        eval(ifStmt->condition);
+        return;
       }
+      //the branch taken replaces the if
+      work.pop();
+      if(popOperand().b)
+        exec(ifStmt->body);
+      else if(ifStmt->elseBody)
+        exec(ifStmt->elseBody);
+      return;
     }
-    //then, look for any valid conversion
-    if(option < 0)
+    case NodeKind::Return:
     {
-      for(size_t i = 0; i < unionDst->options.size(); i++)
+      Return* ret = (Return*) stmt;
+      //A plain call (not a method call, whose frame holds "this")
+      //as the value is a tail call, which reuses the current frame
+      auto call = dynCast<CallExpr>(ret->value);
+      bool tail = call && !dynCast<StructMem>(call->callable);
+      if(task.step == 0 && ret->value)
+      {
+        task.step = 1;
+        eval(tail ? call->callable : ret->value);
+        return;
+      }
+      if(tail)
       {
-        if(unionDst->options[i]->canConvert(value->type))
+        //evaluate the callable, then args in order
+        size_t n = operands.size() - task.base - 1;
+        if(n < call->args.size())
+        {
+          eval(call->args[n]);
+          return;
+        }
+        Value callable = operands[task.base];
+        INTERNAL_ASSERT(callable.tag == ValueTag::SUBR);
+        vector<Value> args(operands.begin() + task.base + 1, operands.end());
+        operands.resize(task.base);
+        if(auto subr = dynCast<Subroutine>(callable.subr))
         {
-          option = i;
-          value = convertConstant(value, unionDst->options[i]);
-          break;
+          tailCallee = subr;
+          tailArgs = std::move(args);
+        }
+        else
+          rv = callExtern(dynCast<ExternalSubroutine>(callable.subr), args);
+      }
+      else if(ret->value)
+        rv = popOperand();
+      returning = true;
+      work.pop();
+      return;
+    }
+    case NodeKind::Print:
+    {
+      Print* print = (Print*) stmt;
+      if(task.index)
+      {
+        //chars and strings print raw, everything else
+        //prints the same as the equivalent constant expression
+        printTopLevel(*out, popOperand(), print->exprs[task.index - 1]->type);
+      }
+      if(task.index == print->exprs.size())
+      {
+        work.pop();
+        return;
+      }
+      eval(print->exprs[task.index++]);
+      return;
+    }
+    case NodeKind::Assertion:
+    {
+      Assertion* assertion = (Assertion*) stmt;
+      if(task.step == 0)
+      {
+        task.step = 1;
+        eval(assertion->asserted);
+        return;
+      }
+      if(!popOperand().b)
+      {
+        errMsgLoc(assertion, "Assertion failed: " << assertion->asserted);
+      }
+      work.pop();
+      return;
+    }
+    case NodeKind::Switch:
+    {
+      Switch* sw = (Switch*) stmt;
+      //the switched value is at operands[base], and then (with a
+      //table) the position of the case found so far
+      while(true)
+      {
+        switch(task.step)
+        {
+          case 0:
+            task.step = 1;
+            eval(sw->switched);
+            return;
+          case 1:
+            task.index = 0;
+            if(sw->hasTable)
+            {
+              operands.push_back(intValue(sw->findCase(caseKey(operands[task.base]))));
+              task.step = 2;
+            }
+            else
+              task.step = 4;
+            break;
+          case 2:
+          {
+            //A non-constant case only matters if it comes before the one found
+            int found = operands[task.base + 1].i;
+            if(task.index < sw->dynamicCases.size() &&
+                (found < 0 || sw->dynamicCases[task.index] <= found))
+            {
+              task.step = 3;
+              eval(sw->caseValues[sw->dynamicCases[task.index]]);
+              return;
+            }
+            task.index = found >= 0 ? sw->caseLabels[found] : sw->defaultPosition;
+            operands.resize(task.base);
+            task.step = 6;
+            break;
+          }
+          case 3:
+          {
+            Value caseValue = popOperand();
+            if(valuesEqual(operands[task.base], caseValue))
+            {
+              task.index = sw->caseLabels[sw->dynamicCases[task.index]];
+              operands.resize(task.base);
+              task.step = 6;
+            }
+            else
+            {
+              task.index++;
+              task.step = 2;
+            }
+            break;
+          }
+          case 4:
+            //Run down list of cases, comparing value
+            if(task.index < sw->caseValues.size())
+            {
+              task.step = 5;
+              eval(sw->caseValues[task.index]);
+              return;
+            }
+            task.index = sw->defaultPosition;
+            operands.pop_back();
+            task.step = 6;
+            break;
+          case 5:
+          {
+            Value caseValue = popOperand();
+            if(valuesEqual(operands[task.base], caseValue))
+            {
+              task.index = sw->caseLabels[task.index];
+              operands.pop_back();
+              task.step = 6;
+            }
+            else
+            {
+              task.index++;
+              task.step = 4;
+            }
+            break;
+          }
+          case 6:
+            //begin executing body at the proper position (index)
+            task.step = 7;
+            //fall through
+          case 7:
+            if(breaking)
+            {
+              breaking = false;
+              work.pop();
+              return;
+            }
+            if(continuing || returning || task.index >= sw->block->stmts.size())
+            {
+              work.pop();
+              return;
+            }
+            exec(sw->block->stmts[task.index++]);
+            return;
+          default:
+            INTERNAL_ERROR;
         }
       }
     }
-    INTERNAL_ASSERT(option >= 0);
-    value = new UnionConstant(value, unionDst);
-    value->setLocation(loc);
-    return value;
+    case NodeKind::Match:
+    {
+      Match* ma = (Match*) stmt;
+      if(task.step == 0)
+      {
+        task.step = 1;
+        eval(ma->matched);
+        return;
+      }
+      Value matched = popOperand();
+      UnionObject* u = asUnion(matched);
+      int i = ma->optionCases[u->option];
+      work.pop();
+      if(i >= 0)
+      {
+        //break and continue inside a case apply to the enclosing loop
+        assignVar(ma->caseVars[i], u->v);
+        exec(ma->cases[i]);
+      }
+      return;
+    }
+    default:
+    {
+      cout << "Interpreter doesn't know how to execute stmt at " << stmt->printLocation() << '\n';
+      INTERNAL_ERROR;
+    }
   }
-  else if(structDst && structDst->members.size() == 1 &&
-      !dynamic_cast<CompoundLiteral*>(value))
+}
+
+//Apply a binary operation (other than logical AND/OR) to its operands
+static Value binaryArith(BinaryArith* ba, Value& lhs, Value& rhs)
+{
+  int op = ba->op;
+  switch(op)
   {
-    //Single-member struct is equivalent to the member
-    vector<Expression*> mem(1,
-        convertConstant(value, structDst->members[0]->type));
-    auto cl = new CompoundLiteral(mem, type);
-    cl->setLocation(loc);
-    return cl;
+    //note: ordering operators are only defined for types
+    //where they're allowed in syntax
+    case CMPEQ:
+      return boolValue(valuesEqual(lhs, rhs));
+    case CMPNEQ:
+      return boolValue(!valuesEqual(lhs, rhs));
+    case CMPL:
+      return boolValue(valueLess(lhs, rhs));
+    case CMPG:
+      return boolValue(valueLess(rhs, lhs));
+    case CMPLE:
+      return boolValue(!valueLess(rhs, lhs));
+    case CMPGE:
+      return boolValue(!valueLess(lhs, rhs));
+    default:;
   }
-  else if(structDst)
+  if(op == PLUS)
   {
-    auto clRHS = dynamic_cast<CompoundLiteral*>(value);
-    INTERNAL_ASSERT(clRHS);
-    //just need to convert the elements in a
-    //CompoundLiteral to match struct member types 
-    vector<Expression*> mems;
-    for(size_t i = 0; i < clRHS->members.size(); i++)
+    //handle array concat, prepend and append operations
+    //(done in place on the operand if it isn't shared)
+    bool compoundLHS = canonicalize(ba->lhs->type)->isArray();
+    bool compoundRHS = canonicalize(ba->rhs->type)->isArray();
+    if(compoundLHS && compoundRHS)
+    {
+      makeUnique(lhs);
+      asArray(lhs)->append(asArray(rhs));
+      return lhs;
+    }
+    else if(compoundLHS)
+    {
+      //array append
+      makeUnique(lhs);
+      asArray(lhs)->push_back(rhs);
+      return lhs;
+    }
+    else if(compoundRHS)
     {
-      mems.push_back(convertConstant(clRHS->members[i], structDst->members[i]->type));
+      //array prepend
+      makeUnique(rhs);
+      asArray(rhs)->push_front(lhs);
+      return rhs;
     }
-    CompoundLiteral* conv = new CompoundLiteral(mems, type);
-    return conv;
   }
-  else if(auto intConst = dynamic_cast<IntConstant*>(value))
+  //all other binary ops are numerical operations between two ints or two floats
+  return binaryOp(op, lhs, rhs, ba->type, ba->rhs->type, ba);
+}
+
+//A compound literal, from the values of its members
+static Value compoundValue(CompoundLiteral* cl, Value* members)
+{
+  size_t n = cl->members.size();
+  if(canonicalize(cl->type)->isArray())
   {
-    //do the conversion which tests for overflow and enum membership
-    value = intConst->convert(type);
-    value->setLocation(loc);
-    return value;
+    ArrayObject* arr = new ArrayObject(((ArrayType*) canonicalize(cl->type))->subtype);
+    arr->reserve(n);
+    for(size_t i = 0; i < n; i++)
+      arr->push_back(members[i]);
+    return objectValue(arr);
   }
-  else if(auto floatConst = dynamic_cast<FloatConstant*>(value))
+  StructObject* st = new StructObject;
+  st->mems.reserve(n);
+  for(size_t i = 0; i < n; i++)
+    st->mems.push_back(members[i]);
+  return objectValue(st);
+}
+
+//Look up key in map for ind (a map lookup)
+static Value lookupMap(Indexed* ind, Value& map, const Value& key)
+{
+  MapType* mt = (MapType*) canonicalize(ind->group->type);
+  //if key is not already in the map, insert it and default-initialize the value
+  Value* val = asMap(map)->table.find(key);
+  if(!val)
   {
-    value = floatConst->convert(type);
-    value->setLocation(loc);
-    return value;
+    makeUnique(map);
+    val = &asMap(map)->table[key];
+    *val = defaultValue(mt->value);
   }
-  else if(auto enumConst = dynamic_cast<EnumExpr*>(value))
+  return makeUnion(*val, mt->value, (UnionType*) canonicalize(ind->type));
+}
+
+//The element of an array or tuple for ind
+static Value indexValue(Indexed* ind, Value& group, const Value& index)
+{
+  if(canonicalize(ind->group->type)->isTuple())
+    return asStruct(group)->mems[tupleIndex(ind)];
+  //an array, so index should be an integer
+  ArrayObject* arr = asArray(group);
+  if(index.tag == ValueTag::INT && index.i < 0)
+    errMsgLoc(ind, "negative array index");
+  if(index.u >= arr->size())
+    errMsgLoc(ind, "array index " << index.u << " out of bound " << arr->size());
+  return arr->get(index.u);
+}
+
+static void checkDimension(NewArray* na, const Value& dim)
+{
+  if(dim.tag == ValueTag::INT && dim.i < 0)
+    errMsgLoc(na, "Negative array dimension: " << dim.i);
+}
+
+//The length of an array or map (always a "long")
+static Value lengthValue(const Value& arr)
+{
+  if(arr.obj->kind == ObjectKind::MAP)
+    return intValue(asMap(arr)->table.size());
+  return intValue(asArray(arr)->size());
+}
+
+Value Interpreter::evaluateNow(Expression* e)
+{
+  if(e->constant())
+  {
+    return constantValue(e);
+  }
+  switch(e->kind)
   {
-    if(enumConst->value->isSigned)
+    case NodeKind::VarExpr:
     {
-      IntConstant asInt((int64_t) enumConst->value->value);
-      asInt.setLocation(loc);
-      return asInt.convert(type);
+      VarExpr* var = (VarExpr*) e;
+      //the value is shared, but copy-on-write means
+      //the original is never modified through it
+      return readVar(var->var);
     }
-    else
+    case NodeKind::UnaryArith:
     {
-      IntConstant asInt(enumConst->value->value);
-      asInt.setLocation(loc);
-      return asInt.convert(type);
+      UnaryArith* ua = (UnaryArith*) e;
+      //logical NOT, bitwise NOT (integers) and negation (integers and floats)
+      return unaryOp(ua->op, evaluateNow(ua->expr));
     }
-  }
-  //array/struct/tuple constants can be converted implicitly
-  //to each other (all use CompoundLiteral) but individual
-  //members (primitives) may need conversion
-  else if(auto compLit = dynamic_cast<CompoundLiteral*>(value))
-  {
-    //attempt to fold all elements (can't proceed unless every
-    //one is a constant)
-    if(auto st = dynamic_cast<StructType*>(type))
+    case NodeKind::BinaryArith:
     {
-      for(size_t i = 0; i < compLit->members.size(); i++)
+      BinaryArith* ba = (BinaryArith*) e;
+      //first, intercept short-circuit evaluation cases (logical AND/OR)
+      if(ba->op == LOR)
       {
-        if(!typesSame(compLit->members[i]->type, st->members[i]->type))
-        {
-          compLit->members[i] = convertConstant(
-              compLit->members[i], st->members[i]->type);
-        }
-        //else: don't need to convert member
+        if(evaluateNow(ba->lhs).b)
+          return boolValue(true);
+        return boolValue(evaluateNow(ba->rhs).b);
+      }
+      else if(ba->op == LAND)
+      {
+        if(!evaluateNow(ba->lhs).b)
+          return boolValue(false);
+        return boolValue(evaluateNow(ba->rhs).b);
       }
-      compLit->type = type;
-      return compLit;
+      Value lhs = evaluateNow(ba->lhs);
+      Value rhs = evaluateNow(ba->rhs);
+      return binaryArith(ba, lhs, rhs);
     }
-    else if(auto tt = dynamic_cast<TupleType*>(type))
+    case NodeKind::CompoundLiteral:
     {
-      for(size_t i = 0; i < compLit->members.size(); i++)
+      CompoundLiteral* cl = (CompoundLiteral*) e;
+      vector<Value> members;
+      members.reserve(cl->members.size());
+      for(auto mem : cl->members)
+        members.push_back(evaluateNow(mem));
+      return compoundValue(cl, members.data());
+    }
+    case NodeKind::Indexed:
+    {
+      Indexed* ind = (Indexed*) e;
+      if(canonicalize(ind->group->type)->isMap())
       {
-        if(!typesSame(compLit->members[i]->type, tt->members[i]))
-        {
-          compLit->members[i] = convertConstant(
-              compLit->members[i], tt->members[i]);
-        }
+        //Map lookups insert missing keys into the original map,
+        //so look up through an lvalue if possible
+        Value index = evaluateNow(ind->index);
+        if(ind->group->assignable())
+          return lookupMap(ind, evaluateLValue(ind->group), index);
+        Value map = evaluateNow(ind->group);
+        return lookupMap(ind, map, index);
       }
-      compLit->type = type;
-      return compLit;
+      Value group = evaluateNow(ind->group);
+      Value index;
+      if(!canonicalize(ind->group->type)->isTuple())
+        index = evaluateNow(ind->index);
+      return indexValue(ind, group, index);
     }
-    else if(auto at = dynamic_cast<ArrayType*>(type))
+    case NodeKind::StructMem:
     {
-      //Array lit is just another CompoundLiteral,
-      //but with array type instead of tuple
-      vector<Expression*> elements;
-      for(auto& elem : compLit->members)
+      StructMem* sm = (StructMem*) e;
+      if(!sm->member.is<Variable*>())
       {
-        elements.push_back(convertConstant(elem, at->subtype));
+        errMsgLoc(sm, "Interpreter doesn't support member subroutines as values");
       }
-      return new CompoundLiteral(elements, at);
+      Value base = evaluateNow(sm->base);
+      return asStruct(base)->mems[sm->index];
     }
-    else if(auto mt = dynamic_cast<MapType*>(type))
+    case NodeKind::NewArray:
     {
-      auto mc = new MapConstant(mt);
-      //add each key/value pair to the map
-      for(size_t i = 0; i < compLit->members.size(); i++)
+      NewArray* na = (NewArray*) e;
+      vector<uint64_t> dims;
+      for(auto d : na->dims)
       {
-        auto kv = dynamic_cast<CompoundLiteral*>(compLit->members[i]);
-        INTERNAL_ASSERT(kv);
-        Expression* key = kv->members[0];
-        Expression* val = kv->members[1];
-        if(!typesSame(key->type, mt->key))
-          key = convertConstant(key, mt->key);
-        if(!typesSame(val->type, mt->value))
-          val = convertConstant(val, mt->value);
-        mc->values[key] = val;
+        Value dim = evaluateNow(d);
+        checkDimension(na, dim);
+        dims.push_back(dim.u);
       }
-      mc->type = type;
-      return mc;
+      Type* elem = ((ArrayType*) canonicalize(na->type))->elem;
+      return createArrayValue(dims.data(), na->dims.size(), elem);
     }
+    case NodeKind::ArrayLength:
+    {
+      ArrayLength* al = (ArrayLength*) e;
+      return lengthValue(evaluateNow(al->array));
+    }
+    case NodeKind::IsExpr:
+    {
+      IsExpr* ie = (IsExpr*) e;
+      Value base = evaluateNow(ie->base);
+      return boolValue(ie->optionMap[asUnion(base)->option] >= 0);
+    }
+    case NodeKind::AsExpr:
+    {
+      AsExpr* ae = (AsExpr*) e;
+      Value base = evaluateNow(ae->base);
+      return narrowUnion(asUnion(base), ae);
+    }
+    case NodeKind::ThisExpr:
+    {
+      return frames.top().getThis();
+    }
+    case NodeKind::Converted:
+    {
+      Converted* conv = (Converted*) e;
+      return convertValue(evaluateNow(conv->value), conv->value->type, conv->type, conv);
+    }
+    default:;
   }
-  //????
-  cout << "Failed to convert constant expr \"" << value << "\" to type \"" << type->getName() << "\"\n";
-  cout << "Value's type is " << value->type->getName() << '\n';
   INTERNAL_ERROR;
-  return nullptr;
+  return Value();
 }
 
-Expression* Interpreter::evaluate(Expression* e)
+void Interpreter::stepExpression(Task& task)
 {
-  if(e->constant())
-  {
-    return e;
-  }
-  if(auto var = dynamic_cast<VarExpr*>(e))
-  {
-    //deep copy the value, so the original is never modified
-    return evaluateLValue(var)->copy();
-  }
-  else if(auto ua = dynamic_cast<UnaryArith*>(e))
+  Expression* e = (Expression*) task.node;
+  //the number of operands evaluated so far
+  size_t n = operands.size() - task.base;
+  //(an expression with a single subexpression is done once it's evaluated)
+  switch(e->kind)
   {
-    Expression* operand = evaluate(ua->expr);
-    switch(ua->op)
+    case NodeKind::UnaryArith:
     {
-      case LNOT:
+      UnaryArith* ua = (UnaryArith*) e;
+      if(n == 0)
+      {
+        eval(ua->expr);
+        return;
+      }
+      done(unaryOp(ua->op, popOperand()));
+      return;
+    }
+    case NodeKind::BinaryArith:
+    {
+      BinaryArith* ba = (BinaryArith*) e;
+      if(n == 0)
+      {
+        eval(ba->lhs);
+        return;
+      }
+      if(ba->op == LOR || ba->op == LAND)
+      {
+        //the rhs is only evaluated if the lhs doesn't decide the result
+        //(step is 1 once it has been)
+        bool value = popOperand().b;
+        if(task.step == 0 && value != (ba->op == LOR))
         {
-          //Logical NOT
-          BoolConstant* bc = dynamic_cast<BoolConstant*>(operand);
-          INTERNAL_ASSERT(bc);
-          return new BoolConstant(!bc->value);
+          task.step = 1;
+          eval(ba->rhs);
         }
-      case BNOT:
+        else
+          done(boolValue(value));
+        return;
+      }
+      if(n == 1)
+      {
+        eval(ba->rhs);
+        return;
+      }
+      Value rhs = popOperand();
+      Value lhs = popOperand();
+      done(binaryArith(ba, lhs, rhs));
+      return;
+    }
+    case NodeKind::CompoundLiteral:
+    {
+      CompoundLiteral* cl = (CompoundLiteral*) e;
+      if(n < cl->members.size())
+      {
+        eval(cl->members[n]);
+        return;
+      }
+      Value result = compoundValue(cl, &operands[task.base]);
+      operands.resize(task.base);
+      done(result);
+      return;
+    }
+    case NodeKind::Indexed:
+    {
+      Indexed* ind = (Indexed*) e;
+      Type* groupType = canonicalize(ind->group->type);
+      if(groupType->isMap())
+      {
+        //Map lookups insert missing keys into the original map,
+        //so look up through an lvalue if possible.
+        //Either way, the key is evaluated first.
+        Value result;
+        if(ind->group->assignable())
         {
-          //Bitwise NOT: only applies to integers
-          IntConstant* ic = dynamic_cast<IntConstant*>(operand->copy());
-          INTERNAL_ASSERT(ic);
-          if(ic->isSigned())
-            ic->sval = ~ic->sval;
-          else
-            ic->uval = ~ic->uval;
-          return ic;
+          if(Expression* operand = lvalueOperand(ind, n))
+          {
+            eval(operand);
+            return;
+          }
+          Value key = operands[task.base];
+          result = lookupMap(ind, lvalueAt(ind->group, task.base + 1), key);
         }
-      case SUB:
+        else
         {
-          //Negation: applies to integers and floats
-          Expression* copy = operand->copy();
-          if(auto ic = dynamic_cast<IntConstant*>(copy))
+          if(n < 2)
           {
-            if(ic->isSigned())
-              ic->sval = -ic->sval;
-            else
-              ic->uval = -ic->uval;
+            eval(n == 0 ? ind->index : ind->group);
+            return;
+          }
+          result = lookupMap(ind, operands[task.base + 1], operands[task.base]);
+        }
+        operands.resize(task.base);
+        done(result);
+        return;
+      }
+      //the group, then (for an array) the index
+      if(n == 0 || (n == 1 && !groupType->isTuple()))
+      {
+        eval(n == 0 ? ind->group : ind->index);
+        return;
+      }
+      Value index;
+      if(n == 2)
+        index = popOperand();
+      Value group = popOperand();
+      done(indexValue(ind, group, index));
+      return;
+    }
+    case NodeKind::CallExpr:
+    {
+      CallExpr* call = (CallExpr*) e;
+      size_t numArgs = call->args.size();
+      //Method call: "this" is the base of the callable
+      auto structMem = dynCast<StructMem>(call->callable);
+      if(structMem && structMem->member.is<Subroutine*>())
+      {
+        Subroutine* subr = structMem->member.get<Subroutine*>();
+        Expression* thisObject = structMem->base;
+        if(thisObject->assignable())
+        {
+          //args, then what the lvalue "this" depends on
+          if(n < numArgs)
+          {
+            eval(call->args[n]);
+            return;
           }
-          else if(auto fc = dynamic_cast<FloatConstant*>(copy))
+          if(Expression* operand = lvalueOperand(thisObject, n - numArgs))
           {
-            if(fc->isDoublePrec())
-              fc->dp = -fc->dp;
-            else
-              fc->fp = -fc->fp;
+            eval(operand);
+            return;
           }
-          return copy;
+          Value* thisPtr = &lvalueAt(thisObject, task.base + numArgs);
+          vector<Value> args(operands.begin() + task.base, operands.begin() + task.base + numArgs);
+          operands.resize(task.base);
+          //the call's result replaces this task
+          work.pop();
+          startCall(subr, args, thisPtr);
+          return;
         }
-      default:
-        INTERNAL_ERROR;
-    }
-    return nullptr;
-  }
-  else if(auto ba = dynamic_cast<BinaryArith*>(e))
-  {
-    //first, intercept short-circuit evaluation cases (logical AND/OR)
-    if(ba->op == LOR)
-    {
-      BoolConstant* lhs = dynamic_cast<BoolConstant*>(evaluate(ba->lhs));
-      INTERNAL_ASSERT(lhs);
-      if(lhs->value)
-        return new BoolConstant(true);
-      BoolConstant* rhs = dynamic_cast<BoolConstant*>(evaluate(ba->rhs));
-      INTERNAL_ASSERT(rhs);
-      return new BoolConstant(rhs->value);
-    }
-    else if(ba->op == LAND)
-    {
-      BoolConstant* lhs = dynamic_cast<BoolConstant*>(evaluate(ba->lhs));
-      INTERNAL_ASSERT(lhs);
-      if(!lhs->value)
-        return new BoolConstant(false);
-      BoolConstant* rhs = dynamic_cast<BoolConstant*>(evaluate(ba->rhs));
-      INTERNAL_ASSERT(rhs);
-      return new BoolConstant(rhs->value);
-    }
-    //need to fold only the LHS, then replace value immediately if it short-circuits
-    //NOTE: since constant folds never have side effects, this change never
-    //affects program semantics but may allow folding when otherwise impossible
-    Expression* lhs = evaluate(ba->lhs);
-    Expression* rhs = evaluate(ba->rhs);
-    int op = ba->op;
-    //Comparison operations easy because
-    //all constant Expressions support comparison,
-    //with semantics matching the language
-    switch(op)
-    {
-      //note: ordering operators are not implemented for all Expression subclasses,
-      //but they are implemented for all constant types where they're allowed in syntax
-      case CMPEQ:
-        return new BoolConstant(*lhs == *rhs);
-      case CMPNEQ:
-        return new BoolConstant(!(*lhs == *rhs));
-      case CMPL:
-        return new BoolConstant(*lhs < *rhs);
-      case CMPG:
-        return new BoolConstant(*rhs < *lhs);
-      case CMPLE:
-        return new BoolConstant(!(*rhs < *lhs));
-      case CMPGE:
-        return new BoolConstant(!(*lhs < *rhs));
-      default:;
-    }
-    if(op == PLUS)
-    {
-      //handle array concat, prepend and append operations (not numeric + yet)
-      CompoundLiteral* compoundLHS = dynamic_cast<CompoundLiteral*>(lhs);
-      CompoundLiteral* compoundRHS = dynamic_cast<CompoundLiteral*>(rhs);
-      if(compoundLHS && compoundRHS)
-      {
-        INTERNAL_ASSERT(compoundLHS->type == compoundRHS->type);
-        vector<Expression*> resultMembers(compoundLHS->members.size() + compoundRHS->members.size());
-        for(size_t i = 0; i < compoundLHS->members.size(); i++)
-          resultMembers[i] = compoundLHS->members[i];
-        for(size_t i = 0; i < compoundRHS->members.size(); i++)
-          resultMembers[i + compoundLHS->members.size()] = compoundRHS->members[i];
-        CompoundLiteral* result = new CompoundLiteral(resultMembers);
-        result->type = compoundLHS->type;
-        result->resolve();
-        return result;
-      }
-      else if(compoundLHS)
-      {
-        //array append
-        vector<Expression*> resultMembers = compoundLHS->members;
-        resultMembers.push_back(rhs);
-        CompoundLiteral* result = new CompoundLiteral(resultMembers);
-        result->type = compoundLHS->type;
-        result->resolve();
-        return result;
-      }
-      else if(compoundRHS)
-      {
-        //array prepend
-        vector<Expression*> resultMembers(1 + compoundRHS->members.size());
-        resultMembers[0] = lhs;
-        for(size_t i = 0; i < compoundRHS->members.size(); i++)
+        //rvalue "this" (evaluated before the args) is owned by the callee's frame
+        if(n <= numArgs)
         {
-          resultMembers[i + 1] = compoundRHS->members[i];
+          eval(n == 0 ? thisObject : call->args[n - 1]);
+          return;
         }
-        CompoundLiteral* result = new CompoundLiteral(resultMembers);
-        result->type = compoundRHS->type;
-        result->resolve();
-        return result;
-      }
-    }
-    //all other binary ops are numerical operations between two ints or two floats
-    FloatConstant* lhsFloat = dynamic_cast<FloatConstant*>(lhs);
-    FloatConstant* rhsFloat = dynamic_cast<FloatConstant*>(rhs);
-    IntConstant* lhsInt = dynamic_cast<IntConstant*>(lhs);
-    IntConstant* rhsInt = dynamic_cast<IntConstant*>(rhs);
-    bool useFloat = lhsFloat && rhsFloat;
-    bool useInt = lhsInt && rhsInt;
-    if(useFloat)
-      return lhsFloat->binOp(op, rhsFloat);
-    INTERNAL_ASSERT(useInt);
-    return lhsInt->binOp(op, rhsInt);
-  }
-  else if(auto cl = dynamic_cast<CompoundLiteral*>(e))
-  {
-    vector<Expression*> elems;
-    for(auto mem : cl->members)
-      elems.push_back(evaluate(mem));
-    return new CompoundLiteral(elems);
-  }
-  else if(auto ind = dynamic_cast<Indexed*>(e))
-  {
-    Expression* group = evaluate(ind->group);
-    Expression* index = evaluate(ind->index);
-    //arrays are represented as CompoundLiteral
-    auto compLit = dynamic_cast<CompoundLiteral*>(group);
-    if(compLit)
-    {
-      //an array, so index should be an integer
-      IntConstant* ic = dynamic_cast<IntConstant*>(index);
-      INTERNAL_ASSERT(ic);
-      unsigned ord = 0;
-      if(ic->isSigned())
+        vector<Value> args(operands.begin() + task.base + 1, operands.end());
+        frames.emplace();
+        frames.top().thisRval = std::move(operands[task.base]);
+        frames.top().thisPtr = &frames.top().thisRval;
+        operands.resize(task.base);
+        work.pop();
+        invoke(subr, args);
+        return;
+      }
+      //evaluate callable, then args in order
+      if(n <= numArgs)
       {
-        if(ic->sval < 0)
-          errMsgLoc(ind, "negative array index");
-        ord = ic->sval;
+        eval(n == 0 ? call->callable : call->args[n - 1]);
+        return;
       }
+      Value callable = operands[task.base];
+      INTERNAL_ASSERT(callable.tag == ValueTag::SUBR);
+      vector<Value> args(operands.begin() + task.base + 1, operands.end());
+      operands.resize(task.base);
+      work.pop();
+      if(auto subr = dynCast<Subroutine>(callable.subr))
+        startCall(subr, args);
       else
-        ord = ic->uval;
-      if(ord >= compLit->members.size())
-        errMsgLoc(ind, "array index " << ord << " out of bound " << compLit->members.size());
-      return compLit->members[ord];
-    }
-    else if(auto mc = dynamic_cast<MapConstant*>(group))
-    {
-      MapType* mapType = (MapType*) mc->type;
-      //if key (index) is not already in the map, insert it and default-initialize the value
-      if(mc->values.find(group) == mc->values.end())
-        mc->values[group] = mapType->value->getDefaultValue();
-      return mc->values[group];
-    }
-    INTERNAL_ERROR;
-  }
-  else if(auto call = dynamic_cast<CallExpr*>(e))
-  {
-    //evaluate callable, then args in order
-    auto callable = evaluate(call->callable);
-    vector<Expression*> args;
-    for(auto a : call->args)
-      args.push_back(evaluate(a));
-    //All "constant" callables must be SubroutineExpr
-    //SubroutineExpr is always non-assignable so fully evaluate it
-    auto subExpr = dynamic_cast<SubroutineExpr*>(callable);
-    auto structMem = dynamic_cast<StructMem*>(callable);
-    INTERNAL_ASSERT((subExpr == nullptr) != (structMem == nullptr));
-    Expression* retVal = nullptr;
-    if(subExpr)
-    {
-      auto subr = dynamic_cast<Subroutine*>(subExpr->subr);
-      auto exSubr = dynamic_cast<ExternalSubroutine*>(subExpr->subr);
-      if(subr)
-        retVal = callSubr(subr, args);
-      else
-        retVal = callExtern(exSubr, args);
+        operands.push_back(callExtern(dynCast<ExternalSubroutine>(callable.subr), args));
+      return;
     }
-    else if(structMem)
+    case NodeKind::StructMem:
     {
-      auto nonEvaluated = dynamic_cast<StructMem*>(call->callable);
-      Expression* thisObject = nonEvaluated->base;
-      Subroutine* subr = structMem->member.get<Subroutine*>();
-      if(thisObject->assignable())
-        retVal = callSubr(subr, args, (Expression*&) evaluateLValue(thisObject));
-      else
-        retVal = callSubr(subr, args, evaluate(thisObject));
-    }
-    else
-      INTERNAL_ERROR;
-    return retVal;
-  }
-  else if(auto sm = dynamic_cast<StructMem*>(e))
-  {
-    //All structs are represented as CompoundLiteral
-    CompoundLiteral* base = dynamic_cast<CompoundLiteral*>(evaluate(sm->base));
-    INTERNAL_ASSERT(base);
-    StructType* structType = dynamic_cast<StructType*>(base->type);
-    INTERNAL_ASSERT(structType);
-    auto& dataMems = structType->members;
-    if(sm->member.is<Variable*>())
-    {
-      for(size_t i = 0; i < dataMems.size(); i++)
+      StructMem* sm = (StructMem*) e;
+      if(!sm->member.is<Variable*>())
       {
-        if(dataMems[i] == sm->member.get<Variable*>())
-          return base->members[i];
+        errMsgLoc(sm, "Interpreter doesn't support member subroutines as values");
       }
-      INTERNAL_ERROR;
-    }
-    else
-    {
-      //Member subroutine - return a SubroutineExpr
-      StructMem* res = new StructMem(base, sm->member.get<Subroutine*>());
-      res->resolve();
-      return res;
-    }
-    INTERNAL_ERROR;
-    return nullptr;
-  }
-  else if(auto na = dynamic_cast<NewArray*>(e))
-  {
-    vector<uint64_t> dims;
-    for(auto d : na->dims)
-    {
-      IntConstant* ic = dynamic_cast<IntConstant*>(d);
-      INTERNAL_ASSERT(ic);
-      if(ic->isSigned())
-        dims.push_back(ic->sval);
-      else
-        dims.push_back(ic->uval);
+      if(n == 0)
+      {
+        eval(sm->base);
+        return;
+      }
+      Value base = popOperand();
+      done(asStruct(base)->mems[sm->index]);
+      return;
     }
-    Type* elem = ((ArrayType*) na->type)->elem;
-    return createArray(dims.data(), na->dims.size(), elem);
-  }
-  else if(auto al = dynamic_cast<ArrayLength*>(e))
-  {
-    //note: the type of this expression is always "long"
-    Expression* arr = evaluate(al->array);
-    auto compLit = dynamic_cast<CompoundLiteral*>(arr);
-    INTERNAL_ASSERT(compLit);
-    return new IntConstant((int64_t) compLit->members.size());
-  }
-  else if(auto ie = dynamic_cast<IsExpr*>(e))
-  {
-    UnionConstant* uc = dynamic_cast<UnionConstant*>(evaluate(ie->base));
-    INTERNAL_ASSERT(uc);
-    bool is = false;
-    for(Type* t : ie->subset)
+    case NodeKind::NewArray:
     {
-      if(typesSame(t, uc->value->type))
+      NewArray* na = (NewArray*) e;
+      //each dimension is checked as soon as it's evaluated
+      if(n)
+        checkDimension(na, operands.back());
+      if(n < na->dims.size())
       {
-        is = true;
-        break;
+        eval(na->dims[n]);
+        return;
       }
+      vector<uint64_t> dims;
+      for(size_t i = task.base; i < operands.size(); i++)
+        dims.push_back(operands[i].u);
+      operands.resize(task.base);
+      Type* elem = ((ArrayType*) canonicalize(na->type))->elem;
+      done(createArrayValue(dims.data(), na->dims.size(), elem));
+      return;
     }
-    return new BoolConstant(is);
-  }
-  else if(auto ae = dynamic_cast<AsExpr*>(e))
-  {
-    UnionConstant* uc = dynamic_cast<UnionConstant*>(evaluate(ae->base));
-    INTERNAL_ASSERT(uc);
-    bool valid = false;
-    for(Type* t : ae->subset)
+    case NodeKind::ArrayLength:
     {
-      if(typesSame(t, uc->value->type))
+      ArrayLength* al = (ArrayLength*) e;
+      if(n == 0)
       {
-        valid = true;
-        break;
+        eval(al->array);
+        return;
       }
+      done(lengthValue(popOperand()));
+      return;
     }
-    if(!valid)
+    case NodeKind::IsExpr:
     {
-      errMsgLoc(ae, "can't evaluate 'as' because value's type " <<
-          uc->value->type->getName() << " is not in union");
+      IsExpr* ie = (IsExpr*) e;
+      if(n == 0)
+      {
+        eval(ie->base);
+        return;
+      }
+      Value base = popOperand();
+      done(boolValue(ie->optionMap[asUnion(base)->option] >= 0));
+      return;
     }
-    UnionType* destUnion = dynamic_cast<UnionType*>(ae->destType);
-    if(destUnion)
+    case NodeKind::AsExpr:
     {
-      return new UnionConstant(uc->value, destUnion);
+      AsExpr* ae = (AsExpr*) e;
+      if(n == 0)
+      {
+        eval(ae->base);
+        return;
+      }
+      Value base = popOperand();
+      done(narrowUnion(asUnion(base), ae));
+      return;
     }
-    else
+    case NodeKind::Converted:
     {
-      return uc->value;
+      Converted* conv = (Converted*) e;
+      if(n == 0)
+      {
+        eval(conv->value);
+        return;
+      }
+      done(convertValue(popOperand(), conv->value->type, conv->type, conv));
+      return;
     }
-  }
-  else if(dynamic_cast<ThisExpr*>(e))
-  {
-    return frames.top().getThis();
-  }
-  else if(auto conv = dynamic_cast<Converted*>(e))
-  {
-    return convertConstant(evaluate(conv->value), conv->type);
+    default:;
   }
   INTERNAL_ERROR;
-  return nullptr;
 }
 
-Expression*& Interpreter::evaluateLValue(Expression* e)
+Value& Interpreter::lvalueAt(Expression* e, size_t pos)
 {
-  if(auto v = dynamic_cast<VarExpr*>(e))
-  {
-    return readVar(v->var);
-  }
-  else if(auto sm = dynamic_cast<StructMem*>(e))
+  switch(e->kind)
   {
-    //the sm's base must be an lvalue, and from that
-    //the member can be accessed
-    Expression*& baseLval = evaluateLValue(sm->base);
-    INTERNAL_ASSERT(typesSame(baseLval->type, sm->base->type));
-    StructType* structType = dynamic_cast<StructType*>(sm->base->type);
-    INTERNAL_ASSERT(structType);
-    CompoundLiteral* compoundBase = dynamic_cast<CompoundLiteral*>(baseLval);
-    INTERNAL_ASSERT(compoundBase);
-    auto& dataMems = structType->members;
-    //Only variable members are mutable!
-    //Subroutine members are immutable parts of a struct type's interface.
-    INTERNAL_ASSERT(sm->member.is<Variable*>());
-    for(size_t i = 0; i < dataMems.size(); i++)
+    case NodeKind::VarExpr:
     {
-      if(dataMems[i] == sm->member.get<Variable*>())
-      {
-        return compoundBase->members[i];
-      }
+      VarExpr* v = (VarExpr*) e;
+      return readVar(v->var);
     }
-    INTERNAL_ERROR;
-  }
-  else if(auto ind = dynamic_cast<Indexed*>(e))
-  {
-    Expression*& group = evaluateLValue(ind->group);
-    Expression* index = evaluate(ind->index);
-    //arrays are represented as CompoundLiteral
-    auto cl = dynamic_cast<CompoundLiteral*>(group);
-    if(cl)
+    case NodeKind::StructMem:
     {
-      //an array, so index should be an integer
-      IntConstant* ic = dynamic_cast<IntConstant*>(index);
-      INTERNAL_ASSERT(ic);
-      unsigned ord = 0;
-      if(ic->isSigned())
+      StructMem* sm = (StructMem*) e;
+      //lvalues are only evaluated to be modified,
+      //so each level must be made unique
+      Value& base = lvalueAt(sm->base, pos);
+      makeUnique(base);
+      //Only variable members are mutable!
+      //Subroutine members are immutable parts of a struct type's interface.
+      INTERNAL_ASSERT(sm->member.is<Variable*>());
+      return asStruct(base)->mems[sm->index];
+    }
+    case NodeKind::Indexed:
+    {
+      Indexed* ind = (Indexed*) e;
+      //(a copy: resolving the group may initialize a global,
+      //which can move operands)
+      Type* groupType = canonicalize(ind->group->type);
+      Value index;
+      if(!groupType->isTuple())
+        index = operands[pos++];
+      Value& group = lvalueAt(ind->group, pos);
+      makeUnique(group);
+      if(groupType->isTuple())
+        return asStruct(group)->mems[tupleIndex(ind)];
+      if(auto mt = dynCast<MapType>(groupType))
       {
-        if(ic->sval < 0)
-          errMsgLoc(ind, "negative array index");
-        ord = ic->sval;
+        auto& table = asMap(group)->table;
+        //if key (index) is not already in the map, insert it and default-initialize the value
+        Value* val = table.find(index);
+        if(!val)
+        {
+          val = &table[index];
+          *val = defaultValue(mt->value);
+        }
+        return *val;
       }
-      else
-        ord = ic->uval;
-      if(ord >= cl->members.size())
-        errMsgLoc(ind, "array index " << ord << " out of bounds [0, " << cl->members.size() << ")");
-      return cl->members[ord];
+      //an array, so index should be an integer
+      ArrayObject* arr = asArray(group);
+      //(elements of flat arrays are only assigned, through assignLValue)
+      INTERNAL_ASSERT(!arr->isFlat());
+      return arr->elem(arrayIndex(index, arr->size(), ind));
     }
-    else if(auto mc = dynamic_cast<MapConstant*>(group))
+    case NodeKind::ThisExpr:
     {
-      MapType* mapType = (MapType*) mc->type;
-      //if key (index) is not already in the map, insert it and default-initialize the value
-      if(mc->values.find(group) == mc->values.end())
-        mc->values[group] = mapType->value->getDefaultValue();
-      return mc->values[group];
+      return frames.top().getThis();
     }
-    INTERNAL_ERROR;
-  }
-  else if(dynamic_cast<ThisExpr*>(e))
-  {
-    return frames.top().getThis();
+    default:;
   }
   cout << "Couldn't evaluate lvalue " << e << '\n';
   INTERNAL_ERROR;
+  return rv;
 }
 
-void Interpreter::assignVar(Variable* v, Expression* e)
+void Interpreter::assignFrom(Assign* assign, Expression* lvalue, size_t i, size_t base)
 {
-  //Type must be identical - if not, the RHS (e) would have
-  //been wrapped in a Convert
-  INTERNAL_ASSERT(typesSame(e->type, v->type));
-  if(!e->constant())
-    e = evaluate(e);
-  INTERNAL_ASSERT(typesSame(e->type, v->type));
-  //Only have to search in top stack frame, and globals
-  if(globals.find(v) != globals.end())
+  size_t pos = base + 1;
+  //(a copy: resolving the lvalue may initialize a global, which can move operands)
+  Value rvalue = operands[base];
+  if(lvalue != assign->lvalue)
   {
-    globals[v] = e;
+    //rvalue (fully evaluated) should also be a struct/tuple.
+    //Do the assignment one element at a time
+    auto& rhsMembers = asStruct(rvalue)->mems;
+    INTERNAL_ASSERT(((CompoundLiteral*) assign->lvalue)->members.size() == rhsMembers.size());
+    assignLValue(lvalue, rhsMembers[i], pos);
   }
-  else
+  else if(auto varExpr = dynCast<VarExpr>(lvalue))
   {
-    //a reference to local must be in the current frame
-    frames.top().locals[v] = e;
+    assignVar(varExpr->var, rvalue);
   }
-}
-
-Expression*& Interpreter::readVar(Variable* v)
-{
-  if(v->isGlobal())
+  else
   {
-    if(globals.find(v) == globals.end())
+    auto ind = dynCast<Indexed>(lvalue);
+    if(ind && canonicalize(ind->group->type)->isMap())
     {
-      //lazily add new global to the global table.
-      globals[v] = evaluate(v->initial);
+      //The value assigned to a map key is a maybe:
+      //assigning void removes the key
+      Value key = operands[pos];
+      Value& map = lvalueAt(ind->group, pos + 1);
+      makeUnique(map);
+      auto& table = asMap(map)->table;
+      UnionObject* u = asUnion(rvalue);
+      if(((UnionType*) canonicalize(ind->type))->options[u->option]->isSimple())
+        table.erase(key);
+      else
+        table[key] = u->v;
     }
-    return globals[v];
+    else
+      assignLValue(lvalue, rvalue, pos);
   }
-  if(frames.top().locals.find(v) == frames.top().locals.end())
+  operands.resize(pos);
+}
+
+Value& Interpreter::evaluateLValue(Expression* e)
+{
+  size_t pos = operands.size();
+  for(size_t n = 0; Expression* operand = lvalueOperand(e, n); n++)
+    operands.push_back(evaluateNow(operand));
+  Value& lvalue = lvalueAt(e, pos);
+  operands.resize(pos);
+  return lvalue;
+}
+
+void Interpreter::assignLValue(Expression* lvalue, const Value& val, size_t pos)
+{
+  auto ind = dynCast<Indexed>(lvalue);
+  if(ind && canonicalize(ind->group->type)->isArray())
   {
-    errMsg("Variable " << v->name << " was used before initialization/declaration.\n");
+    //array elements may be in a flat buffer, so
+    //they can't be assigned through a reference
+    Value index = operands[pos];
+    Value& group = lvalueAt(ind->group, pos + 1);
+    makeUnique(group);
+    ArrayObject* arr = asArray(group);
+    arr->set(arrayIndex(index, arr->size(), ind), val);
   }
-  return frames.top().locals[v];
+  else
+    lvalueAt(lvalue, pos) = val;
 }
 
-Expression* Interpreter::invoke(Subroutine* subr, vector<Expression*>& args)
+void Interpreter::assignVar(Variable* v, const Value& val)
 {
-  returning = false;
-  rv = nullptr;
-  //push stack frame
-  if(args.size() != subr->type->paramTypes.size())
+  INTERNAL_ASSERT(v->slot >= 0);
+  //Only have to search in top stack frame, and globals
+  if(v->isGlobal())
   {
-    errMsg("Call to " << subr->decl->name << " expects " << \
-        subr->type->paramTypes.size() << " args, but got " << args.size() << ".");
+    globals[v->slot] = val;
   }
-  //assign args to corresponding local variables
-  for(size_t i = 0; i < args.size(); i++)
+  else
   {
-    assignVar(subr->params[i], args[i]);
+    //a reference to local must be in the current frame
+    frames.top().locals[v->slot] = val;
   }
-  //Execute statements in linear sequence.
-  //If a return is encountered, execute() returns and
-  //the return value will be placed in the frame rv
-  for(auto s : subr->body->stmts)
+}
+
+Value& Interpreter::readVar(Variable* v)
+{
+  INTERNAL_ASSERT(v->slot >= 0);
+  if(v->isGlobal())
   {
-    execute(s);
-    if(returning)
+    Value& g = globals[v->slot];
+    if(g.tag == ValueTag::NONE)
     {
-      returning = false;
-      break;
+      //lazily initialize global (running its initializer
+      //to completion, above whatever task needs it)
+      Value init = evaluate(v->initial);
+      g = init;
     }
+    return g;
   }
-  frames.pop();
-  if(!rv && !subr->type->returnType->isSimple())
+  Value& local = frames.top().locals[v->slot];
+  if(local.tag == ValueTag::NONE)
   {
-    errMsgLoc(subr, "interpreter reached end of subroutine without a return value");
+    errMsg("Variable " << v->name << " was used before initialization/declaration.\n");
   }
-  return rv;
+  return local;
 }
-
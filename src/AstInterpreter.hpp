@@ -5,67 +5,179 @@
 #include "TypeSystem.hpp"
 #include "Expression.hpp"
 #include "Subroutine.hpp"
+#include "Value.hpp"
+
+struct Profiler;
+struct Memoizer;
+struct MemoTable;
+struct Jit;
 
 struct StackFrame
 {
   StackFrame()
   {
-    thisExprLval = nullptr;
-    thisExprRval = nullptr;
-  }
-  StackFrame(Expression*&& e)
-  {
-    thisExprLval = nullptr;
-    thisExprRval = e;
+    locals = nullptr;
+    thisPtr = nullptr;
+    subr = nullptr;
+    memoTable = nullptr;
   }
-  StackFrame(Expression*& e)
+  //"this" for a method call: either an lvalue owned
+  //by the caller, or thisRval (a temporary owned by the frame)
+  StackFrame(Value* t)
   {
-    thisExprLval = &e;
-    thisExprRval = nullptr;
+    locals = nullptr;
+    thisPtr = t;
+    subr = nullptr;
+    memoTable = nullptr;
   }
-  Expression*& getThis()
+  Value& getThis()
   {
-    if(thisExprLval)
-      return *thisExprLval;
-    else if(!thisExprRval)
+    if(!thisPtr)
       INTERNAL_ERROR;
-    return thisExprRval;
+    return *thisPtr;
   }
-  //Local variables are lazily added
-  //to this when initialized.
-  map<Variable*, Expression*> locals;
-  Expression** thisExprLval;
-  Expression* thisExprRval;
+  //Frame slots (indexed by Variable::slot) in Interpreter::slots.
+  //Slots are uninitialized (ValueTag::NONE) until assigned.
+  Value* locals;
+  Value* thisPtr;
+  Value thisRval;
+  //subroutine running in the frame (null for a block run by runBlock)
+  Subroutine* subr;
+  //For a memoized call, the table that gets the result, and the args
+  MemoTable* memoTable;
+  vector<Value> memoArgs;
+};
+
+//A statement or expression being run. A task is resumed each time one of
+//its children finishes, and step records how far it has gotten.
+//A task with a null node returns from the call in frames.top(): it's
+//under the callee's body, so it runs once the body is done.
+struct Task
+{
+  Task(Node* n, size_t b) : node(n), step(0), index(0), base(b) {}
+  Node* node;
+  int step;
+  //position in a list of children (statements, cases, ...)
+  size_t index;
+  //Interpreter::operands.size() when the task started: the task's own
+  //operands are above this, and an expression leaves its value there
+  size_t base;
 };
 
 struct Interpreter
 {
-  //Interpreter needs to start at entry point subr
-  Interpreter(Subroutine* subr, vector<Expression*> args);
-  //thisExpr is a reference, not a value!
+  //Interpreter needs to start at entry point subr.
+  //stackSize is the memory budget (in bytes) for the call stack: it limits
+  //the frames of all active calls, with their slots and pending work.
+  //If profiler isn't null, the run is profiled.
+  //If memo isn't null, calls to pure funcs are memoized.
+  //If jit isn't null, hot subroutines are compiled to native code.
+  Interpreter(Subroutine* subr, vector<Expression*> args, size_t stackSize, Profiler* profiler, Memoizer* memo, Jit* jit);
+  //Set up an interpreter to run standalone blocks (tests and benchmarks)
+  //with runBlock, printing to out
+  Interpreter(size_t stackSize, OutputBuffer& out, Memoizer* memo);
+  ~Interpreter();
+  //Run a block outside of any subroutine, with numLocals slots for its locals.
+  //Globals keep their values from one run to the next.
+  void runBlock(Block* b, int numLocals);
+  //Make room for globals declared since the interpreter was set up
+  //(the REPL declares more between runs)
+  void addGlobals();
+  //After an error was caught during a run, discard the frames that were
+  //active so that the interpreter can run again (globals are kept)
+  void recover();
+  //thisPtr is a reference, not a value!
   //Any modifications to it through a method apply to the original, not a copy.
-  Expression* callSubr(Subroutine* subr, vector<Expression*> args);
-  Expression* callSubr(Subroutine* subr, vector<Expression*> args, Expression*& thisExpr);
-  Expression* callSubr(Subroutine* subr, vector<Expression*> args, Expression*&& thisExpr);
-  Expression* callExtern(ExternalSubroutine* exSubr, vector<Expression*> args);
-  void execute(Statement* stmt);
-  Expression* evaluate(Expression* e);
-  Expression*& evaluateLValue(Expression* e);
-  static CompoundLiteral* createArray(uint64_t* dims, int ndims, Type* elem);
-  static Expression* convertConstant(Expression* value, Type* type);
-  void assignVar(Variable* v, Expression* e);
-  Expression*& readVar(Variable* v);
-  //frames.back is the top of the call stack
+  Value callSubr(Subroutine* subr, vector<Value>& args, Value* thisPtr = nullptr);
+  Value callExtern(ExternalSubroutine* exSubr, vector<Value>& args);
+  //Evaluate e (running any calls it makes) and return its value
+  Value evaluate(Expression* e);
+  void assignVar(Variable* v, const Value& val);
+  Value& readVar(Variable* v);
+  //frames.top is the top of the call stack
   stack<StackFrame> frames;
-  map<Variable*, Expression*> globals;
+  //Statements and expressions in progress, in all frames. A call doesn't
+  //recurse natively: it pushes a frame and the callee's body, and returns
+  //to the loop in run (which resumes the caller once the callee is done).
+  //(a deque, so a task stays in place while others are pushed above it)
+  stack<Task> work;
+  //values computed by the tasks in work, which their parents haven't used yet
+  vector<Value> operands;
+  //Storage for the locals of all frames, as one contiguous buffer.
+  //It's allocated once for the whole budget (never moved, so that references
+  //to locals stay valid) but only the pages actually used are committed.
+  Value* slots;
+  //first slot not used by any frame
+  size_t slotsUsed;
+  //bytes that frames, slots, work and operands may use in total
+  size_t stackBudget;
+  //Pending tail call (see Return in stepStatement): when the current
+  //subroutine returns, its frame is reused to call tailCallee(tailArgs)
+  Subroutine* tailCallee;
+  vector<Value> tailArgs;
+  //indexed by Variable::slot, and lazily initialized
+  vector<Value> globals;
   //Is the topmost function returning?
   bool returning;
   bool breaking;
   bool continuing;
   //The return value for the current function
-  Expression* rv;
+  Value rv;
+  Profiler* profiler;
+  Memoizer* memo;
+  Jit* jit;
+  //where print statements go
+  OutputBuffer* out;
 private:
-  Expression* invoke(Subroutine* subr, vector<Expression*>& args);
+  //Set up an empty stack (common to both constructors)
+  void init(size_t stackSize);
+  //Run tasks until work is back down to depth
+  void run(size_t depth);
+  //Start a statement or expression (as a task above the current one).
+  //One that can't make calls is run right away instead (see
+  //Expression::mayCall), as are simple statements that can't.
+  //exec returns true if s already finished (so a loop can go on).
+  bool exec(Statement* s);
+  void eval(Expression* e);
+  //Run s right away (returning true) if it's simple and can't make calls.
+  //A block or branch is started right away (running its statements up to
+  //the first one that becomes a task).
+  bool executeNow(Statement* s);
+  //Run block's statements from start
+  void execBlock(Block* block, size_t start);
+  //Evaluate an expression that can't make calls (see Expression::mayCall)
+  Value evaluateNow(Expression* e);
+  Value& evaluateLValue(Expression* e);
+  //Finish the expression on top of work, with value v
+  void done(Value v);
+  Value popOperand();
+  //Resume the statement or expression task, after its last child finished
+  void stepStatement(Task& task);
+  void stepExpression(Task& task);
+  //Start a call of subr, leaving its result on operands once it returns
+  void startCall(Subroutine* subr, vector<Value>& args, Value* thisPtr = nullptr);
+  //Start running subr in frames.top()
+  void invoke(Subroutine* subr, vector<Value>& args);
+  //Set up frames.top() to run subr's body (again for each tail call)
+  void enterBody(Subroutine* subr, vector<Value>& args);
+  //The body of the call in frames.top() is done: start its tail call,
+  //or pop the frame and pass the result to the caller
+  void finishCall();
+  //Resume a counter loop (after its counter is initialized, at step
+  //countLoopStep). increment is the loop's general increment statement, if any.
+  void stepCountLoop(Task& task, For* loop, CounterLoop* cl, Statement* increment);
+  //After a loop's body ran: is the loop done? (a break or continue is consumed)
+  bool loopDone();
+  //Append or prepend the operand to a local array in place
+  void updateArray(ArrayUpdate* au);
+  //Lvalues are resolved once the values they depend on (see lvalueOperand)
+  //are on operands, starting at pos
+  Value& lvalueAt(Expression* e, size_t pos);
+  void assignLValue(Expression* lvalue, const Value& val, size_t pos);
+  //Assign the rvalue at operands[base] to lvalue: assign's lvalue, or member
+  //i of it if it's compound. What lvalue depends on is above the rvalue,
+  //and is popped (the rvalue isn't).
+  void assignFrom(Assign* assign, Expression* lvalue, size_t i, size_t base);
 };
 
 #endif
@@ -0,0 +1,137 @@
+#include "BenchRunner.hpp"
+#include "Subroutine.hpp"
+#include "AstInterpreter.hpp"
+#include <chrono>
+#include <cmath>
+
+//Seconds to run each benchmark before timing it
+const double warmupTime = 0.1;
+//Seconds that one sample must take, at least
+const double minSampleTime = 0.01;
+const int numSamples = 20;
+
+struct BenchResult
+{
+  uint64_t runsPerSample;
+  //nanoseconds per run
+  double mean;
+  double median;
+  double stddev;
+  double min;
+  double max;
+};
+
+//Run b n times, returning the elapsed seconds
+static double timeRuns(Interpreter& interp, Benchmark* b, uint64_t n, OutputBuffer& out)
+{
+  auto start = std::chrono::steady_clock::now();
+  for(uint64_t i = 0; i < n; i++)
+    interp.runBlock(b->run, b->numLocals);
+  auto end = std::chrono::steady_clock::now();
+  out.clear();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+static BenchResult runBenchmark(Benchmark* b, size_t stackSize)
+{
+  OutputBuffer out(true);
+  Interpreter interp(stackSize, out, nullptr);
+  double warmed = 0;
+  while(warmed < warmupTime)
+    warmed += timeRuns(interp, b, 1, out);
+  BenchResult r;
+  r.runsPerSample = 1;
+  while(timeRuns(interp, b, r.runsPerSample, out) < minSampleTime)
+    r.runsPerSample *= 2;
+  vector<double> times;
+  for(int i = 0; i < numSamples; i++)
+    times.push_back(timeRuns(interp, b, r.runsPerSample, out) * 1e9 / r.runsPerSample);
+  std::sort(times.begin(), times.end());
+  double sum = 0;
+  for(double t : times)
+    sum += t;
+  r.mean = sum / numSamples;
+  r.median = (times[(numSamples - 1) / 2] + times[numSamples / 2]) / 2;
+  double squares = 0;
+  for(double t : times)
+    squares += (t - r.mean) * (t - r.mean);
+  r.stddev = sqrt(squares / (numSamples - 1));
+  r.min = times.front();
+  r.max = times.back();
+  return r;
+}
+
+//s as a JSON string literal
+static string jsonString(const string& s)
+{
+  string quoted = "\"";
+  for(char c : s)
+  {
+    if(c == '"' || c == '\\')
+    {
+      quoted += '\\';
+      quoted += c;
+    }
+    else if((unsigned char) c < 0x20)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      quoted += esc;
+    }
+    else
+      quoted += c;
+  }
+  return quoted + '"';
+}
+
+//s as a CSV field (quoted only if it needs to be)
+static string csvField(const string& s)
+{
+  if(s.find_first_of(",\"\n") == string::npos)
+    return s;
+  string quoted = "\"";
+  for(char c : s)
+  {
+    if(c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+void runBenchmarks(const string& format, size_t stackSize)
+{
+  bool json = format == "json";
+  if(json)
+    cout << "[";
+  else
+    cout << "name,file,line,runs_per_sample,samples,mean_ns,median_ns,stddev_ns,min_ns,max_ns\n";
+  char stats[256];
+  for(size_t i = 0; i < Benchmark::benchmarks.size(); i++)
+  {
+    Benchmark* b = Benchmark::benchmarks[i];
+    BenchResult r = runBenchmark(b, stackSize);
+    string file = getSourceName(b->fileID);
+    if(json)
+    {
+      snprintf(stats, sizeof(stats),
+          "\"mean_ns\": %.1f, \"median_ns\": %.1f, \"stddev_ns\": %.1f, \"min_ns\": %.1f, \"max_ns\": %.1f",
+          r.mean, r.median, r.stddev, r.min, r.max);
+      cout << (i ? ",\n  " : "\n  ") << "{\"name\": " << jsonString(b->name) <<
+        ", \"file\": " << jsonString(file) << ", \"line\": " << b->line <<
+        ", \"runs_per_sample\": " << r.runsPerSample << ", \"samples\": " << numSamples <<
+        ", " << stats << '}';
+    }
+    else
+    {
+      snprintf(stats, sizeof(stats), "%.1f,%.1f,%.1f,%.1f,%.1f", r.mean, r.median, r.stddev, r.min, r.max);
+      cout << csvField(b->name) << ',' << csvField(file) << ',' << b->line << ',' <<
+        r.runsPerSample << ',' << numSamples << ',' << stats << '\n';
+    }
+    //results come out as each benchmark finishes
+    cout.flush();
+  }
+  if(json)
+    cout << "\n]\n";
+}
+
@@ -0,0 +1,26 @@
+#ifndef BENCH_RUNNER_H
+#define BENCH_RUNNER_H
+
+#include "Common.hpp"
+
+/*****************************************************************************/
+// BenchRunner: times the program's benchmark blocks (--bench <format>)
+//
+//   benchmark "name" { ... }
+//
+// Each benchmark gets its own Interpreter, so globals keep their values from
+// one run of a benchmark to the next, but not between benchmarks. A benchmark
+// is first run for a while to warm up. Then the number of runs per sample is
+// calibrated (doubling it until a sample is long enough to time accurately)
+// and a fixed number of samples are taken.
+//
+// The time of one run is reported as the mean, median, standard deviation,
+// min and max over the samples, in nanoseconds, as CSV or JSON on stdout.
+// Anything the benchmarks print is discarded, so it can't mix with results.
+/*****************************************************************************/
+
+//Run every Benchmark, printing results in format ("csv" or "json")
+void runBenchmarks(const string& format, size_t stackSize);
+
+#endif
+
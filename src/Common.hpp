@@ -66,10 +66,13 @@ bool runCommand(string command, bool silenced = false);
 
 string getSourceName(int id);
 
-#define errMsg(msg) {ostringstream oss_; oss_ << "Error: " << msg; errAndQuit(oss_.str());}
+//The message is formatted inside a lambda so that its stream doesn't
+//take up space in the frame of every function that can report an error
+//(this matters for the interpreter, which recurses once per Onyx call)
+#define errMsg(msg) {[&]() {ostringstream oss_; oss_ << "Error: " << msg; errAndQuit(oss_.str());}();}
 
 #define errMsgLocManual(fileID, line, col, msg) \
-{ostringstream oss_; oss_ << "Error in " << getSourceName(fileID) << ", " << line << "." << col << ":\n" << msg; errAndQuit(oss_.str());}
+{[&]() {ostringstream oss_; oss_ << "Error in " << getSourceName(fileID) << ", " << line << "." << col << ":\n" << msg; errAndQuit(oss_.str());}();}
 
 #define errMsgLoc(node, msg) errMsgLocManual(node->fileID, node->line, node->col, msg)
 
@@ -0,0 +1,513 @@
+#include "ConstantFold.hpp"
+#include "Value.hpp"
+#include <limits>
+
+using std::numeric_limits;
+
+//Run a constant operation that reports errors like the interpreter does
+//(IntConstant::convert, IntConstant::binOp, ...). If it fails, return null
+//instead of quitting, and the expression is left for runtime.
+template<typename F>
+static Expression* tryFold(F op)
+{
+  bool wasCatching = catchErrors;
+  catchErrors = true;
+  Expression* result = nullptr;
+  try
+  {
+    result = op();
+  }
+  catch(CaughtError&)
+  {}
+  catchErrors = wasCatching;
+  return result;
+}
+
+//Give a newly folded expression the location of the one it replaces
+static Expression* located(Expression* folded, Node* loc)
+{
+  if(folded)
+    folded->setLocation(loc);
+  return folded;
+}
+
+//Constants that constantValue gives a scalar Value
+static bool scalarConstant(Expression* e)
+{
+  return isa<IntConstant>(e) || isa<FloatConstant>(e) ||
+    isa<BoolConstant>(e) || isa<EnumExpr>(e);
+}
+
+static Expression* foldConverted(Converted* conv);
+
+//Can e be removed without removing a side effect or error?
+static bool canDrop(Expression* e)
+{
+  if(auto cl = dynCast<CompoundLiteral>(e))
+  {
+    for(auto mem : cl->members)
+    {
+      if(!canDrop(mem))
+        return false;
+    }
+    return true;
+  }
+  //(reading a variable isn't droppable: it fails if the variable
+  //is used before it's initialized)
+  return e->constant() || isa<ThisExpr>(e);
+}
+
+//Is e the number n (an integer or floating-point constant)?
+static bool hasValue(Expression* e, int n)
+{
+  if(auto ic = dynCast<IntConstant>(e))
+    return ic->isSigned() ? ic->sval == n : ic->uval == (uint64_t) n;
+  if(auto fc = dynCast<FloatConstant>(e))
+    return fc->isDoublePrec() ? fc->dp == n : fc->fp == n;
+  return false;
+}
+
+static Expression* foldUnary(UnaryArith* ua)
+{
+  Expression* operand = ua->expr;
+  if(ua->op == LNOT)
+  {
+    if(auto bc = dynCast<BoolConstant>(operand))
+      return located(new BoolConstant(!bc->value), ua);
+    //!!b is b
+    auto inner = dynCast<UnaryArith>(operand);
+    if(inner && inner->op == LNOT)
+      return inner->expr;
+  }
+  else if(auto ic = dynCast<IntConstant>(operand))
+  {
+    //computed like unaryOp, but only folded if the result fits the type
+    uint64_t val = ic->isSigned() ? (uint64_t) ic->sval : ic->uval;
+    IntConstant* result = new IntConstant(ua->op == SUB ? -val : ~val, ic->type);
+    if(result->checkValueFits())
+      return located(result, ua);
+  }
+  else if(auto fc = dynCast<FloatConstant>(operand))
+  {
+    if(ua->op == SUB)
+    {
+      if(fc->isDoublePrec())
+        return located(new FloatConstant(-fc->dp), ua);
+      return located(new FloatConstant(-fc->fp), ua);
+    }
+  }
+  return nullptr;
+}
+
+static Expression* foldIntOp(BinaryArith* ba, IntConstant* lhs, IntConstant* rhs)
+{
+  int op = ba->op;
+  if(op == SHL || op == SHR)
+  {
+    //shifting by 64 or more bits (or a negative number) is left for runtime
+    uint64_t bits = rhs->isSigned() ? (uint64_t) rhs->sval : rhs->uval;
+    if(bits >= 64)
+      return nullptr;
+  }
+  if((op == DIV || op == MOD) && lhs->isSigned() &&
+      lhs->sval == numeric_limits<int64_t>::min() && rhs->sval == -1)
+  {
+    //the quotient overflows even 64 bits
+    return nullptr;
+  }
+  return located(tryFold([&] {return (Expression*) lhs->binOp(op, rhs);}), ba);
+}
+
+//An operation with an operand that leaves the other unchanged
+static Expression* foldIdentity(BinaryArith* ba, bool isFloat)
+{
+  Expression* lhs = ba->lhs;
+  Expression* rhs = ba->rhs;
+  switch(ba->op)
+  {
+    case PLUS:
+      //-0.0 + 0.0 is 0.0, so x + 0.0 isn't always x
+      if(isFloat)
+        break;
+      if(hasValue(rhs, 0))
+        return lhs;
+      if(hasValue(lhs, 0))
+        return rhs;
+      break;
+    case BOR:
+    case BXOR:
+      if(hasValue(rhs, 0))
+        return lhs;
+      if(hasValue(lhs, 0))
+        return rhs;
+      break;
+    case SUB:
+    case SHL:
+    case SHR:
+      if(hasValue(rhs, 0))
+        return lhs;
+      break;
+    case MUL:
+      if(hasValue(rhs, 1))
+        return lhs;
+      if(hasValue(lhs, 1))
+        return rhs;
+      break;
+    case DIV:
+      if(hasValue(rhs, 1))
+        return lhs;
+      break;
+    default:;
+  }
+  return nullptr;
+}
+
+static Expression* foldBinary(BinaryArith* ba)
+{
+  Expression* lhs = ba->lhs;
+  Expression* rhs = ba->rhs;
+  int op = ba->op;
+  switch(op)
+  {
+    case LAND:
+    case LOR:
+    {
+      bool isAnd = op == LAND;
+      //"true && r" is r, "false && r" is false (and the reverse for ||)
+      if(auto lb = dynCast<BoolConstant>(lhs))
+        return lb->value == isAnd ? rhs : lhs;
+      //"l && true" is l, and "l && false" is false if l can be dropped
+      if(auto rb = dynCast<BoolConstant>(rhs))
+      {
+        if(rb->value == isAnd)
+          return lhs;
+        if(canDrop(lhs))
+          return rhs;
+      }
+      return nullptr;
+    }
+    case CMPEQ:
+    case CMPNEQ:
+    case CMPL:
+    case CMPLE:
+    case CMPG:
+    case CMPGE:
+    {
+      if(!scalarConstant(lhs) || !scalarConstant(rhs))
+        return nullptr;
+      //compare exactly as the interpreter would
+      Value l = constantValue(lhs);
+      Value r = constantValue(rhs);
+      bool result = false;
+      switch(op)
+      {
+        case CMPEQ:
+          result = valuesEqual(l, r);
+          break;
+        case CMPNEQ:
+          result = !valuesEqual(l, r);
+          break;
+        case CMPL:
+          result = valueLess(l, r);
+          break;
+        case CMPLE:
+          result = !valueLess(r, l);
+          break;
+        case CMPG:
+          result = valueLess(r, l);
+          break;
+        default:
+          result = !valueLess(l, r);
+      }
+      return located(new BoolConstant(result), ba);
+    }
+    default:;
+  }
+  //array concatenation, append and prepend aren't folded
+  Type* t = canonicalize(ba->type);
+  bool isFloat = isa<FloatType>(t);
+  if(!isFloat && !isa<IntegerType>(t) && !isa<CharType>(t))
+    return nullptr;
+  auto li = dynCast<IntConstant>(lhs);
+  auto ri = dynCast<IntConstant>(rhs);
+  if(li && ri)
+    return foldIntOp(ba, li, ri);
+  auto lf = dynCast<FloatConstant>(lhs);
+  auto rf = dynCast<FloatConstant>(rhs);
+  if(lf && rf && (op == PLUS || op == SUB || op == MUL || op == DIV))
+    return located(tryFold([&] {return (Expression*) lf->binOp(op, rf);}), ba);
+  return foldIdentity(ba, isFloat);
+}
+
+static Expression* foldConverted(Converted* conv)
+{
+  Type* dst = canonicalize(conv->type);
+  auto at = dynCast<ArrayType>(dst);
+  auto cl = dynCast<CompoundLiteral>(conv->value);
+  if(at && cl)
+  {
+    //a literal of scalar constants becomes an array literal,
+    //if every member can be converted to the element type
+    vector<Expression*> mems;
+    for(auto mem : cl->members)
+    {
+      if(!scalarConstant(mem))
+        return nullptr;
+      if(!typesSame(mem->type, at->subtype))
+      {
+        mem = foldConverted(new Converted(mem, at->subtype));
+        if(!mem)
+          return nullptr;
+      }
+      mems.push_back(mem);
+    }
+    auto folded = new CompoundLiteral(mems, conv->type);
+    folded->lvalue = false;
+    return located(folded, conv);
+  }
+  if(!isa<IntegerType>(dst) && !isa<CharType>(dst) &&
+      !isa<FloatType>(dst) && !isa<EnumType>(dst))
+  {
+    return nullptr;
+  }
+  Expression* value = conv->value;
+  if(auto ee = dynCast<EnumExpr>(value))
+  {
+    //an enum converts the same as its underlying value
+    if(ee->value->isSigned)
+      value = new IntConstant((int64_t) ee->value->value);
+    else
+      value = new IntConstant(ee->value->value);
+    value->setLocation(conv);
+  }
+  if(auto ic = dynCast<IntConstant>(value))
+    return located(tryFold([&] {return ic->convert(dst);}), conv);
+  if(auto fc = dynCast<FloatConstant>(value))
+    return located(tryFold([&] {return fc->convert(dst);}), conv);
+  return nullptr;
+}
+
+static Expression* foldArrayLength(ArrayLength* al)
+{
+  auto cl = dynCast<CompoundLiteral>(al->array);
+  if(!cl || !canonicalize(cl->type)->isArray() || !canDrop(cl))
+    return nullptr;
+  return located(new IntConstant((int64_t) cl->members.size()), al);
+}
+
+//Fold the subexpressions of e (in place)
+static void foldSubexprs(Expression* e)
+{
+  switch(e->kind)
+  {
+    case NodeKind::UnaryArith:
+      foldExpr(((UnaryArith*) e)->expr);
+      break;
+    case NodeKind::BinaryArith:
+      foldExpr(((BinaryArith*) e)->lhs);
+      foldExpr(((BinaryArith*) e)->rhs);
+      break;
+    case NodeKind::CompoundLiteral:
+      for(auto& mem : ((CompoundLiteral*) e)->members)
+        foldExpr(mem);
+      break;
+    case NodeKind::Indexed:
+      foldExpr(((Indexed*) e)->group);
+      foldExpr(((Indexed*) e)->index);
+      break;
+    case NodeKind::CallExpr:
+      foldExpr(((CallExpr*) e)->callable);
+      for(auto& arg : ((CallExpr*) e)->args)
+        foldExpr(arg);
+      break;
+    case NodeKind::StructMem:
+      foldExpr(((StructMem*) e)->base);
+      break;
+    case NodeKind::NewArray:
+      for(auto& dim : ((NewArray*) e)->dims)
+        foldExpr(dim);
+      break;
+    case NodeKind::ArrayLength:
+      foldExpr(((ArrayLength*) e)->array);
+      break;
+    case NodeKind::IsExpr:
+    case NodeKind::AsExpr:
+      foldExpr(((UnionConvBase*) e)->base);
+      break;
+    case NodeKind::Converted:
+      foldExpr(((Converted*) e)->value);
+      break;
+    default:;
+  }
+}
+
+//Can evaluating e call a subroutine? (its subexpressions are already marked)
+static bool mayCall(Expression* e)
+{
+  if(e->constant())
+    return false;
+  switch(e->kind)
+  {
+    case NodeKind::VarExpr:
+    case NodeKind::ThisExpr:
+      return false;
+    case NodeKind::UnaryArith:
+      return ((UnaryArith*) e)->expr->mayCall;
+    case NodeKind::BinaryArith:
+      return ((BinaryArith*) e)->lhs->mayCall || ((BinaryArith*) e)->rhs->mayCall;
+    case NodeKind::CompoundLiteral:
+      for(auto mem : ((CompoundLiteral*) e)->members)
+      {
+        if(mem->mayCall)
+          return true;
+      }
+      return false;
+    case NodeKind::Indexed:
+      return ((Indexed*) e)->group->mayCall || ((Indexed*) e)->index->mayCall;
+    case NodeKind::StructMem:
+      return ((StructMem*) e)->base->mayCall;
+    case NodeKind::NewArray:
+      for(auto dim : ((NewArray*) e)->dims)
+      {
+        if(dim->mayCall)
+          return true;
+      }
+      return false;
+    case NodeKind::ArrayLength:
+      return ((ArrayLength*) e)->array->mayCall;
+    case NodeKind::IsExpr:
+    case NodeKind::AsExpr:
+      return ((UnionConvBase*) e)->base->mayCall;
+    case NodeKind::Converted:
+      return ((Converted*) e)->value->mayCall;
+    default:
+      return true;
+  }
+}
+
+void foldExpr(Expression*& e)
+{
+  foldSubexprs(e);
+  Expression* folded = nullptr;
+  switch(e->kind)
+  {
+    case NodeKind::UnaryArith:
+      folded = foldUnary((UnaryArith*) e);
+      break;
+    case NodeKind::BinaryArith:
+      folded = foldBinary((BinaryArith*) e);
+      break;
+    case NodeKind::Converted:
+      folded = foldConverted((Converted*) e);
+      break;
+    case NodeKind::ArrayLength:
+      folded = foldArrayLength((ArrayLength*) e);
+      break;
+    default:;
+  }
+  if(folded)
+    e = folded;
+  e->mayCall = mayCall(e);
+}
+
+static void foldStatement(Statement* s)
+{
+  switch(s->kind)
+  {
+    case NodeKind::Block:
+      foldConstants((Block*) s);
+      break;
+    case NodeKind::Assign:
+    {
+      Assign* a = (Assign*) s;
+      foldExpr(a->lvalue);
+      foldExpr(a->rvalue);
+      if(a->arrayUpdate)
+        foldExpr(a->arrayUpdate->operand);
+      break;
+    }
+    case NodeKind::CallStmt:
+      foldSubexprs(((CallStmt*) s)->eval);
+      break;
+    case NodeKind::ForC:
+    {
+      ForC* fc = (ForC*) s;
+      if(fc->init)
+        foldStatement(fc->init);
+      if(fc->condition)
+        foldExpr(fc->condition);
+      if(fc->increment)
+        foldStatement(fc->increment);
+      break;
+    }
+    case NodeKind::ForArray:
+      foldExpr(((ForArray*) s)->arr);
+      break;
+    case NodeKind::ForRange:
+    {
+      ForRange* fr = (ForRange*) s;
+      foldExpr(fr->begin);
+      foldExpr(fr->end);
+      break;
+    }
+    case NodeKind::While:
+    {
+      While* w = (While*) s;
+      foldExpr(w->condition);
+      foldConstants(w->body);
+      break;
+    }
+    case NodeKind::If:
+    {
+      If* i = (If*) s;
+      foldExpr(i->condition);
+      foldStatement(i->body);
+      if(i->elseBody)
+        foldStatement(i->elseBody);
+      break;
+    }
+    case NodeKind::Match:
+    {
+      Match* m = (Match*) s;
+      foldExpr(m->matched);
+      for(auto c : m->cases)
+        foldConstants(c);
+      break;
+    }
+    case NodeKind::Switch:
+    {
+      Switch* sw = (Switch*) s;
+      foldExpr(sw->switched);
+      //the case table is already built, and holds only constant cases
+      for(auto& caseVal : sw->caseValues)
+        foldExpr(caseVal);
+      foldConstants(sw->block);
+      break;
+    }
+    case NodeKind::Return:
+    {
+      Return* r = (Return*) s;
+      if(r->value)
+        foldExpr(r->value);
+      break;
+    }
+    case NodeKind::Print:
+      for(auto& e : ((Print*) s)->exprs)
+        foldExpr(e);
+      break;
+    default:;
+  }
+  if(auto f = dynCast<For>(s))
+  {
+    foldConstants(f->inner);
+    if(f->counterLoop)
+      foldExpr(f->counterLoop->bound);
+  }
+}
+
+void foldConstants(Block* b)
+{
+  for(auto s : b->stmts)
+    foldStatement(s);
+}
+
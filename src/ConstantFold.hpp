@@ -0,0 +1,35 @@
+#ifndef CONSTANT_FOLD_H
+#define CONSTANT_FOLD_H
+
+#include "Common.hpp"
+#include "Subroutine.hpp"
+
+/*****************************************************************************/
+// ConstantFold: simplifies expressions in the AST before execution
+//
+// Run over each subroutine, test and benchmark body once it's resolved.
+// Arithmetic, comparisons and conversions with constant operands are
+// replaced by their results, as are the lengths of array literals (a literal
+// of constants converted to an array type becomes an array literal). Algebraic
+// identities that leave an operand unchanged (x + 0, x * 1, b && true, ...)
+// are replaced by the operand.
+//
+// Folding uses the same rules as IntConstant::convert and binOp, which
+// match the interpreter's. An operation that would fail (overflow, div by 0,
+// an integer not in an enum) isn't folded, so it still fails at runtime, and
+// only if it's reached. Operands that could have side effects or errors are
+// never dropped.
+//
+// Asserted expressions are left alone, since a failed assertion prints them.
+//
+// Each folded expression that can't call a subroutine also gets mayCall
+// cleared (see Interpreter::eval).
+/*****************************************************************************/
+
+//Fold all expressions in a block (including nested statements)
+void foldConstants(Block* b);
+//Fold e and its subexpressions
+void foldExpr(Expression*& e);
+
+#endif
+
@@ -11,7 +11,10 @@ using std::numeric_limits;
  **************/
 
 UnaryArith::UnaryArith(OperatorEnum o, Expression* e)
-  : op(o), expr(e) {}
+  : op(o), expr(e)
+{
+  kind = NodeKind::UnaryArith;
+}
 
 void UnaryArith::resolveImpl()
 {
@@ -41,7 +44,7 @@ Expression* UnaryArith::copy()
 
 bool UnaryArith::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const UnaryArith*>(&erhs);
+  auto rhs = dynCast<const UnaryArith>(&erhs);
   if(!rhs)
     return false;
   return op == rhs->op && *expr == *rhs->expr;
@@ -57,7 +60,10 @@ ostream& UnaryArith::print(ostream& os)
  * BinaryArith *
  ***************/
 
-BinaryArith::BinaryArith(Expression* l, OperatorEnum o, Expression* r) : op(o), lhs(l), rhs(r) {}
+BinaryArith::BinaryArith(Expression* l, OperatorEnum o, Expression* r) : op(o), lhs(l), rhs(r)
+{
+  kind = NodeKind::BinaryArith;
+}
 
 void BinaryArith::resolveImpl()
 {
@@ -104,8 +110,8 @@ void BinaryArith::resolveImpl()
     case PLUS:
     {
       //intercept plus operator for arrays (concatenation, prepend, append)
-      auto lhsAT = dynamic_cast<ArrayType*>(ltype);
-      auto rhsAT = dynamic_cast<ArrayType*>(rtype);
+      auto lhsAT = dynCast<ArrayType>(ltype);
+      auto rhsAT = dynCast<ArrayType>(rtype);
       if(lhsAT && rhsAT)
       {
         if(rhsAT->canConvert(lhsAT))
@@ -149,7 +155,7 @@ void BinaryArith::resolveImpl()
       {
         //array prepend
         Type* subtype = rhsAT->subtype;
-        if(!subtype->canConvert(rtype))
+        if(!subtype->canConvert(ltype))
         {
           errMsgLoc(this, "can't prepend type " << ltype->getName() << " to " << rtype->getName());
         }
@@ -241,7 +247,7 @@ Expression* BinaryArith::copy()
 
 bool BinaryArith::operator==(const Expression& eother) const
 {
-  auto other = dynamic_cast<const BinaryArith*>(&eother);
+  auto other = dynCast<const BinaryArith>(&eother);
   if(!other)
     return false;
   if(op != other->op)
@@ -269,7 +275,7 @@ ostream& BinaryArith::print(ostream& os)
 
 Expression* IntConstant::convert(Type* t)
 {
-  if(auto dstType = dynamic_cast<IntegerType*>(t))
+  if(auto dstType = dynCast<IntegerType>(t))
   {
     //just give this constant the same value,
     //then make sure the value fits
@@ -313,7 +319,7 @@ Expression* IntConstant::convert(Type* t)
     }
     return intConstant;
   }
-  else if(dynamic_cast<CharType*>(t))
+  else if(dynCast<CharType>(t))
   {
     //First, convert to ubyte
     IntConstant* toChar = (IntConstant*) this->convert(primitives[Prim::UBYTE]);
@@ -321,7 +327,7 @@ Expression* IntConstant::convert(Type* t)
     toChar->type = getCharType();
     return toChar;
   }
-  else if(auto enumType = dynamic_cast<EnumType*>(t))
+  else if(auto enumType = dynCast<EnumType>(t))
   {
     //when converting int to enum,
     //make sure value is actually in the enum
@@ -353,7 +359,7 @@ Expression* IntConstant::convert(Type* t)
     }
     return nullptr;
   }
-  else if(auto floatType = dynamic_cast<FloatType*>(t))
+  else if(auto floatType = dynCast<FloatType>(t))
   {
     //integer -> float/double conversion always succeeds
     FloatConstant* fc = nullptr;
@@ -380,6 +386,9 @@ Expression* IntConstant::convert(Type* t)
 
 bool IntConstant::checkValueFits()
 {
+  //char behaves as ubyte
+  if(type->isChar())
+    return uval <= numeric_limits<uint8_t>::max();
   auto intType = (IntegerType*) type;
   int size = intType->size;
   if(intType->isSigned)
@@ -430,10 +439,11 @@ IntConstant* IntConstant::binOp(int op, IntConstant* rhs)
   }
   result->type = type;
   //set the type (later check that result actually fits)
+  //signed operations wrap (like the interpreter) so that 64-bit overflow is defined
 #define DO_OP(name, op) \
   case name: \
     if(isSigned()) \
-      result->sval = sval op rhs->sval; \
+      result->sval = (int64_t) ((uint64_t) sval op (uint64_t) rhs->sval); \
     else \
       result->uval = uval op rhs->uval; \
     break;
@@ -486,7 +496,7 @@ IntConstant* IntConstant::binOp(int op, IntConstant* rhs)
       if(isSigned())
       {
         if(op == SHL)
-          result->sval = sval << shiftBits;
+          result->sval = (int64_t) ((uint64_t) sval << shiftBits);
         else
           result->sval = sval >> shiftBits;
       }
@@ -523,7 +533,7 @@ Expression* IntConstant::copy()
 
 bool IntConstant::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const IntConstant*>(&erhs);
+  auto rhs = dynCast<const IntConstant>(&erhs);
   if(!rhs)
     return false;
   if(!typesSame(type, rhs->type))
@@ -550,7 +560,7 @@ Expression* FloatConstant::convert(Type* t)
 {
   //first, just promote to double
   double val = typesSame(type, primitives[Prim::FLOAT]) ? fp : dp;
-  if(auto intType = dynamic_cast<IntegerType*>(t))
+  if(auto intType = dynCast<IntegerType>(t))
   {
     //make sure val fits in a 64-bit integer,
     //then make a 64-bit version of value and narrow it to desired type
@@ -578,7 +588,7 @@ Expression* FloatConstant::convert(Type* t)
       return asULong.convert(t);
     }
   }
-  else if(dynamic_cast<CharType*>(t))
+  else if(dynCast<CharType>(t))
   {
     if(val < 0 || val >= 256.0)
     {
@@ -589,7 +599,7 @@ Expression* FloatConstant::convert(Type* t)
     toChar->setLocation(this);
     return toChar;
   }
-  else if(auto floatType = dynamic_cast<FloatType*>(t))
+  else if(auto floatType = dynCast<FloatType>(t))
   {
     FloatConstant* fc = nullptr;
     if(floatType->size == 4)
@@ -599,7 +609,7 @@ Expression* FloatConstant::convert(Type* t)
     fc->setLocation(this);
     return fc;
   }
-  else if(dynamic_cast<EnumType*>(t))
+  else if(dynCast<EnumType>(t))
   {
     //temporarily make an integer value, then convert that to enum
     if(val < 0)
@@ -676,7 +686,7 @@ Expression* FloatConstant::copy()
 
 bool FloatConstant::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const FloatConstant*>(&erhs);
+  auto rhs = dynCast<const FloatConstant>(&erhs);
   if(!rhs)
     return false;
   if(!typesSame(type, rhs->type))
@@ -708,7 +718,7 @@ Expression* BoolConstant::copy()
 
 bool BoolConstant::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const BoolConstant*>(&erhs);
+  auto rhs = dynCast<const BoolConstant>(&erhs);
   if(!rhs)
     return false;
   return value == rhs->value;
@@ -726,6 +736,7 @@ ostream& BoolConstant::print(ostream& os)
 
 MapConstant::MapConstant(MapType* mt)
 {
+  kind = NodeKind::MapConstant;
   type = mt;
   resolved = true;
 }
@@ -744,7 +755,7 @@ Expression* MapConstant::copy()
 
 bool MapConstant::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const MapConstant*>(&erhs);
+  auto rhs = dynCast<const MapConstant>(&erhs);
   if(!rhs)
     return false;
   auto& l = values;
@@ -782,6 +793,7 @@ ostream& MapConstant::print(ostream& os)
 
 UnionConstant::UnionConstant(Expression* expr, UnionType* ut)
 {
+  kind = NodeKind::UnionConstant;
   INTERNAL_ASSERT(expr->resolved && expr->constant());
   setLocation(expr);
   value = expr;
@@ -808,7 +820,7 @@ Expression* UnionConstant::copy()
 
 bool UnionConstant::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const UnionConstant*>(&erhs);
+  auto rhs = dynCast<const UnionConstant>(&erhs);
   if(!rhs)
     return false;
   return option == rhs->option && *value == *rhs->value;
@@ -828,11 +840,15 @@ ostream& UnionConstant::print(ostream& os)
  *******************/
 
 CompoundLiteral::CompoundLiteral(vector<Expression*>& mems)
-  : members(mems) {}
+  : members(mems)
+{
+  kind = NodeKind::CompoundLiteral;
+}
 
 CompoundLiteral::CompoundLiteral(vector<Expression*>& mems, Type* t)
   : members(mems)
 {
+  kind = NodeKind::CompoundLiteral;
   type = t;
   resolved = true;
 }
@@ -875,7 +891,7 @@ Expression* CompoundLiteral::copy()
 
 bool CompoundLiteral::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const CompoundLiteral*>(&erhs);
+  auto rhs = dynCast<const CompoundLiteral>(&erhs);
   if(!rhs)
     return false;
   auto& l = members;
@@ -898,7 +914,7 @@ ostream& CompoundLiteral::print(ostream& os)
     os << generateCharDotfile('"');
     for(size_t i = 0; i < members.size(); i++)
     {
-      auto c = dynamic_cast<IntConstant*>(members[i]);
+      auto c = dynCast<IntConstant>(members[i]);
       INTERNAL_ASSERT(c);
       os << generateCharDotfile((char) c->uval);
     }
@@ -923,7 +939,10 @@ ostream& CompoundLiteral::print(ostream& os)
  ***********/
 
 Indexed::Indexed(Expression* grp, Expression* ind)
-  : group(grp), index(ind) {}
+  : group(grp), index(ind)
+{
+  kind = NodeKind::Indexed;
+}
 
 void Indexed::resolveImpl()
 {
@@ -931,17 +950,17 @@ void Indexed::resolveImpl()
   resolveExpr(index);
   //Indexing a Tuple (literal, variable or call) requires the index to be an IntLit
   //Anything else is assumed to be an array and then the index can be any integer expression
-  if(dynamic_cast<CompoundLiteral*>(group))
+  if(dynCast<CompoundLiteral>(group))
   {
     errMsgLoc(this, "Can't index a compound literal - assign it to an array first.");
   }
   //note: ok if this is null
   //in all other cases, group must have a type now
-  if(auto tt = dynamic_cast<TupleType*>(group->type))
+  if(auto tt = dynCast<TupleType>(group->type))
   {
     //group's type is a Tuple, whether group is a literal, var or call
     //make sure the index is an IntLit
-    auto intIndex = dynamic_cast<IntConstant*>(index);
+    auto intIndex = dynCast<IntConstant>(index);
     if(!intIndex)
       errMsgLoc(this, "tuple subscript must be an integer constant.");
     uint64_t idx = intIndex->uval;
@@ -959,12 +978,12 @@ void Indexed::resolveImpl()
       errMsgLoc(this, "tuple subscript out of bounds");
     type = tt->members[idx];
   }
-  else if(auto at = dynamic_cast<ArrayType*>(group->type))
+  else if(auto at = dynCast<ArrayType>(group->type))
   {
     //group must be an array
     type = at->subtype;
   }
-  else if(auto mt = dynamic_cast<MapType*>(group->type))
+  else if(auto mt = dynCast<MapType>(group->type))
   {
     //make sure ind can be converted to the key type
     if(!mt->key->canConvert(index->type))
@@ -991,7 +1010,7 @@ Expression* Indexed::copy()
 
 bool Indexed::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const Indexed*>(&erhs);
+  auto rhs = dynCast<const Indexed>(&erhs);
   if(!rhs)
     return false;
   return *group == *rhs->group && *index == *rhs->index;
@@ -1009,6 +1028,7 @@ ostream& Indexed::print(ostream& os)
 
 CallExpr::CallExpr(Expression* c, vector<Expression*>& a)
 {
+  kind = NodeKind::CallExpr;
   callable = c;
   args = a;
 }
@@ -1023,7 +1043,7 @@ void CallExpr::resolveImpl()
     resolveExpr(args[i]);
     argTypes[i] = args[i]->type;
   }
-  auto soe = dynamic_cast<SubrOverloadExpr*>(callable);
+  auto soe = dynCast<SubrOverloadExpr>(callable);
   if(soe)
   {
     //need to choose from a set of overloads based on arg types
@@ -1033,7 +1053,7 @@ void CallExpr::resolveImpl()
     //replace callable
     if(soe->thisObject)
     {
-      Subroutine* subr = dynamic_cast<Subroutine*>(sb);
+      Subroutine* subr = dynCast<Subroutine>(sb);
       INTERNAL_ASSERT(subr);
       callable = new StructMem(soe->thisObject, subr);
     }
@@ -1043,7 +1063,7 @@ void CallExpr::resolveImpl()
     callable->setLocation(this);
   }
   //have a specific callable
-  auto callableType = dynamic_cast<CallableType*>(callable->type);
+  auto callableType = dynCast<CallableType>(callable->type);
   if(!callableType)
   {
     errMsgLoc(this, "Expression of type " << callable->type->getName() << " is not callable");
@@ -1094,7 +1114,7 @@ Expression* CallExpr::copy()
 
 bool CallExpr::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const CallExpr*>(&erhs);
+  auto rhs = dynCast<const CallExpr>(&erhs);
   if(!rhs)
     return false;
   if(*callable != *rhs->callable)
@@ -1125,8 +1145,15 @@ ostream& CallExpr::print(ostream& os)
  * VarExpr *
  ***********/
 
-VarExpr::VarExpr(Variable* v, Scope* s) : var(v), scope(s) {}
-VarExpr::VarExpr(Variable* v) : var(v), scope(nullptr) {}
+VarExpr::VarExpr(Variable* v, Scope* s) : var(v), scope(s)
+{
+  kind = NodeKind::VarExpr;
+}
+
+VarExpr::VarExpr(Variable* v) : var(v), scope(nullptr)
+{
+  kind = NodeKind::VarExpr;
+}
 
 void VarExpr::resolveImpl()
 {
@@ -1160,7 +1187,7 @@ Expression* VarExpr::copy()
 
 bool VarExpr::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const VarExpr*>(&erhs);
+  auto rhs = dynCast<const VarExpr>(&erhs);
   if(!rhs)
     return false;
   return var == rhs->var;
@@ -1178,6 +1205,7 @@ ostream& VarExpr::print(ostream& os)
 
 SubrOverloadExpr::SubrOverloadExpr(SubroutineDecl* d)
 {
+  kind = NodeKind::SubrOverloadExpr;
   decl = d;
   thisObject = nullptr;
   //A SubrOverloadExpr has no single type.
@@ -1186,6 +1214,7 @@ SubrOverloadExpr::SubrOverloadExpr(SubroutineDecl* d)
 
 SubrOverloadExpr::SubrOverloadExpr(Expression* t, SubroutineDecl* d)
 {
+  kind = NodeKind::SubrOverloadExpr;
   decl = d;
   thisObject = t;
   //A SubrOverloadExpr never has a single type, even when resovled.
@@ -1212,6 +1241,7 @@ ostream& SubrOverloadExpr::print(ostream& os)
 
 SubroutineExpr::SubroutineExpr(SubrBase* s)
 {
+  kind = NodeKind::SubroutineExpr;
   subr = s;
 }
 
@@ -1232,7 +1262,7 @@ Expression* SubroutineExpr::copy()
 
 bool SubroutineExpr::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const SubroutineExpr*>(&erhs);
+  auto rhs = dynCast<const SubroutineExpr>(&erhs);
   if(!rhs)
     return false;
   return subr == rhs->subr;
@@ -1251,14 +1281,18 @@ ostream& SubroutineExpr::print(ostream& os)
 
 StructMem::StructMem(Expression* b, Variable* v)
 {
+  kind = NodeKind::StructMem;
   base = b;
   member = v;
+  index = -1;
 }
 
 StructMem::StructMem(Expression* b, Subroutine* s)
 {
+  kind = NodeKind::StructMem;
   base = b;
   member = s;
+  index = -1;
 }
 
 void StructMem::resolveImpl()
@@ -1273,6 +1307,9 @@ void StructMem::resolveImpl()
     {
       INTERNAL_ERROR;
     }
+    auto& mems = var->owner->members;
+    index = std::find(mems.begin(), mems.end(), var) - mems.begin();
+    INTERNAL_ASSERT(index < (int) mems.size());
   }
   else
   {
@@ -1300,7 +1337,7 @@ Expression* StructMem::copy()
 
 bool StructMem::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const StructMem*>(&erhs);
+  auto rhs = dynCast<const StructMem>(&erhs);
   if(!rhs)
     return false;
   if(*base != *rhs->base)
@@ -1329,6 +1366,7 @@ ostream& StructMem::print(ostream& os)
 
 NewArray::NewArray(Type* elemType, vector<Expression*> dimensions)
 {
+  kind = NodeKind::NewArray;
   elem = elemType;
   dims = dimensions;
 }
@@ -1361,7 +1399,7 @@ Expression* NewArray::copy()
 
 bool NewArray::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const NewArray*>(&erhs);
+  auto rhs = dynCast<const NewArray>(&erhs);
   if(!rhs)
     return false;
   if(!typesSame(type, rhs->type))
@@ -1392,13 +1430,14 @@ ostream& NewArray::print(ostream& os)
 
 ArrayLength::ArrayLength(Expression* arr)
 {
+  kind = NodeKind::ArrayLength;
   array = arr;
 }
 
 void ArrayLength::resolveImpl()
 {
   resolveExpr(array);
-  if(!array->type->isArray())
+  if(!array->type->isArray() && !array->type->isMap())
   {
     //len is not a keyword: <expr>.len is a special case
     //that should be handled in resolveExpr
@@ -1418,7 +1457,7 @@ Expression* ArrayLength::copy()
 
 bool ArrayLength::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const ArrayLength*>(&erhs);
+  auto rhs = dynCast<const ArrayLength>(&erhs);
   if(!rhs)
     return false;
   return *array == *rhs->array;
@@ -1438,18 +1477,25 @@ void UnionConvBase::partialResolve()
 {
   resolveExpr(base);
   resolveType(destType);
-  UnionType* srcUnion = dynamic_cast<UnionType*>(base->type);
-  UnionType* destUnion = dynamic_cast<UnionType*>(destType);
+  UnionType* srcUnion = dynCast<UnionType>(base->type);
+  UnionType* destUnion = dynCast<UnionType>(destType);
+  optionMap.assign(srcUnion->options.size(), -1);
   if(destUnion)
   {
     //subset is the intersection of src and dest unions
-    for(Type* srcOption : srcUnion->options)
-      for(Type* destOption : destUnion->options)
-        if(typesSame(srcOption, destOption))
+    for(size_t i = 0; i < srcUnion->options.size(); i++)
+    {
+      Type* srcOption = srcUnion->options[i];
+      for(size_t j = 0; j < destUnion->options.size(); j++)
+      {
+        if(typesSame(srcOption, destUnion->options[j]))
         {
           subset.push_back(srcOption);
+          optionMap[i] = j;
           break;
         }
+      }
+    }
     if(subset.size() == 0)
     {
       errMsgLoc(this, "union types " << srcUnion->getName() << " and " <<
@@ -1459,11 +1505,12 @@ void UnionConvBase::partialResolve()
   else
   {
     //subset is just destType, but make sure it is actually in srcUnion
-    for(Type* srcOption : srcUnion->options)
+    for(size_t i = 0; i < srcUnion->options.size(); i++)
     {
-      if(typesSame(destType, srcOption))
+      if(typesSame(destType, srcUnion->options[i]))
       {
         subset.push_back(destType);
+        optionMap[i] = 0;
         break;
       }
     }
@@ -1488,7 +1535,7 @@ void AsExpr::resolveImpl()
 
 bool AsExpr::operator==(const Expression& rhs) const
 {
-  const AsExpr* ae = dynamic_cast<const AsExpr*>(&rhs);
+  const AsExpr* ae = dynCast<const AsExpr>(&rhs);
   if(!ae)
     return false;
   return typesSame(ae->type, type) && *base == *ae->base;
@@ -1500,6 +1547,7 @@ Expression* AsExpr::copy()
   AsExpr* ae = new AsExpr(base, destType);
   ae->type = this->type;
   ae->subset = this->subset;
+  ae->optionMap = this->optionMap;
   ae->setLocation(this);
   ae->resolved = true;
   return ae;
@@ -1524,7 +1572,7 @@ void IsExpr::resolveImpl()
 
 bool IsExpr::operator==(const Expression& rhs) const
 {
-  const IsExpr* ie = dynamic_cast<const IsExpr*>(&rhs);
+  const IsExpr* ie = dynCast<const IsExpr>(&rhs);
   if(!ie)
     return false;
   return typesSame(ie->type, type) && *base == *ie->base;
@@ -1536,6 +1584,7 @@ Expression* IsExpr::copy()
   IsExpr* ie = new IsExpr(base, destType);
   ie->type = this->type;
   ie->subset = this->subset;
+  ie->optionMap = this->optionMap;
   ie->setLocation(this);
   ie->resolved = true;
   return ie;
@@ -1553,6 +1602,7 @@ ostream& IsExpr::print(ostream& os)
 
 ThisExpr::ThisExpr(Scope* where)
 {
+  kind = NodeKind::ThisExpr;
   usage = where;
 }
 
@@ -1586,6 +1636,7 @@ ostream& ThisExpr::print(ostream& os)
 
 Converted::Converted(Expression* val, Type* dst)
 {
+  kind = NodeKind::Converted;
   if(!val->resolved)
   {
     INTERNAL_ERROR;
@@ -1611,7 +1662,7 @@ Expression* Converted::copy()
 
 bool Converted::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const Converted*>(&erhs);
+  auto rhs = dynCast<const Converted>(&erhs);
   if(!rhs)
     return false;
   return typesSame(type, rhs->type) && *value == *rhs->value;
@@ -1630,6 +1681,7 @@ ostream& Converted::print(ostream& os)
 
 EnumExpr::EnumExpr(EnumConstant* ec)
 {
+  kind = NodeKind::EnumExpr;
   type = ec->et;
   value = ec;
   resolved = true;
@@ -1642,7 +1694,7 @@ Expression* EnumExpr::copy()
 
 bool EnumExpr::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const EnumExpr*>(&erhs);
+  auto rhs = dynCast<const EnumExpr>(&erhs);
   if(!rhs)
     return false;
   return value == rhs->value;
@@ -1660,6 +1712,7 @@ ostream& EnumExpr::print(ostream& os)
 
 SimpleConstant::SimpleConstant(SimpleType* s)
 {
+  kind = NodeKind::SimpleConstant;
   st = s;
   type = s;
   resolved = true;
@@ -1672,7 +1725,7 @@ Expression* SimpleConstant::copy()
 
 bool SimpleConstant::operator==(const Expression& erhs) const
 {
-  auto rhs = dynamic_cast<const SimpleConstant*>(&erhs);
+  auto rhs = dynCast<const SimpleConstant>(&erhs);
   if(!rhs)
     return false;
   return st == rhs->st;
@@ -1695,6 +1748,7 @@ size_t SimpleConstant::hash() const
 
 UnresolvedExpr::UnresolvedExpr(string n, Scope* s)
 {
+  kind = NodeKind::UnresolvedExpr;
   base = nullptr;
   name = new Member;
   name->names.push_back(n);
@@ -1703,6 +1757,7 @@ UnresolvedExpr::UnresolvedExpr(string n, Scope* s)
 
 UnresolvedExpr::UnresolvedExpr(Member* n, Scope* s)
 {
+  kind = NodeKind::UnresolvedExpr;
   base = nullptr;
   name = n;
   usage = s;
@@ -1710,6 +1765,7 @@ UnresolvedExpr::UnresolvedExpr(Member* n, Scope* s)
 
 UnresolvedExpr::UnresolvedExpr(Expression* b, Member* n, Scope* s)
 {
+  kind = NodeKind::UnresolvedExpr;
   base = b;
   name = n;
   usage = s;
@@ -1762,14 +1818,14 @@ EnumType* UnresolvedExpr::shortcutEnum = nullptr;
 
 void resolveExpr(Expression*& expr)
 {
-  if(auto defaultVal = dynamic_cast<DefaultValueExpr*>(expr))
+  if(auto defaultVal = dynCast<DefaultValueExpr>(expr))
   {
     resolveType(defaultVal->t);
     expr = defaultVal->t->getDefaultValue();
     INTERNAL_ASSERT(expr->resolved);
     return;
   }
-  else if(auto asExpr = dynamic_cast<AsExpr*>(expr))
+  else if(auto asExpr = dynCast<AsExpr>(expr))
   {
     //Check if the base is really a union.
     resolveExpr(asExpr->base);
@@ -1782,7 +1838,7 @@ void resolveExpr(Expression*& expr)
       //and resolve below.
     }
   }
-  auto unres = dynamic_cast<UnresolvedExpr*>(expr);
+  auto unres = dynCast<UnresolvedExpr>(expr);
   if(!unres)
   {
     expr->resolve();
@@ -1822,7 +1878,7 @@ void resolveExpr(Expression*& expr)
   if(base)
   {
     resolveExpr(base);
-    structContext = dynamic_cast<StructType*>(base->type);
+    structContext = dynCast<StructType>(base->type);
     if(structContext)
       searchScope = structContext->scope;
     else
@@ -1857,7 +1913,7 @@ void resolveExpr(Expression*& expr)
       base = newBase;
       //compensate for the "++" in the loop
       i += namesUsed - 1;
-      structContext = dynamic_cast<StructType*>(base->type);
+      structContext = dynCast<StructType>(base->type);
       if(structContext)
         searchScope = structContext->scope;
       else
@@ -1888,7 +1944,7 @@ void resolveExpr(Expression*& expr)
         }
         i += namesUsed - 1;
         //update context for new base
-        structContext = dynamic_cast<StructType*>(base->type);
+        structContext = dynCast<StructType>(base->type);
         if(structContext)
           searchScope = structContext->scope;
         else
@@ -1941,7 +1997,7 @@ void resolveExpr(Expression*& expr)
               ThisExpr* implicitThis = new ThisExpr(searchScope);
               implicitThis->resolve();
               implicitThis->setLocation(unres);
-              Subroutine* only = dynamic_cast<Subroutine*>(sd->getOnly());
+              Subroutine* only = dynCast<Subroutine>(sd->getOnly());
               if(only)
                 base = new StructMem(implicitThis, only);
               else
@@ -1988,7 +2044,7 @@ void resolveExpr(Expression*& expr)
               base = new VarExpr(var, searchScope);
             }
             base->resolve();
-            structContext = dynamic_cast<StructType*>(base->type);
+            structContext = dynCast<StructType>(base->type);
             if(structContext)
               searchScope = structContext->scope;
             else
@@ -2020,10 +2076,10 @@ void resolveExpr(Expression*& expr)
 void resolveAndCoerce(Expression*& expr, Type* reqType)
 {
   resolveExpr(expr);
-  SubrOverloadExpr* soe = dynamic_cast<SubrOverloadExpr*>(expr);
+  SubrOverloadExpr* soe = dynCast<SubrOverloadExpr>(expr);
   if(soe)
   {
-    auto callable = dynamic_cast<CallableType*>(reqType);
+    auto callable = dynCast<CallableType>(reqType);
     if(!callable)
       errMsgLoc(expr, "Reference to subroutine " << soe->decl->name <<
           " can't be converted to non-callable type " << reqType->getName());
@@ -2055,7 +2111,7 @@ void resolveAndCoerce(Expression*& expr, Type* reqType)
     if(thisObject)
     {
       //only Subroutine can be a member, not Extern
-      Subroutine* subr = dynamic_cast<Subroutine*>(sb);
+      Subroutine* subr = dynCast<Subroutine>(sb);
       INTERNAL_ASSERT(subr);
       expr = new StructMem(thisObject, subr);
     }
@@ -45,10 +45,14 @@ struct UnresolvedExpr;
 
 struct Expression : public Node
 {
-  Expression() : type(nullptr) {}
+  NODE_KIND_RANGE(UnaryArith, UnresolvedExpr)
+  Expression() : type(nullptr), mayCall(true) {}
   virtual ~Expression() {}
   virtual void resolveImpl() {}
   Type* type;
+  //Can evaluating this call a subroutine? Cleared by ConstantFold for
+  //expressions that can't, which the AST interpreter evaluates directly.
+  bool mayCall;
   //whether this works as an lvalue
   virtual bool assignable() = 0;
   //whether this is a compile-time constant
@@ -121,6 +125,7 @@ struct ExprHash
 
 struct UnaryArith : public Expression
 {
+  NODE_KIND(UnaryArith)
   UnaryArith(OperatorEnum op, Expression* expr);
   OperatorEnum op;
   Expression* expr;
@@ -143,6 +148,7 @@ struct UnaryArith : public Expression
 
 struct BinaryArith : public Expression
 {
+  NODE_KIND(BinaryArith)
   BinaryArith(Expression* lhs, OperatorEnum op, Expression* rhs);
   OperatorEnum op;
   Expression* lhs;
@@ -177,8 +183,10 @@ struct BinaryArith : public Expression
 
 struct IntConstant : public Expression
 {
+  NODE_KIND(IntConstant)
   IntConstant()
   {
+    kind = NodeKind::IntConstant;
     uval = 0;
     sval = 0;
     type = primitives[Prim::ULONG];
@@ -186,6 +194,7 @@ struct IntConstant : public Expression
   }
   IntConstant(IntLit* ast)
   {
+    kind = NodeKind::IntConstant;
     //Prefer a signed type to represent positive integer constants
     auto intType = (IntegerType*) primitives[Prim::INT];
     auto longType = (IntegerType*) primitives[Prim::LONG];
@@ -208,18 +217,21 @@ struct IntConstant : public Expression
   }
   IntConstant(int64_t val)
   {
+    kind = NodeKind::IntConstant;
     sval = val;
     type = primitives[Prim::LONG];
     resolved = true;
   }
   IntConstant(uint64_t val)
   {
+    kind = NodeKind::IntConstant;
     uval = val;
     type = primitives[Prim::ULONG];
     resolved = true;
   }
   IntConstant(int64_t val, Type* t)
   {
+    kind = NodeKind::IntConstant;
     uval = val;
     sval = val;
     type = t;
@@ -227,6 +239,7 @@ struct IntConstant : public Expression
   }
   IntConstant(uint64_t val, Type* t)
   {
+    kind = NodeKind::IntConstant;
     uval = val;
     sval = val;
     type = t;
@@ -284,8 +297,10 @@ struct IntConstant : public Expression
 
 struct FloatConstant : public Expression
 {
+  NODE_KIND(FloatConstant)
   FloatConstant()
   {
+    kind = NodeKind::FloatConstant;
     fp = 0;
     dp = 0;
     type = primitives[Prim::DOUBLE];
@@ -293,18 +308,21 @@ struct FloatConstant : public Expression
   }
   FloatConstant(FloatLit* ast)
   {
+    kind = NodeKind::FloatConstant;
     dp = ast->val;
     type = primitives[Prim::DOUBLE];
     resolved = true;
   }
   FloatConstant(float val)
   {
+    kind = NodeKind::FloatConstant;
     fp = val;
     type = primitives[Prim::FLOAT];
     resolved = true;
   }
   FloatConstant(double val)
   {
+    kind = NodeKind::FloatConstant;
     dp = val;
     type = primitives[Prim::DOUBLE];
     resolved = true;
@@ -350,8 +368,10 @@ struct FloatConstant : public Expression
 
 struct BoolConstant : public Expression
 {
+  NODE_KIND(BoolConstant)
   BoolConstant(bool v)
   {
+    kind = NodeKind::BoolConstant;
     value = v;
     type = primitives[Prim::BOOL];
     resolved = true;
@@ -391,6 +411,7 @@ struct BoolConstant : public Expression
 //Relies on operator== and operator< for Expressions
 struct MapConstant : public Expression
 {
+  NODE_KIND(MapConstant)
   MapConstant(MapType* mt);
   unordered_map<Expression*, Expression*, ExprHash, ExprEqual> values;
   bool constant() const
@@ -435,6 +456,7 @@ struct MapConstant : public Expression
 //(which is guaranteed by semantic checking/implicit conversions)
 struct UnionConstant : public Expression
 {
+  NODE_KIND(UnionConstant)
   UnionConstant(Expression* expr, UnionType* ut);
   bool assignable()
   {
@@ -473,6 +495,7 @@ struct UnionConstant : public Expression
 //implicitly converts to array, struct and other tuples (elementwise).
 struct CompoundLiteral : public Expression
 {
+  NODE_KIND(CompoundLiteral)
   //Constructor used by parser: mems can be unresolved and type is a tuple
   CompoundLiteral(vector<Expression*>& mems);
   //Constructor used by interpreter: mems must be resolved and type is
@@ -532,6 +555,7 @@ struct CompoundLiteral : public Expression
 
 struct Indexed : public Expression
 {
+  NODE_KIND(Indexed)
   Indexed(Expression* grp, Expression* ind);
   void resolveImpl();
   Expression* group; //the array or tuple being subscripted
@@ -554,6 +578,7 @@ struct Indexed : public Expression
 
 struct CallExpr : public Expression
 {
+  NODE_KIND(CallExpr)
   CallExpr(Expression* callable, vector<Expression*>& args);
   Expression* callable;
   vector<Expression*> args;
@@ -581,6 +606,7 @@ struct CallExpr : public Expression
 
 struct VarExpr : public Expression
 {
+  NODE_KIND(VarExpr)
   VarExpr(Variable* v, Scope* s);
   VarExpr(Variable* v);
   void resolveImpl();
@@ -603,6 +629,7 @@ struct VarExpr : public Expression
 
 struct SubrOverloadExpr : public Expression
 {
+  NODE_KIND(SubrOverloadExpr)
   SubrOverloadExpr(SubroutineDecl* decl);
   SubrOverloadExpr(Expression* t, SubroutineDecl* decl);
   void resolveImpl();
@@ -621,7 +648,7 @@ struct SubrOverloadExpr : public Expression
   }
   bool operator==(const Expression& erhs) const
   {
-    auto soe = dynamic_cast<const SubrOverloadExpr*>(&erhs);
+    auto soe = dynCast<const SubrOverloadExpr>(&erhs);
     return soe && soe->decl == decl;
   }
   ostream& print(ostream& os);
@@ -631,6 +658,7 @@ struct SubrOverloadExpr : public Expression
 
 struct SubroutineExpr : public Expression
 {
+  NODE_KIND(SubroutineExpr)
   //2 ways to select a specific SubrBase from an
   //overload family:
   // * using a specific CallableType (requires exact param type match)
@@ -662,11 +690,17 @@ struct SubroutineExpr : public Expression
 
 struct StructMem : public Expression
 {
+  NODE_KIND(StructMem)
   StructMem(Expression* base, Variable* var);
   StructMem(Expression* base, Subroutine* subr);
   void resolveImpl();
   Expression* base;  //base->type must be a StructType
   variant<Variable*, Subroutine*> member;
+  //Position of a data member among its struct's members, so it
+  //can be accessed directly at runtime (-1 for a subroutine member).
+  //A member reached through composition is a chain of StructMems,
+  //each with its own index.
+  int index;
   bool assignable()
   {
     return base->assignable() && member.is<Variable*>();
@@ -688,6 +722,7 @@ struct StructMem : public Expression
 
 struct NewArray : public Expression
 {
+  NODE_KIND(NewArray)
   NewArray(Type* elemType, vector<Expression*> dims);
   Type* elem;
   vector<Expression*> dims;
@@ -711,6 +746,7 @@ struct NewArray : public Expression
 
 struct ArrayLength : public Expression
 {
+  NODE_KIND(ArrayLength)
   ArrayLength(Expression* arr);
   Expression* array;
   void resolveImpl();
@@ -731,6 +767,7 @@ struct ArrayLength : public Expression
 
 struct UnionConvBase : public Expression
 {
+  NODE_KIND_RANGE(IsExpr, AsExpr)
   UnionConvBase(Expression* b, Type* t)
   {
     base = b;
@@ -757,15 +794,22 @@ struct UnionConvBase : public Expression
   //The (set of) type(s) that the union is narrowed to at runtime,
   //before final conversion to destType.
   vector<Type*> subset;
+  //For each option of base's union: -1 if it isn't in subset.
+  //Otherwise, the index of the same option in destType if destType
+  //is a union (or 0 if not).
+  vector<int> optionMap;
   Expression* base;
   Type* destType;
 };
 
 struct IsExpr : public UnionConvBase
 {
+  NODE_KIND(IsExpr)
   IsExpr(Expression* b, Type* t)
     : UnionConvBase(b, t)
-  {}
+  {
+    kind = NodeKind::IsExpr;
+  }
   size_t hash() const
   {
     return fnv1a(UnionConvBase::hash());
@@ -778,9 +822,12 @@ struct IsExpr : public UnionConvBase
 
 struct AsExpr : public UnionConvBase
 {
+  NODE_KIND(AsExpr)
   AsExpr(Expression* b, Type* t)
     : UnionConvBase(b, t)
-  {}
+  {
+    kind = NodeKind::AsExpr;
+  }
   size_t hash() const
   {
     return UnionConvBase::hash();
@@ -793,6 +840,7 @@ struct AsExpr : public UnionConvBase
 
 struct ThisExpr : public Expression
 {
+  NODE_KIND(ThisExpr)
   ThisExpr(Scope* where);
   void resolveImpl();
   //structType is equal to type
@@ -812,7 +860,7 @@ struct ThisExpr : public Expression
   bool operator==(const Expression& rhs) const
   {
     //in any context, "this" always refers to the same thing
-    return dynamic_cast<const ThisExpr*>(&rhs);
+    return dynCast<const ThisExpr>(&rhs);
   }
   Scope* usage;
   Expression* copy();
@@ -821,6 +869,7 @@ struct ThisExpr : public Expression
 
 struct Converted : public Expression
 {
+  NODE_KIND(Converted)
   Converted(Expression* val, Type* dst);
   Expression* value;
   bool assignable()
@@ -840,6 +889,7 @@ struct Converted : public Expression
 
 struct EnumExpr : public Expression
 {
+  NODE_KIND(EnumExpr)
   EnumExpr(EnumConstant* ec); //needs no resolve() after
   EnumConstant* value;
   bool assignable()
@@ -867,6 +917,7 @@ struct EnumExpr : public Expression
 
 struct SimpleConstant : public Expression
 {
+  NODE_KIND(SimpleConstant)
   SimpleConstant(SimpleType* s);
   SimpleType* st;
   bool assignable()
@@ -891,7 +942,11 @@ struct SimpleConstant : public Expression
 //When resolved, it's replaced by type->getDefaultValue()
 struct DefaultValueExpr : public Expression
 {
-  DefaultValueExpr(Type* t_) : t(t_) {}
+  NODE_KIND(DefaultValueExpr)
+  DefaultValueExpr(Type* t_) : t(t_)
+  {
+    kind = NodeKind::DefaultValueExpr;
+  }
   void resolveImpl()
   {
     INTERNAL_ERROR;
@@ -923,6 +978,7 @@ struct DefaultValueExpr : public Expression
 
 struct UnresolvedExpr : public Expression
 {
+  NODE_KIND(UnresolvedExpr)
   UnresolvedExpr(string name, Scope* s);
   UnresolvedExpr(Member* name, Scope* s);
   UnresolvedExpr(Expression* base, Member* name, Scope* s);
@@ -0,0 +1,219 @@
+#include "FFI.hpp"
+#include "Subroutine.hpp"
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32)
+#define FFI_SUPPORTED
+#include <dlfcn.h>
+#include <mutex>
+#endif
+
+const int maxIntArgs = 6;
+const int maxFloatArgs = 8;
+
+//A scalar parameter/return type (nullptr if t isn't a scalar)
+static Type* externScalar(Type* t)
+{
+  t = canonicalize(t);
+  if(dynCast<IntegerType>(t) || dynCast<FloatType>(t) || t->isChar() || t->isBool())
+    return t;
+  return nullptr;
+}
+
+//The element type of a 1-dimensional array of primitives (nullptr otherwise)
+static Type* externArrayElem(Type* t)
+{
+  auto at = dynCast<ArrayType>(canonicalize(t));
+  if(!at || at->dims != 1)
+    return nullptr;
+  return externScalar(at->elem);
+}
+
+void checkExternSignature(ExternalSubroutine* es)
+{
+  int intArgs = 0;
+  int floatArgs = 0;
+  for(auto p : es->type->paramTypes)
+  {
+    if(externScalar(p) && externScalar(p)->isFloat())
+      floatArgs++;
+    else if(externScalar(p) || externArrayElem(p))
+      intArgs++;
+    else
+    {
+      errMsgLoc(es, "type " << p->getName() << " can't be passed to external subroutine " << es->name());
+    }
+  }
+  if(intArgs > maxIntArgs || floatArgs > maxFloatArgs)
+  {
+    errMsgLoc(es, "external subroutine " << es->name() << " has too many parameters (the limit is " <<
+        maxIntArgs << " integer/array and " << maxFloatArgs << " floating-point)");
+  }
+  Type* rt = es->type->returnType;
+  if(!typesSame(rt, primitives[Prim::VOID]) && !externScalar(rt) &&
+      !typesSame(rt, getArrayType(primitives[Prim::CHAR], 1)))
+  {
+    errMsgLoc(es, "type " << rt->getName() << " can't be returned by external subroutine " << es->name());
+  }
+}
+
+#ifdef FFI_SUPPORTED
+
+//Libraries opened so far, by name ("" is the program itself)
+static unordered_map<string, void*> libraries;
+//(tests may call external subroutines from several threads)
+static std::mutex librariesLock;
+
+static void* resolveExtern(ExternalSubroutine* es)
+{
+  std::lock_guard<std::mutex> lock(librariesLock);
+  //another thread may have resolved it first
+  if(void* native = es->native.load(std::memory_order_relaxed))
+    return native;
+  void*& lib = libraries[es->library];
+  if(!lib)
+  {
+    lib = dlopen(es->library.length() ? es->library.c_str() : nullptr, RTLD_NOW);
+    if(!lib)
+    {
+      errMsgLoc(es, "couldn't load library " << es->library << ": " << dlerror());
+    }
+  }
+  void* sym = dlsym(lib, es->symbol.c_str());
+  if(!sym)
+  {
+    if(es->library.length())
+    {
+      errMsgLoc(es, "couldn't find symbol " << es->symbol << " in " << es->library);
+    }
+    errMsgLoc(es, "couldn't find symbol " << es->symbol);
+  }
+  es->native.store(sym, std::memory_order_release);
+  return sym;
+}
+
+//Get an array as a contiguous buffer of n bytes of C elements:
+//either the array's own storage, or a flat copy in temp
+static const uint8_t* arrayData(const Value& v, Type* elem, vector<uint8_t>& temp, size_t& n)
+{
+  ArrayObject* arr = asArray(v);
+  if(arr->isFlat())
+  {
+    n = arr->size() * arr->elemSize;
+    return arr->flatData();
+  }
+  ArrayObject flat(elem);
+  for(size_t i = 0; i < arr->size(); i++)
+    flat.push_back(arr->get(i));
+  temp.swap(flat.bytes);
+  n = temp.size();
+  return temp.data();
+}
+
+//All arguments go in registers, so any function can be called
+//through a pointer with every integer and float register as a parameter
+#define EXTERN_PARAMS int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, \
+  double, double, double, double, double, double, double, double
+#define EXTERN_ARGS ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], \
+  floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]
+
+typedef int64_t (*IntExtern)(EXTERN_PARAMS);
+typedef double (*DoubleExtern)(EXTERN_PARAMS);
+typedef float (*FloatExtern)(EXTERN_PARAMS);
+
+Value callExternal(ExternalSubroutine* es, const Value* args)
+{
+  void* native = es->native.load(std::memory_order_acquire);
+  if(!native)
+    native = resolveExtern(es);
+  int64_t ints[maxIntArgs] = {0};
+  double floats[maxFloatArgs] = {0};
+  int numInts = 0;
+  int numFloats = 0;
+  //temporary copies of arguments, which are freed when the call returns
+  vector<vector<uint8_t>> temps(es->type->paramTypes.size());
+  for(size_t i = 0; i < es->type->paramTypes.size(); i++)
+  {
+    const Value& arg = args[i];
+    Type* pt = canonicalize(es->type->paramTypes[i]);
+    if(auto ft = dynCast<FloatType>(pt))
+    {
+      double& slot = floats[numFloats++];
+      if(ft->size == 4)
+      {
+        //a float goes in the low bits of its register
+        memcpy(&slot, &arg.f, sizeof(float));
+      }
+      else
+        slot = arg.d;
+      continue;
+    }
+    int64_t& slot = ints[numInts++];
+    if(pt->isBool())
+      slot = arg.b;
+    else if(auto it = dynCast<IntegerType>(pt))
+      slot = it->isSigned ? arg.i : (int64_t) arg.u;
+    else if(pt->isChar())
+      slot = (uint8_t) arg.u;
+    else
+    {
+      Type* elem = externArrayElem(pt);
+      size_t n;
+      const uint8_t* data = arrayData(arg, elem, temps[i], n);
+      bool isString = elem->isChar();
+      if(es->paramBorrowed[i] && !isString)
+        slot = (int64_t) data;
+      else
+      {
+        //strings need a terminator, and the callee may modify
+        //an array that isn't const, so both are copied
+        vector<uint8_t> copy(data, data + n);
+        if(isString)
+          copy.push_back(0);
+        temps[i].swap(copy);
+        slot = (int64_t) temps[i].data();
+      }
+    }
+  }
+  Type* rt = canonicalize(es->type->returnType);
+  if(auto ft = dynCast<FloatType>(rt))
+  {
+    if(ft->size == 4)
+      return floatValue(((FloatExtern) native)(EXTERN_ARGS));
+    return doubleValue(((DoubleExtern) native)(EXTERN_ARGS));
+  }
+  int64_t result = ((IntExtern) native)(EXTERN_ARGS);
+  if(rt->isBool())
+    return boolValue((uint8_t) result != 0);
+  if(rt->isChar())
+    return uintValue((uint8_t) result);
+  if(auto it = dynCast<IntegerType>(rt))
+  {
+    //only the low bytes of the result are meaningful
+    int shift = 64 - 8 * it->size;
+    uint64_t low = (uint64_t) result << shift;
+    if(it->isSigned)
+      return intValue((int64_t) low >> shift);
+    return uintValue(low >> shift);
+  }
+  if(rt->isArray())
+  {
+    //string
+    ArrayObject* str = new ArrayObject(primitives[Prim::CHAR]);
+    const char* s = (const char*) result;
+    if(s)
+      str->bytes.assign(s, s + strlen(s));
+    return objectValue(str);
+  }
+  return Value();
+}
+
+#else
+
+Value callExternal(ExternalSubroutine* es, const Value*)
+{
+  errMsgLoc(es, "External calls aren't supported on this platform");
+  return Value();
+}
+
+#endif
+
@@ -0,0 +1,46 @@
+#ifndef FFI_H
+#define FFI_H
+
+#include "Common.hpp"
+#include "Value.hpp"
+
+/*****************************************************************************/
+// FFI: calling external (native) subroutines from the interpreter and VM
+//
+// An extern names its symbol as "library:symbol", or just "symbol" to search
+// the libraries already loaded by the process (libc, libm, ...):
+//
+//   func cos: extern double(x: double) "libm.so.6:cos"
+//
+// Each library is opened with dlopen once and shared by all externs, and each
+// extern resolves its symbol on its first call and keeps it.
+//
+// Arguments are passed according to their types:
+//   -integers, chars and bools: C integers of the same width
+//   -float and double: C float and double
+//   -char[]: NUL-terminated char*
+//   -other 1-dimensional arrays of primitives: pointer to the first element
+// An array parameter declared const is borrowed: the callee gets a view of
+// the array and must not modify it. Otherwise the callee gets a copy, which
+// it may modify. Either way, the pointer is only valid during the call: the
+// callee must not keep it.
+// The return type can be void, a primitive or char[] (copied from a
+// NUL-terminated string, which the callee keeps).
+//
+// All arguments are passed in registers (x86-64 System V and AArch64
+// calling conventions), so an extern can have at most 6 integer/pointer
+// parameters and 8 floating-point parameters.
+/*****************************************************************************/
+
+struct ExternalSubroutine;
+
+//Make sure the signature of es can be called (errors if not)
+void checkExternSignature(ExternalSubroutine* es);
+//Call es with the given arguments (one per parameter).
+//The symbol is called as a C function with a fixed parameter list, so it
+//can't be variadic (like printf): that isn't visible from the symbol, and
+//the variadic calling convention differs, so such a call is undefined.
+Value callExternal(ExternalSubroutine* es, const Value* args);
+
+#endif
+
@@ -0,0 +1,1077 @@
+#include "Jit.hpp"
+#include "Variable.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+#define JIT_SUPPORTED
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+//A raw value passed between the interpreter and native code
+//(the same as OnyxWord in the generated code)
+union JitWord
+{
+  int64_t i;
+  uint64_t u;
+  bool b;
+  float f;
+  double d;
+};
+
+//the most parameters a compiled subroutine can have
+const size_t maxNativeArgs = 16;
+
+//How values of a type are represented in C
+enum struct CKind
+{
+  NONE,
+  SINT,
+  UINT,
+  BOOL,
+  F32,
+  F64
+};
+
+//The representation of t (NONE if t can't be compiled), and
+//the size of t in bytes if it's an integer (chars behave as ubyte)
+static CKind cKind(Type* t, int* size = nullptr)
+{
+  t = canonicalize(t);
+  int bytes = 8;
+  CKind k = CKind::NONE;
+  if(auto it = dynCast<IntegerType>(t))
+  {
+    bytes = it->size;
+    k = it->isSigned ? CKind::SINT : CKind::UINT;
+  }
+  else if(t->isChar())
+  {
+    bytes = 1;
+    k = CKind::UINT;
+  }
+  else if(t->isBool())
+    k = CKind::BOOL;
+  else if(auto ft = dynCast<FloatType>(t))
+    k = ft->size == 4 ? CKind::F32 : CKind::F64;
+  if(size)
+    *size = bytes;
+  return k;
+}
+
+static bool isIntKind(CKind k)
+{
+  return k == CKind::SINT || k == CKind::UINT;
+}
+
+static bool isVoid(Type* t)
+{
+  return canonicalize(t) == primitives[Prim::VOID];
+}
+
+static string cType(CKind k)
+{
+  switch(k)
+  {
+    case CKind::SINT: return "int64_t";
+    case CKind::UINT: return "uint64_t";
+    case CKind::BOOL: return "bool";
+    case CKind::F32: return "float";
+    case CKind::F64: return "double";
+    default:;
+  }
+  INTERNAL_ERROR;
+  return "";
+}
+
+//The member of JitWord/OnyxWord holding a value of kind k
+static string wordField(CKind k)
+{
+  switch(k)
+  {
+    case CKind::SINT: return "i";
+    case CKind::UINT: return "u";
+    case CKind::BOOL: return "b";
+    case CKind::F32: return "f";
+    case CKind::F64: return "d";
+    default:;
+  }
+  INTERNAL_ERROR;
+  return "";
+}
+
+static Value wordValue(JitWord w, Type* t)
+{
+  switch(cKind(t))
+  {
+    case CKind::SINT: return intValue(w.i);
+    case CKind::UINT: return uintValue(w.u);
+    case CKind::BOOL: return boolValue(w.b);
+    case CKind::F32: return floatValue(w.f);
+    case CKind::F64: return doubleValue(w.d);
+    default:;
+  }
+  INTERNAL_ERROR;
+  return Value();
+}
+
+//A check in native code. When one fails, the interpreter
+//redoes the operation that failed to report the error.
+struct JitSite
+{
+  enum
+  {
+    //node is a BinaryArith (overflow, div by 0, negative shift)
+    ARITH,
+    //node is a Converted (value doesn't fit)
+    CONVERT,
+    //node is an Assertion
+    ASSERT,
+    //node is a Subroutine that reached its end without a return value
+    NO_RETURN,
+    //the native stack budget was exceeded
+    STACK
+  } kind;
+  Node* node;
+};
+
+//All sites of all generated code, indexed by the site numbers in the code.
+//Only used by the interpreter's thread (to generate code, and to report errors).
+static vector<JitSite> sites;
+
+//Called by native code (onyx_fail) when the check at site fails,
+//with the operands of the operation
+static void jitFail(int site, JitWord a, JitWord b)
+{
+  JitSite& s = sites[site];
+  switch(s.kind)
+  {
+    case JitSite::ARITH:
+    {
+      BinaryArith* ba = (BinaryArith*) s.node;
+      binaryOp(ba->op, wordValue(a, ba->lhs->type), wordValue(b, ba->rhs->type),
+          ba->type, ba->rhs->type, ba);
+      break;
+    }
+    case JitSite::CONVERT:
+    {
+      Converted* conv = (Converted*) s.node;
+      convertValue(wordValue(a, conv->value->type), conv->value->type, conv->type, conv);
+      break;
+    }
+    case JitSite::ASSERT:
+    {
+      Assertion* assertion = (Assertion*) s.node;
+      errMsgLoc(assertion, "Assertion failed: " << assertion->asserted);
+      break;
+    }
+    case JitSite::NO_RETURN:
+    {
+      errMsgLoc(s.node, "interpreter reached end of subroutine without a return value");
+      break;
+    }
+    case JitSite::STACK:
+    {
+      errMsg("Stack overflow: call depth exceeds the interpreter's stack budget (see --stack)");
+      break;
+    }
+  }
+  //the operation failed natively, so it must fail again here
+  INTERNAL_ERROR;
+}
+
+//Start of every generated C file
+static const char* prelude =
+  "#include <stdint.h>\n"
+  "#include <stdbool.h>\n"
+  "\n"
+  "typedef union {int64_t i; uint64_t u; bool b; float f; double d;} OnyxWord;\n"
+  "\n"
+  "//set by the interpreter once this is loaded\n"
+  "void (*onyx_fail)(int site, OnyxWord a, OnyxWord b);\n"
+  "uintptr_t onyx_stack_low;\n"
+  "\n"
+  "__attribute__((noreturn, cold)) static void onyx_error(int site, OnyxWord a, OnyxWord b)\n"
+  "{\n"
+  "  onyx_fail(site, a, b);\n"
+  "  __builtin_unreachable();\n"
+  "}\n"
+  "\n"
+  "static inline OnyxWord onyx_word_i(int64_t x) {OnyxWord w; w.i = x; return w;}\n"
+  "static inline OnyxWord onyx_word_u(uint64_t x) {OnyxWord w; w.u = x; return w;}\n"
+  "static inline OnyxWord onyx_word_b(bool x) {OnyxWord w; w.u = 0; w.b = x; return w;}\n"
+  "static inline OnyxWord onyx_word_f(float x) {OnyxWord w; w.u = 0; w.f = x; return w;}\n"
+  "static inline OnyxWord onyx_word_d(double x) {OnyxWord w; w.d = x; return w;}\n"
+  "static inline float onyx_float_bits(uint32_t u) {float f; __builtin_memcpy(&f, &u, 4); return f;}\n"
+  "static inline double onyx_double_bits(uint64_t u) {double d; __builtin_memcpy(&d, &u, 8); return d;}\n"
+  "\n";
+
+//Translates a subroutine and every subroutine it can call to C.
+//Anything that can't be translated clears ok (the rest of the
+//output is then meaningless).
+struct CGen
+{
+  CGen() : ok(true), subr(nullptr), numTemps(0), numLabels(0), indent(0) {}
+  //The whole C file for calling root
+  string generate(Subroutine* root);
+  bool ok;
+private:
+  //The name of subr's C function (queueing it to be generated)
+  string function(Subroutine* subr);
+  void genFunction();
+  void stmt(Statement* s);
+  //Evaluate e in the current function: returns a C operand
+  //(variable, temporary or constant) holding the value
+  string expr(Expression* e);
+  string constant(Expression* e);
+  string unary(UnaryArith* ua);
+  string binary(BinaryArith* ba);
+  string compare(BinaryArith* ba, const string& lhs, const string& rhs);
+  string convert(Converted* conv);
+  string call(CallExpr* ce);
+  //The C variable for a local or parameter
+  string var(Variable* v);
+  //A new temporary holding value
+  string temp(CKind k, const string& value);
+  string label();
+  //Emit code to report a failure at site if cond is true,
+  //passing the operation's operands (a and b) to the interpreter
+  void check(const string& cond, int site, const string& a, CKind ak, const string& b = "", CKind bk = CKind::NONE);
+  int addSite(int kind, Node* node);
+  void line(const string& s);
+  string reject()
+  {
+    ok = false;
+    return "0";
+  }
+  //prototypes and definitions of the functions
+  ostringstream decls;
+  ostringstream defs;
+  unordered_map<Subroutine*, string> names;
+  vector<Subroutine*> toGenerate;
+  //the function being generated
+  Subroutine* subr;
+  ostringstream code;
+  unordered_map<Variable*, string> vars;
+  vector<Variable*> locals;
+  //labels for continue and break in each enclosing loop
+  vector<pair<string, string>> loops;
+  int numTemps;
+  int numLabels;
+  int indent;
+};
+
+string CGen::generate(Subroutine* root)
+{
+  string entry = function(root);
+  for(size_t i = 0; ok && i < toGenerate.size(); i++)
+  {
+    subr = toGenerate[i];
+    genFunction();
+  }
+  if(!ok)
+    return "";
+  ostringstream src;
+  src << prelude << decls.str() << '\n' << defs.str();
+  //the entry point takes the arguments as words
+  src << "void onyx_entry(const OnyxWord* args, OnyxWord* result)\n{\n  ";
+  if(!isVoid(root->type->returnType))
+    src << "result->" << wordField(cKind(root->type->returnType)) << " = ";
+  src << entry << '(';
+  for(size_t i = 0; i < root->params.size(); i++)
+  {
+    if(i)
+      src << ", ";
+    src << "args[" << i << "]." << wordField(cKind(root->params[i]->type));
+  }
+  src << ");\n}\n";
+  return src.str();
+}
+
+string CGen::function(Subroutine* s)
+{
+  auto it = names.find(s);
+  if(it != names.end())
+    return it->second;
+  //methods need "this", which native code doesn't have
+  if(s->type->ownerStruct || s->params.size() > maxNativeArgs)
+    return reject();
+  for(auto p : s->params)
+  {
+    if(cKind(p->type) == CKind::NONE)
+      return reject();
+  }
+  Type* rt = s->type->returnType;
+  if(!isVoid(rt) && cKind(rt) == CKind::NONE)
+    return reject();
+  string name = "onyx_subr" + to_string(names.size());
+  names[s] = name;
+  toGenerate.push_back(s);
+  return name;
+}
+
+void CGen::genFunction()
+{
+  code.str("");
+  vars.clear();
+  locals.clear();
+  loops.clear();
+  indent = 1;
+  ostringstream header;
+  Type* rt = subr->type->returnType;
+  header << "static " << (isVoid(rt) ? "void" : cType(cKind(rt))) << ' ' << names[subr] << '(';
+  for(size_t i = 0; i < subr->params.size(); i++)
+  {
+    Variable* p = subr->params[i];
+    vars[p] = "p" + to_string(i);
+    if(i)
+      header << ", ";
+    header << cType(cKind(p->type)) << ' ' << vars[p];
+  }
+  header << ')';
+  for(auto s : subr->body->stmts)
+    stmt(s);
+  if(!isVoid(rt))
+    line("onyx_error(" + to_string(addSite(JitSite::NO_RETURN, subr)) + ", onyx_word_u(0), onyx_word_u(0));");
+  decls << header.str() << ";\n";
+  defs << header.str() << "\n{\n";
+  defs << "  if((uintptr_t) __builtin_frame_address(0) < onyx_stack_low)\n";
+  defs << "    onyx_error(" << addSite(JitSite::STACK, subr) << ", onyx_word_u(0), onyx_word_u(0));\n";
+  //every local is assigned by its declaration before it can be read
+  for(auto v : locals)
+    defs << "  " << cType(cKind(v->type)) << ' ' << vars[v] << " = 0;\n";
+  //(a call to this in a return statement jumps back here)
+  defs << "onyx_top:;\n" << code.str() << "}\n\n";
+}
+
+void CGen::line(const string& s)
+{
+  for(int i = 0; i < indent; i++)
+    code << "  ";
+  code << s << '\n';
+}
+
+string CGen::temp(CKind k, const string& value)
+{
+  string t = "t" + to_string(numTemps++);
+  line(cType(k) + ' ' + t + " = " + value + ';');
+  return t;
+}
+
+string CGen::label()
+{
+  return "onyx_l" + to_string(numLabels++);
+}
+
+int CGen::addSite(int kind, Node* node)
+{
+  JitSite s;
+  s.kind = (decltype(s.kind)) kind;
+  s.node = node;
+  sites.push_back(s);
+  return sites.size() - 1;
+}
+
+void CGen::check(const string& cond, int site, const string& a, CKind ak, const string& b, CKind bk)
+{
+  string words = bk == CKind::NONE ? "onyx_word_u(0)" : "onyx_word_" + wordField(bk) + '(' + b + ')';
+  line("if(" + cond + ")");
+  line("  onyx_error(" + to_string(site) + ", onyx_word_" + wordField(ak) + '(' + a + "), " + words + ");");
+}
+
+string CGen::var(Variable* v)
+{
+  auto it = vars.find(v);
+  if(it != vars.end())
+    return it->second;
+  if(!v->isLocal() || cKind(v->type) == CKind::NONE)
+    return reject();
+  string name = "v" + to_string(locals.size());
+  vars[v] = name;
+  locals.push_back(v);
+  return name;
+}
+
+void CGen::stmt(Statement* s)
+{
+  if(!ok)
+    return;
+  switch(s->kind)
+  {
+    case NodeKind::Assign:
+    {
+      Assign* a = (Assign*) s;
+      auto ve = dynCast<VarExpr>(a->lvalue);
+      if(!ve || cKind(ve->type) != cKind(a->rvalue->type))
+      {
+        reject();
+        break;
+      }
+      string value = expr(a->rvalue);
+      line(var(ve->var) + " = " + value + ';');
+      break;
+    }
+    case NodeKind::Block:
+    {
+      for(auto bs : ((Block*) s)->stmts)
+        stmt(bs);
+      break;
+    }
+    case NodeKind::CallStmt:
+    {
+      expr(((CallStmt*) s)->eval);
+      break;
+    }
+    case NodeKind::If:
+    {
+      If* i = (If*) s;
+      string cond = expr(i->condition);
+      line("if(" + cond + ")");
+      line("{");
+      indent++;
+      stmt(i->body);
+      indent--;
+      line("}");
+      if(i->elseBody)
+      {
+        line("else");
+        line("{");
+        indent++;
+        stmt(i->elseBody);
+        indent--;
+        line("}");
+      }
+      break;
+    }
+    case NodeKind::While:
+    case NodeKind::ForC:
+    case NodeKind::ForRange:
+    {
+      //loop body, then the continue label and the increment
+      Expression* cond = nullptr;
+      Statement* body = nullptr;
+      Statement* increment = nullptr;
+      string counter;
+      if(auto w = dynCast<While>(s))
+      {
+        cond = w->condition;
+        body = w->body;
+      }
+      else if(auto fc = dynCast<ForC>(s))
+      {
+        if(fc->init)
+          stmt(fc->init);
+        cond = fc->condition;
+        body = fc->inner;
+        increment = fc->increment;
+      }
+      else
+      {
+        ForRange* fr = (ForRange*) s;
+        if(cKind(fr->counter->type) != CKind::SINT || cKind(fr->begin->type) != CKind::SINT ||
+            cKind(fr->end->type) != CKind::SINT)
+        {
+          reject();
+          break;
+        }
+        string begin = expr(fr->begin);
+        counter = var(fr->counter);
+        line(counter + " = " + begin + ';');
+        body = fr->inner;
+      }
+      string cont = label();
+      string brk = label();
+      line("while(true)");
+      line("{");
+      indent++;
+      if(cond)
+      {
+        string c = expr(cond);
+        line("if(!" + c + ")");
+        line("  goto " + brk + ';');
+      }
+      else if(counter.length())
+      {
+        //the end of a range is evaluated before each iteration
+        string end = expr(((ForRange*) s)->end);
+        line("if(" + counter + " >= " + end + ")");
+        line("  goto " + brk + ';');
+      }
+      loops.emplace_back(cont, brk);
+      stmt(body);
+      loops.pop_back();
+      line(cont + ":;");
+      if(increment)
+        stmt(increment);
+      if(counter.length())
+        line(counter + " = (int64_t) ((uint64_t) " + counter + " + 1);");
+      indent--;
+      line("}");
+      line(brk + ":;");
+      break;
+    }
+    case NodeKind::Return:
+    {
+      Return* r = (Return*) s;
+      if(!r->value)
+      {
+        line("return;");
+        break;
+      }
+      auto ce = dynCast<CallExpr>(r->value);
+      if(ce && !dynCast<StructMem>(ce->callable))
+      {
+        //The interpreter reuses the frame for a call in a return statement,
+        //so such calls can recurse without a bound. Only calls to the same
+        //subroutine are compiled, as a jump back to its start.
+        auto se = dynCast<SubroutineExpr>(ce->callable);
+        if(!se || se->subr != subr || ce->args.size() != subr->params.size())
+        {
+          reject();
+          break;
+        }
+        //evaluate all the args before assigning any parameter
+        vector<string> args;
+        for(size_t i = 0; i < ce->args.size(); i++)
+        {
+          CKind k = cKind(subr->params[i]->type);
+          if(cKind(ce->args[i]->type) != k)
+            reject();
+          args.push_back(temp(k, expr(ce->args[i])));
+        }
+        for(size_t i = 0; i < args.size(); i++)
+          line(vars[subr->params[i]] + " = " + args[i] + ';');
+        line("goto onyx_top;");
+        break;
+      }
+      if(cKind(r->value->type) != cKind(subr->type->returnType))
+      {
+        reject();
+        break;
+      }
+      line("return " + expr(r->value) + ';');
+      break;
+    }
+    case NodeKind::Break:
+    case NodeKind::Continue:
+    {
+      if(loops.empty())
+      {
+        reject();
+        break;
+      }
+      bool isBreak = s->kind == NodeKind::Break;
+      line("goto " + (isBreak ? loops.back().second : loops.back().first) + ';');
+      break;
+    }
+    case NodeKind::Assertion:
+    {
+      Assertion* a = (Assertion*) s;
+      string cond = expr(a->asserted);
+      check("!" + cond, addSite(JitSite::ASSERT, a), "0", CKind::UINT);
+      break;
+    }
+    default:
+      //prints, globals, switch, match and array loops stay interpreted
+      reject();
+  }
+}
+
+string CGen::expr(Expression* e)
+{
+  if(!ok)
+    return "0";
+  if(e->constant())
+    return constant(e);
+  switch(e->kind)
+  {
+    case NodeKind::VarExpr:
+      return var(((VarExpr*) e)->var);
+    case NodeKind::UnaryArith:
+      return unary((UnaryArith*) e);
+    case NodeKind::BinaryArith:
+      return binary((BinaryArith*) e);
+    case NodeKind::Converted:
+      return convert((Converted*) e);
+    case NodeKind::CallExpr:
+      return call((CallExpr*) e);
+    default:;
+  }
+  return reject();
+}
+
+string CGen::constant(Expression* e)
+{
+  char buf[64];
+  if(auto ic = dynCast<IntConstant>(e))
+  {
+    CKind k = cKind(ic->type);
+    if(k == CKind::SINT)
+    {
+      if(ic->sval == numeric_limits<int64_t>::min())
+        return "INT64_MIN";
+      snprintf(buf, sizeof(buf), "INT64_C(%lld)", (long long) ic->sval);
+    }
+    else if(k == CKind::UINT)
+      snprintf(buf, sizeof(buf), "UINT64_C(%llu)", (unsigned long long) ic->uval);
+    else
+      return reject();
+    return buf;
+  }
+  else if(auto fc = dynCast<FloatConstant>(e))
+  {
+    //exact bits, which also works for infinities
+    if(fc->isDoublePrec())
+    {
+      uint64_t bits;
+      memcpy(&bits, &fc->dp, 8);
+      snprintf(buf, sizeof(buf), "onyx_double_bits(UINT64_C(0x%llx))", (unsigned long long) bits);
+    }
+    else
+    {
+      uint32_t bits;
+      memcpy(&bits, &fc->fp, 4);
+      snprintf(buf, sizeof(buf), "onyx_float_bits(0x%xu)", (unsigned) bits);
+    }
+    return buf;
+  }
+  else if(auto bc = dynCast<BoolConstant>(e))
+    return bc->value ? "true" : "false";
+  return reject();
+}
+
+string CGen::unary(UnaryArith* ua)
+{
+  CKind k = cKind(ua->expr->type);
+  if(k == CKind::NONE || cKind(ua->type) != k)
+    return reject();
+  string v = expr(ua->expr);
+  switch(ua->op)
+  {
+    case LNOT:
+      if(k == CKind::BOOL)
+        return temp(k, "!" + v);
+      break;
+    case BNOT:
+      if(isIntKind(k))
+        return temp(k, '(' + cType(k) + ") ~(uint64_t) " + v);
+      break;
+    case SUB:
+      if(isIntKind(k))
+        return temp(k, '(' + cType(k) + ") -(uint64_t) " + v);
+      else if(k != CKind::BOOL)
+        return temp(k, "-" + v);
+      break;
+    default:;
+  }
+  return reject();
+}
+
+string CGen::binary(BinaryArith* ba)
+{
+  int op = ba->op;
+  CKind lk = cKind(ba->lhs->type);
+  CKind rk = cKind(ba->rhs->type);
+  if(lk == CKind::NONE || rk == CKind::NONE)
+    return reject();
+  if(op == LAND || op == LOR)
+  {
+    //short-circuit
+    string result = temp(CKind::BOOL, expr(ba->lhs));
+    line(op == LAND ? "if(" + result + ")" : "if(!" + result + ")");
+    line("{");
+    indent++;
+    string rhs = expr(ba->rhs);
+    line(result + " = " + rhs + ';');
+    indent--;
+    line("}");
+    return result;
+  }
+  string lhs = expr(ba->lhs);
+  string rhs = expr(ba->rhs);
+  if(op == CMPEQ || op == CMPNEQ || op == CMPL || op == CMPG || op == CMPLE || op == CMPGE)
+    return compare(ba, lhs, rhs);
+  //arithmetic, like binaryOp
+  int size;
+  CKind k = cKind(ba->type, &size);
+  int site = addSite(JitSite::ARITH, ba);
+  if(k == CKind::F32 || k == CKind::F64)
+  {
+    if(lk != k || rk != k)
+      return reject();
+    const char* oper = nullptr;
+    switch(op)
+    {
+      case PLUS: oper = " + "; break;
+      case SUB: oper = " - "; break;
+      case MUL: oper = " * "; break;
+      case DIV:
+        check(rhs + " == 0", site, lhs, lk, rhs, rk);
+        oper = " / ";
+        break;
+      default:
+        return reject();
+    }
+    return temp(k, lhs + oper + rhs);
+  }
+  if(!isIntKind(k) || !isIntKind(lk) || !isIntKind(rk))
+    return reject();
+  //done on the raw 64 bits, then checked for overflow of narrower types
+  string ul = "(uint64_t) " + lhs;
+  string ur = "(uint64_t) " + rhs;
+  string sl = "(int64_t) " + lhs;
+  string sr = "(int64_t) " + rhs;
+  bool isSigned = k == CKind::SINT;
+  string value;
+  switch(op)
+  {
+    case PLUS: value = ul + " + " + ur; break;
+    case SUB: value = ul + " - " + ur; break;
+    case MUL: value = ul + " * " + ur; break;
+    case BOR: value = ul + " | " + ur; break;
+    case BXOR: value = ul + " ^ " + ur; break;
+    case BAND: value = ul + " & " + ur; break;
+    case DIV:
+    case MOD:
+    {
+      check(ur + " == 0", site, lhs, lk, rhs, rk);
+      const char* oper = op == DIV ? " / " : " % ";
+      value = isSigned ? sl + oper + sr : ul + oper + ur;
+      break;
+    }
+    case SHL:
+    case SHR:
+    {
+      if(rk == CKind::SINT)
+        check(sr + " < 0", site, lhs, lk, rhs, rk);
+      //(the shift count is masked like the hardware does)
+      string bits = "(" + ur + " & 63)";
+      if(op == SHL)
+        value = ul + " << " + bits;
+      else
+        value = (isSigned ? sl : ul) + " >> " + bits;
+      break;
+    }
+    default:
+      return reject();
+  }
+  string result = temp(k, '(' + cType(k) + ") (" + value + ')');
+  if(size < 8)
+  {
+    string bits = to_string(size * 8);
+    if(isSigned)
+      check(result + " < INT" + bits + "_MIN || " + result + " > INT" + bits + "_MAX", site, lhs, lk, rhs, rk);
+    else
+      check(result + " > UINT" + bits + "_MAX", site, lhs, lk, rhs, rk);
+  }
+  return result;
+}
+
+//"lhs < rhs" like valueLess (which goes by the kind of lhs)
+static string lessThan(CKind k, const string& lhs, const string& rhs)
+{
+  if(k == CKind::BOOL)
+    return "(!" + lhs + " && " + rhs + ')';
+  if(isIntKind(k))
+    return "((" + cType(k) + ") " + lhs + " < (" + cType(k) + ") " + rhs + ')';
+  return '(' + lhs + " < " + rhs + ')';
+}
+
+string CGen::compare(BinaryArith* ba, const string& lhs, const string& rhs)
+{
+  CKind lk = cKind(ba->lhs->type);
+  CKind rk = cKind(ba->rhs->type);
+  //values of different kinds are never equal, and
+  //only integers can be ordered against the other kind
+  if(lk != rk && !(isIntKind(lk) && isIntKind(rk)))
+  {
+    if(ba->op == CMPEQ)
+      return "false";
+    else if(ba->op == CMPNEQ)
+      return "true";
+    return reject();
+  }
+  switch(ba->op)
+  {
+    case CMPEQ:
+      return temp(CKind::BOOL, lk != rk ? "false" : lhs + " == " + rhs);
+    case CMPNEQ:
+      return temp(CKind::BOOL, lk != rk ? "true" : lhs + " != " + rhs);
+    case CMPL:
+      return temp(CKind::BOOL, lessThan(lk, lhs, rhs));
+    case CMPG:
+      return temp(CKind::BOOL, lessThan(rk, rhs, lhs));
+    case CMPLE:
+      return temp(CKind::BOOL, "!" + lessThan(rk, rhs, lhs));
+    case CMPGE:
+      return temp(CKind::BOOL, "!" + lessThan(lk, lhs, rhs));
+    default:;
+  }
+  return reject();
+}
+
+string CGen::convert(Converted* conv)
+{
+  Type* src = canonicalize(conv->value->type);
+  Type* dst = canonicalize(conv->type);
+  int size;
+  CKind sk = cKind(src);
+  CKind dk = cKind(dst, &size);
+  if(sk == CKind::NONE || dk == CKind::NONE)
+    return reject();
+  string v = expr(conv->value);
+  if(src == dst || typesSame(src, dst))
+    return sk == dk ? v : reject();
+  if(sk == CKind::BOOL || dk == CKind::BOOL)
+    return reject();
+  int site = addSite(JitSite::CONVERT, conv);
+  //the checks of convertInt and convertFloat
+  string bits = to_string(size * 8);
+  if(isIntKind(sk))
+  {
+    if(!isIntKind(dk))
+      return temp(dk, '(' + cType(dk) + ") " + v);
+    string fail;
+    if(sk == CKind::SINT && dk == CKind::UINT)
+      fail = "(int64_t) " + v + " < 0";
+    else if(sk == CKind::UINT && dk == CKind::SINT)
+      fail = "(uint64_t) " + v + " > (uint64_t) INT64_MAX";
+    if(size < 8)
+    {
+      if(fail.length())
+        fail += " || ";
+      if(dk == CKind::SINT)
+        fail += "(int64_t) " + v + " < INT" + bits + "_MIN || (int64_t) " + v + " > INT" + bits + "_MAX";
+      else
+        fail += "(uint64_t) " + v + " > UINT" + bits + "_MAX";
+    }
+    if(fail.length())
+      check(fail, site, v, sk);
+    return temp(dk, '(' + cType(dk) + ") " + v);
+  }
+  if(!isIntKind(dk))
+    return temp(dk, '(' + cType(dk) + ") " + v);
+  string d = temp(CKind::F64, "(double) " + v);
+  if(dst->isChar())
+  {
+    check(d + " < 0 || " + d + " >= 256.0", site, v, sk);
+    return temp(dk, "(uint64_t) " + d);
+  }
+  if(dk == CKind::SINT)
+    check(d + " < (double) INT64_MIN || " + d + " > (double) INT64_MAX", site, v, sk);
+  else
+    check(d + " < 0 || " + d + " > (double) UINT64_MAX", site, v, sk);
+  string result = temp(dk, '(' + cType(dk) + ") " + d);
+  if(size < 8)
+  {
+    if(dk == CKind::SINT)
+      check(result + " < INT" + bits + "_MIN || " + result + " > INT" + bits + "_MAX", site, v, sk);
+    else
+      check(result + " > UINT" + bits + "_MAX", site, v, sk);
+  }
+  return result;
+}
+
+string CGen::call(CallExpr* ce)
+{
+  auto se = dynCast<SubroutineExpr>(ce->callable);
+  Subroutine* callee = se ? dynCast<Subroutine>(se->subr) : nullptr;
+  if(!callee || ce->args.size() != callee->params.size())
+    return reject();
+  string f = function(callee);
+  //args are evaluated in order (each call is stored in a temporary)
+  string args;
+  for(size_t i = 0; ok && i < ce->args.size(); i++)
+  {
+    if(cKind(ce->args[i]->type) != cKind(callee->params[i]->type))
+      return reject();
+    if(i)
+      args += ", ";
+    args += expr(ce->args[i]);
+  }
+  if(isVoid(callee->type->returnType))
+  {
+    line(f + '(' + args + ");");
+    return "";
+  }
+  return temp(cKind(callee->type->returnType), f + '(' + args + ')');
+}
+
+/*******/
+/* Jit */
+/*******/
+
+JitEntry::JitEntry() : calls(0), nativeCalls(0), rejected(false), queued(false), native(nullptr), failed(false)
+{}
+
+//The Jit whose compiler thread is stopped when the program exits
+//(so that an error can't exit before the compiler's output is deleted)
+static Jit* exitingJit = nullptr;
+
+static void stopAtExit()
+{
+  if(exitingJit)
+    exitingJit->stop();
+}
+
+Jit::Jit(uint64_t t) : threshold(t), stackLow(0), stopping(false)
+{
+  if(!exitingJit)
+    atexit(stopAtExit);
+  exitingJit = this;
+}
+
+Jit::~Jit()
+{
+  stop();
+  exitingJit = nullptr;
+#ifdef JIT_SUPPORTED
+  for(auto m : modules)
+    dlclose(m);
+#endif
+}
+
+void Jit::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(jobsLock);
+    stopping = true;
+  }
+  jobsReady.notify_one();
+  if(compiler.joinable())
+    compiler.join();
+}
+
+void Jit::setStackLimit(uintptr_t low)
+{
+  stackLow = low;
+}
+
+bool Jit::call(Subroutine* subr, vector<Value>& args, Value& result)
+{
+  JitEntry& entry = entries[subr];
+  NativeEntry native = entry.native.load(std::memory_order_acquire);
+  if(!native)
+  {
+    if(++entry.calls == threshold)
+      compile(subr, entry);
+    return false;
+  }
+  if(args.size() != subr->params.size())
+    return false;
+  entry.nativeCalls++;
+  JitWord words[maxNativeArgs];
+  for(size_t i = 0; i < args.size(); i++)
+    words[i].u = args[i].u;
+  JitWord rv;
+  rv.u = 0;
+  native(words, &rv);
+  Type* rt = subr->type->returnType;
+  result = isVoid(rt) ? Value() : wordValue(rv, rt);
+  return true;
+}
+
+void Jit::compile(Subroutine* subr, JitEntry& entry)
+{
+#ifdef JIT_SUPPORTED
+  CGen gen;
+  string source = gen.generate(subr);
+  if(!gen.ok)
+  {
+    entry.rejected = true;
+    return;
+  }
+  entry.queued = true;
+  if(!compiler.joinable())
+    compiler = std::thread(&Jit::compileLoop, this);
+  {
+    std::lock_guard<std::mutex> lock(jobsLock);
+    jobs.push_back({&entry, source});
+  }
+  jobsReady.notify_one();
+#else
+  entry.rejected = true;
+#endif
+}
+
+void Jit::compileLoop()
+{
+  while(true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(jobsLock);
+      jobsReady.wait(lock, [this] {return stopping || jobs.size();});
+      if(stopping)
+        return;
+      job = jobs.front();
+      jobs.pop_front();
+    }
+    NativeEntry native = build(job);
+    if(native)
+      job.entry->native.store(native, std::memory_order_release);
+    else
+      job.entry->failed = true;
+  }
+}
+
+NativeEntry Jit::build(Job& job)
+{
+#ifdef JIT_SUPPORTED
+  //the compiler reads the source from a pipe, and its output
+  //is deleted as soon as it's loaded
+  char soFile[] = "/tmp/onyx-jit-XXXXXX.so";
+  int fd = mkstemps(soFile, 3);
+  if(fd < 0)
+    return nullptr;
+  close(fd);
+  const char* cc = getenv("CC");
+  //No FP contraction: operations must round like the interpreter's.
+  //No tail call optimization either: every call must check the stack,
+  //or recursion that overflows in the interpreter could run forever.
+  string command = string(cc && *cc ? cc : "cc") +
+    " -std=gnu99 -O2 -w -shared -fPIC -fexceptions -ffp-contract=off -fno-optimize-sibling-calls -o " +
+    soFile + " -x c - > /dev/null 2>&1";
+  FILE* compilerIn = popen(command.c_str(), "w");
+  int status = -1;
+  if(compilerIn)
+  {
+    fwrite(job.source.data(), 1, job.source.size(), compilerIn);
+    status = pclose(compilerIn);
+  }
+  void* module = status == 0 ? dlopen(soFile, RTLD_NOW | RTLD_LOCAL) : nullptr;
+  unlink(soFile);
+  if(!module)
+    return nullptr;
+  modules.push_back(module);
+  auto entry = (NativeEntry) dlsym(module, "onyx_entry");
+  auto fail = (void (**)(int, JitWord, JitWord)) dlsym(module, "onyx_fail");
+  auto low = (uintptr_t*) dlsym(module, "onyx_stack_low");
+  if(!entry || !fail || !low)
+    return nullptr;
+  *fail = jitFail;
+  *low = stackLow;
+  return entry;
+#else
+  return nullptr;
+#endif
+}
+
+void Jit::printStats(ostream& os)
+{
+  for(auto& e : entries)
+  {
+    JitEntry& entry = e.second;
+    if(entry.native.load())
+    {
+      os << "Compiled " << e.first->name() << ": " << entry.calls << " calls interpreted, " <<
+        entry.nativeCalls << " native\n";
+    }
+    else if(entry.failed)
+      os << "Couldn't compile " << e.first->name() << '\n';
+    else if(entry.rejected)
+      os << "Not compiling " << e.first->name() << " (it isn't self-contained)\n";
+  }
+}
+
@@ -0,0 +1,98 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "Common.hpp"
+#include "Subroutine.hpp"
+#include "Value.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/*****************************************************************************/
+// Jit: tiered execution of hot subroutines as native code (--jit <N>)
+//
+// The interpreter counts the calls to each subroutine. Once one has been
+// called N times, it's translated to C (along with every subroutine it can
+// call), and a background thread compiles that with the system's C compiler
+// ($CC, or cc) into a shared object and loads it with dlopen. Until then,
+// calls are interpreted as usual; after, they go to the native code.
+//
+// Only self-contained subroutines are compiled: not methods, with integer,
+// char, bool and float parameters, locals and return values, and bodies that
+// only compute (no prints, globals, arrays, switches, ...) and call other
+// such subroutines. Anything else just stays interpreted.
+//
+// The C code keeps the interpreter's semantics: 64-bit arithmetic wraps, and
+// narrower arithmetic, conversions, division and assertions are checked.
+// When a check fails, the native code calls back into the interpreter to
+// redo the failing operation, so the error is exactly the interpreter's.
+// Recursion is limited by the same native stack budget (--stack), but native
+// frames are smaller, so compiled code can recurse deeper.
+/*****************************************************************************/
+
+//A subroutine's compiled code, called with its arguments (as raw
+//words, in order) and storing its result
+typedef void (*NativeEntry)(const void* args, void* result);
+
+struct JitEntry
+{
+  JitEntry();
+  //calls interpreted, and calls to the native code
+  uint64_t calls;
+  uint64_t nativeCalls;
+  //can't be compiled (decided when it became hot)
+  bool rejected;
+  //code has been generated and queued for the compiler
+  bool queued;
+  //set by the compiler thread once the code is loaded
+  std::atomic<NativeEntry> native;
+  //set by the compiler thread if the C compiler failed
+  std::atomic<bool> failed;
+};
+
+struct Jit
+{
+  //threshold is the number of calls after which a subroutine is compiled
+  Jit(uint64_t threshold);
+  ~Jit();
+  //Stop the compiler thread, waiting for the compile in
+  //progress if there is one (queued ones are dropped)
+  void stop();
+  //Native code may use the native stack down to (not including) this address
+  void setStackLimit(uintptr_t low);
+  //Count a call to subr. If subr has been compiled, call its
+  //native code with args and return true (with the result in result).
+  bool call(Subroutine* subr, vector<Value>& args, Value& result);
+  //Print each subroutine that was compiled, and how often it ran natively
+  void printStats(ostream& os);
+private:
+  struct Job
+  {
+    JitEntry* entry;
+    string source;
+  };
+  //Generate code for subr and queue it (or reject it)
+  void compile(Subroutine* subr, JitEntry& entry);
+  //Body of the compiler thread
+  void compileLoop();
+  //Compile and load one job, returning its entry point (or nullptr)
+  NativeEntry build(Job& job);
+  uint64_t threshold;
+  uintptr_t stackLow;
+  //(an element's address never changes, so the compiler thread can publish
+  //into entries while more are added)
+  unordered_map<Subroutine*, JitEntry> entries;
+  //jobs for the compiler thread
+  std::deque<Job> jobs;
+  std::mutex jobsLock;
+  std::condition_variable jobsReady;
+  bool stopping;
+  //handles of the loaded shared objects
+  vector<void*> modules;
+  std::thread compiler;
+};
+
+#endif
+
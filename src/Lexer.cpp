@@ -10,7 +10,7 @@ char getEscapedChar(char ident);
 
 struct CodeStream
 {
-  CodeStream(string& srcIn, vector<Token*>& toksIn, int file) : src(srcIn), toks(toksIn)
+  CodeStream(string& srcIn, vector<Token*>& toksIn, int file, int firstLine) : src(srcIn), toks(toksIn)
   {
     iter = 0;
     //no error can happen with iter at 0,
@@ -18,7 +18,7 @@ struct CodeStream
     prevLine = 0;
     prevCol = 0;
     fileID = file;
-    line = 1;
+    line = firstLine;
     col = 1;
   }
   char getNext()
@@ -90,10 +90,10 @@ struct CodeStream
   int nextTokCol;
 };
 
-vector<Token*> lex(string code, int file)
+vector<Token*> lex(string code, int file, int firstLine)
 {
   vector<Token*> tokList;
-  CodeStream cs(code, tokList, file);
+  CodeStream cs(code, tokList, file, firstLine);
   //note: i is incremented various amounts depending on the tokens
   while(cs)
   {
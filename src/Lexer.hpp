@@ -1,6 +1,6 @@
 #include "Token.hpp"
 
 //Lex source file contents
-//All tokens have the given file ID
-vector<Token*> lex(string code, int file);
+//All tokens have the given file ID, and code starts at line firstLine
+vector<Token*> lex(string code, int file, int firstLine = 1);
 
@@ -0,0 +1,97 @@
+#include "Memo.hpp"
+
+//Every this many lookups, check the table's hit rate
+const uint64_t memoCheckInterval = 1024;
+//Stop memoizing a subroutine if fewer than 1 in this many lookups hit
+const uint64_t memoMinHitRatio = 8;
+
+size_t ArgsHash::operator()(const vector<Value>* args) const
+{
+  FNV1A f;
+  for(auto& a : *args)
+    f.pump(hashValue(a));
+  return f.get();
+}
+
+bool ArgsEqual::operator()(const vector<Value>* lhs, const vector<Value>* rhs) const
+{
+  if(lhs->size() != rhs->size())
+    return false;
+  for(size_t i = 0; i < lhs->size(); i++)
+  {
+    if(!valuesEqual((*lhs)[i], (*rhs)[i]))
+      return false;
+  }
+  return true;
+}
+
+MemoTable::MemoTable()
+{
+  hits = 0;
+  misses = 0;
+  bypassed = false;
+  capacity = 0;
+}
+
+Value* MemoTable::find(vector<Value>& args)
+{
+  auto it = index.find(&args);
+  if(it == index.end())
+  {
+    misses++;
+    if((hits + misses) % memoCheckInterval == 0 && hits * memoMinHitRatio < hits + misses)
+    {
+      bypassed = true;
+      index.clear();
+      entries.clear();
+    }
+    return nullptr;
+  }
+  hits++;
+  //move the entry to the front
+  entries.splice(entries.begin(), entries, it->second);
+  return &it->second->second;
+}
+
+void MemoTable::insert(vector<Value>& args, const Value& result)
+{
+  if(bypassed)
+    return;
+  if(entries.size() == capacity)
+  {
+    //evict the least recently used
+    index.erase(&entries.back().first);
+    entries.pop_back();
+  }
+  entries.emplace_front(args, result);
+  index[&entries.front().first] = entries.begin();
+}
+
+Memoizer::Memoizer(size_t cap) : capacity(cap)
+{}
+
+MemoTable* Memoizer::newTable(Subroutine* subr)
+{
+  MemoTable& table = tables[subr];
+  table.capacity = capacity;
+  //not memoizable: mark it bypassed so the lookup fails quickly next time
+  if(!subr->type->pure || subr->decl->owner)
+    table.bypassed = true;
+  return table.bypassed ? nullptr : &table;
+}
+
+void Memoizer::printStats(ostream& os)
+{
+  for(auto& t : tables)
+  {
+    MemoTable& table = t.second;
+    uint64_t lookups = table.hits + table.misses;
+    if(!lookups)
+      continue;
+    os << "Memoized " << t.first->name() << ": " << table.hits << " hits, " << table.misses << " misses";
+    if(table.bypassed)
+      os << " (disabled for low hit rate)";
+    os << '\n';
+  }
+}
+
@@ -0,0 +1,73 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "Common.hpp"
+#include "Subroutine.hpp"
+#include "Value.hpp"
+#include <list>
+
+/*****************************************************************************/
+// Memo: memoization of pure (func) calls in the interpreter (--memo <N>)
+//
+// Each memoized subroutine has a table from argument values to the result,
+// holding at most N entries and evicting the least recently used. Values are
+// copy-on-write, so keeping arguments and results in a table is cheap.
+//
+// Only funcs called without "this" are memoized: a method's result can
+// depend on its object. A table stops being used (and frees its entries)
+// once enough calls have shown that its hit rate is too low to pay for
+// hashing the arguments.
+/*****************************************************************************/
+
+struct ArgsHash
+{
+  size_t operator()(const vector<Value>* args) const;
+};
+
+struct ArgsEqual
+{
+  bool operator()(const vector<Value>* lhs, const vector<Value>* rhs) const;
+};
+
+struct MemoTable
+{
+  MemoTable();
+  //Look up the result for args. Returns nullptr on a miss.
+  Value* find(vector<Value>& args);
+  //Add the result of a call which missed
+  void insert(vector<Value>& args, const Value& result);
+  uint64_t hits;
+  uint64_t misses;
+  //Whether the table was abandoned for a low hit rate
+  bool bypassed;
+  size_t capacity;
+private:
+  typedef std::list<pair<vector<Value>, Value>> EntryList;
+  //entries, most recently used first
+  EntryList entries;
+  //the key of each entry points to its args in entries
+  unordered_map<const vector<Value>*, EntryList::iterator, ArgsHash, ArgsEqual> index;
+};
+
+struct Memoizer
+{
+  //capacity is the maximum number of entries per table
+  Memoizer(size_t capacity);
+  //The table for calls to subr, or nullptr if subr isn't memoized
+  MemoTable* tableFor(Subroutine* subr)
+  {
+    auto it = tables.find(subr);
+    if(it == tables.end())
+      return newTable(subr);
+    return it->second.bypassed ? nullptr : &it->second;
+  }
+  //Print each memoized subroutine's hits and misses
+  void printStats(ostream& os);
+private:
+  MemoTable* newTable(Subroutine* subr);
+  unordered_map<Subroutine*, MemoTable> tables;
+  size_t capacity;
+};
+
+#endif
+
@@ -9,6 +9,16 @@ Options getDefaultOptions()
   op.output = "";
   op.verbose = false;
   op.interactive = false;
+  op.useVM = false;
+  op.flush = "";
+  op.stackSize = 256 << 20;
+  op.profile = "";
+  op.memo = 0;
+  op.jit = 0;
+  op.runTests = false;
+  op.testThreads = 0;
+  op.bench = "";
+  op.cacheDir = "";
   return op;
 }
 
@@ -37,6 +47,64 @@ Options parseOptions(int argc, const char** argv)
       op.emitC = true;
     else if(!strcmp(argv[a], "-v"))
       op.verbose = true;
+    else if(!strcmp(argv[a], "--vm"))
+      op.useVM = true;
+    else if(!strcmp(argv[a], "--test"))
+      op.runTests = true;
+    else if(!strcmp(argv[a], "-j") && a + 1 < argc)
+    {
+      op.testThreads = atoi(argv[++a]);
+      if(op.testThreads <= 0)
+      {
+        puts("Error: -j expects a number of threads.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if(!strcmp(argv[a], "--bench") && a + 1 < argc)
+    {
+      op.bench = argv[++a];
+      if(op.bench != "csv" && op.bench != "json")
+      {
+        puts("Error: --bench expects an output format (csv or json).");
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if(!strcmp(argv[a], "--flush") && a + 1 < argc)
+      op.flush = argv[++a];
+    else if(!strcmp(argv[a], "--cache") && a + 1 < argc)
+      op.cacheDir = argv[++a];
+    else if(!strcmp(argv[a], "--profile") && a + 1 < argc)
+      op.profile = argv[++a];
+    else if(!strcmp(argv[a], "--memo") && a + 1 < argc)
+    {
+      int entries = atoi(argv[++a]);
+      if(entries <= 0)
+      {
+        puts("Error: --memo expects a number of entries.");
+        exit(EXIT_FAILURE);
+      }
+      op.memo = entries;
+    }
+    else if(!strcmp(argv[a], "--jit") && a + 1 < argc)
+    {
+      int calls = atoi(argv[++a]);
+      if(calls <= 0)
+      {
+        puts("Error: --jit expects a number of calls.");
+        exit(EXIT_FAILURE);
+      }
+      op.jit = calls;
+    }
+    else if(!strcmp(argv[a], "--stack") && a + 1 < argc)
+    {
+      int mb = atoi(argv[++a]);
+      if(mb <= 0)
+      {
+        puts("Error: --stack expects a size in MB.");
+        exit(EXIT_FAILURE);
+      }
+      op.stackSize = (size_t) mb << 20;
+    }
     else if(!strcmp(argv[a], "-o"))
     {
       op.output = argv[++a];
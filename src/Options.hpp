@@ -13,6 +13,28 @@ struct Options
   bool emitC;
   bool verbose;
   bool interactive;
+  //run with the bytecode VM instead of the AST interpreter
+  bool useVM;
+  //flush policy for program output ("line", "full" or "explicit"),
+  //or empty for the default
+  string flush;
+  //memory budget for the interpreter's call stack, in bytes (--stack, in MB)
+  size_t stackSize;
+  //profile the program and write collapsed stacks here (empty: don't profile)
+  string profile;
+  //memoize pure funcs, keeping up to this many results per func (0: don't)
+  size_t memo;
+  //compile each subroutine to native code once it's been called this many times (0: don't)
+  uint64_t jit;
+  //run the program's test blocks instead of main
+  bool runTests;
+  //number of threads to run tests on (0: one per core)
+  int testThreads;
+  //run the program's benchmark blocks instead of main, and print
+  //the results in this format ("csv" or "json"; empty: don't)
+  string bench;
+  //directory of cached images of resolved programs (empty: don't cache)
+  string cacheDir;
   vector<string> interpArgs;
 };
 
@@ -0,0 +1,128 @@
+#include "OutputBuffer.hpp"
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#else
+#include <unistd.h>
+#endif
+
+OutputBuffer stdoutBuffer;
+
+//Output is flushed before errAndQuit prints its message
+static void flushBeforeQuit()
+{
+  stdoutBuffer.flush();
+}
+
+const size_t outputBufferSize = 1 << 16;
+
+OutputBuffer::OutputBuffer(bool capt)
+{
+  capture = capt;
+  //a capturing buffer keeps everything, like the explicit policy
+  if(capture)
+    policy = FlushPolicy::EXPLICIT;
+  else
+  {
+    policy = isatty(1) ? FlushPolicy::LINE : FlushPolicy::FULL;
+    quitHandler = flushBeforeQuit;
+  }
+  capacity = outputBufferSize;
+  buf = (char*) malloc(capacity);
+  used = 0;
+}
+
+OutputBuffer::~OutputBuffer()
+{
+  //exit() destroys statics, so this is the flush at exit
+  flush();
+  free(buf);
+}
+
+bool OutputBuffer::setPolicy(const string& name)
+{
+  if(name == "line")
+    policy = FlushPolicy::LINE;
+  else if(name == "full")
+    policy = FlushPolicy::FULL;
+  else if(name == "explicit")
+    policy = FlushPolicy::EXPLICIT;
+  else
+    return false;
+  return true;
+}
+
+void OutputBuffer::write(const char* data, size_t n)
+{
+  if(capacity - used < n)
+    makeRoom(n);
+  if(capacity - used < n)
+  {
+    //too big to buffer: write directly
+    fwrite(data, 1, n, stdout);
+    fflush(stdout);
+    return;
+  }
+  memcpy(buf + used, data, n);
+  used += n;
+  if(policy == FlushPolicy::LINE && memchr(data, '\n', n))
+    flush();
+}
+
+void OutputBuffer::writeInt(int64_t val)
+{
+  if(val < 0)
+  {
+    put('-');
+    //negate as unsigned, so that INT64_MIN works
+    writeUInt(-(uint64_t) val);
+  }
+  else
+    writeUInt(val);
+}
+
+void OutputBuffer::writeUInt(uint64_t val)
+{
+  //format backwards into a small buffer
+  char digits[20];
+  int n = 0;
+  do
+  {
+    digits[sizeof(digits) - 1 - n++] = '0' + val % 10;
+    val /= 10;
+  }
+  while(val);
+  write(digits + sizeof(digits) - n, n);
+}
+
+void OutputBuffer::writeDouble(double val)
+{
+  char text[32];
+  int n = snprintf(text, sizeof(text), "%g", val);
+  write(text, n);
+}
+
+void OutputBuffer::flush()
+{
+  if(capture)
+    return;
+  if(used)
+  {
+    fwrite(buf, 1, used, stdout);
+    used = 0;
+  }
+  fflush(stdout);
+}
+
+void OutputBuffer::makeRoom(size_t n)
+{
+  if(policy == FlushPolicy::EXPLICIT)
+  {
+    while(capacity - used < n)
+      capacity *= 2;
+    buf = (char*) realloc(buf, capacity);
+  }
+  else
+    flush();
+}
+
@@ -0,0 +1,83 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include "Common.hpp"
+#include <cstring>
+
+/*****************************************************************************/
+// OutputBuffer: buffered stdout for print statements (AST interpreter and VM)
+//
+// Values are formatted directly into a large buffer, which goes to stdout in
+// bulk writes. When the buffer is written depends on the flush policy:
+//   LINE:     after any output containing a newline (default for a terminal)
+//   FULL:     when the buffer is full (default otherwise)
+//   EXPLICIT: only on flush(): the buffer grows to hold everything until then
+// Anything still buffered is flushed at exit, and by errAndQuit before it
+// prints the error, so output printed before an error always comes first.
+//
+// A capturing buffer (one per test, in the test runner) never writes to
+// stdout: it keeps everything, to be collected with contents().
+/*****************************************************************************/
+
+enum struct FlushPolicy
+{
+  LINE,
+  FULL,
+  EXPLICIT
+};
+
+struct OutputBuffer
+{
+  OutputBuffer(bool capture = false);
+  ~OutputBuffer();
+  //Set the policy by name ("line", "full" or "explicit").
+  //Returns false if the name is invalid.
+  bool setPolicy(const string& name);
+  void put(char c)
+  {
+    if(used == capacity)
+      makeRoom(1);
+    buf[used++] = c;
+    if(c == '\n' && policy == FlushPolicy::LINE)
+      flush();
+  }
+  void write(const char* data, size_t n);
+  void write(const char* s)
+  {
+    write(s, strlen(s));
+  }
+  void write(const string& s)
+  {
+    write(s.c_str(), s.length());
+  }
+  void writeInt(int64_t val);
+  void writeUInt(uint64_t val);
+  //floating-point values are formatted like ostream (6 significant digits)
+  void writeDouble(double val);
+  //Write everything buffered to stdout (if not capturing)
+  void flush();
+  //Everything written to a capturing buffer
+  string contents()
+  {
+    return string(buf, used);
+  }
+  //Discard everything written to a capturing buffer so far
+  void clear()
+  {
+    used = 0;
+  }
+  FlushPolicy policy;
+private:
+  //Make room for n more bytes (flushing or growing)
+  void makeRoom(size_t n);
+  char* buf;
+  size_t used;
+  size_t capacity;
+  bool capture;
+};
+
+//The buffer for the program's stdout
+extern OutputBuffer stdoutBuffer;
+
+#endif
+
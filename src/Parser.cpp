@@ -52,11 +52,6 @@ void parseProgram(SourceFile* sf)
   }
 }
 
-void parseProgram()
-{
-  parseProgram(new SourceFile);
-}
-
 void parseProgram(string mainSourcePath)
 {
   parseProgram(addSourceFile(nullptr, mainSourcePath));
@@ -169,6 +164,9 @@ namespace Parser
         case TEST:
           parseTest(s);
           return nullptr;
+        case BENCHMARK:
+          parseBenchmark(s);
+          return nullptr;
         case USING:
           parseUsing(s);
           return nullptr;
@@ -438,26 +436,25 @@ namespace Parser
 
   void Stream::parseExternalSubroutine(SubroutineDecl* sd)
   {
-    errMsgLoc(lookAhead(), "External subroutines haven't been implemented yet");
-    /*
     Node* loc = lookAhead();
     expectKeyword(EXTERN);
     Type* retType = parseType(sd->scope);
-    string name = expectIdent();
-    expectPunct(LPAREN);
-    vector<string> paramNames;
     vector<Type*> paramTypes;
+    vector<string> paramNames;
+    vector<bool> borrow;
+    expectPunct(LPAREN);
     while(!acceptPunct(RPAREN))
     {
-      borrow.push_back(acceptKeyword(CONST));
-      paramTypes.push_back(parseType(s));
       paramNames.push_back(expectIdent());
+      expectPunct(COLON);
+      //"const" means the callee only borrows the argument
+      borrow.push_back(acceptKeyword(CONST));
+      paramTypes.push_back(parseType(sd->scope));
     }
     string& code = ((StrLit*) expect(STRING_LITERAL))->val;
-    ExternalSubroutine* es = new ExternalSubroutine(s, name, retType, paramTypes, paramNames, borrow, code);
+    ExternalSubroutine* es = new ExternalSubroutine(sd, sd->scope, sd->name, retType, paramTypes, paramNames, borrow, code);
     es->setLocation(loc);
-    s->addName(es);
-    */
+    sd->overloads.push_back(es);
   }
 
   Assign* Stream::parseVarDecl(Scope* s)
@@ -748,6 +745,7 @@ namespace Parser
   void Stream::parseTest(Scope* s)
   {
     Node* location = lookAhead();
+    expectKeyword(TEST);
     Block* b = new Block(s);
     parseBlock(b);
     Test* t = new Test(s, b);
@@ -756,6 +754,18 @@ namespace Parser
     //it is not added to any scope
   }
 
+  void Stream::parseBenchmark(Scope* s)
+  {
+    Node* location = lookAhead();
+    expectKeyword(BENCHMARK);
+    string name = ((StrLit*) expect(STRING_LITERAL))->val;
+    Block* b = new Block(s);
+    parseBlock(b);
+    Benchmark* bench = new Benchmark(name, s, b);
+    bench->setLocation(location);
+    //like tests, benchmarks are kept in a static list, not in a scope
+  }
+
   Statement* Stream::parseStatementOrDecl(Block* b, bool semicolon)
   {
     Token* next = lookAhead();
@@ -959,7 +969,7 @@ namespace Parser
       }
       else
       {
-        CallExpr* ce = dynamic_cast<CallExpr*>(lhs);
+        CallExpr* ce = dynCast<CallExpr>(lhs);
         if(!ce)
         {
           errMsgLoc(lhs, "side-effect free expression can't be used as statement");
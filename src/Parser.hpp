@@ -24,8 +24,6 @@ struct StructType;
 struct UnresolvedType;
 
 void parseProgram(SourceFile* sf);
-//Parse program from stdin
-void parseProgram();
 //Parse the whole program into the global AST
 void parseProgram(string mainSourcePath);
 
@@ -90,6 +88,7 @@ namespace Parser
     //Parse a block (which has already been constructed)
     void parseBlock(Block* b);
     void parseTest(Scope* s);
+    void parseBenchmark(Scope* s);
     Type* parseType(Scope* s);
     void parseLambdaType(UnresolvedType* ut);
 
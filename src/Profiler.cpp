@@ -0,0 +1,143 @@
+#include "Profiler.hpp"
+#include <cstring>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+volatile sig_atomic_t profileSampleDue = 0;
+
+//Microseconds of CPU time between samples
+const int sampleInterval = 1000;
+
+#ifndef _WIN32
+static void onProfileTimer(int)
+{
+  profileSampleDue = 1;
+}
+#endif
+
+Profiler::Profiler()
+{
+  top = nullptr;
+  totalSamples = 0;
+  startClock = 0;
+  seconds = 0;
+}
+
+void Profiler::start()
+{
+#ifdef _WIN32
+  errMsg("Profiling isn't supported on this platform");
+#else
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onProfileTimer;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, nullptr);
+  itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = sampleInterval;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+  startClock = clock();
+}
+
+void Profiler::stop()
+{
+#ifndef _WIN32
+  itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+  seconds = (double) (clock() - startClock) / CLOCKS_PER_SEC;
+}
+
+void Profiler::takeSample()
+{
+  profileSampleDue = 0;
+  vector<pair<Subroutine*, int>> key;
+  key.reserve(stack.size());
+  for(auto& f : stack)
+    key.push_back(std::make_pair(f.subr, f.stmt ? f.stmt->line : f.subr->line));
+  samples[key]++;
+  totalSamples++;
+}
+
+//The profiler that reports if the program quits with an error,
+//and the quit handler that was installed before (flushing output)
+static Profiler* quitProfiler = nullptr;
+static string quitReportPath;
+static void (*prevQuitHandler)() = nullptr;
+
+static void reportBeforeQuit()
+{
+  if(prevQuitHandler)
+    prevQuitHandler();
+  quitProfiler->stop();
+  quitProfiler->report(quitReportPath, std::cerr);
+}
+
+void Profiler::reportOnQuit(const string& path)
+{
+  quitProfiler = this;
+  quitReportPath = path;
+  prevQuitHandler = quitHandler;
+  quitHandler = reportBeforeQuit;
+}
+
+static string subrName(Subroutine* subr)
+{
+  if(subr->decl->owner)
+    return subr->decl->owner->name + "." + subr->name();
+  return subr->name();
+}
+
+void Profiler::report(const string& path, ostream& os)
+{
+  //collapsed stacks
+  ostringstream collapsed;
+  for(auto& s : samples)
+  {
+    for(size_t i = 0; i < s.first.size(); i++)
+    {
+      if(i > 0)
+        collapsed << ';';
+      collapsed << subrName(s.first[i].first) << ':' << s.first[i].second;
+    }
+    collapsed << ' ' << s.second << '\n';
+  }
+  string text = collapsed.str();
+  writeFile(text, path);
+  //Self time counts samples where subr is on top of the stack, and total
+  //time counts samples where it's anywhere (only once, if it's recursive)
+  map<Subroutine*, pair<uint64_t, uint64_t>> times;
+  for(auto& s : samples)
+  {
+    times[s.first.back().first].first += s.second;
+    set<Subroutine*> onStack;
+    for(auto& f : s.first)
+    {
+      if(onStack.insert(f.first).second)
+        times[f.first].second += s.second;
+    }
+  }
+  vector<pair<Subroutine*, pair<uint64_t, uint64_t>>> rows(times.begin(), times.end());
+  std::sort(rows.begin(), rows.end(),
+    [](const pair<Subroutine*, pair<uint64_t, uint64_t>>& a, const pair<Subroutine*, pair<uint64_t, uint64_t>>& b)
+    {
+      return a.second.first > b.second.first;
+    });
+  //samples are spread evenly over the CPU time
+  double perSample = totalSamples ? seconds / totalSamples : 0;
+  char line[256];
+  os << "Profile: " << totalSamples << " samples over " << seconds << " sec (collapsed stacks in " << path << ")\n";
+  os << "   self (s)  total (s)  subroutine\n";
+  for(auto& row : rows)
+  {
+    snprintf(line, sizeof(line), "%11.3f%11.3f  ", row.second.first * perSample, row.second.second * perSample);
+    os << line << subrName(row.first) << " (" << getSourceName(row.first->fileID) << ':' << row.first->line << ")\n";
+  }
+}
+
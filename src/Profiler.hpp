@@ -0,0 +1,87 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Common.hpp"
+#include "Subroutine.hpp"
+#include <csignal>
+
+/*****************************************************************************/
+// Profiler: sampling profiler for the AST interpreter (--profile <file>)
+//
+// A CPU timer fires every millisecond and sets profileSampleDue. The next
+// statement the interpreter executes then takes a sample of the Onyx call
+// stack, kept by the interpreter (through enter/leave/at) as the subroutine
+// and current statement of each frame. Sampling on the interpreter's own
+// thread means the signal handler only has to set the flag.
+//
+// At the end, each distinct stack and its sample count is written in the
+// collapsed format used by flame graph tools ("main:20;fib:5;fib:7 42"), and
+// a table of each subroutine's self and total time is printed. That also
+// happens if the program quits with an error (see reportOnQuit).
+//
+// When profiling is disabled, the interpreter has no Profiler and
+// doesn't record anything.
+/*****************************************************************************/
+
+extern volatile sig_atomic_t profileSampleDue;
+
+struct ProfFrame
+{
+  Subroutine* subr;
+  //statement being executed in subr (nullptr until the first one)
+  Statement* stmt;
+};
+
+struct Profiler
+{
+  Profiler();
+  //Start and stop the sampling timer
+  void start();
+  void stop();
+  //Push and pop the frame of a call to subr
+  void enter(Subroutine* subr)
+  {
+    ProfFrame f;
+    f.subr = subr;
+    f.stmt = nullptr;
+    stack.push_back(f);
+    top = &stack.back();
+  }
+  void leave()
+  {
+    stack.pop_back();
+    top = stack.empty() ? nullptr : &stack.back();
+  }
+  //The top frame is about to execute s. A due sample is taken first, so
+  //that it's charged to the statement that was running until now. Blocks
+  //are skipped: the statements in them report their own lines (and
+  //blocks made by the compiler, like loop bodies, have no location).
+  void at(Statement* s)
+  {
+    if(isa<Block>(s))
+      return;
+    if(profileSampleDue)
+      takeSample();
+    top->stmt = s;
+  }
+  //Write the collapsed stacks to path,
+  //and print the table of subroutine times to os
+  void report(const string& path, ostream& os);
+  //If the program quits with an error (errAndQuit), stop and
+  //report to path and stderr before the error is printed
+  void reportOnQuit(const string& path);
+private:
+  void takeSample();
+  vector<ProfFrame> stack;
+  ProfFrame* top;
+  //Number of samples of each distinct stack,
+  //where each frame is a subroutine and line
+  map<vector<pair<Subroutine*, int>>, uint64_t> samples;
+  uint64_t totalSamples;
+  //CPU time between start and stop
+  clock_t startClock;
+  double seconds;
+};
+
+#endif
+
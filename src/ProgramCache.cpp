@@ -0,0 +1,1369 @@
+#include "ProgramCache.hpp"
+#include "Subroutine.hpp"
+#include "Variable.hpp"
+#include "SourceFile.hpp"
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+extern vector<SourceFile*> fileList;
+
+//Changes whenever the layout of images changes
+const int imageFormat = 2;
+const char* imageMagic = "onyx program image";
+
+//Objects that aren't Nodes with their own NodeKind are tagged with these
+//(numbered after the NodeKinds, which tag all other objects)
+enum ObjTag : uint8_t
+{
+  TAG_MODULE = (uint8_t) NodeKind::ExternalSubroutine + 1,
+  TAG_VARIABLE,
+  TAG_SUBR_DECL,
+  TAG_ENUM_CONSTANT,
+  TAG_TEST,
+  TAG_BENCHMARK,
+  TAG_SCOPE,
+  //can't be stored (only appears in unresolved programs)
+  TAG_INVALID
+};
+
+//Identifies the build of the compiler: an image is only used by the
+//same build that wrote it
+static string compilerID()
+{
+  Oss id;
+  id << imageFormat << ' ' << __DATE__ << ' ' << __TIME__;
+#ifdef __linux__
+  struct stat st;
+  if(!stat("/proc/self/exe", &st))
+    id << ' ' << st.st_size << ' ' << st.st_mtime;
+#endif
+  return id.str();
+}
+
+//Read a whole file (returning false if it can't be opened)
+static bool readFile(const string& path, string& contents)
+{
+  FILE* f = fopen(path.c_str(), "rb");
+  if(!f)
+    return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  contents.resize(size > 0 ? size : 0);
+  bool ok = size >= 0 && fread((void*) contents.data(), 1, contents.size(), f) == contents.size();
+  fclose(f);
+  return ok;
+}
+
+static uint8_t tagOf(Node* n)
+{
+  switch(n->kind)
+  {
+    case NodeKind::Other:
+      if(dynamic_cast<Variable*>(n))
+        return TAG_VARIABLE;
+      if(dynamic_cast<SubroutineDecl*>(n))
+        return TAG_SUBR_DECL;
+      if(dynamic_cast<Module*>(n))
+        return TAG_MODULE;
+      if(dynamic_cast<EnumConstant*>(n))
+        return TAG_ENUM_CONSTANT;
+      if(dynamic_cast<Test*>(n))
+        return TAG_TEST;
+      if(dynamic_cast<Benchmark*>(n))
+        return TAG_BENCHMARK;
+      return TAG_INVALID;
+    case NodeKind::DefaultValueExpr:
+    case NodeKind::UnresolvedExpr:
+    case NodeKind::UnresolvedType:
+    case NodeKind::ExprType:
+    case NodeKind::ElemExprType:
+      return TAG_INVALID;
+    default:
+      return (uint8_t) n->kind;
+  }
+}
+
+//Is n a T? (classes without their own NodeKind are checked with dynamic_cast)
+template<typename T>
+static auto isKind(Node* n, int) -> decltype(T::classof(n))
+{
+  return T::classof(n);
+}
+
+template<typename T>
+static bool isKind(Node* n, long)
+{
+  return dynamic_cast<T*>(n);
+}
+
+template<typename T>
+static bool isKind(Node* n)
+{
+  return isKind<T>(n, 0);
+}
+
+//Gets the Node in a variant of Node pointers (or None)
+struct NodeOf : public visitor<Node*>
+{
+  Node* operator()(None&)
+  {
+    return nullptr;
+  }
+  template<typename T>
+  Node* operator()(T*& p)
+  {
+    return p;
+  }
+};
+
+namespace
+{
+  //Writes the objects of an image. Each object is given an index (and
+  //queued to be written) the first time a reference to it is written.
+  struct ImageWriter
+  {
+    static const bool reading = false;
+    ImageWriter(vector<void*>& builtins) : numBuiltins(builtins.size()), ok(true)
+    {
+      for(size_t i = 0; i < builtins.size(); i++)
+        index[builtins[i]] = i;
+      objects = builtins;
+      tags.resize(builtins.size(), TAG_INVALID);
+    }
+    void num(uint64_t v)
+    {
+      while(v >= 0x80)
+      {
+        out += (char) (v | 0x80);
+        v >>= 7;
+      }
+      out += (char) v;
+    }
+    //integers (signed values are zigzag-encoded), bools and enums
+    template<typename T>
+    void val(T& v)
+    {
+      int64_t s = (int64_t) v;
+      num(((uint64_t) s << 1) ^ (uint64_t) (s >> 63));
+    }
+    void val(float& v)
+    {
+      uint32_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      num(bits);
+    }
+    void val(double& v)
+    {
+      uint64_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      num(bits);
+    }
+    void val(string& s)
+    {
+      num(s.size());
+      out += s;
+    }
+    template<typename T>
+    void vals(vector<T>& v)
+    {
+      num(v.size());
+      for(auto& elem : v)
+        val(elem);
+    }
+    void vals(vector<bool>& v)
+    {
+      num(v.size());
+      for(bool b : v)
+        num(b);
+    }
+    //tag is only computed for objects that haven't been seen yet
+    template<typename TagOf>
+    void refObject(void* obj, TagOf tagOf)
+    {
+      if(!obj)
+      {
+        num(0);
+        return;
+      }
+      auto it = index.emplace(obj, objects.size());
+      if(it.second)
+      {
+        uint8_t tag = tagOf();
+        if(tag == TAG_INVALID)
+          ok = false;
+        objects.push_back(obj);
+        tags.push_back(tag);
+      }
+      num(it.first->second + 1);
+    }
+    template<typename T>
+    void ref(T*& n)
+    {
+      Node* node = n;
+      refObject(node, [node] {return tagOf(node);});
+    }
+    void ref(Scope*& s)
+    {
+      refObject(s, [] {return (uint8_t) TAG_SCOPE;});
+    }
+    template<typename T>
+    void refs(vector<T*>& v)
+    {
+      num(v.size());
+      for(auto& elem : v)
+        ref(elem);
+    }
+    void mapValues(MapConstant* mc)
+    {
+      num(mc->values.size());
+      for(auto& kv : mc->values)
+      {
+        Expression* key = kv.first;
+        ref(key);
+        ref(kv.second);
+      }
+    }
+    void caseTable(unordered_map<int64_t, int>& table)
+    {
+      num(table.size());
+      for(auto& kv : table)
+      {
+        int64_t key = kv.first;
+        val(key);
+        val(kv.second);
+      }
+    }
+    void names(map<string, Name>& table)
+    {
+      num(table.size());
+      for(auto& kv : table)
+      {
+        string key = kv.first;
+        val(key);
+        ref(kv.second.item);
+        val(kv.second.kind);
+        val(kv.second.name);
+        ref(kv.second.scope);
+      }
+    }
+    //an object with a tag that can't be stored
+    void badTag()
+    {
+      INTERNAL_ERROR;
+    }
+    size_t numBuiltins;
+    unordered_map<void*, size_t> index;
+    vector<void*> objects;
+    vector<uint8_t> tags;
+    string out;
+    //false if something that can't be stored was reached
+    bool ok;
+  };
+
+  //Reads the objects of an image (mirrors ImageWriter). Every reference
+  //is checked against the tag of the object it refers to, so a damaged
+  //image sets failed instead of producing a malformed program.
+  struct ImageReader
+  {
+    static const bool reading = true;
+    ImageReader(const string& image) : pos(image.data()), end(image.data() + image.size()), failed(false) {}
+    uint64_t num()
+    {
+      uint64_t v = 0;
+      for(int shift = 0; shift < 64; shift += 7)
+      {
+        if(pos == end)
+        {
+          failed = true;
+          return 0;
+        }
+        uint8_t byte = *pos++;
+        v |= (uint64_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+          return v;
+      }
+      failed = true;
+      return 0;
+    }
+    template<typename T>
+    void val(T& v)
+    {
+      uint64_t z = num();
+      v = (T) (int64_t) ((z >> 1) ^ (~(z & 1) + 1));
+    }
+    void val(float& v)
+    {
+      uint32_t bits = num();
+      memcpy(&v, &bits, sizeof(bits));
+    }
+    void val(double& v)
+    {
+      uint64_t bits = num();
+      memcpy(&v, &bits, sizeof(bits));
+    }
+    void val(string& s)
+    {
+      uint64_t len = num();
+      if(len > (uint64_t) (end - pos))
+      {
+        failed = true;
+        return;
+      }
+      s.assign(pos, len);
+      pos += len;
+    }
+    string str()
+    {
+      string s;
+      val(s);
+      return s;
+    }
+    //Number of elements for a vector (which take at least a byte each)
+    size_t count()
+    {
+      uint64_t n = num();
+      if(n > (uint64_t) (end - pos))
+      {
+        failed = true;
+        return 0;
+      }
+      return n;
+    }
+    template<typename T>
+    void vals(vector<T>& v)
+    {
+      v.resize(count());
+      for(auto& elem : v)
+        val(elem);
+    }
+    void vals(vector<bool>& v)
+    {
+      v.resize(count());
+      for(size_t i = 0; i < v.size(); i++)
+        v[i] = num();
+    }
+    void* refObject(bool scope)
+    {
+      uint64_t i = num();
+      if(i > objects.size() || (i && (tags[i - 1] == TAG_SCOPE) != scope))
+      {
+        failed = true;
+        return nullptr;
+      }
+      return i ? objects[i - 1] : nullptr;
+    }
+    template<typename T>
+    void ref(T*& n)
+    {
+      Node* node = (Node*) refObject(false);
+      if(node && !isKind<T>(node))
+      {
+        failed = true;
+        node = nullptr;
+      }
+      n = static_cast<T*>(node);
+    }
+    void ref(Scope*& s)
+    {
+      s = (Scope*) refObject(true);
+    }
+    template<typename T>
+    void refs(vector<T*>& v)
+    {
+      v.resize(count());
+      for(auto& elem : v)
+        ref(elem);
+    }
+    //(keys are hashed by value, so they can only be inserted
+    //once all objects have been read)
+    void mapValues(MapConstant* mc)
+    {
+      size_t n = count();
+      for(size_t i = 0; i < n; i++)
+      {
+        Expression* key;
+        Expression* value;
+        ref(key);
+        ref(value);
+        mapEntries.push_back(std::make_tuple(mc, key, value));
+      }
+    }
+    void caseTable(unordered_map<int64_t, int>& table)
+    {
+      size_t n = count();
+      for(size_t i = 0; i < n; i++)
+      {
+        int64_t key;
+        int label;
+        val(key);
+        val(label);
+        table[key] = label;
+      }
+    }
+    void names(map<string, Name>& table)
+    {
+      table.clear();
+      size_t n = count();
+      for(size_t i = 0; i < n; i++)
+      {
+        string key = str();
+        Name& name = table[key];
+        ref(name.item);
+        val(name.kind);
+        val(name.name);
+        ref(name.scope);
+        if(!name.item || !itemFits(name))
+          failed = true;
+      }
+    }
+    //Is the item of a name the kind of declaration it names?
+    bool itemFits(Name& name)
+    {
+      switch(name.kind)
+      {
+        case Name::MODULE: return isKind<Module>(name.item);
+        case Name::STRUCT: return isKind<StructType>(name.item);
+        case Name::ENUM: return isKind<EnumType>(name.item);
+        case Name::TYPEDEF: return isKind<AliasType>(name.item);
+        case Name::SIMPLE_TYPE: return isKind<SimpleType>(name.item);
+        case Name::SUBROUTINE: return isKind<SubroutineDecl>(name.item);
+        case Name::VARIABLE: return isKind<Variable>(name.item);
+        case Name::ENUM_CONSTANT: return isKind<EnumConstant>(name.item);
+        default: return false;
+      }
+    }
+    void badTag()
+    {
+      failed = true;
+    }
+    const char* pos;
+    const char* end;
+    bool failed;
+    vector<void*> objects;
+    //the tag of each object
+    vector<uint8_t> tags;
+    vector<tuple<MapConstant*, Expression*, Expression*>> mapEntries;
+  };
+}
+
+//The node of a variant, as the alternative it was stored as
+template<typename T>
+static T* alternative(ImageWriter&, Node* n)
+{
+  return (T*) n;
+}
+
+template<typename T>
+static T* alternative(ImageReader& r, Node* n)
+{
+  if(n && !isKind<T>(n))
+  {
+    r.failed = true;
+    return nullptr;
+  }
+  return (T*) n;
+}
+
+//Loop, Breakable, StructMem::member and Scope::node are variants of
+//Node pointers: each is stored as its alternative's index and the pointer
+template<typename A, typename V>
+static Node* variantNode(A& a, V& v, int& which)
+{
+  NodeOf nodeOf;
+  which = v.which();
+  Node* n = v.visit(nodeOf);
+  a.val(which);
+  a.ref(n);
+  return n;
+}
+
+template<typename A>
+static void transfer(A& a, Loop& loop)
+{
+  int which;
+  Node* n = variantNode(a, loop, which);
+  if(!A::reading)
+    return;
+  if(which == 1)
+    loop = alternative<For>(a, n);
+  else if(which == 2)
+    loop = alternative<While>(a, n);
+  else
+    loop = None();
+}
+
+template<typename A>
+static void transfer(A& a, Breakable& breakable)
+{
+  int which;
+  Node* n = variantNode(a, breakable, which);
+  if(!A::reading)
+    return;
+  if(which == 1)
+    breakable = alternative<For>(a, n);
+  else if(which == 2)
+    breakable = alternative<While>(a, n);
+  else if(which == 3)
+    breakable = alternative<Switch>(a, n);
+  else
+    breakable = None();
+}
+
+template<typename A>
+static void transfer(A& a, variant<Variable*, Subroutine*>& member)
+{
+  int which;
+  Node* n = variantNode(a, member, which);
+  if(!A::reading)
+    return;
+  if(which == 0)
+    member = alternative<Variable>(a, n);
+  else
+    member = alternative<Subroutine>(a, n);
+}
+
+template<typename A>
+static void transfer(A& a, variant<Module*, StructType*, Subroutine*, Block*, EnumType*>& node)
+{
+  int which;
+  Node* n = variantNode(a, node, which);
+  if(!A::reading)
+    return;
+  switch(which)
+  {
+    case 0: node = alternative<Module>(a, n); break;
+    case 1: node = alternative<StructType>(a, n); break;
+    case 2: node = alternative<Subroutine>(a, n); break;
+    case 3: node = alternative<Block>(a, n); break;
+    default: node = alternative<EnumType>(a, n);
+  }
+}
+
+template<typename A>
+static void transfer(A& a, ArrayUpdate*& au)
+{
+  bool present = au;
+  a.val(present);
+  if(!present)
+    return;
+  if(A::reading)
+    au = new ArrayUpdate;
+  a.ref(au->array);
+  a.ref(au->operand);
+  a.val(au->prepend);
+  a.val(au->concat);
+}
+
+template<typename A>
+static void transfer(A& a, CounterLoop*& cl)
+{
+  bool present = cl;
+  a.val(present);
+  if(!present)
+    return;
+  if(A::reading)
+    cl = new CounterLoop;
+  a.ref(cl->counter);
+  a.ref(cl->bound);
+  a.val(cl->cmp);
+  a.val(cl->step);
+}
+
+template<typename A>
+static void transferScope(A& a, Scope* s)
+{
+  a.ref(s->parent);
+  a.names(s->names);
+  a.refs(s->children);
+  transfer(a, s->node);
+  //using declarations only matter for name lookup during resolution
+}
+
+//Write or read all fields of one object
+template<typename A>
+static void transferObject(A& a, void* obj, uint8_t tag)
+{
+  if(tag == TAG_SCOPE)
+  {
+    transferScope(a, (Scope*) obj);
+    return;
+  }
+  Node* n = (Node*) obj;
+  a.val(n->fileID);
+  a.val(n->line);
+  a.val(n->col);
+  a.val(n->resolved);
+  if(auto e = dynCast<Expression>(n))
+    a.ref(e->type);
+  else if(auto s = dynCast<Statement>(n))
+    a.ref(s->block);
+  else if(auto sb = dynCast<SubrBase>(n))
+  {
+    a.ref(sb->decl);
+    a.ref(sb->type);
+  }
+  if(tag >= TAG_MODULE)
+  {
+    switch((ObjTag) tag)
+    {
+      case TAG_MODULE:
+        {
+          auto m = (Module*) n;
+          a.val(m->name);
+          a.ref(m->scope);
+          break;
+        }
+      case TAG_VARIABLE:
+        {
+          auto v = (Variable*) n;
+          a.val(v->name);
+          a.ref(v->type);
+          a.ref(v->owner);
+          a.ref(v->scope);
+          a.ref(v->initial);
+          a.val(v->id);
+          a.val(v->slot);
+          break;
+        }
+      case TAG_SUBR_DECL:
+        {
+          auto sd = (SubroutineDecl*) n;
+          a.val(sd->name);
+          a.ref(sd->scope);
+          a.val(sd->isPure);
+          a.ref(sd->owner);
+          a.refs(sd->overloads);
+          break;
+        }
+      case TAG_ENUM_CONSTANT:
+        {
+          auto ec = (EnumConstant*) n;
+          a.ref(ec->et);
+          a.val(ec->name);
+          a.val(ec->isSigned);
+          a.val(ec->value);
+          break;
+        }
+      case TAG_TEST:
+        {
+          auto t = (Test*) n;
+          a.ref(t->scope);
+          a.ref(t->run);
+          a.val(t->numLocals);
+          break;
+        }
+      case TAG_BENCHMARK:
+        {
+          auto b = (Benchmark*) n;
+          a.val(b->name);
+          a.ref(b->scope);
+          a.ref(b->run);
+          a.val(b->numLocals);
+          break;
+        }
+      default:
+        a.badTag();
+    }
+    return;
+  }
+  switch((NodeKind) tag)
+  {
+    //Expressions
+    case NodeKind::UnaryArith:
+      {
+        auto e = (UnaryArith*) n;
+        a.val(e->op);
+        a.ref(e->expr);
+        break;
+      }
+    case NodeKind::BinaryArith:
+      {
+        auto e = (BinaryArith*) n;
+        a.val(e->op);
+        a.ref(e->lhs);
+        a.ref(e->rhs);
+        break;
+      }
+    case NodeKind::IntConstant:
+      {
+        auto e = (IntConstant*) n;
+        a.val(e->sval);
+        a.val(e->uval);
+        break;
+      }
+    case NodeKind::FloatConstant:
+      {
+        auto e = (FloatConstant*) n;
+        a.val(e->fp);
+        a.val(e->dp);
+        break;
+      }
+    case NodeKind::BoolConstant:
+      a.val(((BoolConstant*) n)->value);
+      break;
+    case NodeKind::MapConstant:
+      a.mapValues((MapConstant*) n);
+      break;
+    case NodeKind::UnionConstant:
+      {
+        auto e = (UnionConstant*) n;
+        a.ref(e->unionType);
+        a.ref(e->value);
+        a.val(e->option);
+        break;
+      }
+    case NodeKind::CompoundLiteral:
+      {
+        auto e = (CompoundLiteral*) n;
+        a.refs(e->members);
+        a.val(e->lvalue);
+        break;
+      }
+    case NodeKind::Indexed:
+      {
+        auto e = (Indexed*) n;
+        a.ref(e->group);
+        a.ref(e->index);
+        break;
+      }
+    case NodeKind::CallExpr:
+      {
+        auto e = (CallExpr*) n;
+        a.ref(e->callable);
+        a.refs(e->args);
+        break;
+      }
+    case NodeKind::VarExpr:
+      {
+        auto e = (VarExpr*) n;
+        a.ref(e->var);
+        a.ref(e->scope);
+        break;
+      }
+    case NodeKind::SubrOverloadExpr:
+      {
+        auto e = (SubrOverloadExpr*) n;
+        a.ref(e->thisObject);
+        a.ref(e->decl);
+        break;
+      }
+    case NodeKind::SubroutineExpr:
+      a.ref(((SubroutineExpr*) n)->subr);
+      break;
+    case NodeKind::StructMem:
+      {
+        auto e = (StructMem*) n;
+        a.ref(e->base);
+        transfer(a, e->member);
+        a.val(e->index);
+        break;
+      }
+    case NodeKind::NewArray:
+      {
+        auto e = (NewArray*) n;
+        a.ref(e->elem);
+        a.refs(e->dims);
+        break;
+      }
+    case NodeKind::ArrayLength:
+      a.ref(((ArrayLength*) n)->array);
+      break;
+    case NodeKind::IsExpr:
+    case NodeKind::AsExpr:
+      {
+        auto e = (UnionConvBase*) n;
+        a.refs(e->subset);
+        a.vals(e->optionMap);
+        a.ref(e->base);
+        a.ref(e->destType);
+        break;
+      }
+    case NodeKind::ThisExpr:
+      {
+        auto e = (ThisExpr*) n;
+        a.ref(e->structType);
+        a.ref(e->usage);
+        break;
+      }
+    case NodeKind::Converted:
+      a.ref(((Converted*) n)->value);
+      break;
+    case NodeKind::EnumExpr:
+      a.ref(((EnumExpr*) n)->value);
+      break;
+    case NodeKind::SimpleConstant:
+      a.ref(((SimpleConstant*) n)->st);
+      break;
+    //Statements
+    case NodeKind::Block:
+      {
+        auto b = (Block*) n;
+        a.refs(b->stmts);
+        a.ref(b->scope);
+        a.ref(b->subr);
+        transfer(a, b->breakable);
+        transfer(a, b->loop);
+        break;
+      }
+    case NodeKind::Assign:
+      {
+        auto s = (Assign*) n;
+        a.ref(s->lvalue);
+        a.ref(s->rvalue);
+        transfer(a, s->arrayUpdate);
+        break;
+      }
+    case NodeKind::CallStmt:
+      a.ref(((CallStmt*) n)->eval);
+      break;
+    case NodeKind::ForC:
+    case NodeKind::ForArray:
+    case NodeKind::ForRange:
+      {
+        auto f = (For*) n;
+        a.ref(f->outer);
+        a.ref(f->inner);
+        transfer(a, f->counterLoop);
+        if(auto fc = dynCast<ForC>(n))
+        {
+          a.ref(fc->init);
+          a.ref(fc->condition);
+          a.ref(fc->increment);
+        }
+        else if(auto fa = dynCast<ForArray>(n))
+        {
+          a.refs(fa->counters);
+          a.ref(fa->arr);
+          a.ref(fa->iter);
+        }
+        else
+        {
+          auto fr = (ForRange*) n;
+          a.ref(fr->counter);
+          a.ref(fr->begin);
+          a.ref(fr->end);
+        }
+        break;
+      }
+    case NodeKind::While:
+      {
+        auto s = (While*) n;
+        a.ref(s->condition);
+        a.ref(s->body);
+        break;
+      }
+    case NodeKind::If:
+      {
+        auto s = (If*) n;
+        a.ref(s->condition);
+        a.ref(s->body);
+        a.ref(s->elseBody);
+        break;
+      }
+    case NodeKind::Match:
+      {
+        auto s = (Match*) n;
+        a.ref(s->matched);
+        a.refs(s->types);
+        a.refs(s->cases);
+        a.refs(s->caseVars);
+        a.vals(s->optionCases);
+        break;
+      }
+    case NodeKind::Switch:
+      {
+        auto s = (Switch*) n;
+        a.ref(s->switched);
+        a.refs(s->caseValues);
+        a.vals(s->caseLabels);
+        a.val(s->defaultPosition);
+        a.ref(s->block);
+        a.val(s->hasTable);
+        a.val(s->denseTable);
+        a.val(s->tableBase);
+        a.vals(s->jumpTable);
+        a.caseTable(s->caseTable);
+        a.vals(s->dynamicCases);
+        break;
+      }
+    case NodeKind::Return:
+      a.ref(((Return*) n)->value);
+      break;
+    case NodeKind::Break:
+      transfer(a, ((Break*) n)->breakable);
+      break;
+    case NodeKind::Continue:
+      transfer(a, ((Continue*) n)->loop);
+      break;
+    case NodeKind::Print:
+      {
+        auto s = (Print*) n;
+        a.refs(s->exprs);
+        a.ref(s->usage);
+        break;
+      }
+    case NodeKind::Assertion:
+      a.ref(((Assertion*) n)->asserted);
+      break;
+    //Types
+    case NodeKind::StructType:
+      {
+        auto t = (StructType*) n;
+        a.val(t->name);
+        a.refs(t->members);
+        a.vals(t->composed);
+        a.ref(t->scope);
+        break;
+      }
+    case NodeKind::UnionType:
+      {
+        auto t = (UnionType*) n;
+        a.refs(t->options);
+        a.vals(t->optionHashes);
+        a.ref(t->defaultVal);
+        a.val(t->recursive);
+        break;
+      }
+    case NodeKind::ArrayType:
+      {
+        auto t = (ArrayType*) n;
+        a.ref(t->elem);
+        a.ref(t->subtype);
+        a.val(t->dims);
+        break;
+      }
+    case NodeKind::TupleType:
+      a.refs(((TupleType*) n)->members);
+      break;
+    case NodeKind::MapType:
+      {
+        auto t = (MapType*) n;
+        a.ref(t->key);
+        a.ref(t->value);
+        break;
+      }
+    case NodeKind::AliasType:
+      {
+        auto t = (AliasType*) n;
+        a.val(t->name);
+        a.ref(t->actual);
+        a.ref(t->scope);
+        break;
+      }
+    case NodeKind::EnumType:
+      {
+        //(the default value is recreated by resolving again, once the
+        //values have been read)
+        auto t = (EnumType*) n;
+        a.val(t->name);
+        a.refs(t->values);
+        a.ref(t->scope);
+        break;
+      }
+    case NodeKind::IntegerType:
+      {
+        auto t = (IntegerType*) n;
+        a.val(t->name);
+        a.val(t->size);
+        a.val(t->isSigned);
+        break;
+      }
+    case NodeKind::FloatType:
+      {
+        auto t = (FloatType*) n;
+        a.val(t->name);
+        a.val(t->size);
+        break;
+      }
+    case NodeKind::CharType:
+    case NodeKind::BoolType:
+      break;
+    case NodeKind::SimpleType:
+      {
+        auto t = (SimpleType*) n;
+        a.ref(t->val);
+        a.val(t->name);
+        break;
+      }
+    case NodeKind::CallableType:
+      {
+        auto t = (CallableType*) n;
+        a.ref(t->ownerStruct);
+        a.ref(t->returnType);
+        a.refs(t->paramTypes);
+        a.val(t->pure);
+        break;
+      }
+    //Subroutines
+    case NodeKind::Subroutine:
+      {
+        auto s = (Subroutine*) n;
+        a.ref(s->scope);
+        a.refs(s->params);
+        a.ref(s->body);
+        a.val(s->id);
+        a.val(s->numLocals);
+        if(A::reading)
+          s->subrIR = nullptr;
+        break;
+      }
+    case NodeKind::ExternalSubroutine:
+      {
+        auto s = (ExternalSubroutine*) n;
+        a.val(s->c);
+        a.val(s->library);
+        a.val(s->symbol);
+        a.vals(s->paramNames);
+        a.vals(s->paramBorrowed);
+        a.val(s->id);
+        if(A::reading)
+          s->native = nullptr;
+        break;
+      }
+    default:
+      a.badTag();
+  }
+}
+
+//The entry points of the program
+struct Roots
+{
+  Subroutine* main;
+  vector<Test*> tests;
+  vector<Benchmark*> benchmarks;
+  vector<Variable*> globalSlots;
+};
+
+template<typename A>
+static void transferRoots(A& a, Roots& roots)
+{
+  a.ref(roots.main);
+  a.refs(roots.tests);
+  a.refs(roots.benchmarks);
+  a.refs(roots.globalSlots);
+}
+
+//Placeholder arguments for creating objects before reading their fields
+struct Placeholders
+{
+  Placeholders()
+  {
+    scope = new Scope(nullptr, (Module*) nullptr);
+    block = new Block(scope);
+    decl = new SubroutineDecl("", scope, false, false);
+    value = new IntConstant();
+    emptyUnion = new UnionType(vector<Type*>());
+    enumConstant = new EnumConstant("", 0);
+    enumConstant->et = nullptr;
+  }
+  Scope* scope;
+  Block* block;
+  SubroutineDecl* decl;
+  //a resolved constant, and a union with no options (so that
+  //UnionConstant's constructor doesn't look for one)
+  Expression* value;
+  UnionType* emptyUnion;
+  EnumConstant* enumConstant;
+};
+
+//Create an object of the kind given by tag, to have its fields read
+static void* createObject(uint8_t tag, Placeholders& ph)
+{
+  vector<Expression*> noExprs;
+  vector<Type*> noTypes;
+  switch(tag)
+  {
+    case TAG_MODULE: return (Node*) new Module("", nullptr);
+    case TAG_VARIABLE: return (Node*) new Variable("", nullptr);
+    case TAG_SUBR_DECL: return (Node*) new SubroutineDecl("", ph.scope, false, false);
+    case TAG_ENUM_CONSTANT: return (Node*) new EnumConstant("", 0);
+    case TAG_TEST: return (Node*) new Test(nullptr, nullptr);
+    case TAG_BENCHMARK: return (Node*) new Benchmark("", nullptr, nullptr);
+    case TAG_SCOPE: return new Scope(nullptr, (Module*) nullptr);
+    default:;
+  }
+  switch((NodeKind) tag)
+  {
+    case NodeKind::UnaryArith: return (Node*) new UnaryArith(INVALID_OPERATOR, nullptr);
+    case NodeKind::BinaryArith: return (Node*) new BinaryArith(nullptr, INVALID_OPERATOR, nullptr);
+    case NodeKind::IntConstant: return (Node*) new IntConstant;
+    case NodeKind::FloatConstant: return (Node*) new FloatConstant;
+    case NodeKind::BoolConstant: return (Node*) new BoolConstant(false);
+    case NodeKind::MapConstant: return (Node*) new MapConstant(nullptr);
+    case NodeKind::UnionConstant: return (Node*) new UnionConstant(ph.value, ph.emptyUnion);
+    case NodeKind::CompoundLiteral: return (Node*) new CompoundLiteral(noExprs);
+    case NodeKind::Indexed: return (Node*) new Indexed(nullptr, nullptr);
+    case NodeKind::CallExpr: return (Node*) new CallExpr(nullptr, noExprs);
+    case NodeKind::VarExpr: return (Node*) new VarExpr(nullptr);
+    case NodeKind::SubrOverloadExpr: return (Node*) new SubrOverloadExpr(nullptr);
+    case NodeKind::SubroutineExpr: return (Node*) new SubroutineExpr(nullptr);
+    case NodeKind::StructMem: return (Node*) new StructMem(nullptr, (Variable*) nullptr);
+    case NodeKind::NewArray: return (Node*) new NewArray(nullptr, noExprs);
+    case NodeKind::ArrayLength: return (Node*) new ArrayLength(nullptr);
+    case NodeKind::IsExpr: return (Node*) new IsExpr(nullptr, nullptr);
+    case NodeKind::AsExpr: return (Node*) new AsExpr(nullptr, nullptr);
+    case NodeKind::ThisExpr: return (Node*) new ThisExpr(nullptr);
+    case NodeKind::Converted: return (Node*) new Converted(ph.value, ph.value->type);
+    case NodeKind::EnumExpr: return (Node*) new EnumExpr(ph.enumConstant);
+    case NodeKind::SimpleConstant: return (Node*) new SimpleConstant(nullptr);
+    case NodeKind::Block: return (Node*) new Block((Scope*) nullptr);
+    case NodeKind::Assign: return (Node*) new Assign(nullptr, nullptr, nullptr);
+    case NodeKind::CallStmt: return (Node*) new CallStmt(nullptr, nullptr);
+    case NodeKind::ForC: return (Node*) new ForC(ph.block);
+    case NodeKind::ForArray: return (Node*) new ForArray(ph.block);
+    case NodeKind::ForRange: return (Node*) new ForRange(ph.block, "", nullptr, nullptr);
+    case NodeKind::While: return (Node*) new While(ph.block, nullptr);
+    case NodeKind::If: return (Node*) new If(nullptr, nullptr, nullptr);
+    case NodeKind::Match: return (Node*) new Match(nullptr, nullptr, "", noTypes, *new vector<Block*>);
+    case NodeKind::Switch: return (Node*) new Switch(nullptr, nullptr, nullptr);
+    case NodeKind::Return: return (Node*) new Return(nullptr);
+    case NodeKind::Break: return (Node*) new Break(nullptr);
+    case NodeKind::Continue: return (Node*) new Continue(nullptr);
+    case NodeKind::Print: return (Node*) new Print(ph.block, noExprs);
+    case NodeKind::Assertion: return (Node*) new Assertion(nullptr, nullptr);
+    case NodeKind::StructType: return (Node*) new StructType("", nullptr);
+    case NodeKind::UnionType: return (Node*) new UnionType(noTypes);
+    case NodeKind::ArrayType: return (Node*) new ArrayType(primitives[Prim::CHAR], 1);
+    case NodeKind::TupleType: return (Node*) new TupleType(noTypes);
+    case NodeKind::MapType: return (Node*) new MapType(nullptr, nullptr);
+    case NodeKind::AliasType: return (Node*) new AliasType("", nullptr, nullptr);
+    case NodeKind::EnumType: return (Node*) new EnumType("", nullptr);
+    case NodeKind::IntegerType: return (Node*) new IntegerType("", 1, false);
+    case NodeKind::FloatType: return (Node*) new FloatType("", 4);
+    case NodeKind::CharType: return (Node*) new CharType;
+    case NodeKind::BoolType: return (Node*) new BoolType;
+    case NodeKind::SimpleType: return (Node*) new SimpleType("");
+    case NodeKind::CallableType: return (Node*) new CallableType(false, nullptr, noTypes);
+    case NodeKind::Subroutine: return (Node*) new Subroutine(ph.decl);
+    case NodeKind::ExternalSubroutine:
+      {
+        vector<string> noNames;
+        vector<bool> noBorrows;
+        string noCode;
+        return (Node*) new ExternalSubroutine(ph.decl, nullptr, "", primitives[Prim::VOID],
+            noTypes, noNames, noBorrows, noCode);
+      }
+    default:
+      return nullptr;
+  }
+}
+
+ProgramCache::ProgramCache(string dir, string path) : mainPath(path), mainHash(0)
+{
+  //The global module and its scope are stored (they hold the program's
+  //declarations), but the rest of the builtins are always the same
+  builtins.push_back((Node*) global);
+  builtins.push_back(global->scope);
+  for(auto prim : primitives)
+  {
+    builtins.push_back((Node*) prim);
+    if(auto st = dynCast<SimpleType>(prim))
+      builtins.push_back((Node*) st->val);
+  }
+  for(auto& name : global->scope->names)
+  {
+    auto alias = (AliasType*) name.second.item;
+    builtins.push_back((Node*) alias);
+    if(std::find(primitives.begin(), primitives.end(), alias->actual) == primitives.end())
+      builtins.push_back((Node*) alias->actual);
+  }
+  string source;
+  if(!readFile(mainPath, source))
+    return;
+  mainHash = hashSource(source);
+  FNV1A key;
+  string id = compilerID();
+  key.pump(id.c_str(), id.size());
+  key.pump(mainPath.c_str(), mainPath.size() + 1);
+  key.pump(mainHash);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.img", (unsigned long long) key.get());
+#ifdef _WIN32
+  _mkdir(dir.c_str());
+#else
+  mkdir(dir.c_str(), 0755);
+#endif
+  imagePath = dir + '/' + name;
+}
+
+//Hash of an image's tags and body, stored in its header, so that an image
+//that was damaged after it was written isn't loaded
+static uint64_t imageChecksum(const char* tags, size_t numTags, const char* body, size_t bodySize)
+{
+  FNV1A sum;
+  sum.pump(tags, numTags);
+  sum.pump(body, bodySize);
+  return sum.get();
+}
+
+//Objects before this index in the table are builtins that aren't stored
+//(except for the global module and its scope)
+static bool isStored(size_t i, size_t numBuiltins)
+{
+  return i < 2 || i >= numBuiltins;
+}
+
+bool ProgramCache::load()
+{
+  string image;
+  if(!mainHash || !readFile(imagePath, image))
+    return false;
+  ImageReader r(image);
+  if(r.str() != imageMagic || r.str() != compilerID())
+    return false;
+  //check that all the source files are unchanged
+  vector<pair<string, uint64_t>> files(r.count());
+  for(auto& f : files)
+  {
+    r.val(f.first);
+    f.second = r.num();
+  }
+  if(r.failed || !files.size() || files[0].first != mainPath || files[0].second != mainHash)
+    return false;
+  for(size_t i = 1; i < files.size(); i++)
+  {
+    string source;
+    if(!readFile(files[i].first, source) || hashSource(source) != files[i].second)
+      return false;
+  }
+  if(r.num() != builtins.size())
+    return false;
+  size_t numObjects = r.num();
+  if(r.failed || numObjects < builtins.size() ||
+      numObjects - builtins.size() > (size_t) (r.end - r.pos))
+    return false;
+  const char* tags = r.pos;
+  r.pos += numObjects - builtins.size();
+  uint64_t checksum = r.num();
+  if(r.num() != (uint64_t) (r.end - r.pos) || r.failed ||
+      imageChecksum(tags, numObjects - builtins.size(), r.pos, r.end - r.pos) != checksum)
+    return false;
+  //Read all the objects. Nothing that exists outside of this function is
+  //changed until the whole image has been read and checked: the contents
+  //of the global module and its scope are read into copies, and the roots
+  //into locals.
+  Placeholders ph;
+  Module* globalModule = (Module*) createObject(TAG_MODULE, ph);
+  Scope* globalScope = (Scope*) createObject(TAG_SCOPE, ph);
+  //(creating tests and benchmarks adds them to these lists)
+  vector<Test*> prevTests = Test::tests;
+  vector<Benchmark*> prevBenchmarks = Benchmark::benchmarks;
+  r.objects = builtins;
+  r.tags.push_back(TAG_MODULE);
+  r.tags.push_back(TAG_SCOPE);
+  for(size_t i = 2; i < builtins.size(); i++)
+    r.tags.push_back(tagOf((Node*) builtins[i]));
+  for(size_t i = builtins.size(); i < numObjects; i++)
+  {
+    uint8_t tag = tags[i - builtins.size()];
+    void* obj = createObject(tag, ph);
+    if(!obj)
+      r.failed = true;
+    r.objects.push_back(obj);
+    r.tags.push_back(tag);
+  }
+  Test::tests = prevTests;
+  Benchmark::benchmarks = prevBenchmarks;
+  Roots roots;
+  if(!r.failed)
+    transferRoots(r, roots);
+  for(size_t i = 0; i < numObjects && !r.failed; i++)
+  {
+    if(i == 0)
+      transferObject(r, (Node*) globalModule, TAG_MODULE);
+    else if(i == 1)
+      transferObject(r, globalScope, TAG_SCOPE);
+    else if(isStored(i, builtins.size()))
+      transferObject(r, r.objects[i], r.tags[i]);
+  }
+  if(r.failed || r.pos != r.end || globalModule->scope != global->scope)
+    return false;
+  //The image is valid: from here, the program is replaced by its contents
+  for(auto& f : files)
+    new SourceFile(f.first, f.second);
+  global->fileID = globalModule->fileID;
+  global->line = globalModule->line;
+  global->col = globalModule->col;
+  global->resolved = globalModule->resolved;
+  global->name = globalModule->name;
+  global->scope->parent = globalScope->parent;
+  global->scope->names = globalScope->names;
+  global->scope->children = globalScope->children;
+  global->scope->node = globalScope->node;
+  mainSubr = roots.main;
+  Test::tests = roots.tests;
+  Benchmark::benchmarks = roots.benchmarks;
+  globalSlots = roots.globalSlots;
+  for(auto& entry : r.mapEntries)
+    std::get<0>(entry)->values[std::get<1>(entry)] = std::get<2>(entry);
+  for(size_t i = builtins.size(); i < numObjects; i++)
+  {
+    if(r.tags[i] == (uint8_t) NodeKind::EnumType)
+    {
+      auto et = (EnumType*) r.objects[i];
+      et->resolved = false;
+      et->resolve();
+    }
+  }
+  //builtin aliases are otherwise resolved when first used
+  for(auto& name : global->scope->names)
+  {
+    if(name.second.kind == Name::TYPEDEF)
+      name.second.item->resolve();
+  }
+  return true;
+}
+
+void ProgramCache::save()
+{
+  if(!mainHash || !fileList.size() || fileList[0]->hash != mainHash || imagePath.empty())
+    return;
+  ImageWriter w(builtins);
+  Roots roots = {mainSubr, Test::tests, Benchmark::benchmarks, globalSlots};
+  transferRoots(w, roots);
+  for(size_t i = 0; i < w.objects.size(); i++)
+  {
+    if(isStored(i, builtins.size()))
+      transferObject(w, w.objects[i], i < 2 ? (i ? TAG_SCOPE : TAG_MODULE) : w.tags[i]);
+  }
+  if(!w.ok)
+    return;
+  ImageWriter header(builtins);
+  string magic = imageMagic;
+  string id = compilerID();
+  header.val(magic);
+  header.val(id);
+  header.num(fileList.size());
+  for(auto f : fileList)
+  {
+    header.val(f->path);
+    header.num(f->hash);
+  }
+  header.num(builtins.size());
+  header.num(w.objects.size());
+  string tags;
+  for(size_t i = builtins.size(); i < w.objects.size(); i++)
+    tags += (char) w.tags[i];
+  header.out += tags;
+  header.num(imageChecksum(tags.data(), tags.size(), w.out.data(), w.out.size()));
+  header.num(w.out.size());
+  //write to a temporary file first, so that other processes
+  //never see a partial image
+  string temp = imagePath + '.' + to_string(getpid());
+  FILE* f = fopen(temp.c_str(), "wb");
+  if(!f)
+    return;
+  bool ok = fwrite(header.out.data(), 1, header.out.size(), f) == header.out.size() &&
+    fwrite(w.out.data(), 1, w.out.size(), f) == w.out.size();
+  ok = !fclose(f) && ok;
+  if(!ok || rename(temp.c_str(), imagePath.c_str()))
+    remove(temp.c_str());
+}
+
@@ -0,0 +1,51 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "Common.hpp"
+
+/*****************************************************************************/
+// ProgramCache: on-disk images of resolved programs (--cache <dir>)
+//
+// After semantic analysis, the whole program is written to an image in dir:
+// every scope, type, variable, subroutine and statement reachable from the
+// global module (plus tests and benchmarks), with all the information that
+// resolution computed (frame slots, case tables, counter loops, ...). The
+// AST is what the interpreters run, so nothing else needs to be lowered.
+//
+// Images are named by a hash of the compiler build, the main file's path
+// and its contents. An image also lists every included file with the hash
+// of its contents, and is only used if they all still match (and if the
+// checksum of the rest of the image is still right). When an image
+// is loaded, lexing, parsing and resolution are skipped entirely.
+//
+// Objects are stored in a table, referring to each other by index. Loading
+// creates every object (using the ordinary constructors, with placeholders
+// for arguments that aren't known yet), then fills in all their fields,
+// checking that every reference is to the kind of object its field holds.
+// The program is only replaced once the whole image has been read.
+// The builtin types that init() creates are never stored: they are referred
+// to by position, as is the global module (whose contents are stored).
+/*****************************************************************************/
+
+struct ProgramCache
+{
+  //Must be created right after init(), before anything is parsed.
+  //mainPath is the main source file, as given on the command line.
+  ProgramCache(string dir, string mainPath);
+  //If an up-to-date image exists, load it (replacing parsing and
+  //resolution) and return true
+  bool load();
+  //Write an image of the resolved program (nothing is written if the
+  //program contains something that can't be stored)
+  void save();
+private:
+  string imagePath;
+  string mainPath;
+  //hash of the main file's contents, or 0 if it couldn't be read
+  uint64_t mainHash;
+  //the objects that init() created, in a fixed order
+  vector<void*> builtins;
+};
+
+#endif
+
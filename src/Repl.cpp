@@ -0,0 +1,353 @@
+#include "Repl.hpp"
+#include "Parser.hpp"
+#include "Lexer.hpp"
+#include "SourceFile.hpp"
+#include "Subroutine.hpp"
+#include "Variable.hpp"
+#include "ConstantFold.hpp"
+#include "AstInterpreter.hpp"
+#include "Memo.hpp"
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//What became of an attempt to run the next entry
+enum struct EntryResult
+{
+  DONE,
+  //more lines are needed to finish the entry
+  INCOMPLETE,
+  FAILED
+};
+
+static bool stdinIsTerminal()
+{
+#ifdef _WIN32
+  return _isatty(0);
+#else
+  return isatty(0);
+#endif
+}
+
+//Tracks whether the input read so far ends inside a string literal or
+//block comment (then it can't be lexed until more lines are read).
+//Each line is only scanned once.
+struct OpenScan
+{
+  OpenScan() : inString(false), commentDepth(0) {}
+  void scanLine(const string& line);
+  bool open()
+  {
+    return inString || commentDepth;
+  }
+  bool inString;
+  int commentDepth;
+};
+
+void OpenScan::scanLine(const string& line)
+{
+  for(size_t i = 0; i < line.length(); i++)
+  {
+    char c = line[i];
+    char next = i + 1 < line.length() ? line[i + 1] : 0;
+    if(inString)
+    {
+      if(c == '\\')
+        i++;
+      else if(c == '"')
+        inString = false;
+    }
+    else if(commentDepth)
+    {
+      if(c == '/' && next == '*')
+      {
+        commentDepth++;
+        i++;
+      }
+      else if(c == '*' && next == '/')
+      {
+        commentDepth--;
+        i++;
+      }
+    }
+    else if(c == '/' && next == '*')
+    {
+      commentDepth = 1;
+      i++;
+    }
+    else if(c == '/' && next == '/')
+    {
+      //the rest of the line is a comment
+      return;
+    }
+    else if(c == '"')
+      inString = true;
+    else if(c == '\'')
+    {
+      //skip the character (which may be escaped) and the closing quote
+      i += next == '\\' ? 3 : 2;
+    }
+  }
+}
+
+//How much a token changes the bracket nesting depth
+static int bracketChange(Token* t)
+{
+  if(t->type != PUNCTUATION)
+    return 0;
+  switch(((Punct*) t)->val)
+  {
+    case LPAREN:
+    case LBRACE:
+    case LBRACKET:
+      return 1;
+    case RPAREN:
+    case RBRACE:
+    case RBRACKET:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+//Does the next entry declare something (rather than being a statement)?
+static bool isDeclaration(Parser::Stream& stream)
+{
+  Token* next = stream.lookAhead();
+  Punct hash(HASH);
+  Punct colon(COLON);
+  if(next->compareTo(&hash))
+    return true;
+  if(next->type == IDENTIFIER)
+    return stream.lookAhead(1)->compareTo(&colon);
+  if(next->type != KEYWORD)
+    return false;
+  switch(((Keyword*) next)->kw)
+  {
+    case STRUCT:
+    case FUNC:
+    case PROC:
+    case EXTERN:
+    case MODULE:
+    case TYPEDEF:
+    case TYPE:
+    case ENUM:
+    case TEST:
+    case BENCHMARK:
+    case STATIC:
+    case USING:
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct Repl
+{
+  Repl(size_t stackSize, size_t memo)
+    : memoizer(memo ? new Memoizer(memo) : nullptr),
+    interp(stackSize, stdoutBuffer, memoizer), input(new SourceFile), stream(input)
+  {
+    newGlobalNames = &added;
+  }
+  ~Repl()
+  {
+    newGlobalNames = nullptr;
+    delete memoizer;
+  }
+  //Read and run entries until the end of input
+  void run();
+  //Parse, resolve and run the entry at the stream's position.
+  //If final, the input is over (so an entry can't be incomplete).
+  EntryResult runEntry(bool final);
+  //Lex the lines that haven't been lexed yet, then run every
+  //complete entry in the input that has been read
+  void runEntries(bool final);
+  void report(CaughtError& err);
+  Memoizer* memoizer;
+  Interpreter interp;
+  //all the input read so far
+  SourceFile* input;
+  Parser::Stream stream;
+  //the lines read but not lexed yet (which only happens while they end
+  //inside a string or comment), starting at line unlexedLine
+  string unlexed;
+  int unlexedLine;
+  OpenScan scan;
+  //depth[i] is the bracket nesting depth before input->tokens[i],
+  //so the depth at the end of an entry is found in constant time
+  vector<int> depth;
+  //the names the current entry declared in the global scope
+  vector<Name> added;
+  int failed;
+};
+
+void Repl::report(CaughtError& err)
+{
+  stdoutBuffer.flush();
+  std::cerr << err.message << '\n';
+  failed++;
+}
+
+EntryResult Repl::runEntry(bool final)
+{
+  size_t start = stream.pos;
+  Scope* globalScope = global->scope;
+  size_t usings = globalScope->usingDecls.size();
+  bool parsed = false;
+  added.clear();
+  try
+  {
+    if(isDeclaration(stream))
+    {
+      stream.parseDecl(globalScope, true);
+      parsed = true;
+      for(size_t i = usings; i < globalScope->usingDecls.size(); i++)
+        globalScope->usingDecls[i]->resolve();
+      for(auto& name : added)
+        name.item->resolve();
+      //globals are initialized right away, instead of when first used
+      interp.addGlobals();
+      for(auto& name : added)
+      {
+        if(name.kind == Name::VARIABLE)
+          interp.readVar((Variable*) name.item);
+      }
+    }
+    else
+    {
+      Block* block = new Block(globalScope);
+      block->setLocation(stream.lookAhead());
+      Statement* stmt = stream.parseStatementOrDecl(block, true);
+      parsed = true;
+      if(stmt)
+        block->addStatement(stmt);
+      block->resolve();
+      foldConstants(block);
+      int numLocals = 0;
+      assignLocalSlots(block->scope, numLocals);
+      interp.addGlobals();
+      interp.runBlock(block, numLocals);
+    }
+  }
+  catch(CaughtError& err)
+  {
+    interp.recover();
+    //whatever the entry declared is removed, so it can be declared again
+    for(auto& name : added)
+      globalScope->names.erase(name.name);
+    globalScope->usingDecls.resize(usings);
+    if(!parsed && !final && stream.pos >= stream.tokens->size())
+    {
+      stream.pos = start;
+      return EntryResult::INCOMPLETE;
+    }
+    report(err);
+    return EntryResult::FAILED;
+  }
+  stdoutBuffer.flush();
+  return EntryResult::DONE;
+}
+
+void Repl::runEntries(bool final)
+{
+  vector<Token*>& tokens = input->tokens;
+  if(!final && scan.open())
+    return;
+  if(unlexed.length())
+  {
+    //tokens are only appended, so the entries
+    //that have already run keep their positions
+    try
+    {
+      vector<Token*> lexed = lex(unlexed, input->id, unlexedLine);
+      for(auto t : lexed)
+      {
+        tokens.push_back(t);
+        depth.push_back(depth.back() + bracketChange(t));
+      }
+    }
+    catch(CaughtError& err)
+    {
+      report(err);
+      stream.pos = tokens.size();
+      scan = OpenScan();
+    }
+    unlexed.clear();
+  }
+  while(stream.pos < tokens.size())
+  {
+    //more opening than closing brackets: the entry can't be complete yet
+    if(!final && depth.back() > depth[stream.pos])
+      break;
+    EntryResult result = runEntry(final);
+    if(result == EntryResult::INCOMPLETE)
+      break;
+    if(result == EntryResult::FAILED)
+    {
+      //the rest of the line can't be parsed reliably
+      stream.pos = tokens.size();
+    }
+  }
+}
+
+void Repl::run()
+{
+  bool prompt = stdinIsTerminal();
+  int lineNum = 0;
+  depth.push_back(0);
+  failed = 0;
+  while(true)
+  {
+    if(prompt)
+    {
+      bool inEntry = unlexed.length() || stream.pos < input->tokens.size();
+      stdoutBuffer.write(inEntry ? "...   " : "onyx> ");
+      stdoutBuffer.flush();
+    }
+    string line;
+    if(!getline(std::cin, line))
+      break;
+    lineNum++;
+    if(unlexed.empty())
+      unlexedLine = lineNum;
+    line += '\n';
+    scan.scanLine(line);
+    unlexed += line;
+    runEntries(false);
+  }
+  //report whatever is left unfinished
+  if(unlexed.length() || stream.pos < input->tokens.size())
+    runEntries(true);
+  if(prompt)
+    stdoutBuffer.write("\n");
+  stdoutBuffer.flush();
+}
+
+int runRepl(size_t stackSize, size_t memo, vector<Expression*>& mainArgs)
+{
+  catchErrors = true;
+  Repl repl(stackSize, memo);
+  repl.run();
+  if(mainSubr)
+  {
+    vector<Value> args;
+    for(auto a : mainArgs)
+      args.push_back(constantValue(a));
+    try
+    {
+      repl.interp.addGlobals();
+      repl.interp.callSubr(mainSubr, args);
+    }
+    catch(CaughtError& err)
+    {
+      repl.report(err);
+    }
+    stdoutBuffer.flush();
+  }
+  catchErrors = false;
+  return repl.failed;
+}
+
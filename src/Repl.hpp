@@ -0,0 +1,33 @@
+#ifndef REPL_H
+#define REPL_H
+
+#include "Common.hpp"
+
+struct Expression;
+
+/*****************************************************************************/
+// Repl: the interactive mode (-i)
+//
+// Input is read from stdin one line at a time, and each entry (a declaration
+// or a statement) is run as soon as it's complete. Only the new entry is
+// lexed, parsed and resolved: declarations go into the global scope, where
+// later entries can use them, and statements run in a standalone block. All
+// entries run in the same Interpreter, so globals keep their values for the
+// whole session. The work per entry doesn't depend on how long the session
+// has been going.
+//
+// An entry is complete once it parses: when parsing runs out of tokens, more
+// lines are read. Errors (in parsing, resolution or at runtime) only end the
+// entry that caused them, and a declaration that fails is removed again.
+//
+// Names must be declared before they're used. If main was declared, it's
+// called at the end of input, so a whole program can be piped in.
+/*****************************************************************************/
+
+//Run a session on stdin. stackSize and memo are the same as for running main,
+//and mainArgs are passed to main (if there is one). Returns the number of
+//entries that failed.
+int runRepl(size_t stackSize, size_t memo, vector<Expression*>& mainArgs);
+
+#endif
+
@@ -4,6 +4,8 @@
 #include "Subroutine.hpp"
 #include "SourceFile.hpp"
 
+vector<Name>* newGlobalNames = nullptr;
+
 bool Name::inScope(Scope* s)
 {
   //see if scope is same as, or child of, s
@@ -103,6 +105,8 @@ void Scope::addName(const Name& n)
     }
   }
   names[n.name] = n;
+  if(newGlobalNames && this == global->scope)
+    newGlobalNames->push_back(n);
 }
 
 #define IMPL_ADD_NAME(type) \
@@ -135,6 +135,10 @@ struct Scope
   variant<Module*, StructType*, Subroutine*, Block*, EnumType*> node;
 };
 
+//If not null, every name added to the global scope is also appended here
+//(the REPL uses this to resolve each entry's new declarations by themselves)
+extern vector<Name>* newGlobalNames;
+
 struct UsingDecl : public Node
 {
   virtual Name lookup(const string& n) = 0;
@@ -14,16 +14,9 @@ SourceFile::SourceFile()
 {
   id = fileCounter++;
   path = "<stdin>";
-  Oss source;
-  while(!std::cin.eof())
-  {
-    string line;
-    getline(std::cin, line);
-    source << line << '\n';
-  }
+  hash = 0;
   fileList.push_back(this);
   fileTable[path] = this;
-  tokens = lex(source.str(), id);
 }
 
 SourceFile::SourceFile(Node* includeLoc, string path_)
@@ -61,6 +54,7 @@ SourceFile::SourceFile(Node* includeLoc, string path_)
   source.resize(size);
   fread((void*) source.c_str(), 1, size, f);
   fclose(f);
+  hash = hashSource(source);
   if(!includeLoc && source.length() > 2 && source.substr(0, 2) == "#!")
   {
     //skip shebang line in main file
@@ -71,6 +65,15 @@ SourceFile::SourceFile(Node* includeLoc, string path_)
   tokens = lex(source, id);
 }
 
+SourceFile::SourceFile(string path_, uint64_t hash_)
+{
+  id = fileCounter++;
+  path = path_;
+  hash = hash_;
+  fileList.push_back(this);
+  fileTable[path] = this;
+}
+
 SourceFile* findSourceFile(string path)
 {
   auto it = fileTable.find(path);
@@ -100,3 +103,10 @@ SourceFile* sourceFileFromID(int id)
   return fileList[id];
 }
 
+uint64_t hashSource(const string& source)
+{
+  FNV1A f;
+  f.pump(source.c_str(), source.size());
+  return f.get();
+}
+
@@ -9,13 +9,19 @@ struct Node;
 
 struct SourceFile
 {
-  //constructor that reads from stdin
+  //constructor for stdin, which starts out empty: the REPL
+  //appends the tokens of each entry as it's read (see Repl.hpp)
   SourceFile();
   //constructor that reads from general source file
   SourceFile(Node* includeLoc, string path);
+  //constructor for a file whose program was loaded from an image
+  //(see ProgramCache.hpp): the file isn't read, and has no tokens
+  SourceFile(string path, uint64_t hash);
   vector<Token*> tokens;
   string path;
   int id;
+  //hash of the file's contents (see hashSource)
+  uint64_t hash;
 };
 
 //Look up the loaded source file with given path
@@ -24,5 +30,7 @@ SourceFile* findSourceFile(string path);
 SourceFile* addSourceFile(Node* includeLoc, string path);
 SourceFile* addStdinMainFile();
 SourceFile* sourceFileFromID(int id);
+//Hash the contents of a source file
+uint64_t hashSource(const string& source);
 
 #endif
@@ -1,20 +1,24 @@
 #include "Subroutine.hpp"
 #include "Variable.hpp"
+#include "FFI.hpp"
+#include "ConstantFold.hpp"
 #include <algorithm>
 
 using std::find;
 
 static int nextSubrID = 0;
-//static int nextExSubrID = 0;
+static int nextExSubrID = 0;
 
 Subroutine* mainSubr = nullptr;
 extern Module* global;
 
 vector<Test*> Test::tests;
+vector<Benchmark*> Benchmark::benchmarks;
 
 //Block which is body of subroutine
 Block::Block(Subroutine* s)
 {
+  kind = NodeKind::Block;
   breakable = None();
   loop = None();
   subr = s;
@@ -23,6 +27,7 @@ Block::Block(Subroutine* s)
 
 Block::Block(Block* parent)
 {
+  kind = NodeKind::Block;
   breakable = parent->breakable;
   loop = parent->loop;
   subr = parent->subr;
@@ -31,6 +36,7 @@ Block::Block(Block* parent)
 
 Block::Block(Scope* s)
 {
+  kind = NodeKind::Block;
   subr = nullptr;
   loop = None();
   breakable = None();
@@ -59,13 +65,17 @@ void Block::resolveImpl()
 
 Assign::Assign(Block* b, Expression* lhs, Expression* rhs) : Statement(b)
 {
+  kind = NodeKind::Assign;
   lvalue = lhs;
   rvalue = rhs;
+  arrayUpdate = nullptr;
 }
 
 Assign::Assign(Block* b, Expression* lhs, int op, Expression* rhs)
   : Statement(b)
 {
+  kind = NodeKind::Assign;
+  arrayUpdate = nullptr;
   //the actual rvalue used internally depends on the operation
   lvalue = lhs;
   switch(op)
@@ -141,11 +151,13 @@ void Assign::resolveImpl()
     errMsgLoc(this, "left-hand side of assignment is immutable");
   }
   resolveAndCoerce(rvalue, lvalue->type);
+  findArrayUpdate();
   resolved = true;
 }
 
 CallStmt::CallStmt(Block* b, CallExpr* e) : Statement(b)
 {
+  kind = NodeKind::CallStmt;
   eval = e;
 }
 
@@ -161,10 +173,231 @@ For::For(Block* b) : Statement(b)
   inner = new Block(outer);
   inner->loop = this;
   inner->breakable = this;
+  counterLoop = nullptr;
+}
+
+//The local variable (if any) which holds the value of an lvalue or method "this"
+static Variable* rootVariable(Expression* e)
+{
+  while(true)
+  {
+    switch(e->kind)
+    {
+      case NodeKind::VarExpr:
+        return ((VarExpr*) e)->var;
+      case NodeKind::Indexed:
+        e = ((Indexed*) e)->group;
+        break;
+      case NodeKind::StructMem:
+        e = ((StructMem*) e)->base;
+        break;
+      default:
+        return nullptr;
+    }
+  }
+}
+
+//Find the variables which may be modified by evaluating an expression.
+//Other than assignment, a local can only be modified by calling a method on it.
+static void findModifiedVars(Expression* e, set<Variable*>& vars)
+{
+  if(!e)
+    return;
+  switch(e->kind)
+  {
+    case NodeKind::UnaryArith:
+      findModifiedVars(((UnaryArith*) e)->expr, vars);
+      break;
+    case NodeKind::BinaryArith:
+      findModifiedVars(((BinaryArith*) e)->lhs, vars);
+      findModifiedVars(((BinaryArith*) e)->rhs, vars);
+      break;
+    case NodeKind::CompoundLiteral:
+      for(auto mem : ((CompoundLiteral*) e)->members)
+        findModifiedVars(mem, vars);
+      break;
+    case NodeKind::Indexed:
+      findModifiedVars(((Indexed*) e)->group, vars);
+      findModifiedVars(((Indexed*) e)->index, vars);
+      break;
+    case NodeKind::CallExpr:
+    {
+      CallExpr* call = (CallExpr*) e;
+      auto structMem = dynCast<StructMem>(call->callable);
+      if(structMem && structMem->member.is<Subroutine*>())
+        vars.insert(rootVariable(structMem->base));
+      findModifiedVars(call->callable, vars);
+      for(auto arg : call->args)
+        findModifiedVars(arg, vars);
+      break;
+    }
+    case NodeKind::StructMem:
+      findModifiedVars(((StructMem*) e)->base, vars);
+      break;
+    case NodeKind::NewArray:
+      for(auto dim : ((NewArray*) e)->dims)
+        findModifiedVars(dim, vars);
+      break;
+    case NodeKind::ArrayLength:
+      findModifiedVars(((ArrayLength*) e)->array, vars);
+      break;
+    case NodeKind::IsExpr:
+    case NodeKind::AsExpr:
+      findModifiedVars(((UnionConvBase*) e)->base, vars);
+      break;
+    case NodeKind::Converted:
+      findModifiedVars(((Converted*) e)->value, vars);
+      break;
+    default:;
+  }
+}
+
+//Find the variables which may be modified by executing a statement
+static void findModifiedVars(Statement* s, set<Variable*>& vars)
+{
+  if(!s)
+    return;
+  switch(s->kind)
+  {
+    case NodeKind::Block:
+      for(auto stmt : ((Block*) s)->stmts)
+        findModifiedVars(stmt, vars);
+      break;
+    case NodeKind::Assign:
+    {
+      Assign* a = (Assign*) s;
+      if(auto cl = dynCast<CompoundLiteral>(a->lvalue))
+      {
+        for(auto mem : cl->members)
+          vars.insert(rootVariable(mem));
+      }
+      else
+        vars.insert(rootVariable(a->lvalue));
+      findModifiedVars(a->lvalue, vars);
+      findModifiedVars(a->rvalue, vars);
+      break;
+    }
+    case NodeKind::CallStmt:
+      findModifiedVars(((CallStmt*) s)->eval, vars);
+      break;
+    case NodeKind::ForC:
+    {
+      ForC* fc = (ForC*) s;
+      findModifiedVars(fc->init, vars);
+      findModifiedVars(fc->condition, vars);
+      findModifiedVars(fc->increment, vars);
+      findModifiedVars(fc->inner, vars);
+      break;
+    }
+    case NodeKind::ForArray:
+    {
+      ForArray* fa = (ForArray*) s;
+      findModifiedVars(fa->arr, vars);
+      findModifiedVars(fa->inner, vars);
+      break;
+    }
+    case NodeKind::ForRange:
+    {
+      ForRange* fr = (ForRange*) s;
+      findModifiedVars(fr->begin, vars);
+      findModifiedVars(fr->end, vars);
+      findModifiedVars(fr->inner, vars);
+      break;
+    }
+    case NodeKind::While:
+      findModifiedVars(((While*) s)->condition, vars);
+      findModifiedVars(((While*) s)->body, vars);
+      break;
+    case NodeKind::If:
+    {
+      If* i = (If*) s;
+      findModifiedVars(i->condition, vars);
+      findModifiedVars(i->body, vars);
+      findModifiedVars(i->elseBody, vars);
+      break;
+    }
+    case NodeKind::Match:
+    {
+      Match* m = (Match*) s;
+      findModifiedVars(m->matched, vars);
+      for(auto c : m->cases)
+        findModifiedVars(c, vars);
+      break;
+    }
+    case NodeKind::Switch:
+      findModifiedVars(((Switch*) s)->switched, vars);
+      findModifiedVars(((Switch*) s)->block, vars);
+      break;
+    case NodeKind::Return:
+      findModifiedVars(((Return*) s)->value, vars);
+      break;
+    case NodeKind::Print:
+      for(auto e : ((Print*) s)->exprs)
+        findModifiedVars(e, vars);
+      break;
+    case NodeKind::Assertion:
+      findModifiedVars(((Assertion*) s)->asserted, vars);
+      break;
+    default:;
+  }
+}
+
+//Does e always evaluate to the same value (without side effects),
+//given that none of the variables in modified change?
+static bool loopInvariant(Expression* e, set<Variable*>& modified)
+{
+  if(e->constant())
+    return true;
+  switch(e->kind)
+  {
+    case NodeKind::VarExpr:
+    {
+      Variable* var = ((VarExpr*) e)->var;
+      return var->isLocalOrParameter() && modified.find(var) == modified.end();
+    }
+    case NodeKind::UnaryArith:
+      return loopInvariant(((UnaryArith*) e)->expr, modified);
+    case NodeKind::BinaryArith:
+      return loopInvariant(((BinaryArith*) e)->lhs, modified) &&
+        loopInvariant(((BinaryArith*) e)->rhs, modified);
+    case NodeKind::Indexed:
+      return loopInvariant(((Indexed*) e)->group, modified) &&
+        loopInvariant(((Indexed*) e)->index, modified);
+    case NodeKind::StructMem:
+    {
+      StructMem* sm = (StructMem*) e;
+      return sm->member.is<Variable*>() && loopInvariant(sm->base, modified);
+    }
+    case NodeKind::ArrayLength:
+      return loopInvariant(((ArrayLength*) e)->array, modified);
+    case NodeKind::Converted:
+      return loopInvariant(((Converted*) e)->value, modified);
+    default:;
+  }
+  return false;
+}
+
+//Get the value of a constant integer step (1 in "i++").
+//Only small constants are accepted through a conversion, since they
+//fit in any integer type.
+static bool stepConstant(Expression* e, int64_t& step)
+{
+  bool converted = false;
+  if(auto conv = dynCast<Converted>(e))
+  {
+    e = conv->value;
+    converted = true;
+  }
+  auto ic = dynCast<IntConstant>(e);
+  if(!ic)
+    return false;
+  step = ic->isSigned() ? ic->sval : (int64_t) ic->uval;
+  return !converted || (step >= 0 && step < 128);
 }
 
 ForC::ForC(Block* b) : For(b)
 {
+  kind = NodeKind::ForC;
   init = nullptr;
   condition = nullptr;
   increment = nullptr;
@@ -189,11 +422,93 @@ void ForC::resolveImpl()
     increment->resolve();
   //finally, resolve the body
   inner->resolve();
+  findCounterLoop();
   resolved = true;
 }
 
+void ForC::findCounterLoop()
+{
+  //condition must compare an integer local with a bound: "i < n"
+  auto cond = dynCast<BinaryArith>(condition);
+  if(!cond)
+    return;
+  switch(cond->op)
+  {
+    case CMPL:
+    case CMPLE:
+    case CMPG:
+    case CMPGE:
+    case CMPNEQ:
+      break;
+    default:
+      return;
+  }
+  auto ve = dynCast<VarExpr>(cond->lhs);
+  if(!ve || !ve->var->isLocalOrParameter())
+    return;
+  Variable* counter = ve->var;
+  if(!isa<IntegerType>(canonicalize(counter->type)) ||
+      !typesSame(counter->type, cond->rhs->type))
+    return;
+  //increment must add or subtract a constant: "i++", "i -= 2"
+  auto incr = dynCast<Assign>(increment);
+  if(!incr || rootVariable(incr->lvalue) != counter || !isa<VarExpr>(incr->lvalue))
+    return;
+  auto update = dynCast<BinaryArith>(incr->rvalue);
+  if(!update || (update->op != PLUS && update->op != SUB))
+    return;
+  auto updated = dynCast<VarExpr>(update->lhs);
+  int64_t step;
+  if(!updated || updated->var != counter || !stepConstant(update->rhs, step))
+    return;
+  //the bound can't depend on anything the body or increment modifies
+  set<Variable*> modified;
+  modified.insert(counter);
+  findModifiedVars(inner, modified);
+  if(!loopInvariant(cond->rhs, modified))
+    return;
+  counterLoop = new CounterLoop;
+  counterLoop->counter = counter;
+  counterLoop->bound = cond->rhs;
+  counterLoop->cmp = cond->op;
+  counterLoop->step = update->op == PLUS ? step : -step;
+}
+
+void Assign::findArrayUpdate()
+{
+  //lvalue must be a local array, and rvalue the same array plus something
+  auto ve = dynCast<VarExpr>(lvalue);
+  auto sum = dynCast<BinaryArith>(rvalue);
+  if(!ve || !ve->var->isLocalOrParameter() || !sum || sum->op != PLUS ||
+      !canonicalize(ve->var->type)->isArray())
+    return;
+  Variable* array = ve->var;
+  auto lhsVar = dynCast<VarExpr>(sum->lhs);
+  auto rhsVar = dynCast<VarExpr>(sum->rhs);
+  bool prepend;
+  if(lhsVar && lhsVar->var == array)
+    prepend = false;
+  else if(rhsVar && rhsVar->var == array)
+    prepend = true;
+  else
+    return;
+  Expression* operand = prepend ? sum->lhs : sum->rhs;
+  //operand is evaluated before the array is read, so it can't modify the array
+  set<Variable*> modified;
+  findModifiedVars(operand, modified);
+  if(modified.count(array))
+    return;
+  arrayUpdate = new ArrayUpdate;
+  arrayUpdate->array = array;
+  arrayUpdate->operand = operand;
+  arrayUpdate->prepend = prepend;
+  arrayUpdate->concat = canonicalize(operand->type)->isArray();
+}
+
 ForArray::ForArray(Block* b) : For(b)
-{}
+{
+  kind = NodeKind::ForArray;
+}
 
 void ForArray::createIterators(vector<string>& iters)
 {
@@ -217,7 +532,7 @@ void ForArray::createIterators(vector<string>& iters)
 void ForArray::resolveImpl()
 {
   resolveExpr(arr);
-  ArrayType* arrType = dynamic_cast<ArrayType*>(arr->type);
+  ArrayType* arrType = dynCast<ArrayType>(arr->type);
   if(!arrType)
   {
     errMsgLoc(this, "can't iterate over non-array expression");
@@ -237,6 +552,7 @@ void ForArray::resolveImpl()
 ForRange::ForRange(Block* b, string counterName, Expression* beginExpr, Expression* endExpr)
   : For(b), begin(beginExpr), end(endExpr)
 {
+  kind = NodeKind::ForRange;
   //create the counter variable in outer block
   counter = new Variable(counterName, primitives[Prim::LONG], outer);
   outer->scope->addName(counter);
@@ -258,12 +574,25 @@ void ForRange::resolveImpl()
   }
   outer->resolve();
   inner->resolve();
+  //If the body can't change the end value, it only needs to be evaluated once
+  set<Variable*> modified;
+  modified.insert(counter);
+  findModifiedVars(inner, modified);
+  if(loopInvariant(end, modified))
+  {
+    counterLoop = new CounterLoop;
+    counterLoop->counter = counter;
+    counterLoop->bound = end;
+    counterLoop->cmp = CMPL;
+    counterLoop->step = 1;
+  }
   resolved = true;
 }
 
 While::While(Block* b, Expression* cond)
   : Statement(b)
 {
+  kind = NodeKind::While;
   condition = cond;
   body = new Block(b);
   body->loop = this;
@@ -284,6 +613,7 @@ void While::resolveImpl()
 If::If(Block* b, Expression* cond, Statement* bodyStmt)
   : Statement(b)
 {
+  kind = NodeKind::If;
   condition = cond;
   body = bodyStmt;
   elseBody = nullptr;
@@ -292,6 +622,7 @@ If::If(Block* b, Expression* cond, Statement* bodyStmt)
 If::If(Block* b, Expression* cond, Statement* tb, Statement* fb)
   : Statement(b)
 {
+  kind = NodeKind::If;
   condition = cond;
   body = tb;
   elseBody = fb;
@@ -313,6 +644,7 @@ Match::Match(Block* b, Expression* m, string varName,
     vector<Block*>& caseBlocks)
   : Statement(b)
 {
+  kind = NodeKind::Match;
   matched = m;
   types = t;
   cases = caseBlocks;
@@ -334,7 +666,7 @@ Match::Match(Block* b, Expression* m, string varName,
 void Match::resolveImpl()
 {
   resolveExpr(matched);
-  auto ut = dynamic_cast<UnionType*>(canonicalize(matched->type));
+  auto ut = dynCast<UnionType>(canonicalize(matched->type));
   if(!ut)
   {
     errMsgLoc(matched, "matched expression must be of union type");
@@ -343,14 +675,19 @@ void Match::resolveImpl()
   {
     resolveType(t);
   }
-  for(auto t : types)
+  optionCases.assign(ut->options.size(), -1);
+  for(size_t i = 0; i < types.size(); i++)
   {
+    Type* t = types[i];
     bool foundInUnion = false;
-    for(auto op : ut->options)
+    for(size_t j = 0; j < ut->options.size(); j++)
     {
-      if(typesSame(t, op))
+      if(typesSame(t, ut->options[j]))
       {
         foundInUnion = true;
+        //the first case for an option is the one taken
+        if(optionCases[j] < 0)
+          optionCases[j] = i;
         break;
       }
     }
@@ -369,8 +706,12 @@ void Match::resolveImpl()
 Switch::Switch(Block* b, Expression* s, Block* stmtBlock)
   : Statement(b)
 {
+  kind = NodeKind::Switch;
   switched = s;
   block = stmtBlock;
+  hasTable = false;
+  denseTable = false;
+  tableBase = 0;
 }
 
 void Switch::resolveImpl()
@@ -382,7 +723,7 @@ void Switch::resolveImpl()
     //intercept special case of enum values, without preceding enum name.
     if(!caseVal->resolved)
     {
-      auto switchedEnum = dynamic_cast<EnumType*>(switched->type);
+      auto switchedEnum = dynCast<EnumType>(switched->type);
       UnresolvedExpr::setShortcutEnum(switchedEnum);
       resolveExpr(caseVal);
       UnresolvedExpr::clearShortcutEnum();
@@ -393,21 +734,83 @@ void Switch::resolveImpl()
     }
     else if(!typesSame(switched->type, caseVal->type))
     {
-      caseVal = new Converted(caseVal, switched->type);
+      //fold conversion of integer constants, so they can go in the case table
+      if(auto ic = dynCast<IntConstant>(caseVal))
+        caseVal = ic->convert(switched->type);
+      else
+        caseVal = new Converted(caseVal, switched->type);
     }
   }
   //this resolves all statements
   block->resolve();
+  buildCaseTable();
   resolved = true;
 }
 
+void Switch::buildCaseTable()
+{
+  Type* t = canonicalize(switched->type);
+  if(auto et = dynCast<EnumType>(t))
+  {
+    //enum values are compared by identity, so enum constants
+    //can only be looked up by value if the values are unique
+    set<uint64_t> values;
+    for(auto ec : et->values)
+    {
+      if(!values.insert(ec->value).second)
+        return;
+    }
+  }
+  else if(!isa<IntegerType>(t) && !isa<CharType>(t))
+    return;
+  vector<pair<int64_t, int>> keys;
+  for(size_t i = 0; i < caseValues.size(); i++)
+  {
+    Expression* caseVal = caseValues[i];
+    if(auto ic = dynCast<IntConstant>(caseVal))
+      keys.push_back(std::make_pair(ic->isSigned() ? ic->sval : (int64_t) ic->uval, (int) i));
+    else if(auto ee = dynCast<EnumExpr>(caseVal))
+      keys.push_back(std::make_pair((int64_t) ee->value->value, (int) i));
+    else
+      dynamicCases.push_back(i);
+  }
+  if(keys.empty())
+    return;
+  hasTable = true;
+  int64_t minKey = keys[0].first;
+  int64_t maxKey = keys[0].first;
+  for(auto& k : keys)
+  {
+    minKey = std::min(minKey, k.first);
+    maxKey = std::max(maxKey, k.first);
+  }
+  //use a dense table unless it would be mostly empty
+  uint64_t range = (uint64_t) maxKey - (uint64_t) minKey;
+  if(range < 2 * keys.size() + 16)
+  {
+    denseTable = true;
+    tableBase = minKey;
+    jumpTable.resize(range + 1, -1);
+    //insert in reverse so that the first of any duplicate cases wins
+    for(auto it = keys.rbegin(); it != keys.rend(); it++)
+      jumpTable[(uint64_t) it->first - (uint64_t) minKey] = it->second;
+  }
+  else
+  {
+    for(auto& k : keys)
+      caseTable.insert(k);
+  }
+}
+
 Return::Return(Block* b, Expression* e) : Statement(b)
 {
+  kind = NodeKind::Return;
   value = e;
 }
 
 Return::Return(Block* b) : Statement(b)
 {
+  kind = NodeKind::Return;
   value = nullptr;
 }
 
@@ -417,6 +820,10 @@ void Return::resolveImpl()
   {
     resolveExpr(value);
   }
+  if(!block->subr)
+  {
+    errMsgLoc(this, "can't return from a test or benchmark");
+  }
   //make sure value can be converted to enclosing subroutine's return type
   auto subrRetType = block->subr->type->returnType;
   if(typesSame(subrRetType, primitives[Prim::VOID]))
@@ -438,7 +845,9 @@ void Return::resolveImpl()
 }
 
 Break::Break(Block* b) : Statement(b)
-{}
+{
+  kind = NodeKind::Break;
+}
 
 void Break::resolveImpl()
 {
@@ -450,7 +859,9 @@ void Break::resolveImpl()
 }
 
 Continue::Continue(Block* b) : Statement(b)
-{}
+{
+  kind = NodeKind::Continue;
+}
 
 void Continue::resolveImpl()
 {
@@ -463,6 +874,7 @@ void Continue::resolveImpl()
 
 Print::Print(Block* b, vector<Expression*>& e) : Statement(b)
 {
+  kind = NodeKind::Print;
   exprs = e;
   usage = b->scope;
 }
@@ -482,6 +894,7 @@ void Print::resolveImpl()
 
 Assertion::Assertion(Block* b, Expression* a) : Statement(b)
 {
+  kind = NodeKind::Assertion;
   asserted = a;
 }
 
@@ -610,11 +1023,13 @@ void SubroutineDecl::resolveImpl()
 Subroutine::Subroutine(SubroutineDecl* d)
   : SubrBase(d)
 {
+  kind = NodeKind::Subroutine;
   //Create the scope for parameters.
   scope = new Scope(d->scope, this);
   //Body will be a sub-scope of that)
   body = new Block(this);
   id = nextSubrID++;
+  numLocals = 0;
 }
 
 void Subroutine::setSignature(Type* retType, vector<Variable*>& parsedParams)
@@ -633,6 +1048,25 @@ void Subroutine::setSignature(Type* retType, vector<Variable*>& parsedParams)
   type->resolve();
 }
 
+void assignLocalSlots(Scope* s, int& numLocals)
+{
+  for(auto& n : s->names)
+  {
+    if(n.second.kind == Name::VARIABLE)
+    {
+      Variable* v = (Variable*) n.second.item;
+      if(v->isLocal())
+        v->slot = numLocals++;
+    }
+  }
+  for(auto child : s->children)
+  {
+    //don't descend into nested subroutines or structs
+    if(child->node.is<Block*>())
+      assignLocalSlots(child, numLocals);
+  }
+}
+
 void Subroutine::resolveImpl()
 {
   INTERNAL_ASSERT(type->resolved);
@@ -650,12 +1084,18 @@ void Subroutine::resolveImpl()
   resolved = true;
   if(typesSame(type->returnType, primitives[Prim::VOID]) &&
       (body->stmts.size() == 0 ||
-      !dynamic_cast<Return*>(body->stmts.back())))
+      !dynCast<Return>(body->stmts.back())))
   {
     body->stmts.push_back(new Return(body));
   }
   //resolve the body
   body->resolve();
+  foldConstants(body);
+  //assign frame slots: parameters first, then all locals in the body
+  numLocals = 0;
+  for(auto param : params)
+    param->slot = numLocals++;
+  assignLocalSlots(scope, numLocals);
   //do additional checks for main()
   if(name() == "main")
   {
@@ -697,25 +1137,63 @@ ExternalSubroutine::ExternalSubroutine(
     vector<string>& pnames,
     vector<bool>& borrow,
     string& code)
-  : SubrBase(sd)
+  : SubrBase(sd), c(code), paramNames(pnames), paramBorrowed(borrow), native(nullptr)
 {
-  //TODO
-  INTERNAL_ERROR;
+  kind = NodeKind::ExternalSubroutine;
+  size_t colon = c.rfind(':');
+  if(colon == string::npos)
+    symbol = c;
+  else
+  {
+    library = c.substr(0, colon);
+    symbol = c.substr(colon + 1);
+  }
+  type = new CallableType(sd->isPure, returnType, ptypes);
+  type->resolve();
+  id = nextExSubrID++;
 }
 
 void ExternalSubroutine::resolveImpl()
 {
-  INTERNAL_ERROR;
+  if(decl->owner)
+  {
+    errMsgLoc(this, "external subroutine " << name() << " can't be a struct member (declare it static)");
+  }
+  if(symbol.length() == 0)
+  {
+    errMsgLoc(this, "external subroutine " << name() << " has no symbol name");
+  }
+  checkExternSignature(this);
+  resolved = true;
 }
 
 Test::Test(Scope* s, Block* b) : scope(s), run(b)
 {
+  numLocals = 0;
   tests.push_back(this);
 }
 
 void Test::resolveImpl()
 {
   run->resolve();
+  foldConstants(run);
+  numLocals = 0;
+  assignLocalSlots(run->scope, numLocals);
+  resolved = true;
+}
+
+Benchmark::Benchmark(string n, Scope* s, Block* b) : name(n), scope(s), run(b)
+{
+  numLocals = 0;
+  benchmarks.push_back(this);
+}
+
+void Benchmark::resolveImpl()
+{
+  run->resolve();
+  foldConstants(run);
+  numLocals = 0;
+  assignLocalSlots(run->scope, numLocals);
   resolved = true;
 }
 
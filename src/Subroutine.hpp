@@ -6,6 +6,7 @@
 #include "Expression.hpp"
 #include "Scope.hpp"
 #include "AST.hpp"
+#include <atomic>
 
 /***************************************************************************/
 // Subroutine: middle-end structures for program behavior and control flow //
@@ -20,6 +21,7 @@ extern Subroutine* mainSubr;
 
 struct Statement : public Node
 {
+  NODE_KIND_RANGE(Block, Assertion)
   //ctor for statements that don't belong to any block (e.g. subroutine bodies)
   Statement() : block(nullptr) {}
   Statement(Block* b) : block(b) {}
@@ -53,6 +55,7 @@ struct Subroutine;
 struct ExternalSubroutine;
 
 struct Test;
+struct Benchmark;
 
 //Loop (anything that can have continue statement)
 typedef variant<None, For*, While*> Loop;
@@ -61,6 +64,7 @@ typedef variant<None, For*, While*, Switch*> Breakable;
 
 struct Block : public Statement
 {
+  NODE_KIND(Block)
   //Constructor for function/procedure body
   Block(Subroutine* subr);
   //Constructor for empty block
@@ -84,19 +88,40 @@ struct Block : public Statement
   Loop loop;
 };
 
+//An assignment "a = a + x" or "a = x + a" (x an element or an array), where
+//a is a local array variable that evaluating x can't modify. Found during
+//resolution, so that interpreters can evaluate x and then update a's array
+//in place: a's old value can't be observed after the assignment, so unless
+//the array is shared with another value, it doesn't need to be copied.
+struct ArrayUpdate
+{
+  Variable* array;
+  Expression* operand;
+  //is operand added at the front (prepend)?
+  bool prepend;
+  //is operand an array (concatenation), not an element?
+  bool concat;
+};
+
 struct Assign : public Statement
 {
+  NODE_KIND(Assign)
   Assign(Block* b, Expression* lhs, Expression* rhs);
   //Update operators (like +=, &=, etc.)
   //Internally, is converted to just lhs := lhs <op> rhs
   Assign(Block* b, Expression* lhs, int op, Expression* rhs = nullptr);
   void resolveImpl();
+  //recognize "a = a + x" and "a = x + a"
+  void findArrayUpdate();
   Expression* lvalue;
   Expression* rvalue;
+  //non-null if this is an in-place array update (set by resolveImpl)
+  ArrayUpdate* arrayUpdate;
 };
 
 struct CallStmt : public Statement
 {
+  NODE_KIND(CallStmt)
   CallStmt(Block* b, CallExpr* e);
   void resolveImpl();
   //code generator evaluates eval
@@ -104,8 +129,25 @@ struct CallStmt : public Statement
   CallExpr* eval;
 };
 
+//A loop which steps an integer local variable by a constant after
+//each iteration, and continues while it compares true against a bound
+//that the loop body can't change. Found during resolution, so that
+//interpreters can run the loop with a native counter: the bound is
+//evaluated only once, and the condition and increment are not
+//evaluated as general expressions.
+struct CounterLoop
+{
+  Variable* counter;
+  Expression* bound;
+  //comparison "counter <cmp> bound" (CMPL, CMPLE, CMPG, CMPGE or CMPNEQ)
+  int cmp;
+  //added to the counter after each iteration
+  int64_t step;
+};
+
 struct For : public Statement
 {
+  NODE_KIND_RANGE(ForC, ForRange)
   For(Block* b);
   //Outer (exists just for the scope) contains
   //counters and intialization/increment statements
@@ -114,15 +156,20 @@ struct For : public Statement
   //(contains user statements)
   //Loop/Breakable of inner are this loop
   Block* inner;
+  //non-null if this is a counter loop (set by resolveImpl)
+  CounterLoop* counterLoop;
   virtual void resolveImpl() = 0;
 };
 
 //C-style for loop:
 struct ForC : public For
 {
+  NODE_KIND(ForC)
   //note: init, condition and increment are optional (can be NULL)
   ForC(Block* b);
   void resolveImpl();
+  //recognize "for(...; i < n; i += k)"
+  void findCounterLoop();
   //Parser directly assigns these members:
   Statement* init;
   Expression* condition;
@@ -131,6 +178,7 @@ struct ForC : public For
 
 struct ForArray : public For
 {
+  NODE_KIND(ForArray)
   ForArray(Block* b);
   void createIterators(vector<string>& iters);
   void resolveImpl();
@@ -142,6 +190,7 @@ struct ForArray : public For
 
 struct ForRange : public For
 {
+  NODE_KIND(ForRange)
   ForRange(Block* b, string counterName, Expression* begin, Expression* end);
   Variable* counter;
   Expression* begin;
@@ -151,6 +200,7 @@ struct ForRange : public For
 
 struct While : public Statement
 {
+  NODE_KIND(While)
   //body can be any statement,
   //but internally body must be a block (for Loop/Breakable)
   While(Block* b, Expression* condition);
@@ -161,6 +211,7 @@ struct While : public Statement
 
 struct If : public Statement
 {
+  NODE_KIND(If)
   If(Block* b, Expression* condition, Statement* body);
   If(Block* b, Expression* condition, Statement* tbody, Statement* fbody);
   void resolveImpl();
@@ -171,6 +222,7 @@ struct If : public Statement
 
 struct Match : public Statement
 {
+  NODE_KIND(Match)
   //Create an empty match statement
   //Add the individual cases after constructing
   Match(Block* b, Expression* m, string varName,
@@ -181,21 +233,51 @@ struct Match : public Statement
   vector<Type*> types;         //each type must be an option of matched->type
   vector<Block*> cases;        //correspond 1-1 with types
   vector<Variable*> caseVars;  //correspond 1-1 with cases
+  //for each option of matched's union type, the index of its case (or -1)
+  vector<int> optionCases;
 };
 
 struct Switch : public Statement
 {
+  NODE_KIND(Switch)
   Switch(Block* b, Expression* s, Block* block);
   void resolveImpl();
+  //Build the case table (if the switched type is an integer, char or enum)
+  void buildCaseTable();
+  //Index of the first case with constant value key, or -1 if none
+  int findCase(int64_t key)
+  {
+    if(denseTable)
+    {
+      uint64_t i = (uint64_t) key - (uint64_t) tableBase;
+      return i < jumpTable.size() ? jumpTable[i] : -1;
+    }
+    auto it = caseTable.find(key);
+    return it == caseTable.end() ? -1 : it->second;
+  }
   Expression* switched;
   vector<Expression*> caseValues;
   vector<int> caseLabels; //correspond 1-1 with caseValues
   int defaultPosition;
   Block* block;
+  //Case table: maps each constant case value (as an integer; enum
+  //values by their underlying value) to the index of its first case,
+  //so that a case is selected without comparing against each value.
+  //Either dense (jumpTable[key - tableBase]) or hashed (caseTable).
+  bool hasTable;
+  bool denseTable;
+  int64_t tableBase;
+  vector<int> jumpTable;
+  unordered_map<int64_t, int> caseTable;
+  //cases whose values aren't constant (in order): these
+  //must still be evaluated and compared, if they come
+  //before the case found in the table
+  vector<int> dynamicCases;
 };
 
 struct Return : public Statement
 {
+  NODE_KIND(Return)
   //Constructor for returning a value
   Return(Block* b, Expression* value);
   //Constructor for void return
@@ -206,6 +288,7 @@ struct Return : public Statement
 
 struct Break : public Statement
 {
+  NODE_KIND(Break)
   //this ctor checks that the statement is being used inside a loop
   Break(Block* b);
   void resolveImpl();
@@ -214,6 +297,7 @@ struct Break : public Statement
 
 struct Continue : public Statement
 {
+  NODE_KIND(Continue)
   //this ctor checks that the statement is being used inside a loop or Match
   Continue(Block* b);
   void resolveImpl();
@@ -222,6 +306,7 @@ struct Continue : public Statement
 
 struct Print : public Statement
 {
+  NODE_KIND(Print)
   Print(Block* b, vector<Expression*>& exprs);
   void resolveImpl();
   vector<Expression*> exprs;
@@ -230,6 +315,7 @@ struct Print : public Statement
 
 struct Assertion : public Statement
 {
+  NODE_KIND(Assertion)
   Assertion(Block* b, Expression* a);
   void resolveImpl();
   Expression* asserted;
@@ -267,6 +353,7 @@ struct SubroutineDecl : public Node
 
 struct SubrBase : public Node
 {
+  NODE_KIND_RANGE(Subroutine, ExternalSubroutine)
   SubrBase(SubroutineDecl* d)
     : decl(d)
   {}
@@ -289,6 +376,7 @@ struct SubrBase : public Node
 
 struct Subroutine : public SubrBase
 {
+  NODE_KIND(Subroutine)
   //isStatic is just whether there was an explicit "static" before declaration,
   //everything else can be determined from context
   //isPure is whether this is declared as a function
@@ -305,21 +393,33 @@ struct Subroutine : public SubrBase
   Block* body;
   IR::SubroutineIR* subrIR;
   int id;
+  //Number of frame slots for parameters and locals (see Variable::slot)
+  int numLocals;
 };
 
 struct ExternalSubroutine : public SubrBase
 {
+  NODE_KIND(ExternalSubroutine)
   ExternalSubroutine(SubroutineDecl* decl, Scope* s, string name, Type* returnType, vector<Type*>& paramTypes, vector<string>& paramNames, vector<bool>& borrow, string& code);
   void resolveImpl();
-  SubroutineDecl* decl;
-  //the native symbol to call
+  //the native symbol to call, as written ("library:symbol" or "symbol")
   string c;
+  //shared library to load (empty: search the libraries already loaded)
+  string library;
+  string symbol;
   vector<string> paramNames;
   //How each argument is passed
   vector<bool> paramBorrowed;
+  //address of symbol, once resolved by the first call (see FFI.hpp).
+  //Atomic since tests may make that call on several threads.
+  std::atomic<void*> native;
   int id;
 };
 
+//Recursively give each local variable in s a frame slot
+//(numbered from numLocals, which is incremented for each one)
+void assignLocalSlots(Scope* s, int& numLocals);
+
 struct Test : public Node
 {
   Test(Scope* s, Block* b);
@@ -327,10 +427,27 @@ struct Test : public Node
   //scope needed to resolve run
   Scope* scope;
   Block* run;
+  //Number of frame slots for locals (like Subroutine::numLocals)
+  int numLocals;
   //since tests don't live in the program,
   //keep a list of all tests
   static vector<Test*> tests;
 };
 
+//A named block that is timed by the benchmark runner (see BenchRunner.hpp)
+struct Benchmark : public Node
+{
+  Benchmark(string n, Scope* s, Block* b);
+  void resolveImpl();
+  string name;
+  //scope needed to resolve run
+  Scope* scope;
+  Block* run;
+  //Number of frame slots for locals (like Subroutine::numLocals)
+  int numLocals;
+  //like tests, all benchmarks are kept in a list
+  static vector<Benchmark*> benchmarks;
+};
+
 #endif
 
@@ -0,0 +1,166 @@
+#include "TestRunner.hpp"
+#include "Subroutine.hpp"
+#include "AstInterpreter.hpp"
+#include "Memo.hpp"
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+struct TestResult
+{
+  bool passed;
+  //everything the test printed
+  string output;
+  //the error that ended a failed test
+  string error;
+  double seconds;
+};
+
+//A worker's queue of tests (indices into Test::tests)
+struct WorkQueue
+{
+  std::deque<size_t> tests;
+  std::mutex lock;
+};
+
+struct TestPool
+{
+  vector<WorkQueue> queues;
+  vector<TestResult> results;
+  size_t stackSize;
+  size_t memo;
+};
+
+struct Worker
+{
+  TestPool* pool;
+  size_t index;
+};
+
+//Take the next test for worker w: from the front of its own queue,
+//or stolen from the back of another's. Returns false when none are left.
+static bool takeTest(TestPool* pool, size_t w, size_t& test)
+{
+  {
+    WorkQueue& own = pool->queues[w];
+    std::lock_guard<std::mutex> lock(own.lock);
+    if(own.tests.size())
+    {
+      test = own.tests.front();
+      own.tests.pop_front();
+      return true;
+    }
+  }
+  //tests never add more work, so once every queue
+  //has been seen empty, the worker is done
+  for(size_t i = 1; i < pool->queues.size(); i++)
+  {
+    WorkQueue& victim = pool->queues[(w + i) % pool->queues.size()];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if(victim.tests.size())
+    {
+      test = victim.tests.back();
+      victim.tests.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+static void runTest(Test* t, TestResult& result, size_t stackSize, size_t memo)
+{
+  OutputBuffer out(true);
+  Memoizer* memoizer = memo ? new Memoizer(memo) : nullptr;
+  auto start = std::chrono::steady_clock::now();
+  try
+  {
+    Interpreter interp(stackSize, out, memoizer);
+    interp.runBlock(t->run, t->numLocals);
+    result.passed = true;
+  }
+  catch(CaughtError& err)
+  {
+    result.passed = false;
+    result.error = err.message;
+  }
+  auto end = std::chrono::steady_clock::now();
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  result.output = out.contents();
+  delete memoizer;
+}
+
+static void* workerMain(void* arg)
+{
+  Worker* worker = (Worker*) arg;
+  TestPool* pool = worker->pool;
+  catchErrors = true;
+  size_t test;
+  while(takeTest(pool, worker->index, test))
+    runTest(Test::tests[test], pool->results[test], pool->stackSize, pool->memo);
+  return nullptr;
+}
+
+int runTests(int threads, size_t stackSize, size_t memo)
+{
+  size_t numTests = Test::tests.size();
+  if(threads <= 0)
+    threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+  size_t numWorkers = std::max<size_t>(std::min<size_t>(threads, numTests), 1);
+  TestPool pool;
+  pool.queues = vector<WorkQueue>(numWorkers);
+  pool.results.resize(numTests);
+  pool.stackSize = stackSize;
+  pool.memo = memo;
+  for(size_t i = 0; i < numTests; i++)
+    pool.queues[i % numWorkers].tests.push_back(i);
+  vector<Worker> workers(numWorkers);
+  for(size_t i = 0; i < numWorkers; i++)
+  {
+    workers[i].pool = &pool;
+    workers[i].index = i;
+  }
+  auto start = std::chrono::steady_clock::now();
+#ifdef _WIN32
+  workerMain(&workers[0]);
+#else
+  vector<pthread_t> handles(numWorkers);
+  for(size_t i = 0; i < numWorkers; i++)
+  {
+    if(pthread_create(&handles[i], nullptr, workerMain, &workers[i]))
+    {
+      errMsg("Couldn't create a test thread");
+    }
+  }
+  for(auto h : handles)
+    pthread_join(h, nullptr);
+#endif
+  auto end = std::chrono::steady_clock::now();
+  //report in source order
+  int failed = 0;
+  for(size_t i = 0; i < numTests; i++)
+  {
+    Test* t = Test::tests[i];
+    TestResult& r = pool.results[i];
+    cout << (r.passed ? "PASSED" : "FAILED") << ": test at " << getSourceName(t->fileID) << ':' << t->line;
+    if(verboseEnabled())
+      cout << " (" << r.seconds << " sec)";
+    cout << '\n' << r.output;
+    if(!r.passed)
+    {
+      cout << r.error << '\n';
+      failed++;
+    }
+  }
+  cout << numTests - failed << " of " << numTests << " tests passed\n";
+  if(verboseEnabled())
+  {
+    cout << "Running tests on " << numWorkers << " threads took " <<
+      std::chrono::duration<double>(end - start).count() << " sec.\n";
+  }
+  return failed;
+}
+
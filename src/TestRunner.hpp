@@ -0,0 +1,26 @@
+#ifndef TEST_RUNNER_H
+#define TEST_RUNNER_H
+
+#include "Common.hpp"
+
+/*****************************************************************************/
+// TestRunner: runs all of the program's test blocks in parallel (--test)
+//
+// Each test runs in its own Interpreter, with its own globals, frames and
+// captured output, so tests can't observe each other. Errors in a test
+// (failed assertions, for example) end only that test: worker threads set
+// catchErrors so that errAndQuit throws instead of exiting.
+//
+// Tests are dealt out to a queue per worker. A worker takes tests from the
+// front of its own queue, and once that's empty, steals from the back of
+// the others'. Results are reported in the order the tests appear in the
+// source, each with its output, time, and error if it failed.
+/*****************************************************************************/
+
+//Run every Test on the given number of threads (0: one per core).
+//stackSize and memo are the same as for running main.
+//Returns the number of tests that failed.
+int runTests(int threads, size_t stackSize, size_t memo);
+
+#endif
+
@@ -66,7 +66,7 @@ void createBuiltinTypes()
 Type* getArrayType(Type* elem, int ndims)
 {
   resolveType(elem);
-  if(auto subArray = dynamic_cast<ArrayType*>(elem))
+  if(auto subArray = dynCast<ArrayType>(elem))
   {
     ndims += subArray->dims;
     elem = subArray->elem;
@@ -126,9 +126,9 @@ Type* getSubroutineType(StructType* owner, bool pure, Type* retType, vector<Type
 
 Type* promote(Type* lhs, Type* rhs)
 {
-  if(auto leftEnum = dynamic_cast<EnumType*>(lhs))
+  if(auto leftEnum = dynCast<EnumType>(lhs))
     lhs = leftEnum->underlying;
-  if(auto rightEnum = dynamic_cast<EnumType*>(rhs))
+  if(auto rightEnum = dynCast<EnumType>(rhs))
     rhs = rightEnum->underlying;
   INTERNAL_ASSERT(lhs->isNumber() && rhs->isNumber());
   if(typesSame(lhs, rhs))
@@ -146,8 +146,8 @@ Type* promote(Type* lhs, Type* rhs)
   else if(lhs->isInteger() && rhs->isInteger())
   {
     //two non-char integer types
-    auto lhsInt = dynamic_cast<IntegerType*>(lhs);
-    auto rhsInt = dynamic_cast<IntegerType*>(rhs);
+    auto lhsInt = dynCast<IntegerType>(lhs);
+    auto rhsInt = dynCast<IntegerType>(rhs);
     int size = std::max(lhsInt->size, rhsInt->size);
     bool isSigned = lhsInt->isSigned || rhsInt->isSigned;
     //to combine signed and unsigned of same size, expand to next size if not already 8 bytes
@@ -170,8 +170,8 @@ Type* promote(Type* lhs, Type* rhs)
   else
   {
     //both floats, so pick the bigger one
-    auto lhsFloat = dynamic_cast<FloatType*>(lhs);
-    auto rhsFloat = dynamic_cast<FloatType*>(rhs);
+    auto lhsFloat = dynCast<FloatType>(lhs);
+    auto rhsFloat = dynCast<FloatType>(rhs);
     if(lhsFloat->size >= rhsFloat->size)
     {
       return lhs;
@@ -222,6 +222,7 @@ IntegerType* getIntegerType(int bytes, bool isSigned)
 
 StructType::StructType(string n, Scope* enclosingScope)
 {
+  kind = NodeKind::StructType;
   //structs.push_back(this);
   this->name = n;
   scope = new Scope(enclosingScope, this);
@@ -268,8 +269,8 @@ void StructType::resolveImpl()
 bool StructType::canConvert(Type* other)
 {
   other = canonicalize(other);
-  StructType* otherStruct = dynamic_cast<StructType*>(other);
-  TupleType* otherTuple = dynamic_cast<TupleType*>(other);
+  StructType* otherStruct = dynCast<StructType>(other);
+  TupleType* otherTuple = dynCast<TupleType>(other);
   if(otherStruct)
   {
     //test memberwise conversion
@@ -408,6 +409,7 @@ void StructType::dependencies(set<Type*>& types)
 
 UnionType::UnionType(vector<Type*> types)
 {
+  kind = NodeKind::UnionType;
   options = types;
   defaultVal = nullptr;
 }
@@ -456,7 +458,7 @@ void UnionType::resolveImpl()
 bool UnionType::canConvert(Type* other)
 {
   other = canonicalize(other);
-  if(auto otherUnion = dynamic_cast<UnionType*>(other))
+  if(auto otherUnion = dynCast<UnionType>(other))
   {
     //if every option of other can convert to this, good
     for(auto otherOp : otherUnion->options)
@@ -559,12 +561,49 @@ int UnionType::getTypeIndex(Type* t)
   return -1;
 }
 
+int UnionType::optionFor(Type* t, bool& exact)
+{
+  static thread_local unordered_map<UnionType*, unordered_map<Type*, pair<int, bool>>> caches;
+  auto& optionCache = caches[this];
+  auto it = optionCache.find(t);
+  if(it != optionCache.end())
+  {
+    exact = it->second.second;
+    return it->second.first;
+  }
+  int option = -1;
+  exact = false;
+  for(size_t i = 0; i < options.size(); i++)
+  {
+    if(typesSame(options[i], t))
+    {
+      option = i;
+      exact = true;
+      break;
+    }
+  }
+  if(option < 0)
+  {
+    for(size_t i = 0; i < options.size(); i++)
+    {
+      if(options[i]->canConvert(t))
+      {
+        option = i;
+        break;
+      }
+    }
+  }
+  optionCache[t] = std::make_pair(option, exact);
+  return option;
+}
+
 /**************/
 /* Array Type */
 /**************/
 
 ArrayType::ArrayType(Type* elemType, int ndims)
 {
+  kind = NodeKind::ArrayType;
   INTERNAL_ASSERT(elemType)
   INTERNAL_ASSERT(ndims > 0)
   this->dims = ndims;
@@ -589,9 +628,9 @@ void ArrayType::resolveImpl()
 bool ArrayType::canConvert(Type* other)
 {
   other = canonicalize(other);
-  auto otherArray = dynamic_cast<ArrayType*>(other);
-  auto otherTuple = dynamic_cast<TupleType*>(other);
-  auto otherStruct = dynamic_cast<StructType*>(other);
+  auto otherArray = dynCast<ArrayType>(other);
+  auto otherTuple = dynCast<TupleType>(other);
+  auto otherStruct = dynCast<StructType>(other);
   if(otherArray)
   {
     return subtype->canConvert(otherArray->subtype);
@@ -639,6 +678,7 @@ void ArrayType::dependencies(set<Type*>& types)
 
 TupleType::TupleType(vector<Type*> mems)
 {
+  kind = NodeKind::TupleType;
   members = mems;
 }
 
@@ -661,8 +701,8 @@ void TupleType::resolveImpl()
 bool TupleType::canConvert(Type* other)
 {
   other = canonicalize(other);
-  TupleType* otherTuple = dynamic_cast<TupleType*>(other);
-  StructType* otherStruct = dynamic_cast<StructType*>(other);
+  TupleType* otherTuple = dynCast<TupleType>(other);
+  StructType* otherStruct = dynCast<StructType>(other);
   if(otherStruct)
   {
     //test memberwise conversion
@@ -720,7 +760,10 @@ void TupleType::dependencies(set<Type*>& types)
 /* Map Type */
 /************/
 
-MapType::MapType(Type* k, Type* v) : key(k), value(v) {}
+MapType::MapType(Type* k, Type* v) : key(k), value(v)
+{
+  kind = NodeKind::MapType;
+}
 
 void MapType::resolveImpl()
 {
@@ -734,8 +777,8 @@ bool MapType::canConvert(Type* other)
   other = canonicalize(other);
   //Maps can convert to this if keys/values can convert
   //Arrays can also convert to this if key of this is integer
-  auto otherMap = dynamic_cast<MapType*>(other);
-  auto otherArray = dynamic_cast<ArrayType*>(other);
+  auto otherMap = dynCast<MapType>(other);
+  auto otherArray = dynCast<ArrayType>(other);
   if(otherMap)
   {
     return key->canConvert(otherMap->key) &&
@@ -743,7 +786,7 @@ bool MapType::canConvert(Type* other)
   }
   if(otherArray)
   {
-    TupleType* subtypeTuple = dynamic_cast<TupleType*>(otherArray->subtype);
+    TupleType* subtypeTuple = dynCast<TupleType>(otherArray->subtype);
     //must be "(k, v)[]" where k convertible to key and v convertible to value
     return subtypeTuple &&
       subtypeTuple->members.size() == 2 &&
@@ -759,12 +802,18 @@ void MapType::dependencies(set<Type*>& types)
   value->dependencies(types);
 }
 
+Expression* MapType::getDefaultValue()
+{
+  return new MapConstant(this);
+}
+
 /**************/
 /* Alias Type */
 /**************/
 
 AliasType::AliasType(string alias, Type* underlying, Scope* s)
 {
+  kind = NodeKind::AliasType;
   name = alias;
   actual = underlying;
   scope = s;
@@ -788,6 +837,7 @@ void AliasType::resolveImpl()
 
 EnumType::EnumType(string n, Scope* enclosingScope)
 {
+  kind = NodeKind::EnumType;
   name = n;
   //"scope" encloses the enum constants
   scope = new Scope(enclosingScope, this);
@@ -915,6 +965,7 @@ EnumExpr* EnumType::valueFromName(string n)
 
 IntegerType::IntegerType(string typeName, int sz, bool sign)
 {
+  kind = NodeKind::IntegerType;
   name = typeName;
   size = sz;
   isSigned = sign;
@@ -987,6 +1038,7 @@ bool IntegerType::canConvert(Type* other)
 
 FloatType::FloatType(string typeName, int sz)
 {
+  kind = NodeKind::FloatType;
   name = typeName;
   size = sz;
   resolved = true;
@@ -1038,6 +1090,7 @@ Expression* BoolType::getDefaultValue()
 
 CallableType::CallableType(bool isPure, Type* retType, vector<Type*>& params)
 {
+  kind = NodeKind::CallableType;
   pure = isPure;
   returnType = retType;
   paramTypes = params;
@@ -1046,6 +1099,7 @@ CallableType::CallableType(bool isPure, Type* retType, vector<Type*>& params)
 
 CallableType::CallableType(bool isPure, StructType* owner, Type* retType, vector<Type*>& params)
 {
+  kind = NodeKind::CallableType;
   pure = isPure;
   returnType = retType;
   paramTypes = params;
@@ -1093,7 +1147,7 @@ string CallableType::getName() const
 bool CallableType::canConvert(Type* other)
 {
   //Only CallableTypes are convertible to other CallableTypes
-  auto ct = dynamic_cast<CallableType*>(other);
+  auto ct = dynCast<CallableType>(other);
   if(!ct)
     return false;
   if(ownerStruct != ct->ownerStruct)
@@ -1116,6 +1170,7 @@ bool CallableType::canConvert(Type* other)
 
 SimpleType::SimpleType(string n)
 {
+  kind = NodeKind::SimpleType;
   resolved = true;
   name = n;
   val = new SimpleConstant(this);
@@ -1128,6 +1183,7 @@ Expression* SimpleType::getDefaultValue()
 
 ExprType::ExprType(Expression* e)
 {
+  kind = NodeKind::ExprType;
   expr = e;
 }
 
@@ -1140,12 +1196,16 @@ void ExprType::resolveImpl()
 
 ElemExprType::ElemExprType(Expression* a) : arr(a)
 {
+  kind = NodeKind::ElemExprType;
   //0 means remove all dimensions
   reduction = 0;
 }
 
 ElemExprType::ElemExprType(Expression* a, int r)
-  : arr(a), reduction(r) {}
+  : arr(a), reduction(r)
+{
+  kind = NodeKind::ElemExprType;
+}
 
 void ElemExprType::resolveImpl()
 {
@@ -1164,7 +1224,7 @@ void resolveType(Type*& t)
     t = canonicalize(t);
     return;
   }
-  if(UnresolvedType* unres = dynamic_cast<UnresolvedType*>(t))
+  if(UnresolvedType* unres = dynCast<UnresolvedType>(t))
   {
     if(unres->t.is<Prim::PrimType>())
     {
@@ -1264,16 +1324,16 @@ void resolveType(Type*& t)
       t->resolve();
     }
   }
-  else if(ExprType* et = dynamic_cast<ExprType*>(t))
+  else if(ExprType* et = dynCast<ExprType>(t))
   {
     resolveExpr(et->expr);
     if(et->expr->resolved)
       t = et->expr->type;
   }
-  else if(ElemExprType* eet = dynamic_cast<ElemExprType*>(t))
+  else if(ElemExprType* eet = dynCast<ElemExprType>(t))
   {
     resolveExpr(eet->arr);
-    ArrayType* arrType = dynamic_cast<ArrayType*>(eet->arr->type);
+    ArrayType* arrType = dynCast<ArrayType>(eet->arr->type);
     if(eet->reduction == 0 || arrType->dims == eet->reduction)
     {
       //remove all dimensions, giving a singular type
@@ -1310,95 +1370,118 @@ static bool typesSameImpl(const Type* t1, const Type* t2,
     return true;
   assume.insert(TypePair(t1, t2));
   //first, canonicalize aliases
-  while(auto at = dynamic_cast<const AliasType*>(t1))
+  while(t1->kind == NodeKind::AliasType)
   {
-    t1 = at->actual;
+    t1 = ((const AliasType*) t1)->actual;
   }
-  while(auto at = dynamic_cast<const AliasType*>(t2))
+  while(t2->kind == NodeKind::AliasType)
   {
-    t2 = at->actual;
+    t2 = ((const AliasType*) t2)->actual;
   }
-  if(auto a1 = dynamic_cast<const ArrayType*>(t1))
-  {
-    auto a2 = dynamic_cast<const ArrayType*>(t2);
-    if(!a2)
-      return false;
-    return typesSameImpl(a1->subtype, a2->subtype, assume);
-  }
-  else if(auto tt1 = dynamic_cast<const TupleType*>(t1))
+  if(t1->kind != t2->kind)
+    return false;
+  switch(t1->kind)
   {
-    auto tt2 = dynamic_cast<const TupleType*>(t2);
-    if(!tt2)
-      return false;
-    if(tt1->members.size() != tt2->members.size())
-      return false;
-    for(size_t i = 0; i < tt1->members.size(); i++)
+    case NodeKind::ArrayType:
     {
-      if(!typesSameImpl(tt1->members[i], tt2->members[i], assume))
+      auto a1 = (const ArrayType*) t1;
+      auto a2 = (const ArrayType*) t2;
+      return typesSameImpl(a1->subtype, a2->subtype, assume);
+    }
+    case NodeKind::TupleType:
+    {
+      auto tt1 = (const TupleType*) t1;
+      auto tt2 = (const TupleType*) t2;
+      if(tt1->members.size() != tt2->members.size())
         return false;
+      for(size_t i = 0; i < tt1->members.size(); i++)
+      {
+        if(!typesSameImpl(tt1->members[i], tt2->members[i], assume))
+          return false;
+      }
+      return true;
     }
-    return true;
-  }
-  else if(auto u1 = dynamic_cast<const UnionType*>(t1))
-  {
-    auto u2 = dynamic_cast<const UnionType*>(t2);
-    if(!u2)
-      return false;
-    if(u1->options.size() != u2->options.size())
-      return false;
-    for(size_t i = 0; i < u1->options.size(); i++)
+    case NodeKind::UnionType:
     {
-      if(!typesSameImpl(u1->options[i], u2->options[i], assume))
+      auto u1 = (const UnionType*) t1;
+      auto u2 = (const UnionType*) t2;
+      if(u1->options.size() != u2->options.size())
         return false;
+      for(size_t i = 0; i < u1->options.size(); i++)
+      {
+        if(!typesSameImpl(u1->options[i], u2->options[i], assume))
+          return false;
+      }
+      return true;
     }
-    return true;
-  }
-  else if(auto m1 = dynamic_cast<const MapType*>(t1))
-  {
-    auto m2 = dynamic_cast<const MapType*>(t2);
-    if(!m2)
-      return false;
-    if(!typesSameImpl(m1->key, m2->key, assume))
-      return false;
-    if(!typesSameImpl(m1->value, m2->value, assume))
-      return false;
-    return true;
-  }
-  else if(auto c1 = dynamic_cast<const CallableType*>(t1))
-  {
-    auto c2 = dynamic_cast<const CallableType*>(t2);
-    if(!c2)
-      return false;
-    if(c1->pure != c2->pure)
-      return false;
-    if(c1->ownerStruct != c2->ownerStruct)
-      return false;
-    if(c1->paramTypes.size() != c2->paramTypes.size())
-      return false;
-    if(!typesSameImpl(c1->returnType, c2->returnType, assume))
-      return false;
-    for(size_t i = 0; i < c1->paramTypes.size(); i++)
+    case NodeKind::MapType:
     {
-      if(!typesSameImpl(c1->paramTypes[i], c2->paramTypes[i], assume))
+      auto m1 = (const MapType*) t1;
+      auto m2 = (const MapType*) t2;
+      if(!typesSameImpl(m1->key, m2->key, assume))
+        return false;
+      if(!typesSameImpl(m1->value, m2->value, assume))
         return false;
+      return true;
     }
-    return true;
+    case NodeKind::CallableType:
+    {
+      auto c1 = (const CallableType*) t1;
+      auto c2 = (const CallableType*) t2;
+      if(c1->pure != c2->pure)
+        return false;
+      if(c1->ownerStruct != c2->ownerStruct)
+        return false;
+      if(c1->paramTypes.size() != c2->paramTypes.size())
+        return false;
+      if(!typesSameImpl(c1->returnType, c2->returnType, assume))
+        return false;
+      for(size_t i = 0; i < c1->paramTypes.size(); i++)
+      {
+        if(!typesSameImpl(c1->paramTypes[i], c2->paramTypes[i], assume))
+          return false;
+      }
+      return true;
+    }
+    default:
+      //There should be no need to compare other types
+      return false;
   }
-  //There should be no need to compare other types
-  return false;
 }
 
 bool typesSame(const Type* t1, const Type* t2)
 {
+  if(t1 == t2)
+    return true;
+  if(!t1 || !t2)
+    return false;
+  //Distinct non-alias types can only be the same if they're
+  //compound, so only then is the set of assumptions needed
+  if(t1->kind != NodeKind::AliasType && t2->kind != NodeKind::AliasType)
+  {
+    if(t1->kind != t2->kind)
+      return false;
+    switch(t1->kind)
+    {
+      case NodeKind::ArrayType:
+      case NodeKind::TupleType:
+      case NodeKind::UnionType:
+      case NodeKind::MapType:
+      case NodeKind::CallableType:
+        break;
+      default:
+        return false;
+    }
+  }
   set<TypePair> assume;
   return typesSameImpl(t1, t2, assume);
 }
 
 Type* canonicalize(Type* t)
 {
-  while(auto at = dynamic_cast<AliasType*>(t))
+  while(t && t->kind == NodeKind::AliasType)
   {
-    t = at->actual;
+    t = ((AliasType*) t)->actual;
   }
   return t;
 }
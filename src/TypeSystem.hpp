@@ -51,6 +51,7 @@ struct SimpleConstant;
 
 struct Type : public Node
 {
+  NODE_KIND_RANGE(StructType, ElemExprType)
   virtual ~Type() {}
   virtual bool canConvert(Type* other) = 0;
   //get the type's name
@@ -161,6 +162,7 @@ extern map<string, Type*> primNames;
 
 struct StructType : public Type
 {
+  NODE_KIND(StructType)
   //Constructor just creates an empty struct (no members)
   //Parser should explicitly add members as they are parsed
   StructType(string name, Scope* enclosingScope);
@@ -188,6 +190,7 @@ struct StructType : public Type
 
 struct UnionType : public Type
 {
+  NODE_KIND(UnionType)
   UnionType(vector<Type*> types);
   void resolveImpl();
   vector<Type*> options;
@@ -209,6 +212,12 @@ struct UnionType : public Type
     return f.get();
   }
   int getTypeIndex(Type* option);
+  //Index of the option which a value of type t is stored as (the option
+  //that is the same type as t, or else the first that t converts to), or -1.
+  //exact is set if the option is the same type as t.
+  //Results are cached by t, so each type is only compared with the options
+  //once (per thread: this is called at runtime, and tests can run on several)
+  int optionFor(Type* t, bool& exact);
   //defaultVal is precomputed unlike all other types,
   //since it can be somewhat expensive to compute for
   //deeply recursive unions
@@ -225,6 +234,7 @@ struct UnionType : public Type
 
 struct ArrayType : public Type
 {
+  NODE_KIND(ArrayType)
   ArrayType(Type* elemType, int dims);
   //Type of single element (0-dimensional)
   Type* elem;
@@ -253,6 +263,7 @@ struct ArrayType : public Type
 
 struct TupleType : public Type
 {
+  NODE_KIND(TupleType)
   //TupleType has no scope, so ctor doesn't need it
   TupleType(vector<Type*> members);
   ~TupleType() {}
@@ -287,6 +298,7 @@ struct TupleType : public Type
 
 struct MapType : public Type
 {
+  NODE_KIND(MapType)
   MapType(Type* k, Type* v);
   Type* key;
   Type* value;
@@ -310,10 +322,13 @@ struct MapType : public Type
   }
   bool canConvert(Type* other);
   void resolveImpl();
+  //an empty map
+  Expression* getDefaultValue();
 };
 
 struct AliasType : public Type
 {
+  NODE_KIND(AliasType)
   AliasType(string alias, Type* underlying, Scope* scope);
   void resolveImpl();
   string name;
@@ -372,6 +387,7 @@ struct EnumConstant : public Node
 
 struct EnumType : public Type
 {
+  NODE_KIND(EnumType)
   EnumType(string name, Scope* enclosingScope);
   //resolving an enum decides what its underlying type should be
   void resolveImpl();
@@ -410,6 +426,7 @@ private:
 
 struct IntegerType : public Type
 {
+  NODE_KIND(IntegerType)
   //size is in bytes (1, 2, 4, 8)
   IntegerType(string name, int size, bool sign);
   uint64_t maxUnsignedVal();
@@ -439,6 +456,7 @@ struct IntegerType : public Type
 
 struct FloatType : public Type
 {
+  NODE_KIND(FloatType)
   FloatType(string name, int size);
   string name;
   //4 or 8 (bytes, not bits)
@@ -462,8 +480,10 @@ struct FloatType : public Type
 
 struct CharType : public Type
 {
+  NODE_KIND(CharType)
   CharType()
   {
+    kind = NodeKind::CharType;
     resolved = true;
   }
   bool canConvert(Type* other);
@@ -484,8 +504,10 @@ struct CharType : public Type
 
 struct BoolType : public Type
 {
+  NODE_KIND(BoolType)
   BoolType()
   {
+    kind = NodeKind::BoolType;
     resolved = true;
   }
   bool canConvert(Type* other);
@@ -504,6 +526,7 @@ struct BoolType : public Type
 
 struct SimpleType : public Type
 {
+  NODE_KIND(SimpleType)
   SimpleType(string n);
   bool canConvert(Type* other)
   {
@@ -530,6 +553,7 @@ struct SimpleType : public Type
 //purity, 'this' type, return type and parameter types
 struct CallableType : public Type
 {
+  NODE_KIND(CallableType)
   //constructor for non-member callables
   CallableType(bool isPure, Type* returnType, vector<Type*>& params);
   //constructor for members
@@ -579,6 +603,7 @@ struct CallableType : public Type
 
 struct UnresolvedType : public Type
 {
+  NODE_KIND(UnresolvedType)
   //tuple and union are both just vectors of types, so need this
   //to differentiate them in the variant
   struct Tuple
@@ -606,6 +631,10 @@ struct UnresolvedType : public Type
     Type* returnType;
     vector<Type*> params;
   };
+  UnresolvedType()
+  {
+    kind = NodeKind::UnresolvedType;
+  }
   //Note that UnionType is one of the options here
   //UnionType is allowed to have unresolved members, and its resolveImpl()
   //is needed to gracefully deal with circular dependencies (impossible in
@@ -623,6 +652,7 @@ struct UnresolvedType : public Type
 //(used internally for array for loops (and TODO auto vars))
 struct ExprType : public Type
 {
+  NODE_KIND(ExprType)
   ExprType(Expression* e);
   void resolveImpl();
   Expression* expr;
@@ -635,6 +665,7 @@ struct ExprType : public Type
 //passing this to resolveType replaces it by arr's element type
 struct ElemExprType : public Type
 {
+  NODE_KIND(ElemExprType)
   ElemExprType(Expression* arr);
   ElemExprType(Expression* arr, int reduction);
   void resolveImpl();
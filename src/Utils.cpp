@@ -2,8 +2,15 @@
 #include <cstdio>
 #include <iostream>
 
+void (*quitHandler)() = nullptr;
+thread_local bool catchErrors = false;
+
 void errAndQuit(string message)
 {
+  if(catchErrors)
+    throw CaughtError(message);
+  if(quitHandler)
+    quitHandler();
   std::cerr << message << '\n';
   exit(1);
 }
@@ -9,6 +9,18 @@ using std::cout;
 
 //Print message and exit(EXIT_FAILURE)
 void errAndQuit(string message);
+//If set, errAndQuit calls this before printing the message
+//(to flush buffered program output first)
+extern void (*quitHandler)();
+
+//Thrown by errAndQuit instead of exiting, on a thread
+//that sets catchErrors (the test runner's workers)
+struct CaughtError
+{
+  CaughtError(const string& msg) : message(msg) {}
+  string message;
+};
+extern thread_local bool catchErrors;
 
 //Read string from file, and append \n
 string loadFile(string filename);
@@ -0,0 +1,667 @@
+#include "VM.hpp"
+#include "Variable.hpp"
+#include "FFI.hpp"
+#include <deque>
+
+using namespace VM;
+
+//Use computed goto for dispatch where supported (GCC and clang)
+#ifdef __GNUC__
+#define VM_COMPUTED_GOTO
+#endif
+
+namespace
+{
+  //The caller of an active call: where execution resumes
+  //when the call returns
+  struct CallFrame
+  {
+    Function* f;
+    //the call instruction
+    const Instr* ip;
+    Value* regs;
+    Value* thisPtr;
+    //if >= 0, the call is the initializer of this global: the result is
+    //stored there, and then the instruction that needed it is run again
+    int global;
+  };
+
+  Program* prog = nullptr;
+  Value* stackBase = nullptr;
+  //Calls don't recurse natively: each one pushes a CallFrame here, and
+  //execute switches to the callee's code and registers
+  vector<CallFrame> callStack;
+  //bytes that the registers and CallFrames of all active calls may use
+  size_t stackBudget = 0;
+  //globals are in a deque so that references to them stay valid
+  //as more globals are added
+  std::deque<Value> globals;
+  vector<bool> globalReady;
+}
+
+//Get a global, or null if it hasn't been initialized yet
+static Value* findGlobal(int index)
+{
+  if(globals.size() <= (size_t) index)
+  {
+    globals.resize(index + 1);
+    globalReady.resize(index + 1, false);
+  }
+  return globalReady[index] ? &globals[index] : nullptr;
+}
+
+static void storeGlobal(int index, const Value& v)
+{
+  if(globals.size() <= (size_t) index)
+  {
+    globals.resize(index + 1);
+    globalReady.resize(index + 1, false);
+  }
+  globals[index] = v;
+  globalReady[index] = true;
+}
+
+//Check that a frame for f fits at regs (with the current call stack)
+static void enterFrame(Function* f, Value* regs)
+{
+  if(!f->compiled)
+    compile(prog, f);
+  size_t used = (regs + f->numRegs - stackBase) * sizeof(Value) + callStack.size() * sizeof(CallFrame);
+  if(used > stackBudget)
+  {
+    errMsg("Stack overflow: call depth exceeds the interpreter's stack budget (see --stack)");
+  }
+}
+
+//Release everything held in a frame's registers when it returns, so
+//objects owned by the frame are freed immediately (not when a later
+//call happens to overwrite the registers)
+static inline void releaseFrame(Value* regs, Value* top)
+{
+  std::fill(regs, top, Value());
+}
+
+static uint64_t arrayIndex(const Value& index, size_t size, Node* loc)
+{
+  if(index.tag == ValueTag::INT && index.i < 0)
+    errMsgLoc(loc, "negative array index");
+  if(index.u >= size)
+    errMsgLoc(loc, "array index " << index.u << " out of bound " << size);
+  return index.u;
+}
+
+//Integer type described by a NumKind
+static Type* kindType(uint16_t k)
+{
+  return getIntegerType(k & NK_SIZE, k & NK_SIGNED);
+}
+
+//Does result of integer arithmetic fit in its type?
+static inline bool kindFits(const Value& v, uint16_t k)
+{
+  switch(k & (NK_SIZE | NK_SIGNED))
+  {
+    case 1 | NK_SIGNED:
+      return v.i >= INT8_MIN && v.i <= INT8_MAX;
+    case 2 | NK_SIGNED:
+      return v.i >= INT16_MIN && v.i <= INT16_MAX;
+    case 4 | NK_SIGNED:
+      return v.i >= INT32_MIN && v.i <= INT32_MAX;
+    case 1:
+      return v.u <= UINT8_MAX;
+    case 2:
+      return v.u <= UINT16_MAX;
+    case 4:
+      return v.u <= UINT32_MAX;
+    default:
+      return true;
+  }
+}
+
+//Slow path for integer arithmetic: redo the operation
+//with full checking, which produces the right error message
+static Value checkedIntOp(int op, const Value& lhs, const Value& rhs, uint16_t k, Node* loc)
+{
+  return binaryOp(op, lhs, rhs, kindType(k),
+      getIntegerType(8, k & NK_RHS_SIGNED), loc);
+}
+
+//Run f (whose frame starts at regs) until it returns. Calls made by f
+//are run in the same loop.
+static Value execute(Function* f, Value* regs, Value* thisPtr)
+{
+  const Instr* code = f->code.data();
+  const Instr* ip = code;
+  //callee frames start immediately after this one
+  Value* top = regs + f->numRegs;
+  //frames below this belong to whoever called execute
+  size_t baseDepth = callStack.size();
+  //operands of a call (see callFrame below)
+  Function* callee;
+  Value* args;
+  int numArgs;
+  Value* calleeThis;
+  int calleeGlobal;
+  Value returned;
+#define A regs[ip->a]
+#define B regs[ip->b]
+#define C regs[ip->c]
+#ifdef VM_COMPUTED_GOTO
+#define VM_LABEL_ADDR(name) &&op_##name,
+  static void* dispatchTable[] = {VM_OPCODES(VM_LABEL_ADDR)};
+#undef VM_LABEL_ADDR
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH goto *dispatchTable[ip->op]
+  VM_DISPATCH;
+#else
+#define VM_CASE(name) case VM::name:
+#define VM_DISPATCH goto dispatch
+dispatch:
+  switch(ip->op)
+  {
+#endif
+#define VM_NEXT {ip++; VM_DISPATCH;}
+#define VM_JUMP(target) {ip = code + (target); VM_DISPATCH;}
+#define VM_CALL(func, argRegs, n, thisValue, global) \
+  {callee = (func); args = (argRegs); numArgs = (n); \
+    calleeThis = (thisValue); calleeGlobal = (global); goto callFrame;}
+  VM_CASE(NOP)
+    VM_NEXT
+  VM_CASE(LOADK)
+    A = prog->constants[ip->b];
+    VM_NEXT
+  VM_CASE(MOV)
+    A = B;
+    VM_NEXT
+  VM_CASE(CHECKINIT)
+    if(A.tag == ValueTag::NONE)
+      errMsg("Variable " << ((Variable*) ip->aux)->name << " was used before initialization/declaration.\n");
+    VM_NEXT
+  VM_CASE(LOADG)
+    if(Value* g = findGlobal(ip->b))
+    {
+      A = *g;
+      VM_NEXT
+    }
+    VM_CALL(prog->globalInits[ip->b], nullptr, 0, nullptr, ip->b)
+  VM_CASE(STOREG)
+    storeGlobal(ip->a, B);
+    VM_NEXT
+  VM_CASE(LOADTHIS)
+    A = *thisPtr;
+    VM_NEXT
+  VM_CASE(REFLOCAL)
+    A = refValue(&B);
+    VM_NEXT
+  VM_CASE(REFGLOBAL)
+    if(Value* g = findGlobal(ip->b))
+    {
+      A = refValue(g);
+      VM_NEXT
+    }
+    VM_CALL(prog->globalInits[ip->b], nullptr, 0, nullptr, ip->b)
+  VM_CASE(REFTHIS)
+    A = refValue(thisPtr);
+    VM_NEXT
+  //References are only created to be stored through,
+  //so each level must be made unique before taking a reference inside it
+  VM_CASE(REFMEMBER)
+    makeUnique(*B.ref);
+    A = refValue(&asStruct(*B.ref)->mems[ip->c]);
+    VM_NEXT
+  VM_CASE(REFINDEX)
+  {
+    makeUnique(*B.ref);
+    ArrayObject* arr = asArray(*B.ref);
+    INTERNAL_ASSERT(!arr->isFlat());
+    A = refValue(&arr->elem(arrayIndex(C, arr->size(), (Node*) ip->aux)));
+    VM_NEXT
+  }
+  VM_CASE(REFKEY)
+  {
+    MapType* mt = (MapType*) ip->aux;
+    makeUnique(*B.ref);
+    auto& table = asMap(*B.ref)->table;
+    Value* val = table.find(C);
+    //if key is not already in the map, insert it with the default value
+    if(!val)
+    {
+      val = &table[C];
+      *val = defaultValue(mt->value);
+    }
+    A = refValue(val);
+    VM_NEXT
+  }
+  VM_CASE(LOADREF)
+    A = *B.ref;
+    VM_NEXT
+  VM_CASE(STOREREF)
+    *A.ref = B;
+    VM_NEXT
+  VM_CASE(STOREKEY)
+  {
+    //the value assigned is a maybe: void removes the key
+    Indexed* ind = (Indexed*) ip->aux;
+    UnionType* ut = (UnionType*) canonicalize(ind->type);
+    UnionObject* u = asUnion(C);
+    makeUnique(*A.ref);
+    auto& table = asMap(*A.ref)->table;
+    if(canonicalize(ut->options[u->option])->isSimple())
+      table.erase(B);
+    else
+      table[B] = u->v;
+    VM_NEXT
+  }
+  VM_CASE(STOREINDEX)
+  {
+    makeUnique(*A.ref);
+    ArrayObject* arr = asArray(*A.ref);
+    arr->set(arrayIndex(B, arr->size(), (Node*) ip->aux), C);
+    VM_NEXT
+  }
+  VM_CASE(ADDI)
+  {
+    Value r;
+    r.tag = (ip->k & NK_SIGNED) ? ValueTag::INT : ValueTag::UINT;
+    r.u = B.u + C.u;
+    if(!kindFits(r, ip->k))
+      r = checkedIntOp(PLUS, B, C, ip->k, (Node*) ip->aux);
+    A = r;
+    VM_NEXT
+  }
+  VM_CASE(SUBI)
+  {
+    Value r;
+    r.tag = (ip->k & NK_SIGNED) ? ValueTag::INT : ValueTag::UINT;
+    r.u = B.u - C.u;
+    if(!kindFits(r, ip->k))
+      r = checkedIntOp(SUB, B, C, ip->k, (Node*) ip->aux);
+    A = r;
+    VM_NEXT
+  }
+  VM_CASE(MULI)
+  {
+    Value r;
+    r.tag = (ip->k & NK_SIGNED) ? ValueTag::INT : ValueTag::UINT;
+    r.u = B.u * C.u;
+    if(!kindFits(r, ip->k))
+      r = checkedIntOp(MUL, B, C, ip->k, (Node*) ip->aux);
+    A = r;
+    VM_NEXT
+  }
+  VM_CASE(DIVI)
+    A = checkedIntOp(DIV, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(MODI)
+    A = checkedIntOp(MOD, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(ANDI)
+    A = checkedIntOp(BAND, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(ORI)
+    A = checkedIntOp(BOR, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(XORI)
+    A = checkedIntOp(BXOR, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(SHLI)
+    A = checkedIntOp(SHL, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(SHRI)
+    A = checkedIntOp(SHR, B, C, ip->k, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(ADDF)
+    A = (ip->k & NK_SIZE) == 8 ? doubleValue(B.d + C.d) : floatValue(B.f + C.f);
+    VM_NEXT
+  VM_CASE(SUBF)
+    A = (ip->k & NK_SIZE) == 8 ? doubleValue(B.d - C.d) : floatValue(B.f - C.f);
+    VM_NEXT
+  VM_CASE(MULF)
+    A = (ip->k & NK_SIZE) == 8 ? doubleValue(B.d * C.d) : floatValue(B.f * C.f);
+    VM_NEXT
+  VM_CASE(DIVF)
+    A = binaryOp(DIV, B, C, ((BinaryArith*) ip->aux)->type, nullptr, (Node*) ip->aux);
+    VM_NEXT
+  VM_CASE(NOT)
+    A = boolValue(!B.b);
+    VM_NEXT
+  VM_CASE(BNOT)
+    A = unaryOp(::BNOT, B);
+    VM_NEXT
+  VM_CASE(NEG)
+    A = unaryOp(SUB, B);
+    VM_NEXT
+  VM_CASE(EQI)
+    A = boolValue(B.u == C.u);
+    VM_NEXT
+  VM_CASE(NEI)
+    A = boolValue(B.u != C.u);
+    VM_NEXT
+  VM_CASE(LTI)
+    A = boolValue((ip->k & NK_SIGNED) ? B.i < C.i : B.u < C.u);
+    VM_NEXT
+  VM_CASE(LEI)
+    A = boolValue((ip->k & NK_SIGNED) ? B.i <= C.i : B.u <= C.u);
+    VM_NEXT
+  VM_CASE(EQ)
+    A = boolValue(valuesEqual(B, C));
+    VM_NEXT
+  VM_CASE(NE)
+    A = boolValue(!valuesEqual(B, C));
+    VM_NEXT
+  VM_CASE(LT)
+    A = boolValue(valueLess(B, C));
+    VM_NEXT
+  VM_CASE(LE)
+    A = boolValue(!valueLess(C, B));
+    VM_NEXT
+  VM_CASE(JMP)
+    VM_JUMP(ip->a)
+  VM_CASE(JT)
+    if(A.b)
+      VM_JUMP(ip->b)
+    VM_NEXT
+  VM_CASE(JF)
+    if(!A.b)
+      VM_JUMP(ip->b)
+    VM_NEXT
+  VM_CASE(SWITCH)
+  {
+    JumpTable* table = (JumpTable*) ip->aux;
+    int found = table->sw->findCase(caseKey(A));
+    VM_JUMP(found >= 0 ? table->targets[found] : table->defaultTarget)
+  }
+  VM_CASE(MATCH)
+  {
+    JumpTable* table = (JumpTable*) ip->aux;
+    VM_JUMP(table->targets[asUnion(A)->option])
+  }
+  VM_CASE(CALL)
+    VM_CALL((Function*) ip->aux, &B, ip->c, nullptr, -1)
+  VM_CASE(CALLM)
+    VM_CALL((Function*) ip->aux, &B + 1, ip->c, B.ref, -1)
+  VM_CASE(CALLV)
+  {
+    if(auto subr = dynCast<Subroutine>(B.subr))
+      VM_CALL(prog->getFunction(subr), &B + 1, ip->c, nullptr, -1)
+    A = callExternal((ExternalSubroutine*) B.subr, &B + 1);
+    VM_NEXT
+  }
+  VM_CASE(TAILCALL)
+  {
+    //the callee's frame replaces this one: the arguments move down to
+    //the first registers (they come from temporaries, which are above
+    //them), and everything else this frame held is released
+    callee = (Function*) ip->aux;
+    enterFrame(callee, regs);
+    for(int i = 0; i < ip->c; i++)
+      regs[i] = std::move(regs[ip->b + i]);
+    releaseFrame(regs + ip->c, top);
+    f = callee;
+    code = f->code.data();
+    ip = code;
+    top = regs + f->numRegs;
+    thisPtr = nullptr;
+    VM_DISPATCH;
+  }
+  VM_CASE(CALLEXT)
+  {
+    A = callExternal((ExternalSubroutine*) ip->aux, &B);
+    VM_NEXT
+  }
+  VM_CASE(RET)
+    returned = std::move(A);
+    goto returnFrame;
+  VM_CASE(RETV)
+    returned = Value();
+    goto returnFrame;
+  VM_CASE(NORET)
+  {
+    Subroutine* subr = (Subroutine*) ip->aux;
+    errMsgLoc(subr, "interpreter reached end of subroutine without a return value");
+    VM_NEXT
+  }
+  VM_CASE(NEWARRAY)
+  {
+    vector<uint64_t> dims(ip->c);
+    for(int i = 0; i < ip->c; i++)
+    {
+      Value& d = regs[ip->b + i];
+      if(d.tag == ValueTag::INT && d.i < 0)
+        errMsg("Negative array dimension: " << d.i);
+      dims[i] = d.u;
+    }
+    A = createArrayValue(dims.data(), ip->c, (Type*) ip->aux);
+    VM_NEXT
+  }
+  VM_CASE(LEN)
+    if(B.obj->kind == ObjectKind::MAP)
+      A = intValue(asMap(B)->table.size());
+    else
+      A = intValue(asArray(B)->size());
+    VM_NEXT
+  VM_CASE(INDEX)
+  {
+    ArrayObject* arr = asArray(B);
+    A = arr->get(arrayIndex(C, arr->size(), (Node*) ip->aux));
+    VM_NEXT
+  }
+  VM_CASE(MAPGET)
+  {
+    Indexed* ind = (Indexed*) ip->aux;
+    MapType* mt = (MapType*) canonicalize(ind->group->type);
+    Value* val = asMap(*B.ref)->table.find(C);
+    //if key is not already in the map, insert it with the default value
+    if(!val)
+    {
+      makeUnique(*B.ref);
+      val = &asMap(*B.ref)->table[C];
+      *val = defaultValue(mt->value);
+    }
+    A = makeUnion(*val, mt->value, (UnionType*) canonicalize(ind->type));
+    VM_NEXT
+  }
+  VM_CASE(MEMBER)
+    A = asStruct(B)->mems[ip->c];
+    VM_NEXT
+  VM_CASE(MKARRAY)
+  {
+    ArrayObject* arr = new ArrayObject((Type*) ip->aux);
+    arr->reserve(ip->c);
+    for(int i = 0; i < ip->c; i++)
+      arr->push_back((&B)[i]);
+    A = objectValue(arr);
+    VM_NEXT
+  }
+  VM_CASE(MKSTRUCT)
+  {
+    StructObject* st = new StructObject;
+    st->mems.assign(&B, &B + ip->c);
+    A = objectValue(st);
+    VM_NEXT
+  }
+  VM_CASE(CONV)
+  {
+    Converted* conv = (Converted*) ip->aux;
+    A = convertValue(B, conv->value->type, conv->type, conv);
+    VM_NEXT
+  }
+  //"a = a + x" (and "a = x + a") update a's array in place,
+  //unless the array is shared
+  VM_CASE(CONCAT)
+  {
+    if(&A == &B && &A != &C)
+    {
+      makeUnique(A);
+      asArray(A)->append(asArray(C));
+      VM_NEXT
+    }
+    if(&A == &C && &A != &B)
+    {
+      makeUnique(A);
+      asArray(A)->prepend(asArray(B));
+      VM_NEXT
+    }
+    Value result = cloneObject(B);
+    asArray(result)->append(asArray(C));
+    A = std::move(result);
+    VM_NEXT
+  }
+  VM_CASE(APPEND)
+  {
+    if(&A == &B)
+    {
+      makeUnique(A);
+      asArray(A)->push_back(C);
+      VM_NEXT
+    }
+    Value result = cloneObject(B);
+    asArray(result)->push_back(C);
+    A = std::move(result);
+    VM_NEXT
+  }
+  VM_CASE(PREPEND)
+  {
+    if(&A == &C)
+    {
+      makeUnique(A);
+      asArray(A)->push_front(B);
+      VM_NEXT
+    }
+    Value result = cloneObject(C);
+    asArray(result)->push_front(B);
+    A = std::move(result);
+    VM_NEXT
+  }
+  VM_CASE(IS)
+  {
+    IsExpr* ie = (IsExpr*) ip->aux;
+    A = boolValue(ie->optionMap[asUnion(B)->option] >= 0);
+    VM_NEXT
+  }
+  VM_CASE(AS)
+    A = narrowUnion(asUnion(B), (AsExpr*) ip->aux);
+    VM_NEXT
+  VM_CASE(UNIONVAL)
+    A = asUnion(B)->v;
+    VM_NEXT
+  VM_CASE(PRINT)
+    printTopLevel(stdoutBuffer, A, (Type*) ip->aux);
+    VM_NEXT
+  VM_CASE(ASSERT)
+    if(!A.b)
+    {
+      Assertion* assertion = (Assertion*) ip->aux;
+      errMsgLoc(assertion, "Assertion failed: " << assertion->asserted);
+    }
+    VM_NEXT
+#ifndef VM_COMPUTED_GOTO
+    default:
+      INTERNAL_ERROR;
+  }
+#endif
+callFrame:
+  {
+    //callee's frame starts at top, above the args in this frame
+    enterFrame(callee, top);
+    for(int i = 0; i < numArgs; i++)
+      top[i] = args[i];
+    callStack.push_back(CallFrame{f, ip, regs, thisPtr, calleeGlobal});
+    f = callee;
+    code = f->code.data();
+    ip = code;
+    regs = top;
+    top = regs + f->numRegs;
+    thisPtr = calleeThis;
+    VM_DISPATCH;
+  }
+returnFrame:
+  {
+    releaseFrame(regs, top);
+    if(callStack.size() == baseDepth)
+      return returned;
+    CallFrame& caller = callStack.back();
+    f = caller.f;
+    code = f->code.data();
+    ip = caller.ip;
+    regs = caller.regs;
+    top = regs + f->numRegs;
+    thisPtr = caller.thisPtr;
+    int initialized = caller.global;
+    callStack.pop_back();
+    if(initialized >= 0)
+    {
+      storeGlobal(initialized, returned);
+      VM_DISPATCH;
+    }
+    A = std::move(returned);
+    VM_NEXT
+  }
+#undef VM_NEXT
+#undef VM_JUMP
+#undef VM_CALL
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef A
+#undef B
+#undef C
+  INTERNAL_ERROR;
+  return Value();
+}
+
+static const char* opcodeNames[] =
+{
+#define VM_OPCODE_NAME(name) #name,
+  VM_OPCODES(VM_OPCODE_NAME)
+#undef VM_OPCODE_NAME
+};
+
+void VM::disassemble(ostream& os, Function* f)
+{
+  if(f->subr)
+    os << "Function " << f->subr->name() << " (" << f->numRegs << " registers):\n";
+  else
+    os << "Global initializer (" << f->numRegs << " registers):\n";
+  for(size_t i = 0; i < f->code.size(); i++)
+  {
+    const Instr& in = f->code[i];
+    os << "  " << i << ": " << opcodeNames[in.op] << ' ' <<
+      in.a << ' ' << in.b << ' ' << in.c;
+    if(in.k)
+      os << " k=" << in.k;
+    os << '\n';
+  }
+}
+
+void VM::run(Subroutine* entry, vector<Expression*>& args, size_t stackSize)
+{
+  prog = new Program;
+  //only the pages of the stack that are actually used get committed
+  size_t stackCapacity = stackSize / sizeof(Value);
+  stackBase = (Value*) calloc(stackCapacity, sizeof(Value));
+  if(!stackBase)
+  {
+    errMsg("Couldn't allocate VM stack of " << stackSize << " bytes");
+  }
+  stackBudget = stackSize;
+  Function* mainFunc = prog->getFunction(entry);
+  prog->compilePending();
+  if(args.size() != entry->type->paramTypes.size())
+  {
+    errMsg("Call to " << entry->decl->name << " expects " << \
+        entry->type->paramTypes.size() << " args, but got " << args.size() << ".");
+  }
+  if(verboseEnabled())
+  {
+    for(auto& f : prog->functions)
+      disassemble(cout, f.second);
+  }
+  vector<Value> argVals;
+  for(auto a : args)
+    argVals.push_back(constantValue(a));
+  enterFrame(mainFunc, stackBase);
+  std::copy(argVals.begin(), argVals.end(), stackBase);
+  execute(mainFunc, stackBase, nullptr);
+  stdoutBuffer.flush();
+}
+
@@ -0,0 +1,167 @@
+#ifndef VM_H
+#define VM_H
+
+#include "Common.hpp"
+#include "Value.hpp"
+#include "Subroutine.hpp"
+
+/*****************************************************************************/
+// VM: register-based bytecode interpreter (the alternative to AstInterpreter)
+//
+// Each Subroutine is lowered to a Function: a flat array of Instrs operating
+// on a frame of Value registers. Parameters and locals occupy the first
+// registers (given by Variable::slot), then temporaries. Globals live in a
+// separate table and are initialized lazily, on first access (like the AST
+// interpreter).
+//
+// Calls don't recurse on the native stack. A call saves where its caller
+// resumes on the VM's own call stack, and the callee's frame is the next
+// block of registers in one contiguous buffer. A call in tail position
+// (TAILCALL) reuses the caller's frame instead.
+/*****************************************************************************/
+
+namespace VM
+{
+  //X-macro list of all opcodes (used to build both the enum and
+  //the computed-goto dispatch table)
+  //Operand conventions: a is the destination register (if any),
+  //b and c are source registers unless noted otherwise
+#define VM_OPCODES(X) \
+  X(NOP)        /* */ \
+  X(LOADK)      /* a = constants[b] */ \
+  X(MOV)        /* a = b */ \
+  X(CHECKINIT)  /* error if local a (variable aux) isn't initialized yet */ \
+  X(LOADG)      /* a = globals[b] */ \
+  X(STOREG)     /* globals[a] = b */ \
+  X(LOADTHIS)   /* a = this */ \
+  X(REFLOCAL)   /* a = &b */ \
+  X(REFGLOBAL)  /* a = &globals[b] */ \
+  X(REFTHIS)    /* a = &this */ \
+  X(REFMEMBER)  /* a = &(*b).members[c] (c is a constant index) */ \
+  X(REFINDEX)   /* a = &(*b)[c] (array, not flat) */ \
+  X(REFKEY)     /* a = &(*b)[c] (map, inserting default value) */ \
+  X(LOADREF)    /* a = *b */ \
+  X(STOREREF)   /* *a = b */ \
+  X(STOREKEY)   /* (*a)[b] = c (map, c is a maybe) */ \
+  X(STOREINDEX) /* (*a)[b] = c (array) */ \
+  X(ADDI) X(SUBI) X(MULI) X(DIVI) X(MODI) \
+  X(ANDI) X(ORI) X(XORI) X(SHLI) X(SHRI) \
+  X(ADDF) X(SUBF) X(MULF) X(DIVF) \
+  X(NOT) X(BNOT) X(NEG) \
+  X(EQI) X(NEI) X(LTI) X(LEI) \
+  X(EQ) X(NE) X(LT) X(LE) \
+  X(JMP)        /* pc = a */ \
+  X(JT)         /* if a: pc = b */ \
+  X(JF)         /* if !a: pc = b */ \
+  X(SWITCH)     /* pc = target of case matching a (aux is a JumpTable) */ \
+  X(MATCH)      /* pc = target for option of union a (aux is a JumpTable) */ \
+  X(CALL)       /* a = aux(args b...b+c-1) */ \
+  X(CALLM)      /* a = aux(args b+1...b+c) with this = *b */ \
+  X(CALLV)      /* a = b(args b+1...b+c) */ \
+  X(CALLEXT)    /* a = aux(args b...b+c-1), aux is external */ \
+  X(TAILCALL)   /* return aux(args b...b+c-1), reusing this frame */ \
+  X(RET)        /* return a */ \
+  X(RETV)       /* return (void) */ \
+  X(NORET)      /* error: reached end of non-void subroutine aux */ \
+  X(NEWARRAY)   /* a = new aux[b]...[b+c-1] */ \
+  X(LEN)        /* a = b.len */ \
+  X(INDEX)      /* a = b[c] (array) */ \
+  X(MAPGET)     /* a = (*b)[c] (map, inserting default value) */ \
+  X(MEMBER)     /* a = b.members[c] (c is a constant index) */ \
+  X(MKARRAY)    /* a = array of b...b+c-1 (element type aux) */ \
+  X(MKSTRUCT)   /* a = struct/tuple of b...b+c-1 */ \
+  X(CONV)       /* a = (aux->type) b */ \
+  X(CONCAT)     /* a = b + c (array + array) */ \
+  X(APPEND)     /* a = b + c (array + elem) */ \
+  X(PREPEND)    /* a = b + c (elem + array) */ \
+  X(IS)         /* a = b is aux */ \
+  X(AS)         /* a = b as aux */ \
+  X(UNIONVAL)   /* a = value stored in union b */ \
+  X(PRINT)      /* print a (static type aux) */ \
+  X(ASSERT)     /* check a (statement aux) */
+
+#define VM_ENUM_ENTRY(name) name,
+  enum Opcode : uint16_t
+  {
+    VM_OPCODES(VM_ENUM_ENTRY)
+    NUM_OPCODES
+  };
+#undef VM_ENUM_ENTRY
+
+  //Number kind (k) of typed arithmetic instructions
+  enum NumKind : uint16_t
+  {
+    //low bits: size in bytes
+    NK_SIZE = 0xF,
+    NK_SIGNED = 0x10,
+    //for shifts: is the right operand signed?
+    NK_RHS_SIGNED = 0x20
+  };
+
+  struct Instr
+  {
+    Instr(Opcode o, int a_ = 0, int b_ = 0, int c_ = 0, void* x = nullptr)
+      : op(o), k(0), a(a_), b(b_), c(c_), aux(x) {}
+    uint16_t op;
+    uint16_t k;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+    //type, AST node or Function associated with instruction
+    void* aux;
+  };
+
+  //Jump targets of a Switch whose cases are all in its case table,
+  //or of a Match
+  struct JumpTable
+  {
+    //null for a Match
+    Switch* sw;
+    //indexed by case (Switch) or union option (Match)
+    vector<int> targets;
+    int defaultTarget;
+  };
+
+  struct Function
+  {
+    Function(Subroutine* s) : subr(s), numParams(0), numRegs(0), compiled(false) {}
+    //null for a global variable initializer
+    Subroutine* subr;
+    vector<Instr> code;
+    int numParams;
+    int numRegs;
+    bool compiled;
+  };
+
+  //All code and data for a running program
+  struct Program
+  {
+    //Get (and lazily compile) the Function for s
+    Function* getFunction(Subroutine* s);
+    //Get the global table index for v (its slot),
+    //compiling its initializer if needed
+    int getGlobal(Variable* v);
+    int addConstant(const Value& v);
+    //Compile all functions which are known but not yet compiled
+    void compilePending();
+    map<Subroutine*, Function*> functions;
+    vector<Function*> pending;
+    vector<Value> constants;
+    //indexed by global slot
+    vector<Function*> globalInits;
+  };
+
+  //Lower a subroutine body or global initializer to bytecode
+  void compile(Program* prog, Function* f, Variable* initVar = nullptr);
+
+  //Print a function's bytecode (verbose mode)
+  void disassemble(ostream& os, Function* f);
+
+  //Compile and run the program, starting with main
+  //stackSize is the memory budget (in bytes) for the call stack: the
+  //registers and call records of all active frames
+  void run(Subroutine* entry, vector<Expression*>& args, size_t stackSize);
+}
+
+#endif
+
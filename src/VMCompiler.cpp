@@ -0,0 +1,1008 @@
+#include "VM.hpp"
+#include "Variable.hpp"
+
+using namespace VM;
+
+Function* Program::getFunction(Subroutine* s)
+{
+  auto it = functions.find(s);
+  if(it != functions.end())
+    return it->second;
+  Function* f = new Function(s);
+  functions[s] = f;
+  pending.push_back(f);
+  return f;
+}
+
+int Program::getGlobal(Variable* v)
+{
+  INTERNAL_ASSERT(v->slot >= 0);
+  if(globalInits.size() <= (size_t) v->slot)
+    globalInits.resize(v->slot + 1, nullptr);
+  if(!globalInits[v->slot])
+  {
+    Function* init = new Function(nullptr);
+    globalInits[v->slot] = init;
+    compile(this, init, v);
+  }
+  return v->slot;
+}
+
+int Program::addConstant(const Value& v)
+{
+  constants.push_back(v);
+  return constants.size() - 1;
+}
+
+void Program::compilePending()
+{
+  while(pending.size())
+  {
+    Function* f = pending.back();
+    pending.pop_back();
+    if(!f->compiled)
+      compile(this, f);
+  }
+}
+
+//Is t an integer type (or char), which uses the typed integer instructions?
+static bool intArith(Type* t)
+{
+  t = canonicalize(t);
+  return t->isInteger() && !t->isEnum();
+}
+
+static uint16_t numKind(Type* t)
+{
+  t = canonicalize(t);
+  if(auto it = dynCast<IntegerType>(t))
+    return it->size | (it->isSigned ? NK_SIGNED : 0);
+  if(auto ft = dynCast<FloatType>(t))
+    return ft->size;
+  //char
+  return 1;
+}
+
+namespace
+{
+  //Jumps to be patched when a loop or switch is finished
+  struct BranchContext
+  {
+    BranchContext(Statement* s) : stmt(s), continueTarget(-1) {}
+    Statement* stmt;
+    vector<int> breaks;
+    vector<int> continues;
+    int continueTarget;
+  };
+
+  struct FunctionCompiler
+  {
+    FunctionCompiler(Program* p, Function* f) : prog(p), func(f), numLocals(0), nextTemp(0), declaring(nullptr) {}
+    void compileSubroutine();
+    void compileInitializer(Variable* v);
+    int emit(Instr i)
+    {
+      func->code.push_back(i);
+      return func->code.size() - 1;
+    }
+    int here()
+    {
+      return func->code.size();
+    }
+    void patch(int instr, int target)
+    {
+      Instr& i = func->code[instr];
+      if(i.op == JMP)
+        i.a = target;
+      else
+        i.b = target;
+    }
+    int temp()
+    {
+      int t = nextTemp++;
+      if(nextTemp > func->numRegs)
+        func->numRegs = nextTemp;
+      return t;
+    }
+    int target(int dst)
+    {
+      return dst >= 0 ? dst : temp();
+    }
+    int constant(const Value& v, int dst = -1)
+    {
+      int reg = target(dst);
+      emit(Instr(LOADK, reg, prog->addConstant(v)));
+      return reg;
+    }
+    //Statements
+    void stmt(Statement* s);
+    void block(Block* b);
+    void assign(Assign* a);
+    void loopBody(Block* body, BranchContext& ctx);
+    void forArray(ForArray* fa);
+    void switchStmt(Switch* sw);
+    void match(Match* ma);
+    BranchContext& findContext(Statement* s);
+    //Expressions
+    //Evaluate e. If dst >= 0 and e produces a new value,
+    //that value is placed directly in dst.
+    int expr(Expression* e, int dst = -1);
+    //Evaluate e into the register dst
+    void exprInto(Expression* e, int dst);
+    int binary(BinaryArith* ba, int dst);
+    //Emit a comparison (op is CMPEQ, CMPL, etc.) of operands with type t
+    void compare(int op, int dst, int lhs, int rhs, Type* t);
+    //If tail (the call is the value of a return) and the callee is a
+    //subroutine, the call is a TAILCALL and -1 is returned
+    int call(CallExpr* call, int dst, bool tail = false);
+    //Lvalues: produce a register holding a reference to e's storage
+    int lref(Expression* e);
+    //Store val to lvalue (not a local variable)
+    void store(Expression* lvalue, int val);
+    void evalIndices(Expression* e);
+    int buildRef(Expression* e);
+    //locals (including parameters) live in the registers
+    //given by their frame slots
+    int localReg(Variable* v)
+    {
+      INTERNAL_ASSERT(v->slot >= 0 && v->slot < numLocals);
+      return v->slot;
+    }
+    bool isLocal(Variable* v)
+    {
+      return !v->isGlobal();
+    }
+    //Every local is initialized by its declaration, so only a use that
+    //comes before the declaration (or is in its own initializer)
+    //needs to check it at runtime
+    void checkInit(VarExpr* ve)
+    {
+      Variable* v = ve->var;
+      if(v == declaring || (ve->fileID == v->fileID &&
+          (ve->line < v->line || (ve->line == v->line && ve->col < v->col))))
+        emit(Instr(CHECKINIT, localReg(v), 0, 0, v));
+    }
+    Program* prog;
+    Function* func;
+    int numLocals;
+    int nextTemp;
+    vector<BranchContext> contexts;
+    //index registers evaluated before building a reference
+    map<Expression*, int> indexRegs;
+    //local whose declaration's initial value is being compiled
+    Variable* declaring;
+  };
+}
+
+void FunctionCompiler::compileSubroutine()
+{
+  Subroutine* subr = func->subr;
+  //Parameters take the first registers (slots), so arguments
+  //can be copied directly into the new frame
+  numLocals = subr->numLocals;
+  func->numParams = subr->params.size();
+  nextTemp = numLocals;
+  func->numRegs = numLocals;
+  block(subr->body);
+  if(subr->type->returnType->isSimple())
+    emit(Instr(RETV));
+  else
+    emit(Instr(NORET, 0, 0, 0, subr));
+}
+
+void FunctionCompiler::compileInitializer(Variable* v)
+{
+  int init = expr(v->initial);
+  emit(Instr(RET, init));
+}
+
+void FunctionCompiler::stmt(Statement* s)
+{
+  //temporaries never outlive the statement that uses them
+  int tempMark = nextTemp;
+  if(auto a = dynCast<Assign>(s))
+  {
+    assign(a);
+  }
+  else if(auto b = dynCast<Block>(s))
+  {
+    block(b);
+  }
+  else if(auto cs = dynCast<CallStmt>(s))
+  {
+    expr(cs->eval);
+  }
+  else if(auto fc = dynCast<ForC>(s))
+  {
+    contexts.emplace_back(fc);
+    if(fc->init)
+      stmt(fc->init);
+    //the bound of a counter loop is loop-invariant, so compute it once
+    int bound = -1;
+    if(fc->counterLoop)
+      bound = expr(fc->counterLoop->bound);
+    int top = here();
+    int exitJump = -1;
+    if(bound >= 0)
+    {
+      auto cond = (BinaryArith*) fc->condition;
+      int cmp = temp();
+      compare(cond->op, cmp, localReg(fc->counterLoop->counter), bound,
+          canonicalize(fc->counterLoop->counter->type));
+      exitJump = emit(Instr(JF, cmp));
+    }
+    else if(fc->condition)
+    {
+      int cond = expr(fc->condition);
+      exitJump = emit(Instr(JF, cond));
+    }
+    loopBody(fc->inner, contexts.back());
+    if(fc->increment)
+      stmt(fc->increment);
+    emit(Instr(JMP, top));
+    if(exitJump >= 0)
+      patch(exitJump, here());
+    for(auto br : contexts.back().breaks)
+      patch(br, here());
+    contexts.pop_back();
+  }
+  else if(auto fr = dynCast<ForRange>(s))
+  {
+    contexts.emplace_back(fr);
+    int counter = localReg(fr->counter);
+    exprInto(fr->begin, counter);
+    int end = -1;
+    if(fr->counterLoop)
+      end = expr(fr->end);
+    int top = here();
+    if(!fr->counterLoop)
+      end = expr(fr->end);
+    int cond = temp();
+    Instr cmp(LTI, cond, counter, end);
+    cmp.k = numKind(fr->counter->type);
+    emit(cmp);
+    int exitJump = emit(Instr(JF, cond));
+    loopBody(fr->inner, contexts.back());
+    int one = constant(intValue(1));
+    Instr incr(ADDI, counter, counter, one, fr);
+    incr.k = numKind(fr->counter->type);
+    emit(incr);
+    emit(Instr(JMP, top));
+    patch(exitJump, here());
+    for(auto br : contexts.back().breaks)
+      patch(br, here());
+    contexts.pop_back();
+  }
+  else if(auto fa = dynCast<ForArray>(s))
+  {
+    forArray(fa);
+  }
+  else if(auto w = dynCast<While>(s))
+  {
+    contexts.emplace_back(w);
+    int top = here();
+    int cond = expr(w->condition);
+    int exitJump = emit(Instr(JF, cond));
+    loopBody(w->body, contexts.back());
+    emit(Instr(JMP, top));
+    patch(exitJump, here());
+    for(auto br : contexts.back().breaks)
+      patch(br, here());
+    contexts.pop_back();
+  }
+  else if(auto i = dynCast<If>(s))
+  {
+    int cond = expr(i->condition);
+    int elseJump = emit(Instr(JF, cond));
+    stmt(i->body);
+    if(i->elseBody)
+    {
+      int endJump = emit(Instr(JMP));
+      patch(elseJump, here());
+      stmt(i->elseBody);
+      patch(endJump, here());
+    }
+    else
+      patch(elseJump, here());
+  }
+  else if(auto r = dynCast<Return>(s))
+  {
+    if(r->value)
+    {
+      auto ce = dynCast<CallExpr>(r->value);
+      int val = ce ? call(ce, -1, true) : expr(r->value);
+      if(val >= 0)
+        emit(Instr(RET, val));
+    }
+    else
+      emit(Instr(RETV));
+  }
+  else if(auto br = dynCast<Break>(s))
+  {
+    Statement* target = nullptr;
+    if(br->breakable.is<For*>())
+      target = br->breakable.get<For*>();
+    else if(br->breakable.is<While*>())
+      target = br->breakable.get<While*>();
+    else
+      target = br->breakable.get<Switch*>();
+    findContext(target).breaks.push_back(emit(Instr(JMP)));
+  }
+  else if(auto cont = dynCast<Continue>(s))
+  {
+    Statement* target = nullptr;
+    if(cont->loop.is<For*>())
+      target = cont->loop.get<For*>();
+    else
+      target = cont->loop.get<While*>();
+    findContext(target).continues.push_back(emit(Instr(JMP)));
+  }
+  else if(auto print = dynCast<Print>(s))
+  {
+    for(auto e : print->exprs)
+    {
+      int val = expr(e);
+      emit(Instr(VM::PRINT, val, 0, 0, e->type));
+    }
+  }
+  else if(auto assertion = dynCast<Assertion>(s))
+  {
+    int val = expr(assertion->asserted);
+    emit(Instr(VM::ASSERT, val, 0, 0, assertion));
+  }
+  else if(auto sw = dynCast<Switch>(s))
+  {
+    switchStmt(sw);
+  }
+  else if(auto ma = dynCast<Match>(s))
+  {
+    match(ma);
+  }
+  else
+  {
+    cout << "VM can't compile stmt at " << s->printLocation() << '\n';
+    INTERNAL_ERROR;
+  }
+  nextTemp = tempMark;
+}
+
+void FunctionCompiler::block(Block* b)
+{
+  for(auto s : b->stmts)
+    stmt(s);
+}
+
+BranchContext& FunctionCompiler::findContext(Statement* s)
+{
+  for(auto it = contexts.rbegin(); it != contexts.rend(); it++)
+  {
+    if(it->stmt == s)
+      return *it;
+  }
+  INTERNAL_ERROR;
+  return contexts.back();
+}
+
+void FunctionCompiler::loopBody(Block* body, BranchContext& ctx)
+{
+  //note: ctx may move if contexts grows, so use an index
+  size_t ctxIndex = &ctx - contexts.data();
+  block(body);
+  //continue jumps to the end of the body (before increment)
+  for(auto c : contexts[ctxIndex].continues)
+    patch(c, here());
+  contexts[ctxIndex].continues.clear();
+}
+
+void FunctionCompiler::assign(Assign* a)
+{
+  if(auto compoundLHS = dynCast<CompoundLiteral>(a->lvalue))
+  {
+    //Evaluate the whole rvalue first, then assign one member at a time
+    int rhs = expr(a->rvalue);
+    for(size_t i = 0; i < compoundLHS->members.size(); i++)
+    {
+      Expression* mem = compoundLHS->members[i];
+      int val = temp();
+      emit(Instr(MEMBER, val, rhs, i));
+      if(auto ve = dynCast<VarExpr>(mem))
+      {
+        if(isLocal(ve->var))
+        {
+          emit(Instr(MOV, localReg(ve->var), val));
+          continue;
+        }
+      }
+      store(mem, val);
+    }
+    return;
+  }
+  if(auto ve = dynCast<VarExpr>(a->lvalue))
+  {
+    if(isLocal(ve->var))
+    {
+      //a declaration's Assign has the variable's location
+      Variable* v = ve->var;
+      if(a->fileID == v->fileID && a->line == v->line && a->col == v->col)
+        declaring = v;
+      exprInto(a->rvalue, localReg(v));
+      declaring = nullptr;
+    }
+    else
+    {
+      int rhs = expr(a->rvalue);
+      emit(Instr(STOREG, prog->getGlobal(ve->var), rhs));
+    }
+    return;
+  }
+  int rhs = expr(a->rvalue);
+  auto ind = dynCast<Indexed>(a->lvalue);
+  if(ind && canonicalize(ind->group->type)->isMap())
+  {
+    //storing a (maybe) value for a key
+    int key = expr(ind->index);
+    int mapRef = lref(ind->group);
+    emit(Instr(STOREKEY, mapRef, key, rhs, ind));
+    return;
+  }
+  store(a->lvalue, rhs);
+}
+
+void FunctionCompiler::store(Expression* lvalue, int val)
+{
+  auto ind = dynCast<Indexed>(lvalue);
+  if(ind && canonicalize(ind->group->type)->isArray())
+  {
+    //elements of flat arrays can't be referenced, so store directly
+    indexRegs.clear();
+    evalIndices(lvalue);
+    int group = buildRef(ind->group);
+    emit(Instr(STOREINDEX, group, indexRegs[ind], val, ind));
+    return;
+  }
+  emit(Instr(STOREREF, lref(lvalue), val));
+}
+
+void FunctionCompiler::forArray(ForArray* fa)
+{
+  contexts.emplace_back(fa);
+  int dims = fa->counters.size();
+  //arrays[d] is the array being iterated at depth d
+  vector<int> arrays(dims);
+  vector<int> tops(dims);
+  vector<int> exits(dims);
+  //keep a reference to the array: if the loop body modifies the
+  //original, copy-on-write leaves this one unchanged
+  arrays[0] = temp();
+  exprInto(fa->arr, arrays[0]);
+  Type* arrType = canonicalize(fa->arr->type);
+  uint16_t longKind = numKind(getLongType());
+  int one = constant(intValue(1));
+  for(int d = 0; d < dims; d++)
+  {
+    int counter = localReg(fa->counters[d]);
+    constant(intValue(0), counter);
+    tops[d] = here();
+    int len = temp();
+    emit(Instr(LEN, len, arrays[d]));
+    int cond = temp();
+    Instr cmp(LTI, cond, counter, len);
+    cmp.k = longKind;
+    emit(cmp);
+    exits[d] = emit(Instr(JF, cond));
+    if(d + 1 < dims)
+    {
+      arrays[d + 1] = temp();
+      emit(Instr(INDEX, arrays[d + 1], arrays[d], counter, fa));
+      arrType = canonicalize(((ArrayType*) arrType)->subtype);
+    }
+  }
+  //innermost: load the element into iter
+  emit(Instr(INDEX, localReg(fa->iter), arrays[dims - 1], localReg(fa->counters[dims - 1]), fa));
+  loopBody(fa->inner, contexts.back());
+  for(int d = dims - 1; d >= 0; d--)
+  {
+    int counter = localReg(fa->counters[d]);
+    Instr incr(ADDI, counter, counter, one, fa);
+    incr.k = longKind;
+    emit(incr);
+    emit(Instr(JMP, tops[d]));
+    patch(exits[d], here());
+  }
+  for(auto br : contexts.back().breaks)
+    patch(br, here());
+  contexts.pop_back();
+}
+
+void FunctionCompiler::switchStmt(Switch* sw)
+{
+  contexts.emplace_back(sw);
+  int switched = expr(sw->switched);
+  vector<int> caseJumps;
+  int defaultJump = -1;
+  JumpTable* table = nullptr;
+  if(sw->hasTable && sw->dynamicCases.empty())
+  {
+    //Look up the case directly (targets are filled in below)
+    table = new JumpTable;
+    table->sw = sw;
+    emit(Instr(VM::SWITCH, switched, 0, 0, table));
+  }
+  else
+  {
+    //Compare against each case value in order
+    for(auto caseVal : sw->caseValues)
+    {
+      int val = expr(caseVal);
+      int cond = temp();
+      emit(Instr(EQ, cond, switched, val));
+      caseJumps.push_back(emit(Instr(JT, cond)));
+    }
+    defaultJump = emit(Instr(JMP));
+  }
+  //Body: record the position of each statement so cases can jump there
+  vector<int> stmtPos;
+  for(auto s : sw->block->stmts)
+  {
+    stmtPos.push_back(here());
+    stmt(s);
+  }
+  stmtPos.push_back(here());
+  if(table)
+  {
+    for(auto label : sw->caseLabels)
+      table->targets.push_back(stmtPos[label]);
+    table->defaultTarget = stmtPos[sw->defaultPosition];
+  }
+  else
+  {
+    for(size_t i = 0; i < caseJumps.size(); i++)
+      patch(caseJumps[i], stmtPos[sw->caseLabels[i]]);
+    patch(defaultJump, stmtPos[sw->defaultPosition]);
+  }
+  for(auto br : contexts.back().breaks)
+    patch(br, here());
+  //continue inside a switch refers to an enclosing loop
+  auto continues = contexts.back().continues;
+  contexts.pop_back();
+  for(auto c : continues)
+    contexts.back().continues.push_back(c);
+}
+
+void FunctionCompiler::match(Match* ma)
+{
+  int matched = expr(ma->matched);
+  //Jump directly to the case for the value's option
+  JumpTable* table = new JumpTable;
+  table->sw = nullptr;
+  emit(Instr(VM::MATCH, matched, 0, 0, table));
+  vector<int> caseStarts;
+  vector<int> endJumps;
+  for(size_t i = 0; i < ma->cases.size(); i++)
+  {
+    caseStarts.push_back(here());
+    emit(Instr(UNIONVAL, localReg(ma->caseVars[i]), matched));
+    block(ma->cases[i]);
+    endJumps.push_back(emit(Instr(JMP)));
+  }
+  for(auto j : endJumps)
+    patch(j, here());
+  //options with no case go to the end
+  for(int c : ma->optionCases)
+    table->targets.push_back(c >= 0 ? caseStarts[c] : here());
+  table->defaultTarget = here();
+}
+
+void FunctionCompiler::exprInto(Expression* e, int dst)
+{
+  int val = expr(e, dst);
+  if(val != dst)
+    emit(Instr(MOV, dst, val));
+}
+
+int FunctionCompiler::expr(Expression* e, int dst)
+{
+  if(e->constant())
+  {
+    return constant(constantValue(e), dst);
+  }
+  if(auto ve = dynCast<VarExpr>(e))
+  {
+    if(isLocal(ve->var))
+    {
+      checkInit(ve);
+      return localReg(ve->var);
+    }
+    int reg = target(dst);
+    emit(Instr(LOADG, reg, prog->getGlobal(ve->var)));
+    return reg;
+  }
+  else if(auto ua = dynCast<UnaryArith>(e))
+  {
+    int operand = expr(ua->expr);
+    int reg = target(dst);
+    switch(ua->op)
+    {
+      case LNOT:
+        emit(Instr(NOT, reg, operand));
+        break;
+      case ::BNOT:
+        emit(Instr(VM::BNOT, reg, operand));
+        break;
+      case SUB:
+        emit(Instr(NEG, reg, operand));
+        break;
+      default:
+        INTERNAL_ERROR;
+    }
+    return reg;
+  }
+  else if(auto ba = dynCast<BinaryArith>(e))
+  {
+    return binary(ba, dst);
+  }
+  else if(auto cl = dynCast<CompoundLiteral>(e))
+  {
+    int n = cl->members.size();
+    int base = nextTemp;
+    for(int i = 0; i < n; i++)
+      temp();
+    for(int i = 0; i < n; i++)
+      exprInto(cl->members[i], base + i);
+    int reg = target(dst);
+    Type* clType = canonicalize(cl->type);
+    if(auto at = dynCast<ArrayType>(clType))
+      emit(Instr(MKARRAY, reg, base, n, at->subtype));
+    else
+      emit(Instr(MKSTRUCT, reg, base, n));
+    return reg;
+  }
+  else if(auto ind = dynCast<Indexed>(e))
+  {
+    Type* groupType = canonicalize(ind->group->type);
+    if(groupType->isMap())
+    {
+      //Lookup inserts missing keys into the original map,
+      //so it operates on a reference
+      int index = expr(ind->index);
+      int mapRef = -1;
+      if(ind->group->assignable())
+        mapRef = lref(ind->group);
+      else
+      {
+        int group = expr(ind->group);
+        mapRef = temp();
+        emit(Instr(REFLOCAL, mapRef, group));
+      }
+      int reg = target(dst);
+      emit(Instr(MAPGET, reg, mapRef, index, ind));
+      return reg;
+    }
+    int group = expr(ind->group);
+    if(auto tt = dynCast<TupleType>(groupType))
+    {
+      //index is a constant, checked during semantic analysis
+      IntConstant* ic = (IntConstant*) ind->index;
+      int index = ic->isSigned() ? ic->sval : ic->uval;
+      INTERNAL_ASSERT(index >= 0 && index < (int) tt->members.size());
+      int reg = target(dst);
+      emit(Instr(MEMBER, reg, group, index));
+      return reg;
+    }
+    int index = expr(ind->index);
+    int reg = target(dst);
+    emit(Instr(INDEX, reg, group, index, ind));
+    return reg;
+  }
+  else if(auto ce = dynCast<CallExpr>(e))
+  {
+    return call(ce, dst);
+  }
+  else if(auto sm = dynCast<StructMem>(e))
+  {
+    if(!sm->member.is<Variable*>())
+    {
+      errMsgLoc(sm, "VM doesn't support member subroutines as values");
+    }
+    int base = expr(sm->base);
+    int reg = target(dst);
+    emit(Instr(MEMBER, reg, base, sm->index));
+    return reg;
+  }
+  else if(auto na = dynCast<NewArray>(e))
+  {
+    int n = na->dims.size();
+    int base = nextTemp;
+    for(int i = 0; i < n; i++)
+      temp();
+    for(int i = 0; i < n; i++)
+      exprInto(na->dims[i], base + i);
+    int reg = target(dst);
+    emit(Instr(NEWARRAY, reg, base, n, ((ArrayType*) canonicalize(na->type))->elem));
+    return reg;
+  }
+  else if(auto al = dynCast<ArrayLength>(e))
+  {
+    int arr = expr(al->array);
+    int reg = target(dst);
+    emit(Instr(LEN, reg, arr));
+    return reg;
+  }
+  else if(auto ie = dynCast<IsExpr>(e))
+  {
+    int base = expr(ie->base);
+    int reg = target(dst);
+    emit(Instr(VM::IS, reg, base, 0, ie));
+    return reg;
+  }
+  else if(auto ae = dynCast<AsExpr>(e))
+  {
+    int base = expr(ae->base);
+    int reg = target(dst);
+    emit(Instr(VM::AS, reg, base, 0, ae));
+    return reg;
+  }
+  else if(dynCast<ThisExpr>(e))
+  {
+    int reg = target(dst);
+    emit(Instr(LOADTHIS, reg));
+    return reg;
+  }
+  else if(auto conv = dynCast<Converted>(e))
+  {
+    int val = expr(conv->value);
+    int reg = target(dst);
+    emit(Instr(CONV, reg, val, 0, conv));
+    return reg;
+  }
+  cout << "VM can't compile expression " << e << '\n';
+  INTERNAL_ERROR;
+  return 0;
+}
+
+int FunctionCompiler::binary(BinaryArith* ba, int dst)
+{
+  int op = ba->op;
+  if(op == LOR || op == LAND)
+  {
+    //short-circuit evaluation (result computed in a temporary,
+    //since dst may be read by the rhs)
+    int result = temp();
+    exprInto(ba->lhs, result);
+    int skip = emit(Instr(op == LOR ? JT : JF, result));
+    exprInto(ba->rhs, result);
+    patch(skip, here());
+    if(dst >= 0)
+    {
+      emit(Instr(MOV, dst, result));
+      return dst;
+    }
+    return result;
+  }
+  Type* lhsType = canonicalize(ba->lhs->type);
+  Type* rhsType = canonicalize(ba->rhs->type);
+  int lhs = expr(ba->lhs);
+  int rhs = expr(ba->rhs);
+  int reg = target(dst);
+  switch(op)
+  {
+    case CMPEQ:
+    case CMPNEQ:
+    case CMPL:
+    case CMPG:
+    case CMPLE:
+    case CMPGE:
+      //Comparisons: both operands have the same type
+      compare(op, reg, lhs, rhs, lhsType);
+      return reg;
+    default:;
+  }
+  if(op == PLUS && (lhsType->isArray() || rhsType->isArray()))
+  {
+    //array concatenation, append and prepend
+    Opcode opcode = CONCAT;
+    if(!rhsType->isArray())
+      opcode = APPEND;
+    else if(!lhsType->isArray())
+      opcode = PREPEND;
+    emit(Instr(opcode, reg, lhs, rhs));
+    return reg;
+  }
+  Type* t = canonicalize(ba->type);
+  Instr arith(NOP, reg, lhs, rhs, ba);
+  if(t->isFloat() || dynCast<FloatType>(t))
+  {
+    switch(op)
+    {
+      case PLUS: arith.op = ADDF; break;
+      case SUB: arith.op = SUBF; break;
+      case MUL: arith.op = MULF; break;
+      case DIV: arith.op = DIVF; break;
+      default: INTERNAL_ERROR;
+    }
+  }
+  else
+  {
+    switch(op)
+    {
+      case PLUS: arith.op = ADDI; break;
+      case SUB: arith.op = SUBI; break;
+      case MUL: arith.op = MULI; break;
+      case DIV: arith.op = DIVI; break;
+      case MOD: arith.op = MODI; break;
+      case BAND: arith.op = ANDI; break;
+      case BOR: arith.op = ORI; break;
+      case BXOR: arith.op = XORI; break;
+      case SHL: arith.op = SHLI; break;
+      case SHR: arith.op = SHRI; break;
+      default: INTERNAL_ERROR;
+    }
+    if(auto rhsInt = dynCast<IntegerType>(rhsType))
+    {
+      if(rhsInt->isSigned)
+        arith.k |= NK_RHS_SIGNED;
+    }
+  }
+  arith.k |= numKind(t);
+  emit(arith);
+  return reg;
+}
+
+void FunctionCompiler::compare(int op, int dst, int lhs, int rhs, Type* t)
+{
+  bool swap = op == CMPG || op == CMPGE;
+  int l = swap ? rhs : lhs;
+  int r = swap ? lhs : rhs;
+  bool isInt = intArith(t);
+  Opcode opcode = NOP;
+  switch(op)
+  {
+    case CMPEQ: opcode = isInt ? EQI : EQ; break;
+    case CMPNEQ: opcode = isInt ? NEI : NE; break;
+    case CMPL:
+    case CMPG: opcode = isInt ? LTI : LT; break;
+    default: opcode = isInt ? LEI : LE; break;
+  }
+  Instr cmp(opcode, dst, l, r);
+  if(isInt)
+    cmp.k = numKind(t);
+  emit(cmp);
+}
+
+int FunctionCompiler::call(CallExpr* ce, int dst, bool tail)
+{
+  int n = ce->args.size();
+  SubroutineExpr* subrExpr = dynCast<SubroutineExpr>(ce->callable);
+  StructMem* method = dynCast<StructMem>(ce->callable);
+  if(method && !method->member.is<Subroutine*>())
+    method = nullptr;
+  //rvalue "this" is evaluated before the arguments
+  int thisTemp = -1;
+  if(method && !method->base->assignable())
+  {
+    thisTemp = temp();
+    exprInto(method->base, thisTemp);
+  }
+  //dynamic callee is also evaluated before the arguments
+  int calleeReg = -1;
+  if(!subrExpr && !method)
+    calleeReg = expr(ce->callable);
+  //"this" or the callee value go in the register before the arguments
+  int base = nextTemp;
+  temp();
+  for(int i = 0; i < n; i++)
+    temp();
+  for(int i = 0; i < n; i++)
+    exprInto(ce->args[i], base + 1 + i);
+  int reg = target(dst);
+  if(subrExpr)
+  {
+    auto subr = dynCast<Subroutine>(subrExpr->subr);
+    if(subr && tail)
+    {
+      emit(Instr(TAILCALL, 0, base + 1, n, prog->getFunction(subr)));
+      return -1;
+    }
+    if(subr)
+      emit(Instr(CALL, reg, base + 1, n, prog->getFunction(subr)));
+    else
+      emit(Instr(CALLEXT, reg, base + 1, n, subrExpr->subr));
+  }
+  else if(method)
+  {
+    Function* f = prog->getFunction(method->member.get<Subroutine*>());
+    if(thisTemp >= 0)
+      emit(Instr(REFLOCAL, base, thisTemp));
+    else
+      emit(Instr(MOV, base, lref(method->base)));
+    emit(Instr(CALLM, reg, base, n, f));
+  }
+  else
+  {
+    emit(Instr(MOV, base, calleeReg));
+    emit(Instr(CALLV, reg, base, n, ce));
+  }
+  return reg;
+}
+
+int FunctionCompiler::lref(Expression* e)
+{
+  //Evaluate all subscripts first (in order), so that no code runs
+  //between building the reference and using it
+  indexRegs.clear();
+  evalIndices(e);
+  return buildRef(e);
+}
+
+void FunctionCompiler::evalIndices(Expression* e)
+{
+  if(auto sm = dynCast<StructMem>(e))
+  {
+    evalIndices(sm->base);
+  }
+  else if(auto ind = dynCast<Indexed>(e))
+  {
+    evalIndices(ind->group);
+    if(!canonicalize(ind->group->type)->isTuple())
+    {
+      int index = expr(ind->index);
+      indexRegs[ind] = index;
+    }
+  }
+}
+
+int FunctionCompiler::buildRef(Expression* e)
+{
+  int reg = temp();
+  if(auto ve = dynCast<VarExpr>(e))
+  {
+    if(isLocal(ve->var))
+    {
+      checkInit(ve);
+      emit(Instr(REFLOCAL, reg, localReg(ve->var)));
+    }
+    else
+      emit(Instr(REFGLOBAL, reg, prog->getGlobal(ve->var)));
+  }
+  else if(dynCast<ThisExpr>(e))
+  {
+    emit(Instr(REFTHIS, reg));
+  }
+  else if(auto sm = dynCast<StructMem>(e))
+  {
+    INTERNAL_ASSERT(sm->member.is<Variable*>());
+    int base = buildRef(sm->base);
+    emit(Instr(REFMEMBER, reg, base, sm->index));
+  }
+  else if(auto ind = dynCast<Indexed>(e))
+  {
+    Type* groupType = canonicalize(ind->group->type);
+    int group = buildRef(ind->group);
+    if(groupType->isTuple())
+    {
+      IntConstant* ic = (IntConstant*) ind->index;
+      emit(Instr(REFMEMBER, reg, group, ic->isSigned() ? ic->sval : ic->uval));
+    }
+    else if(groupType->isMap())
+      emit(Instr(REFKEY, reg, group, indexRegs[ind], groupType));
+    else
+      emit(Instr(REFINDEX, reg, group, indexRegs[ind], ind));
+  }
+  else
+  {
+    cout << "VM can't compile lvalue " << e << '\n';
+    INTERNAL_ERROR;
+  }
+  return reg;
+}
+
+void VM::compile(Program* prog, Function* f, Variable* initVar)
+{
+  f->compiled = true;
+  FunctionCompiler fc(prog, f);
+  if(initVar)
+    fc.compileInitializer(initVar);
+  else
+    fc.compileSubroutine();
+}
+
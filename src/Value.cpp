@@ -0,0 +1,1330 @@
+#include "Value.hpp"
+#include "Variable.hpp"
+#include "Subroutine.hpp"
+#include <mutex>
+
+size_t ValueHash::operator()(const Value& v) const
+{
+  return hashValue(v);
+}
+
+bool ValueEqual::operator()(const Value& lhs, const Value& rhs) const
+{
+  return valuesEqual(lhs, rhs);
+}
+
+bool isObjectType(Type* t)
+{
+  t = canonicalize(t);
+  return t->isArray() || t->isStruct() || t->isTuple() ||
+    t->isUnion() || t->isMap();
+}
+
+bool isStringType(Type* t)
+{
+  auto at = dynCast<ArrayType>(canonicalize(t));
+  return at && at->dims == 1 && canonicalize(at->elem)->isChar();
+}
+
+//Is t a signed integer type? (char counts as unsigned)
+static bool signedInt(Type* t)
+{
+  auto it = dynCast<IntegerType>(t);
+  return it && it->isSigned;
+}
+
+Value constantValue(Expression* e)
+{
+  switch(e->kind)
+  {
+    case NodeKind::IntConstant:
+    {
+      IntConstant* ic = (IntConstant*) e;
+      if(ic->isSigned())
+        return intValue(ic->sval);
+      return uintValue(ic->uval);
+    }
+    case NodeKind::FloatConstant:
+    {
+      FloatConstant* fc = (FloatConstant*) e;
+      if(fc->isDoublePrec())
+        return doubleValue(fc->dp);
+      return floatValue(fc->fp);
+    }
+    case NodeKind::BoolConstant:
+    {
+      BoolConstant* bc = (BoolConstant*) e;
+      return boolValue(bc->value);
+    }
+    case NodeKind::EnumExpr:
+    {
+      EnumExpr* ee = (EnumExpr*) e;
+      return enumValue(ee->value);
+    }
+    case NodeKind::SimpleConstant:
+    {
+      SimpleConstant* sc = (SimpleConstant*) e;
+      Value v;
+      v.simple = sc->st;
+      v.tag = ValueTag::SIMPLE;
+      return v;
+    }
+    case NodeKind::SubroutineExpr:
+    {
+      SubroutineExpr* se = (SubroutineExpr*) e;
+      Value v;
+      v.subr = se->subr;
+      v.tag = ValueTag::SUBR;
+      return v;
+    }
+    case NodeKind::CompoundLiteral:
+    {
+      CompoundLiteral* cl = (CompoundLiteral*) e;
+      if(cl->type && canonicalize(cl->type)->isArray())
+      {
+        ArrayObject* arr = new ArrayObject(((ArrayType*) canonicalize(cl->type))->subtype);
+        arr->reserve(cl->members.size());
+        for(auto mem : cl->members)
+          arr->push_back(constantValue(mem));
+        return objectValue(arr);
+      }
+      StructObject* st = new StructObject;
+      st->mems.reserve(cl->members.size());
+      for(auto mem : cl->members)
+        st->mems.push_back(constantValue(mem));
+      return objectValue(st);
+    }
+    case NodeKind::MapConstant:
+    {
+      MapConstant* mc = (MapConstant*) e;
+      MapObject* map = new MapObject;
+      for(auto& kv : mc->values)
+        map->table[constantValue(kv.first)] = constantValue(kv.second);
+      return objectValue(map);
+    }
+    case NodeKind::UnionConstant:
+    {
+      UnionConstant* uc = (UnionConstant*) e;
+      UnionObject* u = new UnionObject;
+      u->option = uc->option;
+      u->v = constantValue(uc->value);
+      return objectValue(u);
+    }
+    default:;
+  }
+  cout << "Can't represent " << e << " as a runtime value\n";
+  INTERNAL_ERROR;
+  return Value();
+}
+
+Value defaultValue(Type* t)
+{
+  //Prototype default values are built from Type::getDefaultValue once
+  //(per thread), and then shared
+  static thread_local unordered_map<Type*, Value> prototypes;
+  //getDefaultValue creates and resolves AST nodes
+  static std::mutex defaultValueLock;
+  t = canonicalize(t);
+  auto it = prototypes.find(t);
+  if(it != prototypes.end())
+    return it->second;
+  Value proto;
+  if(t->isMap())
+    proto = objectValue(new MapObject);
+  else
+  {
+    Expression* def;
+    {
+      std::lock_guard<std::mutex> lock(defaultValueLock);
+      def = t->getDefaultValue();
+    }
+    proto = constantValue(def);
+  }
+  prototypes[t] = proto;
+  return proto;
+}
+
+Value createArrayValue(const uint64_t* dims, int ndims, Type* elem)
+{
+  if(ndims == 1)
+  {
+    ArrayObject* arr = new ArrayObject(elem);
+    if(arr->isFlat())
+    {
+      //all primitive default values are zero
+      arr->bytes.resize(dims[0] * arr->elemSize);
+      return objectValue(arr);
+    }
+    Value def = defaultValue(elem);
+    arr->reserve(dims[0]);
+    for(uint64_t i = 0; i < dims[0]; i++)
+      arr->push_back(def);
+    return objectValue(arr);
+  }
+  ArrayObject* arr = new ArrayObject;
+  arr->reserve(dims[0]);
+  for(uint64_t i = 0; i < dims[0]; i++)
+    arr->push_back(createArrayValue(dims + 1, ndims - 1, elem));
+  return objectValue(arr);
+}
+
+Value makeUnion(const Value& v, Type* vType, UnionType* ut)
+{
+  bool exact;
+  int option = ut->optionFor(vType, exact);
+  INTERNAL_ASSERT(option >= 0);
+  UnionObject* u = new UnionObject;
+  u->option = option;
+  if(exact)
+    u->v = v;
+  else
+    u->v = convertValue(v, vType, ut->options[option], nullptr);
+  return objectValue(u);
+}
+
+Value narrowUnion(UnionObject* u, AsExpr* ae)
+{
+  int destOption = ae->optionMap[u->option];
+  if(destOption < 0)
+  {
+    Type* option = ((UnionType*) canonicalize(ae->base->type))->options[u->option];
+    errMsgLoc(ae, "can't evaluate 'as' because value's type " <<
+        option->getName() << " is not in union");
+  }
+  if(!canonicalize(ae->destType)->isUnion())
+    return u->v;
+  //the value's type is also an option of the destination union
+  UnionObject* narrowed = new UnionObject;
+  narrowed->option = destOption;
+  narrowed->v = u->v;
+  return objectValue(narrowed);
+}
+
+Value cloneObject(const Value& v)
+{
+  switch(v.obj->kind)
+  {
+    case ObjectKind::ARRAY:
+    {
+      ArrayObject* src = asArray(v);
+      ArrayObject* arr = new ArrayObject;
+      arr->elemTag = src->elemTag;
+      arr->elemSize = src->elemSize;
+      //the copy doesn't keep the unused space at the front
+      if(src->isFlat())
+      {
+        arr->bytes.assign(src->flatData(), src->flatData() + src->size() * src->elemSize);
+        return objectValue(arr);
+      }
+      //boxed elements stay in the same chunks, which both arrays share
+      size_t first = src->head / ArrayChunk::SIZE;
+      size_t last = (src->head + src->count + ArrayChunk::SIZE - 1) / ArrayChunk::SIZE;
+      arr->chunks.assign(src->chunks.begin() + first, src->chunks.begin() + last);
+      for(auto chunk : arr->chunks)
+        chunk->refs++;
+      arr->count = src->count;
+      arr->head = src->head % ArrayChunk::SIZE;
+      return objectValue(arr);
+    }
+    case ObjectKind::STRUCT:
+    {
+      StructObject* st = new StructObject;
+      st->mems = asStruct(v)->mems;
+      return objectValue(st);
+    }
+    case ObjectKind::UNION:
+    {
+      UnionObject* u = new UnionObject;
+      u->option = asUnion(v)->option;
+      u->v = asUnion(v)->v;
+      return objectValue(u);
+    }
+    case ObjectKind::MAP:
+    {
+      MapObject* map = new MapObject;
+      map->table = asMap(v)->table;
+      return objectValue(map);
+    }
+  }
+  INTERNAL_ERROR;
+  return Value();
+}
+
+ArrayObject::ArrayObject(Type* elem) : ArrayObject()
+{
+  elem = canonicalize(elem);
+  if(elem->isEnum())
+    return;
+  if(auto it = dynCast<IntegerType>(elem))
+  {
+    elemTag = it->isSigned ? ValueTag::INT : ValueTag::UINT;
+    elemSize = it->size;
+  }
+  else if(elem->isChar())
+  {
+    elemTag = ValueTag::UINT;
+    elemSize = 1;
+  }
+  else if(elem->isBool())
+  {
+    elemTag = ValueTag::BOOL;
+    elemSize = 1;
+  }
+  else if(auto ft = dynCast<FloatType>(elem))
+  {
+    elemTag = ft->size == 4 ? ValueTag::FLOAT : ValueTag::DOUBLE;
+    elemSize = ft->size;
+  }
+}
+
+ArrayChunk* ArrayChunk::create(uint32_t capacity)
+{
+  ArrayChunk* chunk = (ArrayChunk*) poolAlloc(sizeof(ArrayChunk) + capacity * sizeof(Value));
+  chunk->refs = 1;
+  chunk->capacity = capacity;
+  for(uint32_t i = 0; i < capacity; i++)
+    new(chunk->vals() + i) Value;
+  return chunk;
+}
+
+void ArrayChunk::destroy(ArrayChunk* chunk)
+{
+  for(uint32_t i = 0; i < chunk->capacity; i++)
+    chunk->vals()[i].~Value();
+  poolFree(chunk, sizeof(ArrayChunk) + chunk->capacity * sizeof(Value));
+}
+
+ArrayObject::~ArrayObject()
+{
+  for(auto chunk : chunks)
+  {
+    if(chunk && --chunk->refs == 0)
+      ArrayChunk::destroy(chunk);
+  }
+}
+
+void ArrayObject::reserve(size_t n)
+{
+  if(isFlat())
+    bytes.reserve((head + n) * elemSize);
+  else
+    chunks.reserve((head + n + ArrayChunk::SIZE - 1) / ArrayChunk::SIZE);
+}
+
+ArrayChunk* ArrayObject::replaceChunk(size_t c, size_t i)
+{
+  ArrayChunk* old = chunks[c];
+  uint32_t capacity = ArrayChunk::SIZE;
+  if(chunks.size() == 1)
+  {
+    //grow geometrically
+    capacity = old ? old->capacity : 1;
+    while(capacity <= i)
+      capacity *= 2;
+  }
+  ArrayChunk* chunk = ArrayChunk::create(capacity);
+  if(old)
+  {
+    //the old chunk's elements are moved if nothing else shares them
+    if(old->refs == 1)
+      std::move(old->vals(), old->vals() + old->capacity, chunk->vals());
+    else
+      std::copy(old->vals(), old->vals() + old->capacity, chunk->vals());
+    if(--old->refs == 0)
+      ArrayChunk::destroy(old);
+  }
+  chunks[c] = chunk;
+  return chunk;
+}
+
+void ArrayObject::reserveFront(size_t n)
+{
+  if(head >= n)
+    return;
+  //grow geometrically, so a sequence of prepends takes linear time
+  n = std::max(n - head, std::max<size_t>(size(), 4));
+  if(isFlat())
+    bytes.insert(bytes.begin(), n * elemSize, 0);
+  else
+  {
+    //(whole chunks, which are only allocated once they're used)
+    size_t newChunks = (n + ArrayChunk::SIZE - 1) / ArrayChunk::SIZE;
+    chunks.insert(chunks.begin(), newChunks, nullptr);
+    n = newChunks * ArrayChunk::SIZE;
+  }
+  head += n;
+}
+
+void ArrayObject::push_back(const Value& v)
+{
+  if(!isFlat())
+  {
+    size_t pos = head + count;
+    if(pos / ArrayChunk::SIZE == chunks.size())
+      chunks.push_back(nullptr);
+    count++;
+    set(count - 1, v);
+    return;
+  }
+  bytes.resize(bytes.size() + elemSize);
+  set(size() - 1, v);
+}
+
+void ArrayObject::push_front(const Value& v)
+{
+  reserveFront(1);
+  head--;
+  if(!isFlat())
+    count++;
+  set(0, v);
+}
+
+void ArrayObject::append(const ArrayObject* other)
+{
+  if(isFlat() && other->isFlat() && elemTag == other->elemTag && elemSize == other->elemSize)
+  {
+    bytes.insert(bytes.end(), other->flatData(), other->flatData() + other->size() * elemSize);
+    return;
+  }
+  //boxed, or layouts differ (only possible if one side was
+  //built without knowing its element type): go through Values
+  size_t n = other->size();
+  reserve(size() + n);
+  for(size_t i = 0; i < n; i++)
+    push_back(other->get(i));
+}
+
+void ArrayObject::prepend(const ArrayObject* other)
+{
+  size_t n = other->size();
+  reserveFront(n);
+  head -= n;
+  if(!isFlat())
+    count += n;
+  if(isFlat() && elemTag == other->elemTag && elemSize == other->elemSize)
+  {
+    memcpy(&bytes[head * elemSize], other->flatData(), n * elemSize);
+    return;
+  }
+  for(size_t i = 0; i < n; i++)
+    set(i, other->get(i));
+}
+
+vector<Value> ArrayObject::values() const
+{
+  vector<Value> vals;
+  size_t n = size();
+  vals.reserve(n);
+  for(size_t i = 0; i < n; i++)
+    vals.push_back(get(i));
+  return vals;
+}
+
+//Block sizes are multiples of poolGranule, up to poolMaxSize.
+//Anything bigger goes directly to malloc.
+static const size_t poolGranule = 16;
+static const size_t poolMaxSize = 128;
+static const size_t poolChunkSize = 64 * 1024;
+
+//(zero-initialized, like all thread_locals, so that the pools
+//need no construction on each thread)
+struct PoolClass
+{
+  //freed blocks (each holds the pointer to the next)
+  void* freeList;
+  //unused part of the most recent chunk
+  char* chunkPos;
+  char* chunkEnd;
+};
+
+static thread_local PoolClass poolClasses[poolMaxSize / poolGranule];
+
+static inline size_t poolClassIndex(size_t size)
+{
+  return (size + poolGranule - 1) / poolGranule - 1;
+}
+
+void* poolAlloc(size_t size)
+{
+  if(size > poolMaxSize)
+    return malloc(size);
+  size_t index = poolClassIndex(size);
+  PoolClass& pc = poolClasses[index];
+  if(pc.freeList)
+  {
+    void* block = pc.freeList;
+    pc.freeList = *((void**) block);
+    return block;
+  }
+  size_t blockSize = (index + 1) * poolGranule;
+  if(pc.chunkPos + blockSize > pc.chunkEnd)
+  {
+    //chunks are never returned to the system, but all
+    //blocks in them are recycled through the free list
+    pc.chunkPos = (char*) malloc(poolChunkSize);
+    if(!pc.chunkPos)
+      errMsg("Out of memory");
+    pc.chunkEnd = pc.chunkPos + poolChunkSize;
+  }
+  void* block = pc.chunkPos;
+  pc.chunkPos += blockSize;
+  return block;
+}
+
+void poolFree(void* p, size_t size)
+{
+  if(size > poolMaxSize)
+  {
+    free(p);
+    return;
+  }
+  PoolClass& pc = poolClasses[poolClassIndex(size)];
+  *((void**) p) = pc.freeList;
+  pc.freeList = p;
+}
+
+Value& ValueMap::operator[](const Value& key)
+{
+  //keep the table at most 7/8 full (probing only reads hashes
+  //until the hash matches, so longer probes are still cheap)
+  if((count + 1) * 8 > hashes.size() * 7)
+    grow();
+  uint32_t h = keyHash(key);
+  size_t mask = hashes.size() - 1;
+  size_t i = h & mask;
+  for(; hashes[i]; i = (i + 1) & mask)
+  {
+    if(hashes[i] == h && keysEqual(entries[i].key, key))
+      return entries[i].value;
+  }
+  hashes[i] = h;
+  entries[i].key = key;
+  count++;
+  return entries[i].value;
+}
+
+void ValueMap::erase(const Value& key)
+{
+  if(!count)
+    return;
+  uint32_t h = keyHash(key);
+  size_t mask = hashes.size() - 1;
+  size_t hole = h & mask;
+  while(hashes[hole] != h || !keysEqual(entries[hole].key, key))
+  {
+    if(!hashes[hole])
+      return;
+    hole = (hole + 1) & mask;
+  }
+  //Shift back the entries after the hole that probed past it,
+  //so that every entry stays reachable from its home slot
+  for(size_t i = (hole + 1) & mask; hashes[i]; i = (i + 1) & mask)
+  {
+    size_t home = hashes[i] & mask;
+    //can the entry at i move to the hole? (is its home not in (hole, i]?)
+    bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+    if(stays)
+      continue;
+    hashes[hole] = hashes[i];
+    entries[hole] = std::move(entries[i]);
+    hole = i;
+  }
+  hashes[hole] = 0;
+  entries[hole].key = Value();
+  entries[hole].value = Value();
+  count--;
+}
+
+void ValueMap::grow()
+{
+  size_t capacity = hashes.size() ? hashes.size() * 2 : 8;
+  vector<uint32_t> oldHashes(capacity, 0);
+  vector<Entry> oldEntries(capacity);
+  oldHashes.swap(hashes);
+  oldEntries.swap(entries);
+  size_t mask = capacity - 1;
+  for(size_t i = 0; i < oldHashes.size(); i++)
+  {
+    if(!oldHashes[i])
+      continue;
+    size_t j = oldHashes[i] & mask;
+    while(hashes[j])
+      j = (j + 1) & mask;
+    hashes[j] = oldHashes[i];
+    entries[j] = std::move(oldEntries[i]);
+  }
+}
+
+void destroyObject(Object* obj)
+{
+  switch(obj->kind)
+  {
+    case ObjectKind::ARRAY:
+      delete (ArrayObject*) obj;
+      break;
+    case ObjectKind::STRUCT:
+      delete (StructObject*) obj;
+      break;
+    case ObjectKind::UNION:
+      delete (UnionObject*) obj;
+      break;
+    case ObjectKind::MAP:
+      delete (MapObject*) obj;
+      break;
+  }
+}
+
+static bool arraysEqual(const ArrayObject* l, const ArrayObject* r)
+{
+  size_t n = l->size();
+  if(n != r->size())
+    return false;
+  bool sameLayout = l->elemTag == r->elemTag && l->elemSize == r->elemSize;
+  if(sameLayout && l->isFlat() && l->elemTag != ValueTag::FLOAT && l->elemTag != ValueTag::DOUBLE)
+  {
+    //integers/bools are equal exactly when their bytes are
+    return n == 0 || !memcmp(l->flatData(), r->flatData(), n * l->elemSize);
+  }
+  for(size_t i = 0; i < n; i++)
+  {
+    if(!valuesEqual(l->get(i), r->get(i)))
+      return false;
+  }
+  return true;
+}
+
+static bool elementsEqual(const vector<Value>& l, const vector<Value>& r)
+{
+  if(l.size() != r.size())
+    return false;
+  for(size_t i = 0; i < l.size(); i++)
+  {
+    if(!valuesEqual(l[i], r[i]))
+      return false;
+  }
+  return true;
+}
+
+bool valuesEqual(const Value& lhs, const Value& rhs)
+{
+  if(lhs.tag != rhs.tag)
+    return false;
+  switch(lhs.tag)
+  {
+    case ValueTag::NONE:
+      return true;
+    case ValueTag::INT:
+    case ValueTag::UINT:
+      return lhs.u == rhs.u;
+    case ValueTag::BOOL:
+      return lhs.b == rhs.b;
+    case ValueTag::FLOAT:
+      return lhs.f == rhs.f;
+    case ValueTag::DOUBLE:
+      return lhs.d == rhs.d;
+    case ValueTag::ENUM:
+      return lhs.enumConst == rhs.enumConst;
+    case ValueTag::SIMPLE:
+      return lhs.simple == rhs.simple;
+    case ValueTag::SUBR:
+      return lhs.subr == rhs.subr;
+    case ValueTag::REF:
+      return lhs.ref == rhs.ref;
+    case ValueTag::OBJECT:
+    {
+      if(lhs.obj == rhs.obj)
+        return true;
+      if(lhs.obj->kind != rhs.obj->kind)
+        return false;
+      switch(lhs.obj->kind)
+      {
+        case ObjectKind::ARRAY:
+          return arraysEqual(asArray(lhs), asArray(rhs));
+        case ObjectKind::STRUCT:
+          return elementsEqual(asStruct(lhs)->mems, asStruct(rhs)->mems);
+        case ObjectKind::UNION:
+          return asUnion(lhs)->option == asUnion(rhs)->option &&
+            valuesEqual(asUnion(lhs)->v, asUnion(rhs)->v);
+        case ObjectKind::MAP:
+        {
+          auto& l = asMap(lhs)->table;
+          auto& r = asMap(rhs)->table;
+          if(l.size() != r.size())
+            return false;
+          for(auto& kv : l)
+          {
+            Value* rv = r.find(kv.key);
+            if(!rv || !valuesEqual(kv.value, *rv))
+              return false;
+          }
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+static bool arraysLess(const ArrayObject* l, const ArrayObject* r)
+{
+  //lexicographic compare
+  size_t n = std::min(l->size(), r->size());
+  for(size_t i = 0; i < n; i++)
+  {
+    Value le = l->get(i);
+    Value re = r->get(i);
+    if(valueLess(le, re))
+      return true;
+    else if(!valuesEqual(le, re))
+      return false;
+  }
+  return l->size() < r->size();
+}
+
+static bool elementsLess(const vector<Value>& l, const vector<Value>& r)
+{
+  //lexicographic compare
+  size_t n = std::min(l.size(), r.size());
+  for(size_t i = 0; i < n; i++)
+  {
+    if(valueLess(l[i], r[i]))
+      return true;
+    else if(!valuesEqual(l[i], r[i]))
+      return false;
+  }
+  return l.size() < r.size();
+}
+
+bool valueLess(const Value& lhs, const Value& rhs)
+{
+  switch(lhs.tag)
+  {
+    case ValueTag::INT:
+      return lhs.i < rhs.i;
+    case ValueTag::UINT:
+      return lhs.u < rhs.u;
+    case ValueTag::BOOL:
+      return !lhs.b && rhs.b;
+    case ValueTag::FLOAT:
+      return lhs.f < rhs.f;
+    case ValueTag::DOUBLE:
+      return lhs.d < rhs.d;
+    case ValueTag::ENUM:
+      if(lhs.enumConst->isSigned && rhs.enumConst->isSigned)
+        return (int64_t) lhs.enumConst->value < (int64_t) rhs.enumConst->value;
+      return lhs.enumConst->value < rhs.enumConst->value;
+    case ValueTag::SIMPLE:
+      return false;
+    case ValueTag::OBJECT:
+      switch(lhs.obj->kind)
+      {
+        case ObjectKind::ARRAY:
+          return arraysLess(asArray(lhs), asArray(rhs));
+        case ObjectKind::STRUCT:
+          return elementsLess(asStruct(lhs)->mems, asStruct(rhs)->mems);
+        case ObjectKind::UNION:
+        {
+          UnionObject* l = asUnion(lhs);
+          UnionObject* r = asUnion(rhs);
+          if(l->option != r->option)
+            return l->option < r->option;
+          return valueLess(l->v, r->v);
+        }
+        default:;
+      }
+    default:;
+  }
+  //maps, subroutines and refs are not ordered
+  INTERNAL_ERROR;
+  return false;
+}
+
+size_t hashValue(const Value& v)
+{
+  switch(v.tag)
+  {
+    case ValueTag::INT:
+    case ValueTag::UINT:
+      return fnv1a(v.u);
+    case ValueTag::BOOL:
+      return v.b ? 0x123456789ABCDEF0ULL : ~0x123456789ABCDEF0ULL;
+    case ValueTag::FLOAT:
+      return fnv1a(v.f);
+    case ValueTag::DOUBLE:
+      return fnv1a(v.d);
+    case ValueTag::ENUM:
+      return fnv1a(v.enumConst);
+    case ValueTag::SIMPLE:
+      return fnv1a(v.simple);
+    case ValueTag::SUBR:
+      return fnv1a(v.subr);
+    case ValueTag::OBJECT:
+    {
+      FNV1A f;
+      switch(v.obj->kind)
+      {
+        case ObjectKind::ARRAY:
+        {
+          ArrayObject* arr = asArray(v);
+          for(size_t i = 0; i < arr->size(); i++)
+            f.pump(31 * hashValue(arr->get(i)));
+          return f.get();
+        }
+        case ObjectKind::STRUCT:
+          for(auto& mem : asStruct(v)->mems)
+            f.pump(31 * hashValue(mem));
+          return f.get();
+        case ObjectKind::UNION:
+          f.pump(asUnion(v)->option);
+          f.pump(hashValue(asUnion(v)->v));
+          return f.get();
+        case ObjectKind::MAP:
+        {
+          //the order of key-value pairs is not deterministic,
+          //so use XOR to combine hashes of each pair
+          size_t h = 0;
+          for(auto& kv : asMap(v)->table)
+          {
+            FNV1A pair;
+            pair.pump(hashValue(kv.key));
+            pair.pump(hashValue(kv.value));
+            h ^= pair.get();
+          }
+          return h;
+        }
+      }
+    }
+    default:;
+  }
+  return 0;
+}
+
+/**************/
+/* Conversion */
+/**************/
+
+bool intFits(const Value& v, int size, bool isSigned)
+{
+  if(isSigned)
+  {
+    switch(size)
+    {
+      case 1:
+        return numeric_limits<int8_t>::min() <= v.i &&
+          v.i <= numeric_limits<int8_t>::max();
+      case 2:
+        return numeric_limits<int16_t>::min() <= v.i &&
+          v.i <= numeric_limits<int16_t>::max();
+      case 4:
+        return numeric_limits<int32_t>::min() <= v.i &&
+          v.i <= numeric_limits<int32_t>::max();
+      default:
+        return true;
+    }
+  }
+  switch(size)
+  {
+    case 1:
+      return v.u <= numeric_limits<uint8_t>::max();
+    case 2:
+      return v.u <= numeric_limits<uint16_t>::max();
+    case 4:
+      return v.u <= numeric_limits<uint32_t>::max();
+    default:
+      return true;
+  }
+}
+
+#define errMsgValueLoc(loc, msg) \
+{ \
+  if(loc) \
+    errMsgLoc(loc, msg) \
+  else \
+    errMsg(msg) \
+}
+
+//Convert an integer to another integer, char, enum or float type
+//(same checks as IntConstant::convert)
+static Value convertInt(const Value& v, bool srcSigned, Type* dst, Node* loc)
+{
+  if(auto dstInt = dynCast<IntegerType>(dst))
+  {
+    Value result;
+    if(srcSigned == dstInt->isSigned)
+      result = v;
+    else if(srcSigned)
+    {
+      if(v.i < 0)
+        errMsgValueLoc(loc, "cannot convert negative value to unsigned");
+      result = uintValue(v.i);
+    }
+    else
+    {
+      if(v.u > (uint64_t) numeric_limits<int64_t>::max())
+        errMsgValueLoc(loc, "unsigned value too big to convert to any signed type");
+      result = intValue(v.u);
+    }
+    result.tag = dstInt->isSigned ? ValueTag::INT : ValueTag::UINT;
+    if(!intFits(result, dstInt->size, dstInt->isSigned))
+    {
+      if(srcSigned)
+        errMsgValueLoc(loc, "value " << v.i << " does not fit in " << dstInt->getName())
+      else
+        errMsgValueLoc(loc, "value " << v.u << " does not fit in " << dstInt->getName())
+    }
+    return result;
+  }
+  else if(dst->isChar())
+  {
+    //First, convert to ubyte
+    return convertInt(v, srcSigned, primitives[Prim::UBYTE], loc);
+  }
+  else if(auto enumType = dynCast<EnumType>(dst))
+  {
+    //when converting int to enum,
+    //make sure value is actually in the enum
+    for(auto ec : enumType->values)
+    {
+      if((srcSigned && v.i == (int64_t) ec->value) ||
+          (!srcSigned && v.u == ec->value))
+        return enumValue(ec);
+    }
+    if(srcSigned)
+      errMsgValueLoc(loc, "value " << v.i << " is not in enum " << enumType->name)
+    else
+      errMsgValueLoc(loc, "value " << v.u << " is not in enum " << enumType->name)
+  }
+  else if(auto floatType = dynCast<FloatType>(dst))
+  {
+    //integer -> float/double conversion always succeeds
+    if(floatType->size == 4)
+      return floatValue(srcSigned ? (float) v.i : (float) v.u);
+    return doubleValue(srcSigned ? (double) v.i : (double) v.u);
+  }
+  INTERNAL_ERROR;
+  return Value();
+}
+
+//Convert a float or double (promoted to double) to another numeric type
+//(same checks as FloatConstant::convert)
+static Value convertFloat(double val, Type* dst, Node* loc)
+{
+  if(auto intType = dynCast<IntegerType>(dst))
+  {
+    //make sure val fits in a 64-bit integer,
+    //then make a 64-bit version of value and narrow it to desired type
+    if(intType->isSigned)
+    {
+      if(val < numeric_limits<int64_t>::min() ||
+          val > numeric_limits<int64_t>::max())
+      {
+        errMsgValueLoc(loc, "floating-point value " << val <<
+            " can't be represented in any signed integer");
+      }
+      return convertInt(intValue((int64_t) val), true, dst, loc);
+    }
+    if(val < 0 || val > numeric_limits<uint64_t>::max())
+    {
+      errMsgValueLoc(loc, "floating-point value " << val <<
+          " can't be represented in any unsigned integer");
+    }
+    return convertInt(uintValue((uint64_t) val), false, dst, loc);
+  }
+  else if(dst->isChar())
+  {
+    if(val < 0 || val >= 256.0)
+    {
+      errMsgValueLoc(loc, "floating-point value " << val <<
+          " can't be represented by char");
+    }
+    return uintValue((uint64_t) val);
+  }
+  else if(auto floatType = dynCast<FloatType>(dst))
+  {
+    if(floatType->size == 4)
+      return floatValue((float) val);
+    return doubleValue(val);
+  }
+  else if(dst->isEnum())
+  {
+    //temporarily make an integer value, then convert that to enum
+    if(val < 0)
+      return convertInt(convertFloat(val, getLongType(), loc), true, dst, loc);
+    return convertInt(convertFloat(val, getULongType(), loc), false, dst, loc);
+  }
+  INTERNAL_ERROR;
+  return Value();
+}
+
+//Get the types of the elements of compound (array, tuple or struct) type t
+static Type* compoundMemberType(Type* t, size_t i)
+{
+  if(auto at = dynCast<ArrayType>(t))
+    return at->subtype;
+  else if(auto tt = dynCast<TupleType>(t))
+    return tt->members[i];
+  else if(auto st = dynCast<StructType>(t))
+    return st->members[i]->type;
+  INTERNAL_ERROR;
+  return nullptr;
+}
+
+static vector<Value> compoundMembers(const Value& v)
+{
+  if(v.obj->kind == ObjectKind::ARRAY)
+    return asArray(v)->values();
+  INTERNAL_ASSERT(v.obj->kind == ObjectKind::STRUCT);
+  return asStruct(v)->mems;
+}
+
+Value convertValue(const Value& value, Type* src, Type* dst, Node* loc)
+{
+  src = canonicalize(src);
+  dst = canonicalize(dst);
+  if(src == dst || typesSame(src, dst))
+    return value;
+  Value v = value;
+  //For converting unions, use the underlying value
+  if(auto srcUnion = dynCast<UnionType>(src))
+  {
+    UnionObject* u = asUnion(v);
+    v = u->v;
+    src = canonicalize(srcUnion->options[u->option]);
+    //is the value's option exactly dst?
+    bool exact;
+    if(srcUnion->optionFor(dst, exact) == u->option && exact)
+      return v;
+  }
+  bool srcCompound = src->isArray() || src->isTuple() || src->isStruct();
+  auto structDst = dynCast<StructType>(dst);
+  if(auto unionDst = dynCast<UnionType>(dst))
+  {
+    return makeUnion(v, src, unionDst);
+  }
+  else if(structDst && structDst->members.size() == 1 && !srcCompound)
+  {
+    //Single-member struct is equivalent to the member
+    StructObject* st = new StructObject;
+    st->mems.push_back(convertValue(v, src, structDst->members[0]->type, loc));
+    return objectValue(st);
+  }
+  else if(src->isInteger())
+  {
+    //do the conversion which tests for overflow and enum membership
+    if(src->isEnum())
+    {
+      EnumConstant* ec = v.enumConst;
+      if(ec->isSigned)
+        return convertInt(intValue(ec->value), true, dst, loc);
+      return convertInt(uintValue(ec->value), false, dst, loc);
+    }
+    return convertInt(v, signedInt(src), dst, loc);
+  }
+  else if(auto floatSrc = dynCast<FloatType>(src))
+  {
+    return convertFloat(floatSrc->size == 4 ? v.f : v.d, dst, loc);
+  }
+  else if(srcCompound)
+  {
+    //array/struct/tuple values can be converted implicitly
+    //to each other but individual members may need conversion
+    vector<Value> mems = compoundMembers(v);
+    if(auto at = dynCast<ArrayType>(dst))
+    {
+      ArrayObject* arr = new ArrayObject(at->subtype);
+      arr->reserve(mems.size());
+      for(size_t i = 0; i < mems.size(); i++)
+        arr->push_back(convertValue(mems[i], compoundMemberType(src, i), at->subtype, loc));
+      return objectValue(arr);
+    }
+    else if(dst->isStruct() || dst->isTuple())
+    {
+      StructObject* st = new StructObject;
+      st->mems.reserve(mems.size());
+      for(size_t i = 0; i < mems.size(); i++)
+        st->mems.push_back(convertValue(mems[i], compoundMemberType(src, i), compoundMemberType(dst, i), loc));
+      return objectValue(st);
+    }
+    else if(auto mt = dynCast<MapType>(dst))
+    {
+      MapObject* map = new MapObject;
+      for(size_t i = 0; i < mems.size(); i++)
+      {
+        Type* memType = canonicalize(compoundMemberType(src, i));
+        if(src->isArray() && !memType->isTuple())
+        {
+          //array converts to map from index to element
+          Value key = convertValue(intValue(i), getLongType(), mt->key, loc);
+          map->table[key] = convertValue(mems[i], memType, mt->value, loc);
+        }
+        else
+        {
+          //each member is a key-value pair
+          vector<Value> kv = compoundMembers(mems[i]);
+          Value key = convertValue(kv[0], compoundMemberType(memType, 0), mt->key, loc);
+          map->table[key] = convertValue(kv[1], compoundMemberType(memType, 1), mt->value, loc);
+        }
+      }
+      return objectValue(map);
+    }
+  }
+  else if(auto srcMap = dynCast<MapType>(src))
+  {
+    if(auto mt = dynCast<MapType>(dst))
+    {
+      MapObject* map = new MapObject;
+      for(auto& kv : asMap(v)->table)
+      {
+        map->table[convertValue(kv.key, srcMap->key, mt->key, loc)] =
+          convertValue(kv.value, srcMap->value, mt->value, loc);
+      }
+      return objectValue(map);
+    }
+  }
+  cout << "Failed to convert value of type \"" << src->getName() << "\" to type \"" << dst->getName() << "\"\n";
+  INTERNAL_ERROR;
+  return Value();
+}
+
+/**************/
+/* Arithmetic */
+/**************/
+
+Value binaryOp(int op, const Value& lhs, const Value& rhs, Type* t, Type* rhsType, Node* loc)
+{
+  t = canonicalize(t);
+  if(auto ft = dynCast<FloatType>(t))
+  {
+    bool dp = ft->size == 8;
+    switch(op)
+    {
+      case PLUS:
+        return dp ? doubleValue(lhs.d + rhs.d) : floatValue(lhs.f + rhs.f);
+      case SUB:
+        return dp ? doubleValue(lhs.d - rhs.d) : floatValue(lhs.f - rhs.f);
+      case MUL:
+        return dp ? doubleValue(lhs.d * rhs.d) : floatValue(lhs.f * rhs.f);
+      case DIV:
+        //div/mod need extra logic to check for div-by-0
+        if((dp && rhs.d == 0) || (!dp && rhs.f == 0))
+          errMsgValueLoc(loc, "divide by 0");
+        return dp ? doubleValue(lhs.d / rhs.d) : floatValue(lhs.f / rhs.f);
+      default:
+        INTERNAL_ERROR;
+    }
+  }
+  //integers: char behaves as ubyte
+  int size = 1;
+  bool isSigned = false;
+  if(auto it = dynCast<IntegerType>(t))
+  {
+    size = it->size;
+    isSigned = it->isSigned;
+  }
+  Value result;
+  result.tag = isSigned ? ValueTag::INT : ValueTag::UINT;
+  //signed arithmetic is done in unsigned (wrapping) so that 64-bit
+  //overflow is well-defined; narrower overflow is caught below
+  switch(op)
+  {
+    case PLUS:
+      result.u = lhs.u + rhs.u;
+      break;
+    case SUB:
+      result.u = lhs.u - rhs.u;
+      break;
+    case MUL:
+      result.u = lhs.u * rhs.u;
+      break;
+    case DIV:
+    case MOD:
+      if(rhs.u == 0)
+        errMsgValueLoc(loc, (op == DIV ? "div" : "mod") << " by 0");
+      if(isSigned)
+        result.i = op == DIV ? lhs.i / rhs.i : lhs.i % rhs.i;
+      else
+        result.u = op == DIV ? lhs.u / rhs.u : lhs.u % rhs.u;
+      break;
+    case BOR:
+      result.u = lhs.u | rhs.u;
+      break;
+    case BXOR:
+      result.u = lhs.u ^ rhs.u;
+      break;
+    case BAND:
+      result.u = lhs.u & rhs.u;
+      break;
+    case SHL:
+    case SHR:
+    {
+      int64_t shiftBits = rhs.i;
+      if(signedInt(canonicalize(rhsType)) && rhs.i < 0)
+        errMsg("Shifting by negative number of bits is illegal.");
+      if(op == SHL)
+        result.u = lhs.u << shiftBits;
+      else if(isSigned)
+        result.i = lhs.i >> shiftBits;
+      else
+        result.u = lhs.u >> shiftBits;
+      break;
+    }
+    default:
+      INTERNAL_ERROR;
+  }
+  if(!intFits(result, size, isSigned))
+    errMsgValueLoc(loc, "operation overflows " << t->getName());
+  return result;
+}
+
+Value unaryOp(int op, const Value& operand)
+{
+  Value result = operand;
+  switch(op)
+  {
+    case LNOT:
+      result.b = !operand.b;
+      break;
+    case BNOT:
+      result.u = ~operand.u;
+      break;
+    case SUB:
+      if(operand.tag == ValueTag::FLOAT)
+        result.f = -operand.f;
+      else if(operand.tag == ValueTag::DOUBLE)
+        result.d = -operand.d;
+      else
+        result.u = -operand.u;
+      break;
+    default:
+      INTERNAL_ERROR;
+  }
+  return result;
+}
+
+/************/
+/* Printing */
+/************/
+
+static void printMembers(OutputBuffer& out, const vector<Value>& mems, Type* t)
+{
+  out.put('[');
+  for(size_t i = 0; i < mems.size(); i++)
+  {
+    printValue(out, mems[i], compoundMemberType(t, i));
+    if(i != mems.size() - 1)
+      out.write(", ");
+  }
+  out.put(']');
+}
+
+void printValue(OutputBuffer& out, const Value& v, Type* t)
+{
+  t = canonicalize(t);
+  switch(v.tag)
+  {
+    case ValueTag::INT:
+      out.writeInt(v.i);
+      break;
+    case ValueTag::UINT:
+      out.writeUInt(v.u);
+      break;
+    case ValueTag::BOOL:
+      out.write(v.b ? "true" : "false");
+      break;
+    case ValueTag::FLOAT:
+      out.writeDouble(v.f);
+      break;
+    case ValueTag::DOUBLE:
+      out.writeDouble(v.d);
+      break;
+    case ValueTag::ENUM:
+      out.write(v.enumConst->name);
+      break;
+    case ValueTag::SIMPLE:
+      out.write(v.simple->name);
+      break;
+    case ValueTag::SUBR:
+      out.write(v.subr->name());
+      break;
+    case ValueTag::OBJECT:
+      switch(v.obj->kind)
+      {
+        case ObjectKind::ARRAY:
+        {
+          ArrayObject* arr = asArray(v);
+          if(isStringType(t))
+          {
+            //it's a string, so just print it as a string literal
+            out.write(generateCharDotfile('"'));
+            for(size_t i = 0; i < arr->size(); i++)
+              out.write(generateCharDotfile((char) arr->get(i).u));
+            out.write(generateCharDotfile('"'));
+          }
+          else
+            printMembers(out, arr->values(), t);
+          break;
+        }
+        case ObjectKind::STRUCT:
+          printMembers(out, asStruct(v)->mems, t);
+          break;
+        case ObjectKind::UNION:
+        {
+          UnionObject* u = asUnion(v);
+          Type* option = ((UnionType*) t)->options[u->option];
+          if(!option->isSimple())
+          {
+            out.write(option->getName());
+            out.write(": ");
+          }
+          printValue(out, u->v, option);
+          break;
+        }
+        case ObjectKind::MAP:
+        {
+          MapType* mt = (MapType*) t;
+          auto& table = asMap(v)->table;
+          out.put('[');
+          for(auto it = table.begin(); it != table.end(); ++it)
+          {
+            if(it != table.begin())
+              out.write(", ");
+            out.put('{');
+            printValue(out, it->key, mt->key);
+            out.write(", ");
+            printValue(out, it->value, mt->value);
+            out.put('}');
+          }
+          out.put(']');
+          break;
+        }
+      }
+      break;
+    default:
+      INTERNAL_ERROR;
+  }
+}
+
+void printTopLevel(OutputBuffer& out, const Value& v, Type* t)
+{
+  t = canonicalize(t);
+  if(t->isChar())
+  {
+    out.put((char) v.u);
+  }
+  else if(isStringType(t))
+  {
+    ArrayObject* arr = asArray(v);
+    if(arr->isFlat() && arr->elemSize == 1)
+      out.write((const char*) arr->flatData(), arr->size());
+    else
+    {
+      for(size_t i = 0; i < arr->size(); i++)
+        out.put((char) arr->get(i).u);
+    }
+  }
+  else
+  {
+    printValue(out, v, t);
+  }
+}
+
@@ -0,0 +1,655 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include "Common.hpp"
+#include <cstring>
+#include "TypeSystem.hpp"
+#include "Expression.hpp"
+#include "OutputBuffer.hpp"
+
+/*****************************************************************************/
+// Value: runtime representation of Onyx data.
+//
+// Primitives (integers, chars, floats, bools and enum values) are stored
+// directly inside the Value. Compound data (arrays, structs/tuples, unions
+// and maps) is stored in a heap Object that the Value points to.
+//
+// Values don't carry their Onyx type: all code that needs it (printing,
+// conversion, arithmetic) is given the static type from the AST.
+//
+// Objects are reference counted and copy-on-write: copying a Value shares
+// the object, so code that modifies an object in place must first call
+// makeUnique on the Value that holds it.
+/*****************************************************************************/
+
+struct SubrBase;
+struct Object;
+
+enum struct ValueTag : uint8_t
+{
+  NONE,     //uninitialized
+  INT,      //signed integer (i)
+  UINT,     //unsigned integer or char (u)
+  BOOL,     //b
+  FLOAT,    //f
+  DOUBLE,   //d
+  ENUM,     //enumConst
+  SIMPLE,   //simple (an instance of void/error)
+  SUBR,     //subr (a subroutine used as a value)
+  OBJECT,   //obj
+  REF       //ref: address of another value (VM lvalues and "this" only)
+};
+
+struct Value
+{
+  Value() : u(0), tag(ValueTag::NONE) {}
+  Value(const Value& other) : u(other.u), tag(other.tag)
+  {
+    retain();
+  }
+  Value(Value&& other) : u(other.u), tag(other.tag)
+  {
+    other.tag = ValueTag::NONE;
+  }
+  ~Value()
+  {
+    release();
+  }
+  Value& operator=(const Value& other)
+  {
+    other.retain();
+    release();
+    u = other.u;
+    tag = other.tag;
+    return *this;
+  }
+  Value& operator=(Value&& other)
+  {
+    if(this != &other)
+    {
+      release();
+      u = other.u;
+      tag = other.tag;
+      other.tag = ValueTag::NONE;
+    }
+    return *this;
+  }
+  union
+  {
+    int64_t i;
+    uint64_t u;
+    bool b;
+    float f;
+    double d;
+    EnumConstant* enumConst;
+    SimpleType* simple;
+    SubrBase* subr;
+    Object* obj;
+    Value* ref;
+  };
+  ValueTag tag;
+  bool isObject() const
+  {
+    return tag == ValueTag::OBJECT;
+  }
+  inline void retain() const;
+  inline void release();
+};
+
+static_assert(sizeof(Value) <= 16, "Value must fit in 16 bytes");
+
+inline Value intValue(int64_t i)
+{
+  Value v;
+  v.i = i;
+  v.tag = ValueTag::INT;
+  return v;
+}
+
+inline Value uintValue(uint64_t u)
+{
+  Value v;
+  v.u = u;
+  v.tag = ValueTag::UINT;
+  return v;
+}
+
+inline Value boolValue(bool b)
+{
+  Value v;
+  v.b = b;
+  v.tag = ValueTag::BOOL;
+  return v;
+}
+
+inline Value floatValue(float f)
+{
+  Value v;
+  v.f = f;
+  v.tag = ValueTag::FLOAT;
+  return v;
+}
+
+inline Value doubleValue(double d)
+{
+  Value v;
+  v.d = d;
+  v.tag = ValueTag::DOUBLE;
+  return v;
+}
+
+inline Value enumValue(EnumConstant* ec)
+{
+  Value v;
+  v.enumConst = ec;
+  v.tag = ValueTag::ENUM;
+  return v;
+}
+
+//Integer key of an integer, char or enum value (see Switch::findCase)
+inline int64_t caseKey(const Value& v)
+{
+  if(v.tag == ValueTag::ENUM)
+    return v.enumConst->value;
+  return v.i;
+}
+
+inline Value refValue(Value* ref)
+{
+  Value v;
+  v.ref = ref;
+  v.tag = ValueTag::REF;
+  return v;
+}
+
+struct ValueHash
+{
+  size_t operator()(const Value& v) const;
+};
+
+struct ValueEqual
+{
+  bool operator()(const Value& lhs, const Value& rhs) const;
+};
+
+/*****************/
+/* Heap objects  */
+/*****************/
+
+enum struct ObjectKind : uint8_t
+{
+  ARRAY,
+  STRUCT,   //structs and tuples
+  UNION,
+  MAP
+};
+
+//Objects are allocated from a pool: fixed-size blocks are carved out of
+//large chunks and recycled through per-size free lists, so the many
+//short-lived objects a program creates don't each go through malloc,
+//and memory freed by one statement or call is reused by the next.
+//Each thread has its own pool, since reference counts aren't atomic
+//anyway: objects never move between threads (see TestRunner.hpp).
+void* poolAlloc(size_t size);
+void poolFree(void* p, size_t size);
+
+struct Object
+{
+  Object(ObjectKind k) : kind(k), refs(0) {}
+  static void* operator new(size_t size)
+  {
+    return poolAlloc(size);
+  }
+  static void operator delete(void* p, size_t size)
+  {
+    poolFree(p, size);
+  }
+  ObjectKind kind;
+  //number of Values referring to this
+  uint32_t refs;
+};
+
+//Free an object whose last reference was released
+void destroyObject(Object* obj);
+
+inline void Value::retain() const
+{
+  if(tag == ValueTag::OBJECT)
+    obj->refs++;
+}
+
+inline void Value::release()
+{
+  if(tag == ValueTag::OBJECT && --obj->refs == 0)
+    destroyObject(obj);
+}
+
+//Take a reference to a new object
+inline Value objectValue(Object* obj)
+{
+  Value v;
+  v.obj = obj;
+  v.tag = ValueTag::OBJECT;
+  obj->refs++;
+  return v;
+}
+
+//A block of up to SIZE consecutive elements of a boxed array. Like
+//objects, chunks are reference counted and copy-on-write: copies of an
+//array share its chunks, until one of them modifies an element.
+//
+//The elements are allocated (from the pool) right after the chunk. Only
+//the first capacity elements exist: the only chunk of a small array grows
+//as needed, like a vector, so small arrays stay small.
+struct ArrayChunk
+{
+  enum
+  {
+    SIZE = 32
+  };
+  static ArrayChunk* create(uint32_t capacity);
+  static void destroy(ArrayChunk* chunk);
+  Value* vals()
+  {
+    return (Value*) (this + 1);
+  }
+  uint32_t refs;
+  uint32_t capacity;
+};
+
+//Arrays of primitives (integers, chars, bools and floats) are "flat":
+//the elements are stored at their native width in bytes, and elemTag and
+//elemSize describe how to load/store them as Values. All other arrays
+//store their elements as Values, in chunks.
+//
+//Copying a boxed array only copies its list of chunks, so updating one
+//element of a shared array (like a.b[i].c = x, when a was passed by value)
+//copies one chunk instead of every element.
+//
+//Elements of flat arrays can't be referenced directly: use get/set.
+struct ArrayObject : public Object
+{
+  //Array of boxed elements
+  ArrayObject() : Object(ObjectKind::ARRAY), elemTag(ValueTag::NONE), elemSize(0), count(0), head(0) {}
+  //Array with element type elem (flat if possible)
+  explicit ArrayObject(Type* elem);
+  ArrayObject(const ArrayObject&) = delete;
+  ~ArrayObject();
+  bool isFlat() const
+  {
+    return elemSize != 0;
+  }
+  size_t size() const
+  {
+    return isFlat() ? bytes.size() / elemSize - head : count;
+  }
+  inline Value get(size_t i) const;
+  inline void set(size_t i, const Value& v);
+  //Element i of a boxed array (which is only referenced to modify
+  //it, so its chunk is copied first if another array shares it)
+  Value& elem(size_t i)
+  {
+    size_t pos = head + i;
+    return ownChunk(pos / ArrayChunk::SIZE, pos % ArrayChunk::SIZE)->vals()[pos % ArrayChunk::SIZE];
+  }
+  //The elements of a flat array, as size() * elemSize bytes
+  const uint8_t* flatData() const
+  {
+    return bytes.data() + head * elemSize;
+  }
+  void reserve(size_t n);
+  void push_back(const Value& v);
+  void push_front(const Value& v);
+  //Append all the elements of other
+  void append(const ArrayObject* other);
+  //Insert all the elements of other at the front
+  void prepend(const ArrayObject* other);
+  //the elements as Values (for code that doesn't care about performance)
+  vector<Value> values() const;
+  ValueTag elemTag;
+  uint8_t elemSize;
+  //Storage (chunks if boxed, bytes if flat). Like a deque, the
+  //storage may begin with head unused elements, so that prepending
+  //is amortized O(1) like appending. Chunks that hold no elements yet
+  //are null.
+  vector<ArrayChunk*> chunks;
+  size_t count;
+  vector<uint8_t> bytes;
+  size_t head;
+private:
+  //Make at least n unused elements at the front
+  void reserveFront(size_t n);
+  //Chunk c, which this array can modify, with room for element i of it
+  ArrayChunk* ownChunk(size_t c, size_t i)
+  {
+    ArrayChunk* chunk = chunks[c];
+    if(!chunk || chunk->refs > 1 || i >= chunk->capacity)
+      chunk = replaceChunk(c, i);
+    return chunk;
+  }
+  ArrayChunk* replaceChunk(size_t c, size_t i);
+};
+
+struct StructObject : public Object
+{
+  StructObject() : Object(ObjectKind::STRUCT) {}
+  vector<Value> mems;
+};
+
+struct UnionObject : public Object
+{
+  UnionObject() : Object(ObjectKind::UNION), option(-1) {}
+  int option;
+  Value v;
+};
+
+//Hash table for maps, with open addressing and linear probing.
+//hashes has 31 bits of each slot's key hash, with the top bit set (0 marks
+//an empty slot): probing scans this compact array and only compares keys
+//whose hashes match, and growing the table never hashes keys again.
+//Integer, char, bool and enum keys are hashed and compared inline.
+//
+//Like elements of arrays, entries move when the table grows, so
+//references to values are only valid until the next insertion.
+struct ValueMap
+{
+  struct Entry
+  {
+    Value key;
+    Value value;
+  };
+  struct iterator
+  {
+    iterator(ValueMap* m, size_t i) : map(m), index(i)
+    {
+      skipEmpty();
+    }
+    Entry& operator*() const
+    {
+      return map->entries[index];
+    }
+    Entry* operator->() const
+    {
+      return &map->entries[index];
+    }
+    iterator& operator++()
+    {
+      index++;
+      skipEmpty();
+      return *this;
+    }
+    bool operator!=(const iterator& other) const
+    {
+      return index != other.index;
+    }
+    bool operator==(const iterator& other) const
+    {
+      return index == other.index;
+    }
+  private:
+    void skipEmpty()
+    {
+      while(index < map->hashes.size() && !map->hashes[index])
+        index++;
+    }
+    ValueMap* map;
+    size_t index;
+  };
+  ValueMap() : count(0) {}
+  size_t size() const
+  {
+    return count;
+  }
+  //The value for key, or nullptr if key isn't in the map
+  inline Value* find(const Value& key);
+  //The value for key. If key isn't in the map yet,
+  //it's inserted with an empty value (ValueTag::NONE).
+  Value& operator[](const Value& key);
+  void erase(const Value& key);
+  //(in no particular order)
+  iterator begin()
+  {
+    return iterator(this, 0);
+  }
+  iterator end()
+  {
+    return iterator(this, hashes.size());
+  }
+private:
+  static inline uint32_t keyHash(const Value& key);
+  static inline bool keysEqual(const Value& lhs, const Value& rhs);
+  //Double the capacity
+  void grow();
+  vector<uint32_t> hashes;
+  vector<Entry> entries;
+  size_t count;
+};
+
+struct MapObject : public Object
+{
+  MapObject() : Object(ObjectKind::MAP) {}
+  ValueMap table;
+};
+
+inline ArrayObject* asArray(const Value& v)
+{
+  return (ArrayObject*) v.obj;
+}
+
+inline StructObject* asStruct(const Value& v)
+{
+  return (StructObject*) v.obj;
+}
+
+inline UnionObject* asUnion(const Value& v)
+{
+  return (UnionObject*) v.obj;
+}
+
+inline MapObject* asMap(const Value& v)
+{
+  return (MapObject*) v.obj;
+}
+
+template<typename T>
+inline T loadFlat(const uint8_t* p)
+{
+  T val;
+  memcpy(&val, p, sizeof(T));
+  return val;
+}
+
+template<typename T>
+inline void storeFlat(uint8_t* p, T val)
+{
+  memcpy(p, &val, sizeof(T));
+}
+
+inline Value ArrayObject::get(size_t i) const
+{
+  if(!isFlat())
+  {
+    size_t pos = head + i;
+    return chunks[pos / ArrayChunk::SIZE]->vals()[pos % ArrayChunk::SIZE];
+  }
+  const uint8_t* p = &bytes[(head + i) * elemSize];
+  Value v;
+  v.tag = elemTag;
+  switch(elemTag)
+  {
+    case ValueTag::INT:
+      switch(elemSize)
+      {
+        case 1: v.i = loadFlat<int8_t>(p); break;
+        case 2: v.i = loadFlat<int16_t>(p); break;
+        case 4: v.i = loadFlat<int32_t>(p); break;
+        default: v.i = loadFlat<int64_t>(p);
+      }
+      break;
+    case ValueTag::UINT:
+      switch(elemSize)
+      {
+        case 1: v.u = loadFlat<uint8_t>(p); break;
+        case 2: v.u = loadFlat<uint16_t>(p); break;
+        case 4: v.u = loadFlat<uint32_t>(p); break;
+        default: v.u = loadFlat<uint64_t>(p);
+      }
+      break;
+    case ValueTag::BOOL:
+      v.b = *p != 0;
+      break;
+    case ValueTag::FLOAT:
+      v.f = loadFlat<float>(p);
+      break;
+    default:
+      v.d = loadFlat<double>(p);
+  }
+  return v;
+}
+
+inline void ArrayObject::set(size_t i, const Value& v)
+{
+  if(!isFlat())
+  {
+    elem(i) = v;
+    return;
+  }
+  uint8_t* p = &bytes[(head + i) * elemSize];
+  switch(elemTag)
+  {
+    case ValueTag::INT:
+    case ValueTag::UINT:
+      //integers are stored in two's complement, so
+      //truncating works for both signed and unsigned
+      switch(elemSize)
+      {
+        case 1: *p = (uint8_t) v.u; break;
+        case 2: storeFlat<uint16_t>(p, v.u); break;
+        case 4: storeFlat<uint32_t>(p, v.u); break;
+        default: storeFlat<uint64_t>(p, v.u);
+      }
+      break;
+    case ValueTag::BOOL:
+      *p = v.b;
+      break;
+    case ValueTag::FLOAT:
+      storeFlat<float>(p, v.f);
+      break;
+    default:
+      storeFlat<double>(p, v.d);
+  }
+}
+
+/*************************/
+/* Operations on values  */
+/*************************/
+
+//Does a value of type t live in a heap object?
+bool isObjectType(Type* t);
+
+//Convert a constant (folded) expression to a value
+Value constantValue(Expression* e);
+//Get the default (zero) value of a type
+Value defaultValue(Type* t);
+//Create a default-initialized (rectangular) array
+Value createArrayValue(const uint64_t* dims, int ndims, Type* elem);
+//Make a new union value, with option chosen by the type of v
+Value makeUnion(const Value& v, Type* vType, UnionType* ut);
+//Evaluate "u as T" (ae gives T, and the mapping of u's options to T's)
+Value narrowUnion(UnionObject* u, AsExpr* ae);
+
+//Shallow copy of an object (the members are shared)
+Value cloneObject(const Value& v);
+
+//Ensure v's object (if any) isn't shared, so it can be modified in place
+inline void makeUnique(Value& v)
+{
+  if(v.isObject() && v.obj->refs > 1)
+    v = cloneObject(v);
+}
+
+bool valuesEqual(const Value& lhs, const Value& rhs);
+//Only defined for values where the language allows relational comparison
+bool valueLess(const Value& lhs, const Value& rhs);
+size_t hashValue(const Value& v);
+
+inline uint32_t ValueMap::keyHash(const Value& key)
+{
+  uint64_t h;
+  switch(key.tag)
+  {
+    case ValueTag::INT:
+    case ValueTag::UINT:
+      h = key.u;
+      break;
+    case ValueTag::BOOL:
+      h = key.b;
+      break;
+    case ValueTag::ENUM:
+      h = (uint64_t) key.enumConst;
+      break;
+    default:
+      h = hashValue(key);
+  }
+  //mix all bits into the low ones (MurmurHash3's finalizer),
+  //since sequential integer keys are common
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (uint32_t) h | 0x80000000;
+}
+
+inline bool ValueMap::keysEqual(const Value& lhs, const Value& rhs)
+{
+  if(lhs.tag != rhs.tag)
+    return false;
+  switch(lhs.tag)
+  {
+    case ValueTag::INT:
+    case ValueTag::UINT:
+      return lhs.u == rhs.u;
+    case ValueTag::BOOL:
+      return lhs.b == rhs.b;
+    case ValueTag::ENUM:
+      return lhs.enumConst == rhs.enumConst;
+    default:
+      return valuesEqual(lhs, rhs);
+  }
+}
+
+inline Value* ValueMap::find(const Value& key)
+{
+  if(!count)
+    return nullptr;
+  uint32_t h = keyHash(key);
+  size_t mask = hashes.size() - 1;
+  for(size_t i = h & mask; hashes[i]; i = (i + 1) & mask)
+  {
+    if(hashes[i] == h && keysEqual(entries[i].key, key))
+      return &entries[i].value;
+  }
+  return nullptr;
+}
+
+//Does (signed or unsigned) integer value fit in an integer with given size?
+bool intFits(const Value& v, int size, bool isSigned);
+
+//Implicit or explicit conversion between types, with the same checks
+//(overflow, enum membership) as constant folding. loc is used for errors.
+Value convertValue(const Value& v, Type* src, Type* dst, Node* loc);
+
+//Arithmetic and bitwise operators (not comparisons or logical AND/OR).
+//lhs and rhs have type t, except the rhs of a shift which has type rhsType.
+Value binaryOp(int op, const Value& lhs, const Value& rhs, Type* t, Type* rhsType, Node* loc);
+Value unaryOp(int op, const Value& operand);
+
+//Print the way Expression::print prints the equivalent constant
+void printValue(OutputBuffer& out, const Value& v, Type* t);
+//Print the way the print statement does (chars and strings are raw)
+void printTopLevel(OutputBuffer& out, const Value& v, Type* t);
+
+//Is the type char[] (with any aliases removed)?
+bool isStringType(Type* t);
+
+#endif
+
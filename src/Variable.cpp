@@ -3,6 +3,8 @@
 
 static int nextVarID = 0;
 
+vector<Variable*> globalSlots;
+
 Variable::Variable(Scope* s, string n, Type* t, Expression* init, bool isStatic, bool compose)
 {
   scope = s;
@@ -22,6 +24,7 @@ Variable::Variable(Scope* s, string n, Type* t, Expression* init, bool isStatic,
     owner->composed.push_back(compose);
   }
   id = nextVarID++;
+  slot = -1;
 }
 
 Variable::Variable(string n, Type* t, Block* b)
@@ -34,6 +37,7 @@ Variable::Variable(string n, Type* t, Block* b)
   initial = nullptr;
   owner = nullptr;
   id = nextVarID++;
+  slot = -1;
 }
 
 void Variable::resolveImpl()
@@ -52,6 +56,11 @@ void Variable::resolveImpl()
   }
   else
     initial = type->getDefaultValue();
+  if(isGlobal())
+  {
+    slot = globalSlots.size();
+    globalSlots.push_back(this);
+  }
   resolved = true;
 }
 
@@ -33,7 +33,14 @@ struct Variable : public Node
   //Each variable gets a unique ID when it is parsed.
   //This allows the IR to know the exact order in which globals are initialized.
   int id;
+  //Interpreter storage location: index in the subroutine's frame
+  //(locals and parameters) or in globalSlots (globals).
+  //-1 for members, or if not yet resolved.
+  int slot;
 };
 
+//All global variables, indexed by slot (in resolution order)
+extern vector<Variable*> globalSlots;
+
 #endif
 
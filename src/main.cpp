@@ -6,7 +6,19 @@
 #include "AST.hpp"
 #include "AST_Output.hpp"
 #include "AstInterpreter.hpp"
+#include "Profiler.hpp"
+#include "Memo.hpp"
+#include "Jit.hpp"
+#include "TestRunner.hpp"
+#include "BenchRunner.hpp"
+#include "VM.hpp"
 #include "BuiltIn.hpp"
+#include "ProgramCache.hpp"
+#include "Repl.hpp"
+#include <functional>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 //#include "C_Backend.hpp"
 //#include "IR.hpp"
@@ -24,15 +36,73 @@ void init()
   //C::init();
 }
 
-void resolveSemantics()
+static void checkMain(bool needMain)
 {
-  global->resolve();
-  if(!mainSubr)
+  if(needMain && !mainSubr)
   {
     errMsg("Program requires proc main to be defined");
   }
 }
 
+void resolveSemantics(bool needMain)
+{
+  global->resolve();
+  //tests and benchmarks aren't in any scope, so resolve them separately
+  for(auto t : Test::tests)
+    t->resolve();
+  for(auto b : Benchmark::benchmarks)
+    b->resolve();
+  checkMain(needMain);
+}
+
+//Run f on a thread with a native stack of the given size. The interpreters
+//keep their call stacks in memory they allocate, but code compiled by --jit
+//recurses natively, so its depth is limited by --stack rather than the
+//main thread's stack.
+static void runWithStack(size_t stackSize, std::function<void()> f)
+{
+#ifdef _WIN32
+  f();
+#else
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, stackSize);
+  pthread_t thread;
+  auto entry = [](void* arg) -> void*
+  {
+    (*(std::function<void()>*) arg)();
+    return nullptr;
+  };
+  if(pthread_create(&thread, &attr, entry, &f))
+  {
+    errMsg("Couldn't create a thread with a " << (stackSize >> 20) << " MB stack");
+  }
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attr);
+#endif
+}
+
+//The arguments for main: the strings given after the input file
+static vector<Expression*> getMainArgs(Options& op)
+{
+  vector<Expression*> mainArgs;
+  Type* stringType = getStringType();
+  Type* stringArrType = getArrayType(stringType, 1);
+  vector<Expression*> stringArgs;
+  for(auto& s : op.interpArgs)
+  {
+    vector<Expression*> strChars;
+    for(size_t j = 0; j < s.length(); j++)
+      strChars.push_back(new IntConstant((uint64_t) s[j], getCharType()));
+    stringArgs.push_back(new CompoundLiteral(strChars, stringType));
+  }
+  if(stringArgs.size())
+  {
+    mainArgs.push_back(new CompoundLiteral(stringArgs, stringArrType));
+  }
+  return mainArgs;
+}
+
 int main(int argc, const char** argv)
 {
   //auto startTime = clock();
@@ -46,29 +116,76 @@ int main(int argc, const char** argv)
   //Parse the global/root module
   if(op.verbose)
     enableVerboseMode();
+  if(op.flush.length() && !stdoutBuffer.setPolicy(op.flush))
+    errMsg("Invalid flush policy \"" << op.flush << "\" (must be line, full or explicit)");
   if(op.interactive)
-    TIMEIT("Parsing", parseProgram();)
+  {
+    if(op.useVM || op.profile.length() || op.jit)
+      errMsg("-i runs on the AST interpreter, without profiling or --jit");
+    vector<Expression*> mainArgs = getMainArgs(op);
+    int failed = runRepl(op.stackSize, op.memo, mainArgs);
+    return failed ? EXIT_FAILURE : 0;
+  }
+  bool needMain = !op.runTests && !op.bench.length();
+  //a cached image replaces parsing and resolution
+  ProgramCache* cache = nullptr;
+  bool cached = false;
+  if(op.cacheDir.length())
+  {
+    cache = new ProgramCache(op.cacheDir, op.input);
+    TIMEIT("Loading cached program", cached = cache->load(););
+  }
+  if(cached)
+    checkMain(needMain);
   else
+  {
     TIMEIT("Parsing", parseProgram(op.input);)
-  //DEBUG_DO(outputAST(global, "parse.dot"););
-  TIMEIT("Semantic analysis", resolveSemantics(););
+    //DEBUG_DO(outputAST(global, "parse.dot"););
+    TIMEIT("Semantic analysis", resolveSemantics(needMain););
+    if(cache)
+      TIMEIT("Saving cached program", cache->save(););
+  }
   outputAST(global, "AST.dot");
-  vector<Expression*> mainArgs;
-  Type* stringType = getStringType();
-  Type* stringArrType = getArrayType(stringType, 1);
-  vector<Expression*> stringArgs;
-  for(auto& s : op.interpArgs)
+  if(op.runTests)
   {
-    vector<Expression*> strChars;
-    for(size_t j = 0; j < s.length(); j++)
-      strChars.push_back(new IntConstant((uint64_t) s[j], getCharType()));
-    stringArgs.push_back(new CompoundLiteral(strChars, stringType));
+    if(op.useVM || op.profile.length())
+      errMsg("--test runs tests on the AST interpreter, without profiling");
+    return runTests(op.testThreads, op.stackSize, op.memo) ? EXIT_FAILURE : 0;
   }
-  if(stringArgs.size())
+  if(op.bench.length())
   {
-    mainArgs.push_back(new CompoundLiteral(stringArgs, stringArrType));
+    if(op.useVM || op.profile.length())
+      errMsg("--bench runs benchmarks on the AST interpreter, without profiling");
+    runBenchmarks(op.bench, op.stackSize);
+    return 0;
+  }
+  vector<Expression*> mainArgs = getMainArgs(op);
+  if(op.useVM)
+  {
+    if(op.jit)
+      errMsg("--jit compiles subroutines for the AST interpreter, not the VM");
+    if(op.profile.length())
+      errMsg("--profile samples the AST interpreter, not the VM");
+    if(op.memo)
+      errMsg("--memo caches calls in the AST interpreter, not the VM");
+    //(the VM doesn't use the native stack for calls)
+    TIMEIT("Running VM", VM::run(mainSubr, mainArgs, op.stackSize););
+  }
+  else
+  {
+    Profiler* profiler = op.profile.length() ? new Profiler : nullptr;
+    Memoizer* memo = op.memo ? new Memoizer(op.memo) : nullptr;
+    if(op.jit && profiler)
+      errMsg("--jit can't be used with --profile (native code isn't profiled)");
+    if(profiler)
+      profiler->reportOnQuit(op.profile);
+    Jit* jit = op.jit ? new Jit(op.jit) : nullptr;
+    auto interpret = [&]() {Interpreter(mainSubr, mainArgs, op.stackSize, profiler, memo, jit);};
+    TIMEIT("Interpreting AST", if(jit) runWithStack(op.stackSize, interpret); else interpret(););
+    if(profiler)
+      profiler->report(op.profile, std::cerr);
+    delete jit;
   }
-  TIMEIT("Interpreting AST", Interpreter(mainSubr, mainArgs));
   return 0;
 }
 
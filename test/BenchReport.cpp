@@ -0,0 +1,204 @@
+#include "Testing.hpp"
+#include "Utils.hpp"
+#include <regex>
+
+typedef map<string, string> Fields;
+
+//Minimal JSON parser, for what --bench json produces: an array of flat
+//objects. Strings and numbers are kept as their text (strings unquoted).
+struct JsonReader
+{
+  JsonReader(const string& text) : p(text.c_str()), ok(true) {}
+  void space()
+  {
+    while(*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r')
+      p++;
+  }
+  bool expect(char c)
+  {
+    space();
+    if(*p != c)
+      return ok = false;
+    p++;
+    return true;
+  }
+  string str()
+  {
+    string s;
+    if(!expect('"'))
+      return s;
+    while(*p && *p != '"')
+    {
+      if(*p == '\\' && p[1])
+        p++;
+      s += *p++;
+    }
+    expect('"');
+    return s;
+  }
+  string value()
+  {
+    space();
+    if(*p == '"')
+      return str();
+    const char* start = p;
+    while(*p && (isalnum(*p) || *p == '-' || *p == '+' || *p == '.'))
+      p++;
+    if(p == start)
+      ok = false;
+    return string(start, p);
+  }
+  Fields object()
+  {
+    Fields fields;
+    if(!expect('{'))
+      return fields;
+    space();
+    if(*p == '}')
+    {
+      p++;
+      return fields;
+    }
+    do
+    {
+      string key = str();
+      expect(':');
+      fields[key] = value();
+    }
+    while(ok && (space(), *p == ',') && p++);
+    expect('}');
+    return fields;
+  }
+  vector<Fields> array()
+  {
+    vector<Fields> objects;
+    if(!expect('['))
+      return objects;
+    space();
+    if(*p == ']')
+    {
+      p++;
+      return objects;
+    }
+    do
+      objects.push_back(object());
+    while(ok && (space(), *p == ',') && p++);
+    expect(']');
+    space();
+    if(*p)
+      ok = false;
+    return objects;
+  }
+  const char* p;
+  bool ok;
+};
+
+//Split a CSV line into fields (handling quoted fields)
+static vector<string> csvFields(const string& line)
+{
+  vector<string> fields(1);
+  bool quoted = false;
+  for(size_t i = 0; i < line.size(); i++)
+  {
+    char c = line[i];
+    if(quoted && c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+      fields.back() += line[++i];
+    else if(c == '"')
+      quoted = !quoted;
+    else if(c == ',' && !quoted)
+      fields.push_back("");
+    else
+      fields.back() += c;
+  }
+  return fields;
+}
+
+int main(int argc, const char** argv)
+{
+  //usage: BenchReport csv|json|return
+  //Bench.os is run with --bench, and only the report's structure is
+  //checked (timings vary). BenchReturn.os returns from a benchmark.
+  INTERNAL_ASSERT(argc == 2);
+  string mode = argv[1];
+  vector<string> problems;
+  string output;
+  if(mode == "return")
+  {
+    vector<string> args = {"--bench", "csv", "BenchReturn.os"};
+    output = runOnyx(args, "");
+    if(output.find("can't return from a test or benchmark") == string::npos)
+      problems.push_back("no error for returning from a benchmark");
+  }
+  else
+  {
+    vector<string> args = {"--bench", mode, "Bench.os"};
+    output = runOnyx(args, "");
+    if(compilerInternalError(output) || !compilerSuccess(output))
+      problems.push_back("the benchmarks failed");
+    if(output.find("benchmark output") != string::npos)
+      problems.push_back("output from a benchmark was printed");
+    //each benchmark's fields, by column name
+    vector<Fields> rows;
+    if(mode == "csv")
+    {
+      std::istringstream lines(output);
+      string header;
+      getline(lines, header);
+      if(header != "name,file,line,runs_per_sample,samples,mean_ns,median_ns,stddev_ns,min_ns,max_ns")
+        problems.push_back("bad CSV header: " + header);
+      vector<string> columns = csvFields(header);
+      string line;
+      while(getline(lines, line))
+      {
+        vector<string> fields = csvFields(line);
+        if(fields.size() != columns.size())
+        {
+          problems.push_back("bad CSV row: " + line);
+          continue;
+        }
+        Fields row;
+        for(size_t i = 0; i < fields.size(); i++)
+          row[columns[i]] = fields[i];
+        rows.push_back(row);
+      }
+    }
+    else
+    {
+      JsonReader json(output);
+      rows = json.array();
+      if(!json.ok)
+        problems.push_back("the JSON doesn't parse");
+    }
+    const char* names[] = {"sum", "concat, small"};
+    if(rows.size() != 2)
+      problems.push_back("expected 2 benchmarks, got " + to_string(rows.size()));
+    std::regex number("[0-9]+(\\.[0-9]+)?");
+    for(size_t i = 0; i < rows.size() && i < 2; i++)
+    {
+      Fields& row = rows[i];
+      if(row["name"] != names[i])
+        problems.push_back("benchmark " + to_string(i) + " is named " + row["name"]);
+      if(row["file"] != "Bench.os" || row["line"] != (i ? "19" : "13"))
+        problems.push_back("bad location for " + row["name"]);
+      if(!std::regex_match(row["runs_per_sample"], number) || stoull(row["runs_per_sample"]) < 1)
+        problems.push_back("bad runs_per_sample for " + row["name"]);
+      if(row["samples"] != "20")
+        problems.push_back("samples isn't 20 for " + row["name"]);
+      for(const char* stat : {"mean_ns", "median_ns", "stddev_ns", "min_ns", "max_ns"})
+      {
+        if(!std::regex_match(row[stat], number))
+          problems.push_back(string("bad ") + stat + " for " + row["name"]);
+      }
+    }
+  }
+  if(problems.empty())
+  {
+    cout << "TEST PASSED\n";
+    return 0;
+  }
+  cout << "TEST FAILED\n";
+  for(auto& p : problems)
+    cout << p << '\n';
+  cout << "Produced output:\n" << output << "<<<\n";
+  return 1;
+}
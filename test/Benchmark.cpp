@@ -0,0 +1,80 @@
+#include "Testing.hpp"
+#include "Utils.hpp"
+
+//Usage: Benchmark [--reps N] [onyx options...] program.os...
+//(run from the test build directory, like Driver)
+//
+//Runs the compiler in verbose mode on each program N times,
+//and reports the fastest time of each phase (parsing, semantic
+//analysis, interpreting) along with the totals over all programs.
+//Compare the output from two builds to measure a change.
+
+//Get the phase timings ("<phase> took <t> sec.") from verbose output
+static void getTimings(const string& output, vector<pair<string, double>>& timings)
+{
+  std::istringstream lines(output);
+  string line;
+  while(std::getline(lines, line))
+  {
+    size_t took = line.find(" took ");
+    if(took == string::npos || line.find(" sec.") == string::npos)
+      continue;
+    timings.push_back(std::make_pair(line.substr(0, took), atof(line.c_str() + took + 6)));
+  }
+}
+
+int main(int argc, const char** argv)
+{
+  int reps = 5;
+  vector<string> options;
+  vector<string> programs;
+  for(int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if(arg == "--reps" && i + 1 < argc)
+      reps = atoi(argv[++i]);
+    else if(arg.length() > 3 && arg.substr(arg.length() - 3) == ".os")
+      programs.push_back(arg);
+    else
+      options.push_back(arg);
+  }
+  if(programs.empty() || reps < 1)
+  {
+    cout << "Usage: Benchmark [--reps N] [onyx options...] program.os...\n";
+    return 1;
+  }
+  //phases in the order they first appear, and their total times
+  vector<string> phases;
+  map<string, double> totals;
+  for(auto& program : programs)
+  {
+    map<string, double> best;
+    for(int rep = 0; rep < reps; rep++)
+    {
+      vector<string> args = options;
+      args.push_back("-v");
+      args.push_back(program);
+      vector<pair<string, double>> timings;
+      getTimings(runOnyx(args, ""), timings);
+      for(auto& t : timings)
+      {
+        if(best.find(t.first) == best.end())
+          best[t.first] = t.second;
+        else
+          best[t.first] = std::min(best[t.first], t.second);
+      }
+    }
+    cout << program << ":\n";
+    for(auto& phase : best)
+    {
+      cout << "  " << phase.first << ": " << phase.second << " sec\n";
+      if(totals.find(phase.first) == totals.end())
+        phases.push_back(phase.first);
+      totals[phase.first] += phase.second;
+    }
+  }
+  cout << "Total (best of " << reps << "):\n";
+  for(auto& phase : phases)
+    cout << "  " << phase << ": " << totals[phase] << " sec\n";
+  return 0;
+}
@@ -3,12 +3,22 @@
 
 int main(int argc, const char** argv)
 {
-  INTERNAL_ASSERT(argc == 2);
+  //usage: Driver testName [onyx options...]
+  INTERNAL_ASSERT(argc >= 2);
   string fileStem = argv[1];
   string srcFile = fileStem + ".os";
   string goldOut = loadFile(fileStem + ".gold");
-  vector<string> args(1, srcFile);
-  string actualOut = runOnyx(args, "");
+  //options must come before the input file
+  vector<string> args(argv + 2, argv + argc);
+  string actualOut;
+  //in interactive mode, the source is typed in instead
+  if(std::find(args.begin(), args.end(), "-i") != args.end())
+    actualOut = runOnyx(args, loadFile(srcFile));
+  else
+  {
+    args.push_back(srcFile);
+    actualOut = runOnyx(args, "");
+  }
   bool success = actualOut == goldOut;
   if(success)
     cout << "TEST PASSED\n";
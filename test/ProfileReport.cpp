@@ -0,0 +1,79 @@
+#include "Testing.hpp"
+#include "Utils.hpp"
+#include <regex>
+
+//Does output have a line of the subroutine table for name?
+static bool hasRow(const string& output, const string& name)
+{
+  std::regex row("\n +[0-9.]+ +[0-9.]+  " + name + " \\(Profile\\.os:[0-9]+\\)\n");
+  return std::regex_search(output, row);
+}
+
+int main(int argc, const char** argv)
+{
+  //usage: ProfileReport ok|fail
+  //Profile.os is run with --profile, and only the structure of the report
+  //is checked (which subroutines appear), since sample counts vary
+  INTERNAL_ASSERT(argc == 2);
+  string mode = argv[1];
+  string reportFile = "Profile_" + mode + ".txt";
+  vector<string> args = {"--profile", reportFile, "Profile.os", mode};
+  string output = runOnyx(args, "");
+  vector<string> problems;
+  if(compilerInternalError(output))
+    problems.push_back("internal error");
+  if(output.find("\nProfile: ") == string::npos)
+    problems.push_back("no profile summary");
+  if(output.find("\n   self (s)  total (s)  subroutine\n") == string::npos)
+    problems.push_back("no table header");
+  for(const char* name : {"main", "busy", "spin"})
+  {
+    if(!hasRow(output, name))
+      problems.push_back(string("no table row for ") + name);
+  }
+  bool failed = output.find("Error in Profile.os") != string::npos;
+  if(failed != (mode == "fail"))
+    problems.push_back(failed ? "unexpected error" : "no error");
+  //the report comes before the error that ended the run
+  if(failed && output.find("Error in Profile.os") < output.find("\nProfile: "))
+    problems.push_back("error printed before the report");
+  //collapsed stacks: one "main:line;busy:line;spin:line count" per line
+  std::regex stack("main:[0-9]+(;[a-z]+:[0-9]+)* [0-9]+");
+  std::istringstream collapsed(loadFile(reportFile));
+  string line;
+  int lines = 0;
+  bool sawSpin = false;
+  //samples in spin, by line (line 7, the loop body, is where its time goes)
+  map<int, uint64_t> spinLines;
+  std::regex spinTop(";spin:([0-9]+) ([0-9]+)$");
+  while(getline(collapsed, line))
+  {
+    lines++;
+    if(!std::regex_match(line, stack))
+      problems.push_back("bad collapsed stack: " + line);
+    if(line.find(";busy:") != string::npos && line.find(";spin:") != string::npos)
+      sawSpin = true;
+    std::smatch m;
+    if(std::regex_search(line, m, spinTop))
+      spinLines[stoi(m[1])] += stoull(m[2]);
+  }
+  if(!lines)
+    problems.push_back("no collapsed stacks");
+  else if(!sawSpin)
+    problems.push_back("no stack of main, busy and spin");
+  uint64_t spinSamples = 0;
+  for(auto& l : spinLines)
+    spinSamples += l.second;
+  if(spinSamples && spinLines[7] * 2 < spinSamples)
+    problems.push_back("most samples in spin aren't charged to line 7");
+  if(problems.empty())
+  {
+    cout << "TEST PASSED\n";
+    return 0;
+  }
+  cout << "TEST FAILED\n";
+  for(auto& p : problems)
+    cout << p << '\n';
+  cout << "Produced output:\n" << output << "<<<\n";
+  return 1;
+}
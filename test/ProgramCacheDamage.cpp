@@ -0,0 +1,62 @@
+#include "Testing.hpp"
+#include "Utils.hpp"
+#include <dirent.h>
+#include <random>
+
+//Path of the image in dir (or "" if there isn't one)
+static string findImage(const string& dir)
+{
+  string image;
+  DIR* d = opendir(dir.c_str());
+  if(!d)
+    return image;
+  while(dirent* entry = readdir(d))
+  {
+    string name = entry->d_name;
+    if(name.size() > 4 && name.substr(name.size() - 4) == ".img")
+      image = dir + '/' + name;
+  }
+  closedir(d);
+  return image;
+}
+
+int main()
+{
+  //ProgramCache.os is saved to an image, and then run many times with a
+  //few bits of the image flipped: a damaged image must never be loaded
+  //(the program is compiled from source again instead)
+  string goldOut = loadFile("ProgramCache.gold");
+  vector<string> args = {"--cache", "damaged", "ProgramCache.os"};
+  string output = runOnyx(args, "");
+  string imagePath = findImage("damaged");
+  if(output != goldOut || imagePath.empty())
+  {
+    cout << "TEST FAILED\nNo image was saved. Produced output:\n" << output << "<<<\n";
+    return 1;
+  }
+  string image = loadFile(imagePath);
+  std::mt19937 rng(1);
+  int failures = 0;
+  for(int run = 0; run < 100; run++)
+  {
+    string damaged = image;
+    for(int i = 0; i < 2; i++)
+      damaged[rng() % damaged.size()] ^= 1 << (rng() % 8);
+    writeFile(damaged, imagePath);
+    output = runOnyx(args, "");
+    if(output != goldOut)
+    {
+      if(!failures)
+        cout << "Produced output:\n" << output << "<<<\n";
+      failures++;
+    }
+  }
+  writeFile(image, imagePath);
+  if(failures)
+  {
+    cout << "TEST FAILED\n" << failures << " of 100 runs with a damaged image went wrong\n";
+    return 1;
+  }
+  cout << "TEST PASSED\n";
+  return 0;
+}